@@ -9,6 +9,10 @@ HDF5_PATH="/home/sarrvesh/Documents/hdf5"
 # NVCC flags
 NVCC_FLAGS=arch=compute_50,code=sm_50
 
+# Set to 1 to build rmsynthesis with MPI. Needs mpicc in PATH. For
+# collective output, HDF5_PATH must point to a parallel HDF5 build.
+USE_MPI=0
+
 #####################################################################
 ################## DO NOT EDIT BELOW THIS LINE ######################
 #####################################################################
@@ -28,19 +32,74 @@ else
     printf "Compiling with Gnuplot\n"
 fi
 
+# MPI builds compile everything that includes hdf5.h with mpicc,
+# since a parallel hdf5.h includes mpi.h. Only ranks.c calls MPI.
+if [ "$USE_MPI" = "1" ]; then
+    CC="mpicc"
+    MPI_FLAGS="-DMPI_ENABLE"
+    NVCC_HOST="-ccbin mpicc"
+    printf "Compiling with MPI\n"
+else
+    CC="gcc"
+    MPI_FLAGS=""
+    NVCC_HOST=""
+fi
+
 printf "Compiling devices.cu\n"
 nvcc -O3 -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -L${CUDA_PATH}/lib64/ -c src/devices.cu -lhdf5 -gencode $NVCC_FLAGS
 
+printf "Compiling kernels.cu\n"
+nvcc -O3 -Xcompiler -fPIC -c src/kernels.cu -gencode $NVCC_FLAGS
+
 printf "Compiling fileaccess.c\n"
-gcc -Wno-unused-result $GCC_FLAGS -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -L/${CFITSIO_PATH}/lib/ -L${HDF5_PATH}/lib/ -c src/fileaccess.c -lhdf5 -lhdf5_hl
+$CC -Wno-unused-result $GCC_FLAGS -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -L/${CFITSIO_PATH}/lib/ -L${HDF5_PATH}/lib/ -c src/fileaccess.c -lhdf5 -lhdf5_hl
 
 printf "Compiling inputparser.c\n"
-gcc $GCC_FLAGS -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/inputparser.c
+$CC $GCC_FLAGS -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/inputparser.c
+
+printf "Compiling librmsynth\n"
+for f in rmsynth engine cpusynth rmsf timing; do
+    gcc $GCC_FLAGS -fPIC -DCUDA_ENABLE -c src/${f}.c
+done
+ar rcs librmsynth.a rmsynth.o engine.o cpusynth.o rmsf.o timing.o kernels.o
+nvcc -O3 -shared -L${CUDA_PATH}/lib64/ -o librmsynth.so rmsynth.o engine.o cpusynth.o rmsf.o timing.o kernels.o -lcudart -lm -lpthread -gencode $NVCC_FLAGS
+
+printf "Compiling dosynthesis.c\n"
+$CC $GCC_FLAGS -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/dosynthesis.c
+
+printf "Compiling ranks.c\n"
+$CC $MPI_FLAGS $GCC_FLAGS -I${HDF5_PATH}/include/ -c src/ranks.c
 
-printf "Compiling rmsf.c\n"
-gcc $GCC_FLAGS -I${CFITSIO_PATH}/include/ -L/${CFITSIO_PATH}/lib/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/rmsf.c
+printf "Compiling planner.c\n"
+$CC $GCC_FLAGS -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/planner.c
+
+printf "Compiling products.c\n"
+$CC $GCC_FLAGS -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/products.c
+
+printf "Compiling catalog.c\n"
+$CC $GCC_FLAGS -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/catalog.c
+
+printf "Compiling arena.c\n"
+$CC $GCC_FLAGS -c src/arena.c
+
+printf "Compiling job.c\n"
+$CC $MACRO $GCC_FLAGS -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/job.c
 
 printf "Compiling rmsynthesis.c\n"
-gcc -DMACRO $GCC_FLAGS -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/rmsynthesis.c
+$CC -DMACRO $GCC_FLAGS -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/rmsynthesis.c
+
+nvcc $NVCC_HOST -O3 -I${CUDA_PATH}/include/ -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -L${CUDA_PATH}/lib64/ -L${HDF5_PATH}/lib/ -o rmsynthesis rmsynthesis.o devices.o fileaccess.o inputparser.o dosynthesis.o job.o ranks.o planner.o arena.o products.o catalog.o librmsynth.a -lconfig -lcfitsio -lcudart -lm -lpthread -lhdf5 -lhdf5_hl -gencode $NVCC_FLAGS
+
+printf "Compiling rmsynthd\n"
+$CC $GCC_FLAGS -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/daemon.c
+nvcc $NVCC_HOST -O3 -I${CUDA_PATH}/include/ -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -L${CUDA_PATH}/lib64/ -L${HDF5_PATH}/lib/ -o rmsynthd daemon.o devices.o fileaccess.o inputparser.o dosynthesis.o job.o ranks.o planner.o arena.o products.o catalog.o librmsynth.a -lconfig -lcfitsio -lcudart -lm -lpthread -lhdf5 -lhdf5_hl -gencode $NVCC_FLAGS
+
+printf "Compiling cube-assemble\n"
+$CC $GCC_FLAGS -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -L/${CFITSIO_PATH}/lib/ -L${HDF5_PATH}/lib/ -o cube-assemble src/assemble.c src/timing.c -lcfitsio -lhdf5 -lhdf5_hl -lm -lpthread
 
-nvcc -O3 -I${CUDA_PATH}/include/ -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -L${CUDA_PATH}/lib64/ -L${HDF5_PATH}/lib/ -o rmsynthesis rmsynthesis.o devices.o fileaccess.o inputparser.o rmsf.o -lconfig -lcfitsio -lcudart -lm -lhdf5 -lhdf5_hl -gencode $NVCC_FLAGS
+printf "Compiling rmbench\n"
+for f in bench synthcube reference; do
+    gcc $GCC_FLAGS -c src/${f}.c
+done
+$CC $GCC_FLAGS -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/verify.c
+nvcc $NVCC_HOST -O3 -I${CUDA_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -L${CUDA_PATH}/lib64/ -L${HDF5_PATH}/lib/ -o rmbench bench.o synthcube.o reference.o verify.o devices.o fileaccess.o inputparser.o dosynthesis.o job.o ranks.o planner.o arena.o products.o catalog.o librmsynth.a -lconfig -lcfitsio -lcudart -lm -lpthread -lhdf5 -lhdf5_hl -gencode $NVCC_FLAGS
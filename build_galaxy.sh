@@ -9,6 +9,10 @@ HDF5_PATH="/opt/cray/hdf5/1.8.14/GNU/4.9"
 # NVCC flags
 NVCC_FLAGS=arch=compute_35,code=sm_35
 
+# Set to 1 to build rmsynthesis with MPI. Needs mpicc in PATH. For
+# collective output, HDF5_PATH must point to a parallel HDF5 build.
+USE_MPI=0
+
 #####################################################################
 ################## DO NOT EDIT BELOW THIS LINE ######################
 #####################################################################
@@ -23,19 +27,74 @@ else
     printf "Compiling with Gnuplot\n"
 fi
 
+# MPI builds compile everything that includes hdf5.h with mpicc,
+# since a parallel hdf5.h includes mpi.h. Only ranks.c calls MPI.
+if [ "$USE_MPI" = "1" ]; then
+    CC="mpicc"
+    MPI_FLAGS="-DMPI_ENABLE"
+    NVCC_HOST="-ccbin mpicc"
+    printf "Compiling with MPI\n"
+else
+    CC="gcc"
+    MPI_FLAGS=""
+    NVCC_HOST=""
+fi
+
 printf "Compiling devices.cu\n"
 nvcc -g -G -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/devices.cu -gencode $NVCC_FLAGS -use_fast_math
 
+printf "Compiling kernels.cu\n"
+nvcc -g -G -Xcompiler -fPIC -c src/kernels.cu -gencode $NVCC_FLAGS -use_fast_math
+
 printf "Compiling fileaccess.c\n"
-gcc -g -I${CFITSIO_PATH}/include/ -L/${CFITSIO_PATH}/lib/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/fileaccess.c
+$CC -g -I${CFITSIO_PATH}/include/ -L/${CFITSIO_PATH}/lib/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/fileaccess.c
 
 printf "Compiling inputparser.c\n"
-gcc -g -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/inputparser.c
+$CC -g -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/inputparser.c
+
+printf "Compiling librmsynth\n"
+for f in rmsynth engine cpusynth rmsf timing; do
+    gcc -g -fPIC -DCUDA_ENABLE -c src/${f}.c
+done
+ar rcs librmsynth.a rmsynth.o engine.o cpusynth.o rmsf.o timing.o kernels.o
+nvcc -g -G -shared -L${CUDA_PATH}/lib64/ -o librmsynth.so rmsynth.o engine.o cpusynth.o rmsf.o timing.o kernels.o -lcudart -lm -lpthread -gencode $NVCC_FLAGS -use_fast_math
+
+printf "Compiling dosynthesis.c\n"
+$CC -g -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/dosynthesis.c
+
+printf "Compiling ranks.c\n"
+$CC $MPI_FLAGS -g -I${HDF5_PATH}/include/ -c src/ranks.c
 
-printf "Compiling rmsf.c\n"
-gcc -g -I${CFITSIO_PATH}/include/ -L/${CFITSIO_PATH}/lib/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/rmsf.c
+printf "Compiling planner.c\n"
+$CC -g -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/planner.c
+
+printf "Compiling products.c\n"
+$CC -g -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/products.c
+
+printf "Compiling catalog.c\n"
+$CC -g -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/catalog.c
+
+printf "Compiling arena.c\n"
+$CC -g -c src/arena.c
+
+printf "Compiling job.c\n"
+$CC $MACRO -g -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/job.c
 
 printf "Compiling rmsynthesis.c\n"
-gcc -g -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/rmsynthesis.c
+$CC -g -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -lhdf5 -lhdf5_hl -c src/rmsynthesis.c
+
+nvcc $NVCC_HOST -g -G -I${CUDA_PATH}/include/ -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -L${CUDA_PATH}/lib64/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -o rmsynthesis rmsynthesis.o devices.o fileaccess.o inputparser.o dosynthesis.o job.o ranks.o planner.o arena.o products.o catalog.o librmsynth.a -lconfig -lcfitsio -lcudart -lm -lpthread -lhdf5 -lhdf5_hl -gencode $NVCC_FLAGS -use_fast_math
+
+printf "Compiling rmsynthd\n"
+$CC -g -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/daemon.c
+nvcc $NVCC_HOST -g -G -I${CUDA_PATH}/include/ -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -L${CUDA_PATH}/lib64/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -o rmsynthd daemon.o devices.o fileaccess.o inputparser.o dosynthesis.o job.o ranks.o planner.o arena.o products.o catalog.o librmsynth.a -lconfig -lcfitsio -lcudart -lm -lpthread -lhdf5 -lhdf5_hl -gencode $NVCC_FLAGS -use_fast_math
+
+printf "Compiling cube-assemble\n"
+$CC -g -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -L/${CFITSIO_PATH}/lib/ -L${HDF5_PATH}/lib/ -o cube-assemble src/assemble.c src/timing.c -lcfitsio -lhdf5 -lhdf5_hl -lm -lpthread
 
-nvcc -g -G -I${CUDA_PATH}/include/ -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -L${CUDA_PATH}/lib64/ -I${HDF5_PATH}/include/ -L${HDF5_PATH}/lib/ -o rmsynthesis rmsynthesis.o devices.o fileaccess.o inputparser.o rmsf.o -lconfig -lcfitsio -lcudart -lm -lhdf5 -lhdf5_hl -gencode $NVCC_FLAGS -use_fast_math
+printf "Compiling rmbench\n"
+for f in bench synthcube reference; do
+    gcc -g -c src/${f}.c
+done
+$CC -g -I${LIB_CONFIG_PATH}/include/ -I${CFITSIO_PATH}/include/ -I${HDF5_PATH}/include/ -c src/verify.c
+nvcc $NVCC_HOST -g -G -I${CUDA_PATH}/include/ -L${LIB_CONFIG_PATH}/lib/ -L/${CFITSIO_PATH}/lib/ -L${CUDA_PATH}/lib64/ -L${HDF5_PATH}/lib/ -o rmbench bench.o synthcube.o reference.o verify.o devices.o fileaccess.o inputparser.o dosynthesis.o job.o ranks.o planner.o arena.o products.o catalog.o librmsynth.a -lconfig -lcfitsio -lcudart -lm -lpthread -lhdf5 -lhdf5_hl -gencode $NVCC_FLAGS -use_fast_math
@@ -3,6 +3,8 @@
 makeFitsCube.py
 
 This script is intended for merging channel maps into a FITS cube.
+Superseded by cube-assemble (see README), which streams the maps
+into a rotated FITS or HDF5 cube without holding it in memory.
 
 Written by Sarrvesh S. Sridhar
 
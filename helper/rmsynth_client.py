@@ -0,0 +1,85 @@
+#!/usr/bin/env python
+"""
+rmsynth_client.py
+
+Stand-in client for rmsynthd. Sends one or more parset files to the
+daemon socket and prints the reply for each. Jobs are submitted
+concurrently so that they queue up inside the daemon.
+
+    rmsynth_client.py /tmp/rmsynthd.sock job1.parset job2.parset
+    rmsynth_client.py /tmp/rmsynthd.sock --shutdown
+
+Relative paths in a parset are resolved by the daemon, i.e. against
+the directory it was started from.
+"""
+import optparse
+import socket
+import sys
+import threading
+import time
+
+def sendRequest(socketPath, text):
+    """
+    Send text, close our side and wait for the one line reply.
+    """
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        sock.connect(socketPath)
+        sock.sendall(text.encode())
+        sock.shutdown(socket.SHUT_WR)
+        reply = b''
+        while True:
+            chunk = sock.recv(4096)
+            if not chunk:
+                break
+            reply += chunk
+    finally:
+        sock.close()
+    return reply.decode().strip()
+
+def submit(socketPath, parsetName, results, index):
+    start = time.time()
+    with open(parsetName) as f:
+        text = f.read()
+    try:
+        reply = sendRequest(socketPath, text)
+    except socket.error as err:
+        reply = 'ERROR {}'.format(err)
+    results[index] = (parsetName, reply, time.time() - start)
+
+def main(options, args):
+    socketPath = args[0]
+    if options.shutdown:
+        print(sendRequest(socketPath, 'SHUTDOWN'))
+        return 0
+    parsets = args[1:]
+    results = [None] * len(parsets)
+    threads = []
+    for index, name in enumerate(parsets):
+        thread = threading.Thread(target=submit,
+                                  args=(socketPath, name, results, index))
+        thread.start()
+        threads.append(thread)
+        # Keep the submission order so that the queue order is known
+        time.sleep(options.stagger)
+    for thread in threads:
+        thread.join()
+    failed = 0
+    for name, reply, elapsed in results:
+        print('{}: {} (round trip {:.3f} s)'.format(name, reply, elapsed))
+        if not reply.startswith('OK'):
+            failed += 1
+    return 1 if failed else 0
+
+if __name__ == '__main__':
+    opt = optparse.OptionParser()
+    opt.set_usage('%prog <socket> [parset ...] [--shutdown]')
+    opt.add_option('-s', '--shutdown', action='store_true', default=False,
+                   help='Stop the daemon once its queued jobs are done')
+    opt.add_option('-d', '--stagger', type='float', default=0.05,
+                   help='Delay between submissions in seconds [default: %default]')
+    options, args = opt.parse_args()
+    if len(args) < 1 or (len(args) < 2 and not options.shutdown):
+        opt.print_help()
+        sys.exit(1)
+    sys.exit(main(options, args))
@@ -0,0 +1,313 @@
+"""
+rmsynth.py
+
+Python bindings for librmsynth. NumPy arrays (including memmaps) are
+handed to the library without copying and the GIL is released while
+the backend computes, so several sources can be analysed from
+threads without going through FITS files on disk.
+
+    import numpy as np
+    import rmsynth
+    s = rmsynth.Synthesizer(lambda2, phi_min=-250., dphi=1., nphi=500)
+    qphi, uphi, pphi = s.synthesize(q, u)     # q, u: (..., nchan)
+    fphi, pphi = s.synthesize_complex(q + 1j*u)   # complex64, no copies
+    peak, peak_phi = s.peak(q, u)
+
+librmsynth.so is looked for in $RMSYNTH_LIB, next to this file, in
+the repository root (where build.sh puts it) and on the library path.
+"""
+import ctypes
+import ctypes.util
+import os
+import threading
+try:
+    import numpy as np
+except ImportError:
+    raise Exception('Unable to import Numpy')
+
+# Must match src/constants.h and src/rmsynth.h
+BACKENDS = {'cpu': 0, 'cuda': 1, 'gpu': 1}
+KERNELS = {'direct': 0, 'recurrence': 1}
+LAYOUTS = {'freq_first': 0, 'los_first': 1}
+LAMBDA20_MODES = {'median': 0, 'weighted': 1, 'user': 2}
+RMS_SUCCESS = 0
+
+class RMSynthError(Exception):
+    pass
+
+class _RMSConfig(ctypes.Structure):
+    _fields_ = [('nChan', ctypes.c_int),
+                ('lambda2', ctypes.POINTER(ctypes.c_double)),
+                ('weights', ctypes.POINTER(ctypes.c_double)),
+                ('lambda20Mode', ctypes.c_int),
+                ('lambda20', ctypes.c_double),
+                ('nPhi', ctypes.c_int),
+                ('phiMin', ctypes.c_double),
+                ('dPhi', ctypes.c_double),
+                ('backend', ctypes.c_int),
+                ('variant', ctypes.c_int),
+                ('layout', ctypes.c_int),
+                ('maxLOS', ctypes.c_long),
+                ('stokesI', ctypes.c_int),
+                ('nThreads', ctypes.c_int),
+                ('deviceId', ctypes.c_int)]
+
+_lib = None
+_libLock = threading.Lock()
+
+def _findLibrary():
+    """
+    Return the path of librmsynth.so.
+    """
+    here = os.path.dirname(os.path.abspath(__file__))
+    candidates = [os.environ.get('RMSYNTH_LIB', ''),
+                  os.path.join(here, 'librmsynth.so'),
+                  os.path.join(here, os.pardir, 'librmsynth.so')]
+    for name in candidates:
+        if name and os.path.exists(name):
+            return name
+    name = ctypes.util.find_library('rmsynth')
+    if name is None:
+        raise RMSynthError('Unable to find librmsynth.so. Run build.sh or set RMSYNTH_LIB.')
+    return name
+
+def _loadLibrary():
+    """
+    Load librmsynth once and declare the prototypes. ctypes.CDLL
+    releases the GIL for the duration of every call.
+    """
+    global _lib
+    with _libLock:
+        if _lib is not None:
+            return _lib
+        lib = ctypes.CDLL(_findLibrary())
+        floatPtr = ctypes.POINTER(ctypes.c_float)
+        ctxPtr = ctypes.c_void_p
+        lib.rmsDefaultConfig.argtypes = [ctypes.POINTER(_RMSConfig)]
+        lib.rmsDefaultConfig.restype = None
+        lib.rmsCreate.argtypes = [ctypes.POINTER(_RMSConfig), ctypes.POINTER(ctxPtr)]
+        lib.rmsCreate.restype = ctypes.c_int
+        lib.rmsSynthesize.argtypes = [ctxPtr, floatPtr, floatPtr, ctypes.c_long,
+                                      floatPtr, floatPtr, floatPtr]
+        lib.rmsSynthesize.restype = ctypes.c_int
+        lib.rmsSynthesizeInterleaved.argtypes = [ctxPtr, floatPtr, ctypes.c_long,
+                                                 floatPtr, floatPtr]
+        lib.rmsSynthesizeInterleaved.restype = ctypes.c_int
+        lib.rmsGetPhiAxis.argtypes = [ctxPtr, floatPtr]
+        lib.rmsGetPhiAxis.restype = ctypes.c_int
+        lib.rmsGetRMSF.argtypes = [ctxPtr, floatPtr, floatPtr, floatPtr]
+        lib.rmsGetRMSF.restype = ctypes.c_int
+        lib.rmsGetLambda20.argtypes = [ctxPtr]
+        lib.rmsGetLambda20.restype = ctypes.c_double
+        lib.rmsDestroy.argtypes = [ctxPtr]
+        lib.rmsDestroy.restype = None
+        lib.rmsStatusString.argtypes = [ctypes.c_int]
+        lib.rmsStatusString.restype = ctypes.c_char_p
+        _lib = lib
+        return lib
+
+def _check(lib, status, what):
+    if status != RMS_SUCCESS:
+        raise RMSynthError('{}: {}'.format(what, lib.rmsStatusString(status).decode()))
+
+def _floatPtr(array):
+    return array.ctypes.data_as(ctypes.POINTER(ctypes.c_float))
+
+def _asInput(array, name, dtype=np.float32):
+    """
+    Return array as-is if the library can read it in place.
+    Otherwise refuse rather than copy behind the caller's back.
+    """
+    array = np.asanyarray(array)
+    if array.dtype != dtype or not array.flags['C_CONTIGUOUS']:
+        raise RMSynthError('{} must be a C-contiguous {} array; use '
+                           'np.ascontiguousarray({}, dtype=np.{})'.format(
+                               name, np.dtype(dtype).name, name, np.dtype(dtype).name))
+    return array
+
+class Synthesizer(object):
+    """
+    RM synthesis context for one set of channels and one phi axis.
+
+    lambda2      channel lambda^2 in m^2
+    phi_min, dphi, nphi
+                 Faraday depth axis in rad/m/m
+    weights      per-channel weights, None for uniform
+    lambda20     'median', 'weighted' or a value in m^2
+    backend      'cpu' or 'cuda'
+    kernel       'direct' or 'recurrence' (CPU only)
+    layout       'freq_first': inputs are (..., nchan), outputs (..., nphi)
+                 'los_first':  inputs are (nchan, ...), outputs (nphi, ...)
+    nthreads     CPU threads, 0 for all cores
+    """
+    def __init__(self, lambda2, phi_min, dphi, nphi, weights=None,
+                 lambda20='median', backend='cpu', kernel='direct',
+                 layout='freq_first', nthreads=0, device=0):
+        self._lib = _loadLibrary()
+        self._ctx = ctypes.c_void_p()
+        self._maxLOS = 0
+        self._lock = threading.Lock()
+        self._lambda2 = np.ascontiguousarray(lambda2, dtype=np.float64)
+        self._weights = None if weights is None else \
+                        np.ascontiguousarray(weights, dtype=np.float64)
+        if self._weights is not None and self._weights.shape != self._lambda2.shape:
+            raise RMSynthError('weights and lambda2 must have the same length')
+        try:
+            self.layout = LAYOUTS[layout]
+            self._config = _RMSConfig()
+            self._lib.rmsDefaultConfig(ctypes.byref(self._config))
+            self._config.backend = BACKENDS[backend.lower()]
+            self._config.variant = KERNELS[kernel.lower()]
+        except KeyError as err:
+            raise RMSynthError('Unknown option {}'.format(err))
+        self._config.nChan = self._lambda2.size
+        self._config.lambda2 = self._lambda2.ctypes.data_as(ctypes.POINTER(ctypes.c_double))
+        if self._weights is not None:
+            self._config.weights = self._weights.ctypes.data_as(ctypes.POINTER(ctypes.c_double))
+        if isinstance(lambda20, str):
+            if lambda20.lower() not in ('median', 'weighted'):
+                raise RMSynthError('lambda20 must be median, weighted or a number')
+            self._config.lambda20Mode = LAMBDA20_MODES[lambda20.lower()]
+        else:
+            self._config.lambda20Mode = LAMBDA20_MODES['user']
+            self._config.lambda20 = float(lambda20)
+        self._config.nPhi = int(nphi)
+        self._config.phiMin = float(phi_min)
+        self._config.dPhi = float(dphi)
+        self._config.layout = self.layout
+        self._config.nThreads = int(nthreads)
+        self._config.deviceId = int(device)
+        self.nchan = self._config.nChan
+        self.nphi = self._config.nPhi
+        self._create(1)
+
+        # Quantities that do not depend on the number of sightlines
+        self.phi = np.empty(self.nphi, dtype=np.float32)
+        re = np.empty(self.nphi, dtype=np.float32)
+        im = np.empty(self.nphi, dtype=np.float32)
+        amp = np.empty(self.nphi, dtype=np.float32)
+        self._lib.rmsGetPhiAxis(self._ctx, _floatPtr(self.phi))
+        self._lib.rmsGetRMSF(self._ctx, _floatPtr(re), _floatPtr(im), _floatPtr(amp))
+        self.rmsf = re + 1j*im
+        self.lambda20 = self._lib.rmsGetLambda20(self._ctx)
+
+    def _create(self, maxLOS):
+        """
+        (Re)create the library context for frames of up to maxLOS
+        sightlines. Device buffers are sized by maxLOS.
+        """
+        if self._ctx:
+            self._lib.rmsDestroy(self._ctx)
+            self._ctx = ctypes.c_void_p()
+        self._config.maxLOS = maxLOS
+        _check(self._lib, self._lib.rmsCreate(ctypes.byref(self._config),
+                                              ctypes.byref(self._ctx)),
+               'rmsCreate')
+        self._maxLOS = maxLOS
+
+    def synthesize(self, q, u, out=None):
+        """
+        Return Q(phi), U(phi) and P(phi) for the spectra in q and u.
+        q and u are read in place; out may be a tuple of three
+        preallocated float32 arrays (e.g. memmaps) to write into.
+        """
+        q = _asInput(q, 'q')
+        u = _asInput(u, 'u')
+        if q.shape != u.shape:
+            raise RMSynthError('q and u must have the same shape')
+        if self.layout == LAYOUTS['freq_first']:
+            if q.shape[-1] != self.nchan:
+                raise RMSynthError('last axis of q must have {} channels'.format(self.nchan))
+            outShape = q.shape[:-1] + (self.nphi,)
+        else:
+            if q.shape[0] != self.nchan:
+                raise RMSynthError('first axis of q must have {} channels'.format(self.nchan))
+            outShape = (self.nphi,) + q.shape[1:]
+        nLOS = q.size // self.nchan
+        if out is None:
+            out = tuple(np.empty(outShape, dtype=np.float32) for i in range(3))
+        else:
+            out = tuple(_asInput(o, 'out') for o in out)
+            if len(out) != 3 or any(o.shape != outShape for o in out):
+                raise RMSynthError('out must be three arrays of shape {}'.format(outShape))
+        if nLOS == 0:
+            return out
+
+        # The library call runs without the GIL; the lock only keeps
+        # two threads from using one context at the same time.
+        with self._lock:
+            if nLOS > self._maxLOS:
+                self._create(nLOS)
+            _check(self._lib, self._lib.rmsSynthesize(self._ctx, _floatPtr(q), _floatPtr(u),
+                                                      nLOS, _floatPtr(out[0]),
+                                                      _floatPtr(out[1]), _floatPtr(out[2])),
+                   'rmsSynthesize')
+        return out
+
+    def synthesize_complex(self, p, out=None):
+        """
+        Return Q(phi) + iU(phi) as complex64 and P(phi) for the
+        spectra q + iu in the complex64 array p. This is the layout
+        the backends use, so nothing is copied. out may be a pair
+        of a complex64 and a float32 array to write into.
+        """
+        p = _asInput(p, 'p', np.complex64)
+        if self.layout == LAYOUTS['freq_first']:
+            if p.shape[-1] != self.nchan:
+                raise RMSynthError('last axis of p must have {} channels'.format(self.nchan))
+            outShape = p.shape[:-1] + (self.nphi,)
+        else:
+            if p.shape[0] != self.nchan:
+                raise RMSynthError('first axis of p must have {} channels'.format(self.nchan))
+            outShape = (self.nphi,) + p.shape[1:]
+        nLOS = p.size // self.nchan
+        if out is None:
+            out = (np.empty(outShape, dtype=np.complex64),
+                   np.empty(outShape, dtype=np.float32))
+        else:
+            if len(out) != 2:
+                raise RMSynthError('out must be a complex64 and a float32 array')
+            out = (_asInput(out[0], 'out[0]', np.complex64), _asInput(out[1], 'out[1]'))
+            if any(o.shape != outShape for o in out):
+                raise RMSynthError('out must have shape {}'.format(outShape))
+        if nLOS == 0:
+            return out
+
+        with self._lock:
+            if nLOS > self._maxLOS:
+                self._create(nLOS)
+            _check(self._lib, self._lib.rmsSynthesizeInterleaved(self._ctx, _floatPtr(p), nLOS,
+                                                                 _floatPtr(out[0]),
+                                                                 _floatPtr(out[1])),
+                   'rmsSynthesizeInterleaved')
+        return out
+
+    def peak(self, q, u):
+        """
+        Return the peak polarized intensity and the Faraday depth at
+        which it occurs for every sightline.
+        """
+        pphi = self.synthesize(q, u)[2]
+        axis = -1 if self.layout == LAYOUTS['freq_first'] else 0
+        index = np.argmax(pphi, axis=axis)
+        return np.max(pphi, axis=axis), self.phi[index]
+
+    def close(self):
+        """
+        Release the library context and any device buffers.
+        """
+        if self._ctx:
+            self._lib.rmsDestroy(self._ctx)
+            self._ctx = ctypes.c_void_p()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        try:
+            self.close()
+        except Exception:
+            pass
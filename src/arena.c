@@ -0,0 +1,135 @@
+/******************************************************************************
+arena.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<string.h>
+#include<sys/mman.h>
+
+#include "constants.h"
+#include "devices.h"
+#include "arena.h"
+
+#define MB (1024.*1024.)
+
+void initArena(struct hostArena *arena) {
+    memset(arena, 0, sizeof(*arena));
+}
+
+/*************************************************************
+*
+* Map size bytes aligned to a huge page boundary, so that the
+*  kernel can back the block with transparent huge pages. The
+*  mapping is made one huge page larger and trimmed.
+*
+*************************************************************/
+static char *mapHugeBlock(size_t size) {
+    char *raw, *block;
+    size_t head;
+
+    raw = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED) { return(NULL); }
+    head = (HUGE_PAGE_SIZE - (size_t)raw % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+    block = raw + head;
+    if(head > 0) { munmap(raw, head); }
+    munmap(block + size, HUGE_PAGE_SIZE - head);
+    #ifdef MADV_HUGEPAGE
+    madvise(block, size, MADV_HUGEPAGE);
+    #endif
+    return(block);
+}
+
+static void unmapBlock(struct hostArena *arena) {
+    if(arena->base == NULL) { return; }
+    if(arena->pinned) { unpinHostMemory(arena->base); }
+    munmap(arena->base, arena->size);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->pinned = FALSE;
+}
+
+/*************************************************************
+*
+* Make room for a job of up to bytes and hand out buffers from
+*  the start again. The block is kept if it is large enough.
+*  With pin set, it is page-locked; if that fails, the job runs
+*  from pageable memory.
+*
+*************************************************************/
+int reserveArena(struct hostArena *arena, size_t bytes, int pin) {
+    size_t size;
+
+    arena->used = 0;
+    if(arena->base != NULL && arena->size >= bytes &&
+       (arena->pinned || !pin)) {
+        arena->nReuses++;
+        return(SUCCESS);
+    }
+    unmapBlock(arena);
+    size = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    if(size == 0) { size = HUGE_PAGE_SIZE; }
+    arena->base = mapHugeBlock(size);
+    if(arena->base == NULL) {
+        printf("Error: Unable to map %.1f MB of host memory\n", size/MB);
+        return(FAILURE);
+    }
+    arena->size = size;
+    arena->nMaps++;
+    if(pin) {
+        if(pinHostMemory(arena->base, arena->size) == SUCCESS)
+            arena->pinned = TRUE;
+        else
+            printf("INFO: Unable to page-lock %.1f MB; using pageable memory\n",
+                   arena->size/MB);
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Take an aligned buffer of bytes from the arena. Returns NULL
+*  if the reservation was too small. The contents are whatever
+*  the previous job left behind.
+*
+*************************************************************/
+void *arenaAlloc(struct hostArena *arena, size_t bytes) {
+    char *buffer;
+    size_t offset = (arena->used + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+    if(arena->base == NULL || offset + bytes > arena->size) { return(NULL); }
+    buffer = arena->base + offset;
+    arena->used = offset + bytes;
+    if(arena->used > arena->peak) { arena->peak = arena->used; }
+    arena->nBuffers++;
+    return(buffer);
+}
+
+void freeArena(struct hostArena *arena) {
+    unmapBlock(arena);
+    arena->used = 0;
+}
+
+void printArenaStats(const struct hostArena *arena) {
+    printf("INFO: Staging arena %.1f MB%s, peak %.1f MB, %ld buffers, %ld mappings, %ld reuses\n",
+           arena->size/MB, arena->pinned ? " (page-locked)" : "",
+           arena->peak/MB, arena->nBuffers, arena->nMaps, arena->nReuses);
+}
@@ -0,0 +1,60 @@
+/******************************************************************************
+arena.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef ARENA_H
+#define ARENA_H
+
+#include<stddef.h>
+
+/* Alignment of every buffer handed out by an arena */
+#define ARENA_ALIGN       4096
+/* Buffers a job takes at most; the planner leaves this much slack */
+#define ARENA_MAX_BUFFERS 16
+/* Size of a transparent huge page */
+#define HUGE_PAGE_SIZE    (2 << 20)
+
+/* One block of host memory from which a job takes its staging
+   buffers. The block is kept between jobs and only remapped when
+   a job needs more, so batch fields and daemon jobs reuse it.
+   With the CUDA backend it is page-locked, so that transfers to
+   and from the device run at full speed. Not thread safe. */
+struct hostArena {
+    char *base;
+    size_t size;         /* Bytes mapped */
+    size_t used, peak;   /* Bytes handed out, now and at most */
+    int pinned;          /* Registered with the CUDA driver */
+    long nBuffers;       /* Buffers handed out */
+    long nMaps;          /* Times the block was (re)mapped */
+    long nReuses;        /* Jobs served from an existing block */
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+
+void initArena(struct hostArena *arena);
+int reserveArena(struct hostArena *arena, size_t bytes, int pin);
+void *arenaAlloc(struct hostArena *arena, size_t bytes);
+void freeArena(struct hostArena *arena);
+void printArenaStats(const struct hostArena *arena);
+
+#endif
@@ -0,0 +1,636 @@
+/******************************************************************************
+assemble.c: cube-assemble, streams a directory of channel maps into
+an RM-ready cube.
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<glob.h>
+#include<pthread.h>
+#include<sys/resource.h>
+
+#include "fitsio.h"
+#include "hdf5.h"
+#include "hdf5_hl.h"
+#include "constants.h"
+#include "version.h"
+#include "timing.h"
+
+#define MAX_MAP_AXES       4
+#define DEFAULT_MEM_MB     1024
+#define DEFAULT_FREQ_FILE  "frequency.txt"
+#define FREQ_DATASET       "/FREQUENCY"
+#define MHZ                1.e6
+
+/* Where the frequency of a channel map is stored */
+enum freqKeys { FREQ_KEY_CRVAL3, FREQ_KEY_RESTFRQ, FREQ_KEY_MWA };
+
+struct assembleOptions {
+    char *outName;
+    char *freqFileName;
+    char *pattern;
+    int format;
+    int freqKey;
+    long memBudget;
+    int nThreads;
+};
+
+/* WCS of one spatial axis of the channel maps */
+struct wcsAxis {
+    double crval, cdelt, crpix;
+    char ctype[FLEN_VALUE];
+};
+
+/* The open channel maps. Every map has nx by ny pixels */
+struct channelMaps {
+    int nChan;
+    char **names;
+    fitsfile **files;
+    double *freq;
+    long nx, ny;
+    struct wcsAxis axis[2];
+    char bunit[FLEN_VALUE];
+};
+
+/* Work for one reader thread: every nThreads-th channel starting
+   at first, rows y0 to y0+nRows-1, into buf[chan][row][x] */
+struct readerArgs {
+    struct channelMaps *maps;
+    int first, stride;
+    long y0, nRows;
+    float *buf;
+    int status;
+};
+
+static void printUsage(char *name) {
+    printf("Usage: %s [options] -o <output> <map.fits> ... | -i '<glob>'\n", name);
+    printf("  -o file      output cube; .h5 or .hdf5 writes HDF5, anything else FITS\n");
+    printf("  -i glob      select the channel maps with a glob pattern (sorted)\n");
+    printf("  -f file      frequency list to write (%s)\n", DEFAULT_FREQ_FILE);
+    printf("  -r           frequency is in RESTFRQ instead of CRVAL3\n");
+    printf("  -m           frequency is in FREQ in MHz (MWA maps)\n");
+    printf("  -M MB        memory for the transpose buffers (%d)\n", DEFAULT_MEM_MB);
+    printf("  -t threads   parallel channel readers, 0 for all cores (0)\n\n");
+    printf("FITS output has frequency on NAXIS1, RA on NAXIS2 and DEC on NAXIS3\n");
+    printf("(the layout rmsynthesis reads). HDF5 output is HDFITS with one chunk\n");
+    printf("per DEC row and the frequencies in %s.\n\n", FREQ_DATASET);
+}
+
+/*************************************************************
+*
+* Read the frequency of a channel map
+*
+*************************************************************/
+static int readMapFrequency(fitsfile *file, int freqKey, double *freq) {
+    int status = 0;
+    char comment[FLEN_COMMENT];
+
+    switch(freqKey) {
+       case FREQ_KEY_RESTFRQ:
+          fits_read_key(file, TDOUBLE, "RESTFRQ", freq, comment, &status);
+          if(status == KEY_NO_EXIST) {
+             status = 0;
+             fits_read_key(file, TDOUBLE, "RESTFREQ", freq, comment, &status);
+          }
+          break;
+       case FREQ_KEY_MWA:
+          fits_read_key(file, TDOUBLE, "FREQ", freq, comment, &status);
+          *freq *= MHZ;
+          break;
+       default:
+          fits_read_key(file, TDOUBLE, "CRVAL3", freq, comment, &status);
+          break;
+    }
+    return(status);
+}
+
+/* Optional WCS keys default to a pixel grid */
+static void readWCSAxis(fitsfile *file, int n, struct wcsAxis *axis) {
+    char key[FLEN_KEYWORD], comment[FLEN_COMMENT];
+    int status;
+
+    axis->crval = 0.; axis->cdelt = 1.; axis->crpix = 1.;
+    axis->ctype[0] = '\0';
+    sprintf(key, "CRVAL%d", n); status = 0;
+    fits_read_key(file, TDOUBLE, key, &axis->crval, comment, &status);
+    sprintf(key, "CDELT%d", n); status = 0;
+    fits_read_key(file, TDOUBLE, key, &axis->cdelt, comment, &status);
+    sprintf(key, "CRPIX%d", n); status = 0;
+    fits_read_key(file, TDOUBLE, key, &axis->crpix, comment, &status);
+    sprintf(key, "CTYPE%d", n); status = 0;
+    fits_read_key(file, TSTRING, key, axis->ctype, comment, &status);
+}
+
+/*************************************************************
+*
+* Open every channel map, check that they have the same shape
+*  and collect the frequencies and the spatial WCS
+*
+*************************************************************/
+static int openChannelMaps(struct channelMaps *maps, int freqKey) {
+    int i, j, naxis, status = 0;
+    long naxes[MAX_MAP_AXES];
+    struct rlimit limit;
+
+    /* Every map stays open for the whole run */
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+       limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < (rlim_t)maps->nChan + 16) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+        if(limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < (rlim_t)maps->nChan + 16) {
+            printf("Error: %d channel maps exceed the open file limit of %ld\n\n",
+                   maps->nChan, (long)limit.rlim_cur);
+            return(FAILURE);
+        }
+    }
+
+    maps->files = calloc(maps->nChan, sizeof(*maps->files));
+    maps->freq  = calloc(maps->nChan, sizeof(*maps->freq));
+    if(maps->files == NULL || maps->freq == NULL) {
+        printf("Error: Mem alloc failed while opening channel maps\n\n");
+        return(FAILURE);
+    }
+    for(i=0; i<maps->nChan; i++) {
+        fits_open_image(&maps->files[i], maps->names[i], READONLY, &status);
+        fits_get_img_dim(maps->files[i], &naxis, &status);
+        if(status) {
+            printf("Error: Unable to open %s\n", maps->names[i]);
+            fits_report_error(stdout, status);
+            return(FAILURE);
+        }
+        if(naxis < 2 || naxis > MAX_MAP_AXES) {
+            printf("Error: %s has %d axes\n\n", maps->names[i], naxis);
+            return(FAILURE);
+        }
+        fits_get_img_size(maps->files[i], naxis, naxes, &status);
+        for(j=2; j<naxis && naxes[j] == 1; j++);
+        if(status || j < naxis) {
+            printf("Error: %s is not a single channel map\n\n", maps->names[i]);
+            return(FAILURE);
+        }
+        if(i == 0) {
+            maps->nx = naxes[0];
+            maps->ny = naxes[1];
+            readWCSAxis(maps->files[0], 1, &maps->axis[0]);
+            readWCSAxis(maps->files[0], 2, &maps->axis[1]);
+            maps->bunit[0] = '\0';
+            fits_read_key(maps->files[0], TSTRING, "BUNIT", maps->bunit, NULL, &status);
+            status = 0;
+        }
+        else if(naxes[0] != maps->nx || naxes[1] != maps->ny) {
+            printf("Error: %s has an incompatible shape\n\n", maps->names[i]);
+            return(FAILURE);
+        }
+        if(readMapFrequency(maps->files[i], freqKey, &maps->freq[i])) {
+            printf("Error: Unable to read the frequency of %s\n\n", maps->names[i]);
+            return(FAILURE);
+        }
+    }
+    return(SUCCESS);
+}
+
+static void closeChannelMaps(struct channelMaps *maps) {
+    int i, status;
+
+    for(i=0; maps->files != NULL && i<maps->nChan; i++) {
+        status = 0;
+        if(maps->files[i] != NULL) { fits_close_file(maps->files[i], &status); }
+    }
+    free(maps->files);
+    free(maps->freq);
+}
+
+/*************************************************************
+*
+* Reader threads. Each reads nRows full rows of its channels;
+*  the rows of a map are contiguous on disk.
+*
+*************************************************************/
+static void *readChannels(void *arg) {
+    struct readerArgs *r = (struct readerArgs *)arg;
+    struct channelMaps *maps = r->maps;
+    long fPixel[MAX_MAP_AXES] = {1, 1, 1, 1};
+    long nElements = r->nRows * maps->nx;
+    int c;
+
+    r->status = 0;
+    fPixel[1] = r->y0 + 1;
+    for(c=r->first; c<maps->nChan && r->status == 0; c+=r->stride) {
+        fits_read_pix(maps->files[c], TFLOAT, fPixel, nElements, NULL,
+                      r->buf + c*nElements, NULL, &r->status);
+        if(r->status) {
+            printf("Error: Unable to read %s\n", maps->names[c]);
+            fits_report_error(stdout, r->status);
+        }
+    }
+    return(NULL);
+}
+
+static int startReaders(pthread_t *threads, struct readerArgs *args, int nThreads,
+                        struct channelMaps *maps, long y0, long nRows, float *buf) {
+    int i;
+
+    for(i=0; i<nThreads; i++) {
+        args[i].maps = maps;
+        args[i].first = i; args[i].stride = nThreads;
+        args[i].y0 = y0; args[i].nRows = nRows;
+        args[i].buf = buf;
+        args[i].status = 0;
+        if(pthread_create(&threads[i], NULL, readChannels, &args[i])) {
+            printf("Error: Unable to start reader thread\n\n");
+            while(i-- > 0) { pthread_join(threads[i], NULL); }
+            return(FAILURE);
+        }
+    }
+    return(SUCCESS);
+}
+
+static int joinReaders(pthread_t *threads, struct readerArgs *args, int nThreads) {
+    int i, status = SUCCESS;
+
+    for(i=0; i<nThreads; i++) {
+        pthread_join(threads[i], NULL);
+        if(args[i].status) { status = FAILURE; }
+    }
+    return(status);
+}
+
+/*************************************************************
+*
+* buf[chan][row][x] -> out[row][x][chan], in square blocks so
+*  that both sides stay in cache
+*
+*************************************************************/
+static void transposeBlock(const float *buf, float *out, int nChan, long nPix) {
+    long p0, p, pEnd;
+    int c0, c, cEnd;
+
+    for(p0=0; p0<nPix; p0+=TRANSPOSE_BLOCK) {
+        pEnd = p0+TRANSPOSE_BLOCK < nPix ? p0+TRANSPOSE_BLOCK : nPix;
+        for(c0=0; c0<nChan; c0+=TRANSPOSE_BLOCK) {
+            cEnd = c0+TRANSPOSE_BLOCK < nChan ? c0+TRANSPOSE_BLOCK : nChan;
+            for(p=p0; p<pEnd; p++)
+                for(c=c0; c<cEnd; c++)
+                    out[p*nChan + c] = buf[(long)c*nPix + p];
+        }
+    }
+}
+
+/*************************************************************
+*
+* Create the output cubes
+*
+*************************************************************/
+static int createFitsCube(char *name, struct channelMaps *maps, fitsfile **out) {
+    long naxes[FITS_OUT_NAXIS];
+    double cdelt, one = 1.;
+    int i, status = 0;
+    char key[FLEN_KEYWORD];
+
+    naxes[0] = maps->nChan; naxes[1] = maps->nx; naxes[2] = maps->ny;
+    cdelt = maps->nChan > 1 ? maps->freq[1] - maps->freq[0] : 1.;
+    fits_create_file(out, name, &status);
+    fits_create_img(*out, FLOAT_IMG, FITS_OUT_NAXIS, naxes, &status);
+    fits_write_key(*out, TSTRING, "CTYPE1", "FREQ", "", &status);
+    fits_write_key(*out, TDOUBLE, "CRVAL1", &maps->freq[0], "", &status);
+    fits_write_key(*out, TDOUBLE, "CDELT1", &cdelt, "", &status);
+    fits_write_key(*out, TDOUBLE, "CRPIX1", &one, "", &status);
+    for(i=0; i<2; i++) {
+        sprintf(key, "CTYPE%d", i+2);
+        fits_write_key(*out, TSTRING, key, maps->axis[i].ctype, "", &status);
+        sprintf(key, "CRVAL%d", i+2);
+        fits_write_key(*out, TDOUBLE, key, &maps->axis[i].crval, "", &status);
+        sprintf(key, "CDELT%d", i+2);
+        fits_write_key(*out, TDOUBLE, key, &maps->axis[i].cdelt, "", &status);
+        sprintf(key, "CRPIX%d", i+2);
+        fits_write_key(*out, TDOUBLE, key, &maps->axis[i].crpix, "", &status);
+    }
+    if(maps->bunit[0] != '\0')
+        fits_write_key(*out, TSTRING, "BUNIT", maps->bunit, "", &status);
+    if(status) {
+        printf("Error: Unable to create %s\n", name);
+        fits_report_error(stdout, status);
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+static int createHDF5Cube(char *name, struct channelMaps *maps, hid_t *file, hid_t *dataset) {
+    hsize_t dims[N_DIMS], chunk[N_DIMS], nFreq = maps->nChan;
+    hid_t space, plist, group;
+    double one = 1.;
+    int i, positionID = POSITION_ID;
+    char key[FLEN_KEYWORD];
+    herr_t error = 0;
+
+    *file = H5Fcreate(name, H5F_ACC_EXCL, H5P_DEFAULT, H5P_DEFAULT);
+    if(*file < 0) {
+        printf("Error: Unable to create %s\n\n", name);
+        return(FAILURE);
+    }
+    group = H5Gcreate(*file, PRIMARY, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if(group < 0) { return(FAILURE); }
+    H5Gclose(group);
+
+    /* One chunk is one frame as rmsynthesis reads it */
+    dims[0] = maps->nChan; dims[1] = maps->ny; dims[2] = maps->nx;
+    chunk[0] = maps->nChan; chunk[1] = 1; chunk[2] = maps->nx;
+    space = H5Screate_simple(N_DIMS, dims, NULL);
+    plist = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(plist, N_DIMS, chunk);
+    *dataset = H5Dcreate2(*file, PRIMARYDATA, H5T_NATIVE_FLOAT, space,
+                          H5P_DEFAULT, plist, H5P_DEFAULT);
+    H5Pclose(plist);
+    H5Sclose(space);
+    if(*dataset < 0) {
+        printf("Error: Unable to create the dataset in %s\n\n", name);
+        return(FAILURE);
+    }
+
+    error |= H5LTset_attribute_string(*file, ROOT, "CLASS", HDFITS);
+    error |= H5LTset_attribute_int(*file, PRIMARY, "POSITION", &positionID, 1);
+    error |= H5LTset_attribute_string(*file, PRIMARYDATA, "CLASS", H5IMAGE);
+    for(i=0; i<2; i++) {
+        sprintf(key, "CTYPE%d", i+1);
+        error |= H5LTset_attribute_string(*file, PRIMARY, key, maps->axis[i].ctype);
+        sprintf(key, "CRVAL%d", i+1);
+        error |= H5LTset_attribute_double(*file, PRIMARY, key, &maps->axis[i].crval, 1);
+        sprintf(key, "CDELT%d", i+1);
+        error |= H5LTset_attribute_double(*file, PRIMARY, key, &maps->axis[i].cdelt, 1);
+        sprintf(key, "CRPIX%d", i+1);
+        error |= H5LTset_attribute_double(*file, PRIMARY, key, &maps->axis[i].crpix, 1);
+    }
+    one = maps->nChan > 1 ? maps->freq[1] - maps->freq[0] : 1.;
+    error |= H5LTset_attribute_string(*file, PRIMARY, "CTYPE3", "FREQ");
+    error |= H5LTset_attribute_double(*file, PRIMARY, "CRVAL3", &maps->freq[0], 1);
+    error |= H5LTset_attribute_double(*file, PRIMARY, "CDELT3", &one, 1);
+    one = 1.;
+    error |= H5LTset_attribute_double(*file, PRIMARY, "CRPIX3", &one, 1);
+    error |= H5LTmake_dataset_double(*file, FREQ_DATASET, 1, &nFreq, maps->freq);
+    if(error < 0) {
+        printf("Error: Unable to write the header of %s\n\n", name);
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+/* Write one block of rows. buf is [chan][row][x] */
+static int writeHDF5Rows(hid_t dataset, struct channelMaps *maps,
+                         long y0, long nRows, float *buf) {
+    hsize_t start[N_DIMS] = {0, 0, 0}, count[N_DIMS];
+    hid_t fileSpace, memSpace;
+    herr_t error;
+
+    start[1] = y0;
+    count[0] = maps->nChan; count[1] = nRows; count[2] = maps->nx;
+    fileSpace = H5Dget_space(dataset);
+    memSpace  = H5Screate_simple(N_DIMS, count, NULL);
+    error = H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, start, NULL, count, NULL);
+    if(error >= 0)
+        error = H5Dwrite(dataset, H5T_NATIVE_FLOAT, memSpace, fileSpace, H5P_DEFAULT, buf);
+    H5Sclose(memSpace);
+    H5Sclose(fileSpace);
+    return(error < 0 ? FAILURE : SUCCESS);
+}
+
+static int writeFreqList(char *name, struct channelMaps *maps) {
+    FILE *f = fopen(name, "w");
+    int i;
+
+    if(f == NULL) {
+        printf("Error: Unable to open %s for writing\n\n", name);
+        return(FAILURE);
+    }
+    for(i=0; i<maps->nChan; i++) { fprintf(f, "%.17g\n", maps->freq[i]); }
+    fclose(f);
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Stream the maps into the cube a block of rows at a time.
+*  The readers fill one buffer while the previous block is
+*  transposed and written from the other, so the memory used
+*  is bounded by the budget whatever the size of the cube.
+*
+*************************************************************/
+static int assembleCube(struct assembleOptions *opt, struct channelMaps *maps) {
+    fitsfile *fitsOut = NULL;
+    hid_t h5File = -1, h5Data = -1;
+    long rowBytes, nRows, y0, nextY0, nBuffers;
+    long fPixel[FITS_OUT_NAXIS] = {1, 1, 1};
+    float *buf[2] = {NULL, NULL}, *trans = NULL;
+    pthread_t *threads;
+    struct readerArgs *args;
+    int b, status = SUCCESS, fitsStatus = 0, reading;
+    struct timeInfoList t;
+
+    initTimer(&t);
+
+    /* Rows per block from the memory budget */
+    nBuffers = opt->format == FITS ? 3 : 2;
+    rowBytes = (long)maps->nChan * maps->nx * sizeof(float);
+    nRows = opt->memBudget / (rowBytes * nBuffers);
+    if(nRows < 1) {
+        printf("INFO: One row of all channels needs %.1f MB; ignoring -M\n",
+               nBuffers*rowBytes/1.e6);
+        nRows = 1;
+    }
+    if(nRows > maps->ny) { nRows = maps->ny; }
+    printf("INFO: %ld rows per block, %.1f MB of buffers, %d readers\n",
+           nRows, nBuffers*nRows*rowBytes/1.e6, opt->nThreads);
+
+    threads = calloc(opt->nThreads, sizeof(*threads));
+    args = calloc(opt->nThreads, sizeof(*args));
+    buf[0] = malloc(nRows*rowBytes);
+    buf[1] = malloc(nRows*rowBytes);
+    if(opt->format == FITS) { trans = malloc(nRows*rowBytes); }
+    if(threads == NULL || args == NULL || buf[0] == NULL || buf[1] == NULL ||
+       (opt->format == FITS && trans == NULL)) {
+        printf("Error: Unable to allocate the transpose buffers\n\n");
+        status = FAILURE;
+    }
+
+    startTimer(&t, STAGE_SETUP);
+    if(status == SUCCESS) {
+        if(opt->format == FITS) status = createFitsCube(opt->outName, maps, &fitsOut);
+        else status = createHDF5Cube(opt->outName, maps, &h5File, &h5Data);
+    }
+    stopTimer(&t, STAGE_SETUP);
+
+    /* Read the first block, then overlap reading with writing */
+    reading = FALSE;
+    if(status == SUCCESS) {
+        startTimer(&t, STAGE_READ);
+        status = startReaders(threads, args, opt->nThreads, maps, 0, nRows, buf[0]);
+        if(status == SUCCESS) { status = joinReaders(threads, args, opt->nThreads); }
+        stopTimer(&t, STAGE_READ);
+    }
+    for(b=0, y0=0; status == SUCCESS && y0<maps->ny; b++, y0=nextY0) {
+        long blockRows = y0+nRows <= maps->ny ? nRows : maps->ny-y0;
+        nextY0 = y0 + blockRows;
+        if(nextY0 < maps->ny) {
+            long nextRows = nextY0+nRows <= maps->ny ? nRows : maps->ny-nextY0;
+            status = startReaders(threads, args, opt->nThreads, maps,
+                                  nextY0, nextRows, buf[(b+1)%2]);
+            if(status) { break; }
+            reading = TRUE;
+        }
+
+        startTimer(&t, STAGE_WRITE);
+        if(opt->format == FITS) {
+            transposeBlock(buf[b%2], trans, maps->nChan, blockRows*maps->nx);
+            fPixel[2] = y0 + 1;
+            fits_write_pix(fitsOut, TFLOAT, fPixel, blockRows*maps->nx*maps->nChan,
+                           trans, &fitsStatus);
+            if(fitsStatus) {
+                fits_report_error(stdout, fitsStatus);
+                status = FAILURE;
+            }
+        }
+        else if(writeHDF5Rows(h5Data, maps, y0, blockRows, buf[b%2])) {
+            printf("Error: Unable to write rows %ld to %ld\n\n", y0, nextY0-1);
+            status = FAILURE;
+        }
+        stopTimer(&t, STAGE_WRITE);
+        addStageBytes(&t, STAGE_WRITE, blockRows*rowBytes);
+        addStageBytes(&t, STAGE_READ, blockRows*rowBytes);
+
+        if(reading) {
+            startTimer(&t, STAGE_READ);
+            if(joinReaders(threads, args, opt->nThreads)) { status = FAILURE; }
+            stopTimer(&t, STAGE_READ);
+            reading = FALSE;
+        }
+        printf("\rINFO: Wrote %ld of %ld rows", nextY0, maps->ny);
+        fflush(stdout);
+    }
+    printf("\n");
+
+    /* Closing flushes the cube */
+    startTimer(&t, STAGE_WRITE);
+    if(fitsOut != NULL) {
+        fits_close_file(fitsOut, &fitsStatus);
+        if(fitsStatus) { fits_report_error(stdout, fitsStatus); status = FAILURE; }
+    }
+    if(h5Data >= 0) { H5Dclose(h5Data); }
+    if(h5File >= 0 && H5Fclose(h5File) < 0) { status = FAILURE; }
+    stopTimer(&t, STAGE_WRITE);
+    stopTotalTimer(&t);
+    if(status == SUCCESS) {
+        printf("INFO: Read waits %.3f s, transpose and write %.3f s, total %.3f s\n",
+               t.stageTime[STAGE_READ], t.stageTime[STAGE_WRITE], t.totalTime);
+    }
+
+    free(threads); free(args);
+    free(buf[0]); free(buf[1]); free(trans);
+    return(status);
+}
+
+/*************************************************************
+*
+* Main code
+*
+*************************************************************/
+int main(int argc, char *argv[]) {
+    struct assembleOptions opt;
+    struct channelMaps maps;
+    glob_t globList;
+    int c, status;
+    size_t len;
+
+    printf("\n");
+    printf("cube-assemble v%s\n", VERSION_STR);
+
+    memset(&opt, 0, sizeof(opt));
+    memset(&maps, 0, sizeof(maps));
+    opt.freqFileName = DEFAULT_FREQ_FILE;
+    opt.freqKey = FREQ_KEY_CRVAL3;
+    opt.memBudget = (long)DEFAULT_MEM_MB << 20;
+    while((c = getopt(argc, argv, "o:i:f:rmM:t:h")) != -1) {
+        switch(c) {
+           case 'o': opt.outName = optarg; break;
+           case 'i': opt.pattern = optarg; break;
+           case 'f': opt.freqFileName = optarg; break;
+           case 'r': if(opt.freqKey != FREQ_KEY_MWA) opt.freqKey = FREQ_KEY_RESTFRQ; break;
+           case 'm': opt.freqKey = FREQ_KEY_MWA; break;
+           case 'M': opt.memBudget = atol(optarg) << 20; break;
+           case 't': opt.nThreads = atoi(optarg); break;
+           case 'h':
+           default:
+              printUsage(argv[0]);
+              return(c == 'h' ? SUCCESS : FAILURE);
+        }
+    }
+    if(opt.outName == NULL || opt.memBudget <= 0 || opt.nThreads < 0 ||
+       (opt.pattern == NULL) == (optind == argc)) {
+        printUsage(argv[0]);
+        return(FAILURE);
+    }
+    len = strlen(opt.outName);
+    opt.format = (len > 3 && strcmp(opt.outName+len-3, ".h5") == 0) ||
+                 (len > 5 && strcmp(opt.outName+len-5, ".hdf5") == 0) ? HDF5 : FITS;
+
+    /* List the channel maps */
+    if(opt.pattern != NULL) {
+        if(glob(opt.pattern, 0, NULL, &globList) || globList.gl_pathc == 0) {
+            printf("Error: No files match %s\n\n", opt.pattern);
+            return(FAILURE);
+        }
+        maps.names = globList.gl_pathv;
+        maps.nChan = globList.gl_pathc;
+    }
+    else {
+        maps.names = argv + optind;
+        maps.nChan = argc - optind;
+    }
+
+    /* cfitsio can only be used from several threads if it was
+       built with --enable-reentrant */
+    if(opt.nThreads == 0) { opt.nThreads = sysconf(_SC_NPROCESSORS_ONLN); }
+    if(opt.nThreads > maps.nChan) { opt.nThreads = maps.nChan; }
+    if(opt.nThreads > 1 && !fits_is_reentrant()) {
+        printf("INFO: cfitsio is not thread safe; using one reader\n");
+        opt.nThreads = 1;
+    }
+
+    printf("INFO: Opening %d channel maps\n", maps.nChan);
+    status = openChannelMaps(&maps, opt.freqKey);
+    if(status == SUCCESS) {
+        printf("INFO: Maps are %ld x %ld pixels, %g to %g Hz\n", maps.nx, maps.ny,
+               maps.freq[0], maps.freq[maps.nChan-1]);
+        printf("INFO: Writing %s cube %s\n", opt.format == FITS ? "FITS" : "HDF5",
+               opt.outName);
+        status = assembleCube(&opt, &maps);
+    }
+    if(status == SUCCESS) {
+        printf("INFO: Writing the frequency list to %s\n", opt.freqFileName);
+        status = writeFreqList(opt.freqFileName, &maps);
+    }
+    closeChannelMaps(&maps);
+    if(opt.pattern != NULL) { globfree(&globList); }
+    printf("\n");
+    return(status);
+}
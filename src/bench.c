@@ -0,0 +1,457 @@
+/******************************************************************************
+bench.c: Benchmark for the RM Synthesis engines.
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<unistd.h>
+#include<fcntl.h>
+
+#include "constants.h"
+#include "version.h"
+#include "timing.h"
+#include "engine.h"
+#include "reference.h"
+#include "synthcube.h"
+#include "verify.h"
+
+#define STORE_MEM   0
+#define STORE_TMPFS 1
+#define DEFAULT_TMPFS_DIR  "/dev/shm"
+#define DEFAULT_TOLERANCE  1e-4
+#define N_CHECK_FRAMES     4
+#define N_LAYOUTS          2
+
+/* Options of one benchmark run */
+struct benchOptions {
+    struct synthCubeParams cube;
+    int nPhi;
+    double dPhi;
+    int nThreads;
+    int storage;
+    char *tmpDir;
+    int backend, variant;     /* -1 runs all */
+    double tolerance;
+    char *jsonFileName;
+    int verify;
+};
+
+/* Input frames of the cube as they would be stored on disk */
+struct benchStore {
+    float *qCube, *uCube;     /* STORE_MEM */
+    int qFd, uFd;             /* STORE_TMPFS */
+    char qName[FILENAME_LEN], uName[FILENAME_LEN];
+};
+
+static const char *layoutNames[N_LAYOUTS] = { "fits", "hdf5" };
+
+static void printUsage(char *name) {
+    printf("Usage: %s [options]\n", name);
+    printf("  -x nRA       sightlines per DEC row (64)\n");
+    printf("  -y nDec      DEC rows (32)\n");
+    printf("  -c nChan     frequency channels (256)\n");
+    printf("  -p nPhi      Faraday depth planes (256)\n");
+    printf("  -d dPhi      Faraday depth spacing in rad/m/m (1.0)\n");
+    printf("  -s nThin     injected Faraday-thin sources (8)\n");
+    printf("  -S nThick    injected Faraday-thick sources (4)\n");
+    printf("  -n noise     noise per channel (0.01)\n");
+    printf("  -r seed      random seed (1)\n");
+    printf("  -t threads   CPU threads, 0 for all cores (0)\n");
+    printf("  -m mem|tmpfs keep the cubes in memory or in files (mem)\n");
+    printf("  -D dir       directory for tmpfs files (%s)\n", DEFAULT_TMPFS_DIR);
+    printf("  -b backend   cpu or cuda (all available)\n");
+    printf("  -k kernel    direct or recurrence (all available)\n");
+    printf("  -e tol       tolerance relative to the peak of P (%g)\n", DEFAULT_TOLERANCE);
+    printf("  -j file      append results as JSON lines to file\n");
+    printf("  -V           run the numerical regression suite instead\n\n");
+}
+
+/*************************************************************
+*
+* Parse the command line
+*
+*************************************************************/
+static int parseBenchOptions(int argc, char *argv[], struct benchOptions *opt) {
+    int c, i;
+
+    opt->cube.nRA = 64; opt->cube.nDec = 32; opt->cube.nChan = 256;
+    opt->cube.freqMin = 1.0e9; opt->cube.freqMax = 2.0e9;
+    opt->cube.nThin = 8; opt->cube.nThick = 4;
+    opt->cube.maxThickness = 50.;
+    opt->cube.noise = 0.01; opt->cube.seed = 1;
+    opt->nPhi = 256; opt->dPhi = 1.0;
+    opt->nThreads = 0;
+    opt->storage = STORE_MEM;
+    opt->tmpDir = DEFAULT_TMPFS_DIR;
+    opt->backend = -1; opt->variant = -1;
+    opt->tolerance = DEFAULT_TOLERANCE;
+    opt->jsonFileName = NULL;
+    opt->verify = FALSE;
+
+    while((c = getopt(argc, argv, "x:y:c:p:d:s:S:n:r:t:m:D:b:k:e:j:Vh")) != -1) {
+        switch(c) {
+           case 'x': opt->cube.nRA = atoi(optarg); break;
+           case 'y': opt->cube.nDec = atoi(optarg); break;
+           case 'c': opt->cube.nChan = atoi(optarg); break;
+           case 'p': opt->nPhi = atoi(optarg); break;
+           case 'd': opt->dPhi = atof(optarg); break;
+           case 's': opt->cube.nThin = atoi(optarg); break;
+           case 'S': opt->cube.nThick = atoi(optarg); break;
+           case 'n': opt->cube.noise = atof(optarg); break;
+           case 'r': opt->cube.seed = atoi(optarg); break;
+           case 't': opt->nThreads = atoi(optarg); break;
+           case 'm':
+              if(strcmp(optarg, "tmpfs") == 0) opt->storage = STORE_TMPFS;
+              else if(strcmp(optarg, "mem") == 0) opt->storage = STORE_MEM;
+              else { printUsage(argv[0]); return(FAILURE); }
+              break;
+           case 'D': opt->tmpDir = optarg; break;
+           case 'b':
+              for(i=0; i<N_BACKENDS && strcmp(optarg, backendName(i)); i++);
+              if(i == N_BACKENDS) { printUsage(argv[0]); return(FAILURE); }
+              opt->backend = i;
+              break;
+           case 'k':
+              for(i=0; i<N_KERNELS && strcmp(optarg, variantName(i)); i++);
+              if(i == N_KERNELS) { printUsage(argv[0]); return(FAILURE); }
+              opt->variant = i;
+              break;
+           case 'e': opt->tolerance = atof(optarg); break;
+           case 'j': opt->jsonFileName = optarg; break;
+           case 'V': opt->verify = TRUE; break;
+           case 'h':
+           default:
+              printUsage(argv[0]);
+              return(FAILURE);
+        }
+    }
+    if(opt->cube.nRA < 1 || opt->cube.nDec < 1 || opt->cube.nChan < 1 ||
+       opt->nPhi < 1 || opt->dPhi <= 0.) {
+        printf("Error: Cube dimensions and dPhi must be positive\n");
+        return(FAILURE);
+    }
+    /* Keep the injected sources inside the middle half of the phi axis */
+    opt->cube.phiRange = 0.25*opt->nPhi*opt->dPhi;
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Put the input frames in the requested layout into memory or
+*  into files on tmpfs
+*
+*************************************************************/
+static int makeStore(struct benchOptions *opt, struct synthCube *cube,
+                     int layout, struct benchStore *store) {
+    long frameLen = (long)opt->cube.nRA*opt->cube.nChan;
+    long nElements = frameLen*opt->cube.nDec;
+    int j;
+
+    store->qCube = malloc(nElements*sizeof(float));
+    store->uCube = malloc(nElements*sizeof(float));
+    if(store->qCube == NULL || store->uCube == NULL) {
+        printf("Error: Mem alloc failed while preparing the input\n");
+        return(FAILURE);
+    }
+    for(j=0; j<opt->cube.nDec; j++) {
+        if(layout == LAYOUT_LOS_FIRST) {
+            transposeFrame(cube->qCube + j*frameLen, store->qCube + j*frameLen,
+                           opt->cube.nRA, opt->cube.nChan);
+            transposeFrame(cube->uCube + j*frameLen, store->uCube + j*frameLen,
+                           opt->cube.nRA, opt->cube.nChan);
+        }
+        else {
+            memcpy(store->qCube + j*frameLen, cube->qCube + j*frameLen, frameLen*sizeof(float));
+            memcpy(store->uCube + j*frameLen, cube->uCube + j*frameLen, frameLen*sizeof(float));
+        }
+    }
+    store->qFd = store->uFd = -1;
+    if(opt->storage == STORE_MEM) { return(SUCCESS); }
+
+    /* Move the cube to tmpfs and only keep the file descriptors */
+    sprintf(store->qName, "%s/rmbench_q_%s_%d.raw", opt->tmpDir, layoutNames[layout], getpid());
+    sprintf(store->uName, "%s/rmbench_u_%s_%d.raw", opt->tmpDir, layoutNames[layout], getpid());
+    store->qFd = open(store->qName, O_RDWR|O_CREAT|O_TRUNC, 0600);
+    store->uFd = open(store->uName, O_RDWR|O_CREAT|O_TRUNC, 0600);
+    if(store->qFd < 0 || store->uFd < 0 ||
+       write(store->qFd, store->qCube, nElements*sizeof(float)) != (ssize_t)(nElements*sizeof(float)) ||
+       write(store->uFd, store->uCube, nElements*sizeof(float)) != (ssize_t)(nElements*sizeof(float))) {
+        printf("Error: Unable to write the input cubes to %s\n", opt->tmpDir);
+        return(FAILURE);
+    }
+    free(store->qCube); free(store->uCube);
+    store->qCube = store->uCube = NULL;
+    return(SUCCESS);
+}
+
+static void freeStore(struct benchStore *store) {
+    free(store->qCube); free(store->uCube);
+    if(store->qFd >= 0) { close(store->qFd); unlink(store->qName); }
+    if(store->uFd >= 0) { close(store->uFd); unlink(store->uName); }
+}
+
+/*************************************************************
+*
+* Largest deviation of an engine frame from the reference,
+*  relative to the peak of the reference P(\phi)
+*
+*************************************************************/
+static double compareFrame(const float *qPhi, const float *uPhi, const float *pPhi,
+                           const double *qRef, const double *uRef, const double *pRef,
+                           long nElements) {
+    double maxErr = 0., maxP = 0., err;
+    long i;
+
+    for(i=0; i<nElements; i++) {
+        if(pRef[i] > maxP) maxP = pRef[i];
+        err = fabs(qPhi[i] - qRef[i]);
+        if(fabs(uPhi[i] - uRef[i]) > err) err = fabs(uPhi[i] - uRef[i]);
+        if(fabs(pPhi[i] - pRef[i]) > err) err = fabs(pPhi[i] - pRef[i]);
+        if(err > maxErr) maxErr = err;
+    }
+    return(maxP > 0. ? maxErr/maxP : maxErr);
+}
+
+/*************************************************************
+*
+* Run read -> synthesize -> write over the whole cube with one
+*  backend, kernel variant and layout
+*
+*************************************************************/
+static int runBenchCase(struct benchOptions *opt, struct synthCube *cube,
+                        struct benchStore *store, float *phiAxis,
+                        double *phiAxisD, double lambda20, int backend,
+                        int variant, int layout, FILE *json) {
+    struct synthEngine engine;
+    struct timeInfoList t;
+    long nRA = opt->cube.nRA, nChan = opt->cube.nChan, nPhi = opt->nPhi;
+    long inLen = nRA*nChan, outLen = nRA*nPhi;
+    float *qIn, *uIn, *qOut, *uOut, *pOut, *outCube = NULL;
+    float *quIn, *quOut;
+    double *qRef, *uRef, *pRef, err, maxErr = 0., seconds, rate;
+    int j, k, outFd[3] = {-1, -1, -1}, checkStride, status = SUCCESS;
+    char outName[3][FILENAME_LEN];
+    float *outs[3];
+
+    if(initEngine(&engine, backend, variant, layout, nChan, nPhi, nRA, FALSE, phiAxis,
+                  cube->lambda2, lambda20, NULL, opt->nThreads, 0)) {
+        return(FAILURE);
+    }
+    initTimer(&t);
+    engine.t = &t;
+
+    qIn  = malloc(inLen*sizeof(float));  uIn  = malloc(inLen*sizeof(float));
+    qOut = malloc(outLen*sizeof(float)); uOut = malloc(outLen*sizeof(float));
+    pOut = malloc(outLen*sizeof(float));
+    quIn = malloc(2*inLen*sizeof(float)); quOut = malloc(2*outLen*sizeof(float));
+    qRef = malloc(outLen*sizeof(double)); uRef = malloc(outLen*sizeof(double));
+    pRef = malloc(outLen*sizeof(double));
+    if(opt->storage == STORE_MEM)
+        outCube = malloc(3*outLen*opt->cube.nDec*sizeof(float));
+    if(qIn == NULL || uIn == NULL || qOut == NULL || uOut == NULL ||
+       pOut == NULL || quIn == NULL || quOut == NULL ||
+       qRef == NULL || uRef == NULL || pRef == NULL ||
+       (opt->storage == STORE_MEM && outCube == NULL)) {
+        printf("Error: Mem alloc failed while running the benchmark\n");
+        status = FAILURE;
+    }
+    outs[0] = qOut; outs[1] = uOut; outs[2] = pOut;
+    for(k=0; k<3 && opt->storage == STORE_TMPFS && status == SUCCESS; k++) {
+        sprintf(outName[k], "%s/rmbench_out%d_%d.raw", opt->tmpDir, k, getpid());
+        outFd[k] = open(outName[k], O_WRONLY|O_CREAT|O_TRUNC, 0600);
+        if(outFd[k] < 0) {
+            printf("Error: Unable to create %s\n", outName[k]);
+            status = FAILURE;
+        }
+    }
+
+    checkStride = opt->cube.nDec > N_CHECK_FRAMES ? opt->cube.nDec/N_CHECK_FRAMES : 1;
+    for(j=0; j<opt->cube.nDec && status == SUCCESS; j++) {
+        startRowTimer(&t);
+
+        /* Read one frame */
+        startTimer(&t, STAGE_READ);
+        if(opt->storage == STORE_MEM) {
+            memcpy(qIn, store->qCube + j*inLen, inLen*sizeof(float));
+            memcpy(uIn, store->uCube + j*inLen, inLen*sizeof(float));
+        }
+        else if(pread(store->qFd, qIn, inLen*sizeof(float), j*inLen*sizeof(float)) < 0 ||
+                pread(store->uFd, uIn, inLen*sizeof(float), j*inLen*sizeof(float)) < 0) {
+            printf("Error: Unable to read frame %d\n", j);
+            status = FAILURE;
+        }
+        /* The engines take Q and U interleaved, as rmsynthesis does */
+        interleaveQU(qIn, uIn, inLen, quIn);
+        stopTimer(&t, STAGE_READ);
+        addStageBytes(&t, STAGE_READ, 2.*inLen*sizeof(float));
+
+        /* Synthesize */
+        if(status == SUCCESS &&
+           runEngine(&engine, quIn, nRA, quOut, pOut)) { status = FAILURE; }
+
+        /* Write one frame */
+        startTimer(&t, STAGE_WRITE);
+        splitQU(quOut, outLen, qOut, uOut);
+        for(k=0; k<3 && status == SUCCESS; k++) {
+            if(opt->storage == STORE_MEM)
+                memcpy(outCube + (k*opt->cube.nDec + j)*outLen, outs[k], outLen*sizeof(float));
+            else if(pwrite(outFd[k], outs[k], outLen*sizeof(float), j*outLen*sizeof(float)) < 0) {
+                printf("Error: Unable to write frame %d\n", j);
+                status = FAILURE;
+            }
+        }
+        stopTimer(&t, STAGE_WRITE);
+        addStageBytes(&t, STAGE_WRITE, 3.*outLen*sizeof(float));
+        stopRowTimer(&t);
+
+        /* Check some frames against the reference (not timed) */
+        if(status == SUCCESS && j % checkStride == 0) {
+            referenceComputeQUP(qIn, uIn, nRA, nChan, layout, nPhi, phiAxisD,
+                                cube->lambda2, lambda20, NULL, qRef, uRef, pRef);
+            err = compareFrame(qOut, uOut, pOut, qRef, uRef, pRef, outLen);
+            if(err > maxErr) maxErr = err;
+        }
+    }
+    stopTotalTimer(&t);
+
+    seconds = t.stageTime[STAGE_READ] + t.stageTime[STAGE_H2D] +
+              t.stageTime[STAGE_COMPUTE] + t.stageTime[STAGE_D2H] +
+              t.stageTime[STAGE_WRITE];
+    rate = seconds > 0. ? (double)nRA*opt->cube.nDec*nChan*nPhi/seconds : 0.;
+    if(status == SUCCESS) {
+        printf("%-5s %-11s %-5s %10.4f %10.4f %10.4f %10.4f %10.4f %12.4e %10.2e %s\n",
+               backendName(backend), variantName(variant), layoutNames[layout],
+               t.stageTime[STAGE_READ], t.stageTime[STAGE_H2D],
+               t.stageTime[STAGE_COMPUTE], t.stageTime[STAGE_D2H],
+               t.stageTime[STAGE_WRITE], rate, maxErr,
+               maxErr <= opt->tolerance ? "PASS" : "FAIL");
+        if(json != NULL) {
+            fprintf(json, "{\"version\": \"%s\", \"backend\": \"%s\", \"kernel\": \"%s\", "
+                    "\"layout\": \"%s\", \"storage\": \"%s\", \"nRA\": %ld, \"nDec\": %d, "
+                    "\"nChan\": %ld, \"nPhi\": %ld, \"threads\": %d, "
+                    "\"read\": %.6f, \"h2d\": %.6f, \"compute\": %.6f, \"d2h\": %.6f, "
+                    "\"write\": %.6f, \"GFLOPs\": %.6f, \"losChanPhiPerSec\": %.6e, "
+                    "\"maxRelErr\": %.6e, \"pass\": %s}\n",
+                    VERSION_STR, backendName(backend), variantName(variant),
+                    layoutNames[layout], opt->storage == STORE_MEM ? "mem" : "tmpfs",
+                    nRA, opt->cube.nDec, nChan, nPhi, engine.nThreads,
+                    t.stageTime[STAGE_READ], t.stageTime[STAGE_H2D],
+                    t.stageTime[STAGE_COMPUTE], t.stageTime[STAGE_D2H],
+                    t.stageTime[STAGE_WRITE],
+                    t.stageTime[STAGE_COMPUTE] > 0. ? t.flops/t.stageTime[STAGE_COMPUTE]/GIGA : 0.,
+                    rate, maxErr, maxErr <= opt->tolerance ? "true" : "false");
+        }
+        if(maxErr > opt->tolerance) status = FAILURE;
+    }
+
+    for(k=0; k<3; k++) {
+        if(outFd[k] >= 0) { close(outFd[k]); unlink(outName[k]); }
+    }
+    free(qIn); free(uIn); free(qOut); free(uOut); free(pOut);
+    free(quIn); free(quOut);
+    free(qRef); free(uRef); free(pRef); free(outCube);
+    freeEngine(&engine);
+    return(status);
+}
+
+/*************************************************************
+*
+* Main code
+*
+*************************************************************/
+int main(int argc, char *argv[]) {
+    struct benchOptions opt;
+    struct synthCube cube;
+    struct benchStore store;
+    float *phiAxis;
+    double *phiAxisD, lambda20 = 0.;
+    int i, backend, variant, layout, nFailed = 0;
+    FILE *json = NULL;
+
+    printf("\nRM Synthesis benchmark v%s\n", VERSION_STR);
+    if(parseBenchOptions(argc, argv, &opt)) { return(FAILURE); }
+
+    /* Regression suite on small built-in cubes */
+    if(opt.verify) {
+        nFailed = runVerifySuite(opt.backend, opt.variant, opt.nThreads);
+        if(nFailed) {
+            printf("ERROR: %d check(s) failed\n\n", nFailed);
+            return(FAILURE);
+        }
+        printf("INFO: All checks passed\n\n");
+        return(SUCCESS);
+    }
+
+    printf("INFO: Generating %d x %d x %d cube with %d thin and %d thick sources\n",
+           opt.cube.nRA, opt.cube.nDec, opt.cube.nChan, opt.cube.nThin, opt.cube.nThick);
+    if(makeSynthCube(&opt.cube, &cube)) { return(FAILURE); }
+
+    /* Uniform phi axis centred on zero and the mean lambda^2 */
+    phiAxis  = calloc(opt.nPhi, sizeof(*phiAxis));
+    phiAxisD = calloc(opt.nPhi, sizeof(*phiAxisD));
+    if(phiAxis == NULL || phiAxisD == NULL) {
+        printf("Error: Mem alloc failed\n");
+        return(FAILURE);
+    }
+    for(i=0; i<opt.nPhi; i++) {
+        phiAxisD[i] = (i - opt.nPhi/2)*opt.dPhi;
+        phiAxis[i]  = phiAxisD[i];
+    }
+    for(i=0; i<opt.cube.nChan; i++)
+        lambda20 += cube.lambda2[i]/opt.cube.nChan;
+
+    if(opt.jsonFileName != NULL) {
+        json = fopen(opt.jsonFileName, "a");
+        if(json == NULL) {
+            printf("Error: Unable to open %s\n", opt.jsonFileName);
+            return(FAILURE);
+        }
+    }
+
+    printf("INFO: Throughput in sightline-channel-phi per second\n");
+    printf("%-5s %-11s %-5s %10s %10s %10s %10s %10s %12s %10s\n", "back", "kernel",
+           "io", "read[s]", "h2d[s]", "comp[s]", "d2h[s]", "write[s]", "rate", "maxErr");
+    for(layout=0; layout<N_LAYOUTS; layout++) {
+        if(makeStore(&opt, &cube, layout, &store)) { return(FAILURE); }
+        for(backend=0; backend<N_BACKENDS; backend++) {
+            if(opt.backend >= 0 && backend != opt.backend) continue;
+            for(variant=0; variant<N_KERNELS; variant++) {
+                if(opt.variant >= 0 && variant != opt.variant) continue;
+                if(!engineHasVariant(backend, variant)) continue;
+                if(runBenchCase(&opt, &cube, &store, phiAxis, phiAxisD, lambda20,
+                                backend, variant, layout, json)) { nFailed++; }
+            }
+        }
+        freeStore(&store);
+    }
+
+    if(json != NULL) fclose(json);
+    free(phiAxis); free(phiAxisD);
+    freeSynthCube(&cube);
+    if(nFailed) {
+        printf("ERROR: %d benchmark case(s) failed\n\n", nFailed);
+        return(FAILURE);
+    }
+    printf("\n");
+    return(SUCCESS);
+}
@@ -0,0 +1,260 @@
+/******************************************************************************
+catalog.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stddef.h>
+
+#include "structures.h"
+#include "constants.h"
+#include "hdf5_hl.h"
+#include "ranks.h"
+#include "catalog.h"
+
+/* Columns of the table, in the order of struct catalogRow */
+static const char *fieldNames[CATALOG_FIELDS] = {
+    "X", "Y", "PHI", "P", "Q", "U", "SIGMA"
+};
+static const char *fieldUnits[CATALOG_FIELDS] = {
+    "", "", RM_UNIT, BUNIT, BUNIT, BUNIT, BUNIT
+};
+static const size_t fieldOffsets[CATALOG_FIELDS] = {
+    offsetof(struct catalogRow, x),   offsetof(struct catalogRow, y),
+    offsetof(struct catalogRow, phi), offsetof(struct catalogRow, p),
+    offsetof(struct catalogRow, q),   offsetof(struct catalogRow, u),
+    offsetof(struct catalogRow, sigma)
+};
+static const size_t fieldSizes[CATALOG_FIELDS] = {
+    sizeof(int), sizeof(int), sizeof(float), sizeof(float),
+    sizeof(float), sizeof(float), sizeof(float)
+};
+
+void initCatalog(struct catalog *cat, int fileFormat) {
+    memset(cat, 0, sizeof(*cat));
+    cat->fileFormat = fileFormat;
+    cat->file = -1;
+}
+
+/*************************************************************
+*
+* Create the FITS binary table, with the sky axes of the cubes
+*  in its header so that X and Y can be turned into positions
+*
+*************************************************************/
+static int createFitsCatalog(struct catalog *cat, struct fits_header_parameters *header) {
+    char *ttype[CATALOG_FIELDS], *tunit[CATALOG_FIELDS];
+    char *tform[CATALOG_FIELDS] = {"1J", "1J", "1E", "1E", "1E", "1E", "1E"};
+    int i, stat = SUCCESS;
+
+    for(i=0; i<CATALOG_FIELDS; i++) {
+        ttype[i] = (char *)fieldNames[i];
+        tunit[i] = (char *)fieldUnits[i];
+    }
+    fits_create_file(&cat->fits, cat->filename, &stat);
+    fits_create_tbl(cat->fits, BINARY_TBL, 0, CATALOG_FIELDS, ttype, tform, tunit,
+                    CATALOG_TABLE, &stat);
+    fits_write_key(cat->fits, TDOUBLE, "CRVAL1", &header->crval1, " ", &stat);
+    fits_write_key(cat->fits, TDOUBLE, "CDELT1", &header->cdelt1, " ", &stat);
+    fits_write_key(cat->fits, TDOUBLE, "CRPIX1", &header->crpix1, " ", &stat);
+    fits_write_key(cat->fits, TSTRING, "CTYPE1", header->ctype1, " ", &stat);
+    fits_write_key(cat->fits, TDOUBLE, "CRVAL2", &header->crval2, " ", &stat);
+    fits_write_key(cat->fits, TDOUBLE, "CDELT2", &header->cdelt2, " ", &stat);
+    fits_write_key(cat->fits, TDOUBLE, "CRPIX2", &header->crpix2, " ", &stat);
+    fits_write_key(cat->fits, TSTRING, "CTYPE2", header->ctype2, " ", &stat);
+    if(stat) {
+        fits_report_error(stdout, stat);
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+/* Same as an HDF5 table at /COMPONENTS, with TUNITn attributes */
+static int createHDF5Catalog(struct catalog *cat, struct fits_header_parameters *header) {
+    hid_t types[CATALOG_FIELDS];
+    char key[STRING_BUF_LEN];
+    herr_t error;
+    int i;
+
+    cat->file = H5Fcreate(cat->filename, H5F_ACC_EXCL, H5P_DEFAULT, H5P_DEFAULT);
+    if(cat->file < 0) { return(FAILURE); }
+    /* X and Y are the integer columns */
+    for(i=0; i<CATALOG_FIELDS; i++)
+        types[i] = i < 2 ? H5T_NATIVE_INT : H5T_NATIVE_FLOAT;
+    error = H5TBmake_table(CATALOG_TABLE, cat->file, CATALOG_TABLE, CATALOG_FIELDS, 0,
+                           sizeof(struct catalogRow), fieldNames, fieldOffsets, types,
+                           CATALOG_CHUNK, NULL, 0, NULL);
+    for(i=0; i<CATALOG_FIELDS; i++) {
+        sprintf(key, "TUNIT%d", i+1);
+        error |= H5LTset_attribute_string(cat->file, CATALOG_TABLE, key, fieldUnits[i]);
+    }
+    error |= H5LTset_attribute_double(cat->file, CATALOG_TABLE, "CRVAL1", &(header->crval1), 1);
+    error |= H5LTset_attribute_double(cat->file, CATALOG_TABLE, "CRVAL2", &(header->crval2), 1);
+    error |= H5LTset_attribute_double(cat->file, CATALOG_TABLE, "CRPIX1", &(header->crpix1), 1);
+    error |= H5LTset_attribute_double(cat->file, CATALOG_TABLE, "CRPIX2", &(header->crpix2), 1);
+    error |= H5LTset_attribute_double(cat->file, CATALOG_TABLE, "CDELT1", &(header->cdelt1), 1);
+    error |= H5LTset_attribute_double(cat->file, CATALOG_TABLE, "CDELT2", &(header->cdelt2), 1);
+    error |= H5LTset_attribute_string(cat->file, CATALOG_TABLE, "CTYPE1", header->ctype1);
+    error |= H5LTset_attribute_string(cat->file, CATALOG_TABLE, "CTYPE2", header->ctype2);
+    return(error < 0 ? FAILURE : SUCCESS);
+}
+
+/*************************************************************
+*
+* Create the catalog of an output set. Called on rank 0 only,
+*  where the output cubes are created.
+*
+*************************************************************/
+int createCatalog(struct optionsList *inOptions, struct catalog *cat,
+                  struct fits_header_parameters *header) {
+    sprintf(cat->filename, "%s%s.%s", inOptions->outPrefix, CATALOG_NAME,
+            cat->fileFormat == FITS ? "fits" : "h5");
+    if(cat->fileFormat == FITS) { return(createFitsCatalog(cat, header)); }
+    if(createHDF5Catalog(cat, header)) {
+        printf("Error: Unable to create %s\n", cat->filename);
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+/* Write n rows after the last, a column at a time */
+static int writeFitsRows(struct catalog *cat, const struct catalogRow *rows, long n) {
+    float *column;
+    int *pixel;
+    long i;
+    int k, stat = SUCCESS;
+
+    column = malloc(n*sizeof(*column));
+    pixel = malloc(n*sizeof(*pixel));
+    if(column == NULL || pixel == NULL) {
+        free(column); free(pixel);
+        return(FAILURE);
+    }
+    for(i=0; i<n; i++) pixel[i] = rows[i].x;
+    fits_write_col(cat->fits, TINT, 1, cat->nRows+1, 1, n, pixel, &stat);
+    for(i=0; i<n; i++) pixel[i] = rows[i].y;
+    fits_write_col(cat->fits, TINT, 2, cat->nRows+1, 1, n, pixel, &stat);
+    for(k=2; k<CATALOG_FIELDS; k++) {
+        for(i=0; i<n; i++)
+            column[i] = *(const float *)((const char *)(rows + i) + fieldOffsets[k]);
+        fits_write_col(cat->fits, TFLOAT, k+1, cat->nRows+1, 1, n, column, &stat);
+    }
+    free(column); free(pixel);
+    if(stat) {
+        fits_report_error(stdout, stat);
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Hold the components of a chunk of sightlines, starting at
+*  los0 of row (counting from 0), until writeCatalog()
+*
+*************************************************************/
+int addComponents(struct catalog *cat, int row, long los0,
+                  const struct rmsComponent *components, long nComponents) {
+    struct catalogRow *grown;
+    long i;
+
+    if(cat->nPending + nComponents > cat->maxRows) {
+        grown = realloc(cat->rows, (cat->nPending + nComponents)*sizeof(*grown));
+        if(grown == NULL) {
+            printf("\nError: Mem alloc failed while listing components\n\n");
+            return(FAILURE);
+        }
+        cat->rows = grown;
+        cat->maxRows = cat->nPending + nComponents;
+    }
+    for(i=0; i<nComponents; i++) {
+        grown = cat->rows + cat->nPending + i;
+        grown->x     = los0 + components[i].los + 1;
+        grown->y     = row + 1;
+        grown->phi   = components[i].phi;
+        grown->p     = components[i].p;
+        grown->q     = components[i].q;
+        grown->u     = components[i].u;
+        grown->sigma = components[i].sigma;
+    }
+    cat->nPending += nComponents;
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Write the components held since the last call. Every rank
+*  calls this at every step, holding none if it has nothing to
+*  add, so that rank 0 can gather the rows of all ranks. Only
+*  the components are written, so the cost follows the number
+*  of detections rather than the size of the cubes.
+*
+*************************************************************/
+int writeCatalog(struct catalog *cat) {
+    const struct rankInfo *ranks = getRanks();
+    long nAll;
+    int status;
+
+    status = gatherRecords(cat->rows, cat->nPending, sizeof(*cat->rows),
+                           (void **)&cat->all, &cat->maxAll, &nAll);
+    cat->nPending = 0;
+    if(status) {
+        printf("\nError: Unable to gather the catalog\n\n");
+        return(FAILURE);
+    }
+    if(ranks->rank != 0 || nAll == 0) { return(SUCCESS); }
+    if(cat->fileFormat == FITS) {
+        if(writeFitsRows(cat, cat->all, nAll)) { return(FAILURE); }
+    }
+    else if(H5TBappend_records(cat->file, CATALOG_TABLE, nAll, sizeof(*cat->all),
+                               fieldOffsets, fieldSizes, cat->all) < 0) {
+        printf("\nError: Unable to write to %s\n\n", cat->filename);
+        return(FAILURE);
+    }
+    cat->nRows += nAll;
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Close the catalog and release its buffers. Safe to call more
+*  than once, and on ranks that never opened it.
+*
+*************************************************************/
+int closeCatalog(struct catalog *cat) {
+    int stat = SUCCESS, status = SUCCESS;
+
+    if(cat->fits != NULL || cat->file >= 0)
+        printf("INFO: %ld components in %s\n", cat->nRows, cat->filename);
+    if(cat->fits != NULL) { fits_close_file(cat->fits, &stat); }
+    if(cat->file >= 0 && H5Fclose(cat->file) < 0) { status = FAILURE; }
+    if(stat) {
+        fits_report_error(stdout, stat);
+        status = FAILURE;
+    }
+    free(cat->rows); free(cat->all);
+    cat->rows = cat->all = NULL;
+    cat->nPending = cat->maxRows = cat->maxAll = 0;
+    cat->fits = NULL;
+    cat->file = -1;
+    return(status);
+}
@@ -0,0 +1,70 @@
+/******************************************************************************
+catalog.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "fitsio.h"
+#include "hdf5.h"
+#include "rmsynth.h"
+
+#define CATALOG_NAME   "catalog"
+#define CATALOG_TABLE  "COMPONENTS"
+#define CATALOG_FIELDS 7
+/* Rows per chunk of the HDF5 table */
+#define CATALOG_CHUNK  4096
+
+/* A row of the catalog. x and y are the pixel of the sightline,
+   counting from 1, with x along the sightlines of a frame and y
+   along the frames, as in the per-sightline products. */
+struct catalogRow {
+    int x, y;
+    float phi, p, q, u, sigma;
+};
+
+/* The component catalog of an output set, written next to the
+   cubes as <outPrefix>catalog.fits (a binary table) or .h5 (an
+   HDF5 table). Only rank 0 has it open; the nPending rows held
+   by each rank are gathered there once per step. */
+struct catalog {
+    char filename[FILENAME_LEN];
+    int fileFormat;
+    fitsfile *fits;
+    hid_t file;
+    long nRows, nPending;
+    struct catalogRow *rows, *all;
+    long maxRows, maxAll;
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+
+void initCatalog(struct catalog *cat, int fileFormat);
+int createCatalog(struct optionsList *inOptions, struct catalog *cat,
+                  struct fits_header_parameters *header);
+int addComponents(struct catalog *cat, int row, long los0,
+                  const struct rmsComponent *components, long nComponents);
+int writeCatalog(struct catalog *cat);
+int closeCatalog(struct catalog *cat);
+
+#endif
@@ -36,12 +36,20 @@ extern "C"
 #define Z_DIM  2
 
 #define NUM_INPUTS 2
+#define NUM_OUTPUTS 3
 
 #define ZERO 0
 
 #define SUCCESS 0
 #define FAILURE 1
 
+#ifndef TRUE
+#define TRUE  1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
 #define FILENAME_LEN        256
 #define STRING_BUF_LEN      256
 #define DEFAULT_OUT_PREFIX  "output_"
@@ -53,20 +61,141 @@ extern "C"
 #define FILE_READWRITE      "w"
 #define CTYPE_LEN           10
 
+#define BUNIT          "JY/BEAM"
+#define RM             "PHI"
+#define RM_UNIT        "rad/m/m"
+
 #define FITS_OUT_NAXIS 3
 #define RA_AXIS        0
 #define DEC_AXIS       1
 #define PHI_AXIS       2
 
+/* Axis order of the FITS output cubes. PHI_FIRST is the order the
+   kernels produce; SKY is (RA, DEC, phi), as image viewers expect */
+#define ORDER_PHI_FIRST 0
+#define ORDER_SKY       1
+/* What a job writes: the Q, U and P(phi) cubes, a catalog of
+   significant peaks of P(phi), or both */
+#define OUTPUT_CUBES   0
+#define OUTPUT_CATALOG 1
+#define OUTPUT_BOTH    2
+/* Host memory (MB) for the rows held back for sky ordered output */
+#define DEFAULT_TILE_MEMORY 256
+/* Threads, each with its own file descriptors, reading FITS cubes */
+#define DEFAULT_READ_THREADS 1
+/* Side of the square blocks used by the host side transposes */
+#define TRANSPOSE_BLOCK     64
+/* Share of the free device memory the memory planner may use */
+#define DEVICE_MEMORY_FRACTION 0.9
+
 #define LIGHTSPEED 299792458.
 #define KILO       1000.
 #define MEGA       1000000.
+#define GIGA       1000000000.
 #define SEC_PER_MIN 60
 #define SEC_PER_HOUR 3600
 
 #define FITS 0
 #define HDF5 1
 
+/* What the input files hold: Q and U cubes, or tables of one
+   spectrum per row (an HDF5 dataset of nRows x nChan, or a vector
+   column of a FITS binary table). A table is synthesized as a
+   single frame of nRows sightlines. */
+#define INPUT_CUBE  0
+#define INPUT_TABLE 1
+#define DEFAULT_Q_COLUMN "Q"
+#define DEFAULT_U_COLUMN "U"
+#define TABLE_CTYPE      "ROW"
+
+/* Synthesis backends and kernel variants */
+#define BACKEND_CPU       0
+#define BACKEND_CUDA      1
+#define N_BACKENDS        2
+#define KERNEL_DIRECT     0
+#define KERNEL_RECURRENCE 1
+#define N_KERNELS         2
+/* Recompute the recurrence phasors exactly every so many phi planes */
+#define RECURRENCE_RESEED 64
+
+/* Memory layout of a frame of sightlines. FITS input is rotated
+   so that frequency varies fastest; HDF5 input is not. */
+#define LAYOUT_FREQ_FIRST 0
+#define LAYOUT_LOS_FIRST  1
+/* Largest gridDim.y; computeQUP_hdf5 puts sightlines on this axis */
+#define MAX_GRID_Y        65535
+/* Largest frame the kernels address; they index with int */
+#define MAX_FRAME_ELEMENTS 2147483647L
+
+/* Stages tracked by the timers */
+#define STAGE_SETUP    0
+#define STAGE_READ     1
+#define STAGE_H2D      2
+#define STAGE_COMPUTE  3
+#define STAGE_D2H      4
+#define STAGE_WRITE    5
+#define N_TIMER_STAGES 6
+#define N_HIST_BINS    32
+#define TIMING_JSON    "timing.json"
+
+/* Operations per (LOS, channel, phi) term in the kernels: the
+   phase, two weight multiplies and four multiply-adds. sinf/cosf
+   are not counted. */
+#define FLOPS_PER_TERM 11
+
+/* Where the list of channel frequencies comes from */
+#define FREQ_TEXT   0
+#define FREQ_BINARY 1
+#define FREQ_HDF5   2
+#define FREQ_WCS    3
+#define DEFAULT_FREQ_DATASET "/FREQUENCY"
+
+/* Where Stokes I for fractional polarization comes from: a cube
+   shaped like Q and U, or a map of I at a reference frequency
+   and of the spectral index */
+#define STOKES_I_NONE  0
+#define STOKES_I_CUBE  1
+#define STOKES_I_MODEL 2
+#define N_MODEL_PLANES 2
+
+/* Most samples in a peak refinement window */
+#define MAX_REFINE_SAMPLES 1001
+
+/* Steps per dPhi of the RMSF table used to subtract peaks */
+#define RMSF_OVERSAMPLE 16
+/* Golden section steps of the phi of a peak, 0.618^n dPhi */
+#define PEAK_FIT_STEPS  40
+/* Sources cleaned before the noise of a sightline is measured:
+   at most NOISE_CLEAN_MAX, while they reach NOISE_CLEAN_SNR
+   times the noise of what is left */
+#define NOISE_CLEAN_MAX 5
+#define NOISE_CLEAN_SNR 5.
+/* Times the sources of a sightline are fitted again together */
+#define CLEAN_PASSES    3
+
+/* Standard deviation of a normal distribution over its median
+   absolute deviation */
+#define MAD_TO_SIGMA 1.4826
+
+/* Models fitted to the Q and U spectra: a Faraday thin source
+   (p0, psi0, phi) or a Burn slab (p0, psi0, phi, width) */
+#define FIT_NONE        0
+#define FIT_THIN        1
+#define FIT_THICK       2
+#define FIT_MAX_PARAMS  4
+#define DEFAULT_FIT_ITERATIONS 50
+/* Levenberg-Marquardt damping at the start, and its bounds */
+#define FIT_LAMBDA_START 1e-3
+#define FIT_LAMBDA_MAX   1e10
+/* Relative chi^2 improvement below which a fit has converged */
+#define FIT_TOLERANCE    1e-6
+
+/* How the reference wavelength \lambda^2_0 is chosen */
+#define LAMBDA20_MEDIAN   0
+#define LAMBDA20_WEIGHTED 1
+#define LAMBDA20_USER     2
+#define FILE_READBINARY "rb"
+
 #define ROOT "/"
 #define CLASS "CLASS"
 #define PRIMARY "/PRIMARY"
@@ -0,0 +1,527 @@
+/******************************************************************************
+cpusynth.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<pthread.h>
+
+#include "constants.h"
+#include "engine.h"
+#include "cpusynth.h"
+
+/* Work given to each CPU thread: a contiguous range of sightlines,
+   or of points for a sparse evaluation. Q and U are interleaved,
+   so both come from one cache line. */
+struct cpuSynthJob {
+    struct synthEngine *engine;
+    const float *quImageArray;
+    long nLOS, losStart, losStop;
+    float *quPhi, *pPhi;
+    const int *losIndex;        /* Sparse points, NULL for a frame */
+    const float *phi;
+    int model, maxIter;         /* QU-fitting, model FIT_NONE otherwise */
+    float *params, *errors, *chi2;
+    int status;
+};
+
+/*************************************************************
+*
+* Index of channel or phi plane i of sightline los in a frame
+*
+*************************************************************/
+static long frameIndex(int layout, long los, long i, long nLOS, long len) {
+    if(layout == LAYOUT_LOS_FIRST) return(los + i*nLOS);
+    return(los*len + i);
+}
+
+/* Factor applied to Q and U of element idx: 1/I with a Stokes I
+   frame, 0 where I is not positive or not a number */
+static float stokesScale(const float *iIn, long idx) {
+    if(iIn == NULL) return(1.0);
+    return(iIn[idx] > 0.0 ? 1.0/iIn[idx] : 0.0);
+}
+
+/*************************************************************
+*
+* Direct sum. Same arithmetic as computeQUP_fits/_hdf5.
+*
+*************************************************************/
+static void cpuDirect(struct cpuSynthJob *job) {
+    struct synthEngine *e = job->engine;
+    long los, readIdx, writeIdx;
+    int i, p;
+    float myphi, sinVal, cosVal, qIn, uIn, scale;
+    float qPhi, uPhi;
+    const float *quIn = job->quImageArray;
+
+    for(los=job->losStart; los<job->losStop; los++) {
+        for(p=0; p<e->nPhi; p++) {
+            myphi = e->phiAxis[p];
+            qPhi = 0.0; uPhi = 0.0;
+            for(i=0; i<e->nChan; i++) {
+                readIdx = frameIndex(e->layout, los, i, job->nLOS, e->nChan);
+                sinVal = e->weights[i]*sinf(myphi*e->lambdaDiff2[i]);
+                cosVal = e->weights[i]*cosf(myphi*e->lambdaDiff2[i]);
+                scale = stokesScale(e->iFrame, readIdx);
+                qIn = scale*quIn[2*readIdx];
+                uIn = scale*quIn[2*readIdx+1];
+                qPhi += qIn*cosVal + uIn*sinVal;
+                uPhi += uIn*cosVal - qIn*sinVal;
+            }
+            writeIdx = frameIndex(e->layout, los, p, job->nLOS, e->nPhi);
+            job->quPhi[2*writeIdx]   = e->K*qPhi;
+            job->quPhi[2*writeIdx+1] = e->K*uPhi;
+            job->pPhi[writeIdx] = e->K*sqrtf(qPhi*qPhi + uPhi*uPhi);
+        }
+    }
+}
+
+/*************************************************************
+*
+* Recurrence. Each channel keeps the phasor w(q+iu)exp(-i phi d)
+*  and steps it to the next phi plane with one complex multiply
+*  instead of a sinf/cosf pair. The phasors are recomputed
+*  exactly every RECURRENCE_RESEED planes to bound the drift.
+*
+*************************************************************/
+static void cpuRecurrence(struct cpuSynthJob *job) {
+    struct synthEngine *e = job->engine;
+    long los, readIdx, writeIdx;
+    int i, p;
+    float *zr, *zi;
+    float arg, qIn, uIn, re, im, qPhi, uPhi, scale;
+    const float *quIn = job->quImageArray;
+
+    zr = malloc(e->nChan*sizeof(*zr));
+    zi = malloc(e->nChan*sizeof(*zi));
+    if(zr == NULL || zi == NULL) {
+        free(zr); free(zi);
+        job->status = FAILURE;
+        return;
+    }
+
+    for(los=job->losStart; los<job->losStop; los++) {
+        for(p=0; p<e->nPhi; p++) {
+            if(p % RECURRENCE_RESEED == 0) {
+                for(i=0; i<e->nChan; i++) {
+                    readIdx = frameIndex(e->layout, los, i, job->nLOS, e->nChan);
+                    scale = e->weights[i]*stokesScale(e->iFrame, readIdx);
+                    qIn = scale*quIn[2*readIdx];
+                    uIn = scale*quIn[2*readIdx+1];
+                    arg = e->phiAxis[p]*e->lambdaDiff2[i];
+                    zr[i] = qIn*cosf(arg) + uIn*sinf(arg);
+                    zi[i] = uIn*cosf(arg) - qIn*sinf(arg);
+                }
+            }
+            qPhi = 0.0; uPhi = 0.0;
+            for(i=0; i<e->nChan; i++) {
+                qPhi += zr[i];
+                uPhi += zi[i];
+                re = zr[i]*e->stepCos[i] + zi[i]*e->stepSin[i];
+                im = zi[i]*e->stepCos[i] - zr[i]*e->stepSin[i];
+                zr[i] = re; zi[i] = im;
+            }
+            writeIdx = frameIndex(e->layout, los, p, job->nLOS, e->nPhi);
+            job->quPhi[2*writeIdx]   = e->K*qPhi;
+            job->quPhi[2*writeIdx+1] = e->K*uPhi;
+            job->pPhi[writeIdx] = e->K*sqrtf(qPhi*qPhi + uPhi*uPhi);
+        }
+    }
+    free(zr); free(zi);
+}
+
+/*************************************************************
+*
+* Sparse evaluation. Point n is sightline losIndex[n] at
+*  phi[n]; the arithmetic is that of cpuDirect().
+*
+*************************************************************/
+static void cpuSparse(struct cpuSynthJob *job) {
+    struct synthEngine *e = job->engine;
+    long n, readIdx;
+    int i;
+    float myphi, sinVal, cosVal, qIn, uIn, scale;
+    float qPhi, uPhi;
+    const float *quIn = job->quImageArray;
+
+    for(n=job->losStart; n<job->losStop; n++) {
+        myphi = job->phi[n];
+        qPhi = 0.0; uPhi = 0.0;
+        for(i=0; i<e->nChan; i++) {
+            readIdx = frameIndex(e->layout, job->losIndex[n], i, job->nLOS, e->nChan);
+            sinVal = e->weights[i]*sinf(myphi*e->lambdaDiff2[i]);
+            cosVal = e->weights[i]*cosf(myphi*e->lambdaDiff2[i]);
+            scale = stokesScale(e->iFrame, readIdx);
+            qIn = scale*quIn[2*readIdx];
+            uIn = scale*quIn[2*readIdx+1];
+            qPhi += qIn*cosVal + uIn*sinVal;
+            uPhi += uIn*cosVal - qIn*sinVal;
+        }
+        job->quPhi[2*n]   = e->K*qPhi;
+        job->quPhi[2*n+1] = e->K*uPhi;
+        job->pPhi[n] = e->K*sqrtf(qPhi*qPhi + uPhi*uPhi);
+    }
+}
+
+/*************************************************************
+*
+* Model of a fit at channel i: Q and U of a thin source of
+*  amplitude a[0], angle a[1] at lambda^2_0 and depth a[2], damped
+*  for a Burn slab by sinc(a[3] lambda^2). J receives the
+*  derivatives of Q and U with respect to each parameter.
+*
+*************************************************************/
+static void fitModel(const struct synthEngine *e, int model, const double *a,
+                     int i, double *q, double *u, double J[2][FIT_MAX_PARAMS]) {
+    double x = e->lambdaDiff2[i];
+    double lambda2 = 0.5*x + e->lambda20;
+    double arg, s = 1.0, ds = 0.0, amp, c, sn;
+
+    if(model == FIT_THICK) {
+        arg = a[3]*lambda2;
+        if(fabs(arg) < 1e-4) { s = 1.0 - arg*arg/6.0; ds = -arg/3.0; }
+        else {
+            s = sin(arg)/arg;
+            ds = (arg*cos(arg) - sin(arg))/(arg*arg);
+        }
+    }
+    amp = a[0]*s;
+    c  = cos(2.0*a[1] + a[2]*x);
+    sn = sin(2.0*a[1] + a[2]*x);
+    *q = amp*c; *u = amp*sn;
+    if(J == NULL) return;
+    J[0][0] = s*c;          J[1][0] = s*sn;
+    J[0][1] = -2.0*amp*sn;  J[1][1] = 2.0*amp*c;
+    J[0][2] = -x*amp*sn;    J[1][2] = x*amp*c;
+    if(model == FIT_THICK) {
+        J[0][3] = a[0]*lambda2*ds*c;
+        J[1][3] = a[0]*lambda2*ds*sn;
+    }
+}
+
+/*************************************************************
+*
+* Weighted chi^2 of parameters a for sightline los. With A and g
+*  it also accumulates the normal equations J^T W J and J^T W r.
+*  Channels with no weight, no Stokes I or no data are skipped;
+*  their number is left in nObs.
+*
+*************************************************************/
+static double fitChi2(const struct cpuSynthJob *job, long los, const double *a,
+                      int nPar, double *A, double *g, int *nObs) {
+    const struct synthEngine *e = job->engine;
+    double J[2][FIT_MAX_PARAMS], q, u, rq, ru, w, chi2 = 0.0;
+    long readIdx;
+    float scale, qIn, uIn;
+    int i, j, k;
+
+    if(A != NULL) {
+        for(j=0; j<nPar*nPar; j++) A[j] = 0.0;
+        for(j=0; j<nPar; j++) g[j] = 0.0;
+    }
+    *nObs = 0;
+    for(i=0; i<e->nChan; i++) {
+        readIdx = frameIndex(e->layout, los, i, job->nLOS, e->nChan);
+        scale = stokesScale(e->iFrame, readIdx);
+        qIn = scale*job->quImageArray[2*readIdx];
+        uIn = scale*job->quImageArray[2*readIdx+1];
+        w = e->weights[i];
+        if(w <= 0.0 || scale == 0.0 || isnan(qIn) || isnan(uIn)) continue;
+        fitModel(e, job->model, a, i, &q, &u, A != NULL ? J : NULL);
+        rq = qIn - q; ru = uIn - u;
+        chi2 += w*(rq*rq + ru*ru);
+        *nObs += 2;
+        if(A == NULL) continue;
+        for(j=0; j<nPar; j++) {
+            g[j] += w*(J[0][j]*rq + J[1][j]*ru);
+            for(k=0; k<=j; k++)
+                A[j*nPar+k] += w*(J[0][j]*J[0][k] + J[1][j]*J[1][k]);
+        }
+    }
+    if(A != NULL)
+        for(j=0; j<nPar; j++)
+            for(k=j+1; k<nPar; k++) A[j*nPar+k] = A[k*nPar+j];
+    return(chi2);
+}
+
+/*************************************************************
+*
+* Channel noise of sightline los for unit weight, taking the
+*  weights as relative inverse variances: the mean square of the
+*  differences of the residuals of fit a between neighbouring
+*  channels used by fitChi2(), each over the sum of the two
+*  channel variances. Differencing removes what the model misses
+*  on scales wider than a channel, so the reduced chi^2 against
+*  it shows that misfit rather than absorbing it.
+*
+*************************************************************/
+static double fitNoise(const struct cpuSynthJob *job, long los, const double *a) {
+    const struct synthEngine *e = job->engine;
+    double q, u, rq, ru, w, prevQ = 0.0, prevU = 0.0, prevW = 0.0, sum = 0.0;
+    long readIdx;
+    float scale, qIn, uIn;
+    int i, n = 0;
+
+    for(i=0; i<e->nChan; i++) {
+        readIdx = frameIndex(e->layout, los, i, job->nLOS, e->nChan);
+        scale = stokesScale(e->iFrame, readIdx);
+        qIn = scale*job->quImageArray[2*readIdx];
+        uIn = scale*job->quImageArray[2*readIdx+1];
+        w = e->weights[i];
+        if(w <= 0.0 || scale == 0.0 || isnan(qIn) || isnan(uIn)) continue;
+        fitModel(e, job->model, a, i, &q, &u, NULL);
+        rq = qIn - q; ru = uIn - u;
+        if(prevW > 0.0) {
+            sum += ((rq-prevQ)*(rq-prevQ) + (ru-prevU)*(ru-prevU))/(1.0/w + 1.0/prevW);
+            n += 2;
+        }
+        prevQ = rq; prevU = ru; prevW = w;
+    }
+    return(n > 0 ? sum/n : NAN);
+}
+
+/* Solve M x = b for n unknowns by Gaussian elimination with partial
+   pivoting. M and b are overwritten. */
+static int fitSolve(double *M, double *b, double *x, int n) {
+    int r, c, k, pivot;
+    double f, t;
+
+    for(c=0; c<n; c++) {
+        pivot = c;
+        for(r=c+1; r<n; r++)
+            if(fabs(M[r*n+c]) > fabs(M[pivot*n+c])) pivot = r;
+        if(!(fabs(M[pivot*n+c]) > 0.0)) return(FAILURE);
+        if(pivot != c) {
+            for(k=0; k<n; k++) {
+                t = M[c*n+k]; M[c*n+k] = M[pivot*n+k]; M[pivot*n+k] = t;
+            }
+            t = b[c]; b[c] = b[pivot]; b[pivot] = t;
+        }
+        for(r=c+1; r<n; r++) {
+            f = M[r*n+c]/M[c*n+c];
+            for(k=c; k<n; k++) M[r*n+k] -= f*M[c*n+k];
+            b[r] -= f*b[c];
+        }
+    }
+    for(r=n-1; r>=0; r--) {
+        x[r] = b[r];
+        for(k=r+1; k<n; k++) x[r] -= M[r*n+k]*x[k];
+        x[r] /= M[r*n+r];
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Levenberg-Marquardt fit of job->model to each sightline,
+*  starting from job->params. Same arithmetic as fitQU in
+*  kernels.cu.
+*
+*************************************************************/
+static void cpuFit(struct cpuSynthJob *job) {
+    const int nPar = fitParameters(job->model);
+    double a[FIT_MAX_PARAMS], trial[FIT_MAX_PARAMS], delta[FIT_MAX_PARAMS];
+    double A[FIT_MAX_PARAMS*FIT_MAX_PARAMS], g[FIT_MAX_PARAMS];
+    double M[FIT_MAX_PARAMS*FIT_MAX_PARAMS], b[FIT_MAX_PARAMS];
+    double chi2, chi2Trial, lambda, dof;
+    int j, k, iter, nObs, valid;
+    long los, n = job->nLOS;
+
+    for(los=job->losStart; los<job->losStop; los++) {
+        valid = 1;
+        for(j=0; j<nPar; j++) {
+            a[j] = job->params[j*n+los];
+            if(isnan(a[j])) valid = 0;
+        }
+        chi2 = fitChi2(job, los, a, nPar, A, g, &nObs);
+        dof = nObs - nPar;
+        if(!valid || dof <= 0) {
+            for(j=0; j<nPar; j++)
+                job->params[j*n+los] = job->errors[j*n+los] = NAN;
+            job->chi2[los] = NAN;
+            continue;
+        }
+        lambda = FIT_LAMBDA_START;
+        for(iter=0; iter<job->maxIter && lambda<FIT_LAMBDA_MAX; iter++) {
+            for(j=0; j<nPar*nPar; j++) M[j] = A[j];
+            for(j=0; j<nPar; j++) {
+                M[j*nPar+j] *= 1.0 + lambda;
+                b[j] = g[j];
+            }
+            if(fitSolve(M, b, delta, nPar) != SUCCESS) { lambda *= 10.0; continue; }
+            for(j=0; j<nPar; j++) trial[j] = a[j] + delta[j];
+            chi2Trial = fitChi2(job, los, trial, nPar, NULL, NULL, &nObs);
+            if(!(chi2Trial < chi2)) { lambda *= 10.0; continue; }
+            for(j=0; j<nPar; j++) a[j] = trial[j];
+            if(chi2 - chi2Trial < FIT_TOLERANCE*chi2) { chi2 = chi2Trial; break; }
+            chi2 = fitChi2(job, los, a, nPar, A, g, &nObs);
+            lambda /= 10.0;
+        }
+
+        /* Uncertainties from the inverse of the curvature at the
+           solution, scaled by the scatter of the residuals */
+        fitChi2(job, los, a, nPar, A, g, &nObs);
+        for(j=0; j<nPar; j++) {
+            for(k=0; k<nPar*nPar; k++) M[k] = A[k];
+            for(k=0; k<nPar; k++) b[k] = k == j ? 1.0 : 0.0;
+            if(fitSolve(M, b, delta, nPar) != SUCCESS || delta[j] < 0.0)
+                job->errors[j*n+los] = NAN;
+            else job->errors[j*n+los] = sqrt(delta[j]*chi2/dof);
+        }
+
+        /* Positive amplitude, angle in (-pi/2, pi/2], positive width */
+        if(a[0] < 0.0) { a[0] = -a[0]; a[1] += 0.5*M_PI; }
+        a[1] = fmod(a[1], M_PI);
+        if(a[1] <= -0.5*M_PI) a[1] += M_PI;
+        if(a[1] > 0.5*M_PI) a[1] -= M_PI;
+        if(nPar > 3) a[3] = fabs(a[3]);
+        for(j=0; j<nPar; j++) job->params[j*n+los] = a[j];
+        job->chi2[los] = chi2/(dof*fitNoise(job, los, a));
+    }
+}
+
+static void *cpuSynthWorker(void *arg) {
+    struct cpuSynthJob *job = (struct cpuSynthJob *)arg;
+
+    job->status = SUCCESS;
+    if(job->model != FIT_NONE) cpuFit(job);
+    else if(job->losIndex != NULL) cpuSparse(job);
+    else if(job->engine->variant == KERNEL_RECURRENCE) cpuRecurrence(job);
+    else cpuDirect(job);
+    return(NULL);
+}
+
+/*************************************************************
+*
+* Split nItems (sightlines or points) of proto over
+*  engine->nThreads CPU threads and run them
+*
+*************************************************************/
+static int runCpuJobs(struct cpuSynthJob *proto, long nItems) {
+    struct cpuSynthJob *jobs;
+    pthread_t *threads;
+    int i, nThreads, status = SUCCESS;
+    long perThread;
+
+    nThreads = proto->engine->nThreads;
+    if(nThreads > nItems) nThreads = nItems;
+    if(nThreads < 1) nThreads = 1;
+    jobs    = calloc(nThreads, sizeof(*jobs));
+    threads = calloc(nThreads, sizeof(*threads));
+    if(jobs == NULL || threads == NULL) {
+        free(jobs); free(threads);
+        return(FAILURE);
+    }
+
+    perThread = (nItems + nThreads - 1)/nThreads;
+    for(i=0; i<nThreads; i++) {
+        jobs[i] = *proto;
+        jobs[i].losStart = i*perThread;
+        jobs[i].losStop  = (i+1)*perThread < nItems ? (i+1)*perThread : nItems;
+    }
+    /* Thread 0 is the caller */
+    for(i=1; i<nThreads; i++)
+        pthread_create(&threads[i], NULL, cpuSynthWorker, &jobs[i]);
+    cpuSynthWorker(&jobs[0]);
+    for(i=1; i<nThreads; i++)
+        pthread_join(threads[i], NULL);
+    for(i=0; i<nThreads; i++)
+        if(jobs[i].status != SUCCESS) status = FAILURE;
+
+    free(jobs); free(threads);
+    return(status);
+}
+
+/*************************************************************
+*
+* Compute Q(\phi)+iU(\phi) and P(\phi) for a frame of nLOS
+*  sightlines of interleaved Q and U on engine->nThreads CPU
+*  threads
+*
+*************************************************************/
+int cpuComputeQUP(struct synthEngine *engine, const float *quImageArray,
+                  long nLOS, float *quPhi, float *pPhi) {
+    struct cpuSynthJob proto = {0};
+    int status;
+
+    if(engine->t != NULL) startTimer(engine->t, STAGE_COMPUTE);
+    proto.engine = engine;
+    proto.quImageArray = quImageArray;
+    proto.nLOS = nLOS;
+    proto.quPhi = quPhi; proto.pPhi = pPhi;
+    status = runCpuJobs(&proto, nLOS);
+    if(engine->t != NULL) {
+        stopTimer(engine->t, STAGE_COMPUTE);
+        addFlops(engine->t, (double)FLOPS_PER_TERM*nLOS*engine->nChan*engine->nPhi);
+    }
+    return(status);
+}
+
+/*************************************************************
+*
+* Same for nPoints (sightline, phi) points of a frame. See
+*  runEngineSparse().
+*
+*************************************************************/
+int cpuSparseQUP(struct synthEngine *engine, const float *quImageArray,
+                 long nLOS, long nPoints, const int *losIndex,
+                 const float *phi, float *quOut, float *pOut) {
+    struct cpuSynthJob proto = {0};
+    int status;
+
+    if(engine->t != NULL) startTimer(engine->t, STAGE_COMPUTE);
+    proto.engine = engine;
+    proto.quImageArray = quImageArray;
+    proto.nLOS = nLOS;
+    proto.quPhi = quOut; proto.pPhi = pOut;
+    proto.losIndex = losIndex; proto.phi = phi;
+    status = runCpuJobs(&proto, nPoints);
+    if(engine->t != NULL) {
+        stopTimer(engine->t, STAGE_COMPUTE);
+        addFlops(engine->t, (double)FLOPS_PER_TERM*nPoints*engine->nChan);
+    }
+    return(status);
+}
+
+/*************************************************************
+*
+* Fit a model to the Q and U spectra of nLOS sightlines. See
+*  runEngineFit().
+*
+*************************************************************/
+int cpuFitQU(struct synthEngine *engine, const float *quImageArray,
+             long nLOS, int model, int maxIter, float *params,
+             float *errors, float *chi2) {
+    struct cpuSynthJob proto = {0};
+    int status;
+
+    if(engine->t != NULL) startTimer(engine->t, STAGE_COMPUTE);
+    proto.engine = engine;
+    proto.quImageArray = quImageArray;
+    proto.nLOS = nLOS;
+    proto.model = model; proto.maxIter = maxIter;
+    proto.params = params; proto.errors = errors; proto.chi2 = chi2;
+    status = runCpuJobs(&proto, nLOS);
+    if(engine->t != NULL) stopTimer(engine->t, STAGE_COMPUTE);
+    return(status);
+}
@@ -0,0 +1,43 @@
+/******************************************************************************
+cpusynth.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef CPUSYNTH_H
+#define CPUSYNTH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int cpuComputeQUP(struct synthEngine *engine, const float *quImageArray,
+                  long nLOS, float *quPhi, float *pPhi);
+int cpuFitQU(struct synthEngine *engine, const float *quImageArray,
+             long nLOS, int model, int maxIter, float *params,
+             float *errors, float *chi2);
+int cpuSparseQUP(struct synthEngine *engine, const float *quImageArray,
+                 long nLOS, long nPoints, const int *losIndex,
+                 const float *phi, float *quOut, float *pOut);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,321 @@
+/******************************************************************************
+daemon.c: rmsynthd, a long running RM Synthesis server that takes
+jobs over a local Unix socket.
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<signal.h>
+#include<pthread.h>
+#include<sys/socket.h>
+#include<sys/time.h>
+#include<sys/un.h>
+
+#include "structures.h"
+#include "constants.h"
+#include "version.h"
+#include "timing.h"
+#include "devices.h"
+#include "inputparser.h"
+#include "job.h"
+
+#define DAEMON_QUEUE_LEN 64
+#define MAX_JOB_LEN      65536
+#define SHUTDOWN_CMD     "SHUTDOWN"
+/* Seconds a client may take to send its request */
+#define REQUEST_TIMEOUT  10
+
+/* A queued job: the parset text and the client waiting for it */
+struct daemonJob {
+    int client;
+    char *parset;
+};
+
+/* Bounded FIFO shared by the listener and the worker */
+struct jobQueue {
+    struct daemonJob jobs[DAEMON_QUEUE_LEN];
+    int head, count;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+};
+
+/* State owned by the worker thread */
+struct daemonState {
+    struct jobQueue queue;
+    struct contextCache cache;
+    int gpuAvailable;
+    int deviceId;
+};
+
+/*************************************************************
+*
+* Send a one line reply to the client and hang up
+*
+*************************************************************/
+static void replyAndClose(int client, const char *reply) {
+    size_t done = 0, len = strlen(reply);
+    ssize_t n;
+
+    while(done < len) {
+        n = write(client, reply+done, len-done);
+        if(n <= 0) { break; }
+        done += n;
+    }
+    close(client);
+}
+
+/*************************************************************
+*
+* Read a request until the client shuts down its write side.
+*  Returns a NUL terminated buffer or NULL. The listener reads
+*  every request itself, so a client that stops sending before
+*  it shuts down is dropped after REQUEST_TIMEOUT idle seconds
+*  rather than holding up the other clients.
+*
+*************************************************************/
+static char *readRequest(int client) {
+    char *buf;
+    size_t len = 0;
+    ssize_t n;
+    struct timeval timeout;
+
+    timeout.tv_sec = REQUEST_TIMEOUT;
+    timeout.tv_usec = 0;
+    if(setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)))
+        return(NULL);
+    buf = malloc(MAX_JOB_LEN+1);
+    if(buf == NULL) { return(NULL); }
+    while(len < MAX_JOB_LEN) {
+        n = read(client, buf+len, MAX_JOB_LEN-len);
+        if(n < 0) { free(buf); return(NULL); }
+        if(n == 0) { break; }
+        len += n;
+    }
+    if(len == MAX_JOB_LEN) { free(buf); return(NULL); }
+    buf[len] = '\0';
+    return(buf);
+}
+
+/*************************************************************
+*
+* Worker thread. Jobs run back-to-back in arrival order so
+*  that they share the device and the cached contexts.
+*
+*************************************************************/
+static void *worker(void *arg) {
+    struct daemonState *state = (struct daemonState *)arg;
+    struct jobQueue *queue = &state->queue;
+    struct daemonJob job;
+    struct optionsList inOptions;
+    struct timeInfoList t;
+    char reply[STRING_BUF_LEN];
+    double start;
+    int status;
+
+    while(1) {
+        pthread_mutex_lock(&queue->lock);
+        while(queue->count == 0 && !queue->stop)
+            pthread_cond_wait(&queue->notEmpty, &queue->lock);
+        if(queue->count == 0) {
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        job = queue->jobs[queue->head];
+        queue->head = (queue->head+1) % DAEMON_QUEUE_LEN;
+        queue->count--;
+        pthread_mutex_unlock(&queue->lock);
+
+        initTimer(&t);
+        if(parseInputString(job.parset, &inOptions)) {
+            sprintf(reply, "ERROR Unable to parse the job\n");
+        }
+        else if(inOptions.backend == BACKEND_CUDA && !state->gpuAvailable) {
+            sprintf(reply, "ERROR GPU backend requested but rmsynthd runs with -c\n");
+        }
+        else {
+            /* A batch parset restarts the timers for every field */
+            start = t.startTime;
+            status = runBatch(&inOptions, state->deviceId, &state->cache, &t);
+            if(status == SUCCESS)
+                sprintf(reply, "OK %.3f\n", getWallTime() - start);
+            else
+                sprintf(reply, "ERROR RM Synthesis failed\n");
+        }
+        printf("INFO: Job finished: %s", reply);
+        printf("INFO: Context cache %ld hits, %ld misses\n",
+               state->cache.hits, state->cache.misses);
+        fflush(stdout);
+        freeOptions(&inOptions);
+        free(job.parset);
+        replyAndClose(job.client, reply);
+    }
+    return(NULL);
+}
+
+static int openSocket(const char *path) {
+    struct sockaddr_un addr;
+    int sock;
+
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Error: Socket path is too long\n\n");
+        return(-1);
+    }
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(sock < 0) {
+        perror("Error: socket");
+        return(-1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(sock, DAEMON_QUEUE_LEN) < 0) {
+        perror("Error: Unable to listen on socket");
+        close(sock);
+        return(-1);
+    }
+    return(sock);
+}
+
+static void printUsage(char *name) {
+    printf("Usage: %s [-c] <socket path>\n", name);
+    printf("  -c  CPU only; do not initialise any GPU\n");
+    printf("Send a parset to the socket and close the write side to\n");
+    printf("queue a job. The reply is \"OK <seconds>\" or \"ERROR <reason>\".\n");
+    printf("Send %s to stop the server after the queued jobs.\n\n", SHUTDOWN_CMD);
+}
+
+/*************************************************************
+*
+* Main code
+*
+*************************************************************/
+int main(int argc, char *argv[]) {
+    struct daemonState state;
+    struct daemonJob job;
+    struct deviceInfoList *gpuList;
+    pthread_t workerThread;
+    char *socketPath;
+    int nDevices, tail;
+    int sock, client;
+    int opt;
+
+    printf("\n");
+    printf("RM Synthesis daemon v%s\n", VERSION_STR);
+
+    memset(&state, 0, sizeof(state));
+    state.gpuAvailable = TRUE;
+    while((opt = getopt(argc, argv, "ch")) != -1) {
+        switch(opt) {
+           case 'c':
+              state.gpuAvailable = FALSE;
+              break;
+           case 'h':
+              printUsage(argv[0]);
+              return(SUCCESS);
+           default:
+              printUsage(argv[0]);
+              return(FAILURE);
+        }
+    }
+    if(optind != argc-1) {
+        printUsage(argv[0]);
+        return(FAILURE);
+    }
+    socketPath = argv[optind];
+
+    /* Device discovery and selection happen once, not per job */
+    if(state.gpuAvailable) {
+        gpuList = getDeviceInformation(&nDevices);
+        state.deviceId = getBestDevice(gpuList, nDevices);
+        printf("INFO: Selected device %d\n", state.deviceId);
+        selectDevice(state.deviceId);
+        free(gpuList);
+    }
+
+    /* A client hanging up early must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+    sock = openSocket(socketPath);
+    if(sock < 0) { return(FAILURE); }
+
+    initContextCache(&state.cache);
+    pthread_mutex_init(&state.queue.lock, NULL);
+    pthread_cond_init(&state.queue.notEmpty, NULL);
+    if(pthread_create(&workerThread, NULL, worker, &state)) {
+        printf("Error: Unable to start the worker thread\n\n");
+        close(sock);
+        unlink(socketPath);
+        return(FAILURE);
+    }
+    printf("INFO: Listening on %s\n", socketPath);
+    fflush(stdout);
+
+    /* Accept requests until asked to stop */
+    while(1) {
+        client = accept(sock, NULL, NULL);
+        if(client < 0) { continue; }
+        job.client = client;
+        job.parset = readRequest(client);
+        if(job.parset == NULL) {
+            replyAndClose(client, "ERROR Unable to read the job\n");
+            continue;
+        }
+        if(strncmp(job.parset, SHUTDOWN_CMD, strlen(SHUTDOWN_CMD)) == 0) {
+            free(job.parset);
+            replyAndClose(client, "OK\n");
+            break;
+        }
+        pthread_mutex_lock(&state.queue.lock);
+        if(state.queue.count == DAEMON_QUEUE_LEN) {
+            pthread_mutex_unlock(&state.queue.lock);
+            free(job.parset);
+            replyAndClose(client, "ERROR Job queue is full\n");
+            continue;
+        }
+        tail = (state.queue.head + state.queue.count) % DAEMON_QUEUE_LEN;
+        state.queue.jobs[tail] = job;
+        state.queue.count++;
+        pthread_cond_signal(&state.queue.notEmpty);
+        pthread_mutex_unlock(&state.queue.lock);
+    }
+
+    /* Let the worker drain the queue, then release everything */
+    close(sock);
+    unlink(socketPath);
+    pthread_mutex_lock(&state.queue.lock);
+    printf("INFO: Shutting down after %d queued jobs\n", state.queue.count);
+    fflush(stdout);
+    state.queue.stop = TRUE;
+    pthread_cond_signal(&state.queue.notEmpty);
+    pthread_mutex_unlock(&state.queue.lock);
+    pthread_join(workerThread, NULL);
+    freeContextCache(&state.cache);
+    pthread_mutex_destroy(&state.queue.lock);
+    pthread_cond_destroy(&state.queue.notEmpty);
+    if(state.gpuAvailable) { resetDevices(); }
+    printf("\n");
+    return(SUCCESS);
+}
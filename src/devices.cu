@@ -23,19 +23,9 @@ sarrvesh.ss@gmail.com
 extern "C" {
 #include<cuda_runtime.h>
 #include<cuda.h>
-#include<time.h>
 #include "structures.h"
 #include "constants.h"
 #include "devices.h"
-#include "fileaccess.h"
-__global__ void computeQUP_fits(float *d_qImageArray, float *d_uImageArray, 
-                           int nChan, int nPhi, float K, float *d_qPhi,  
-                           float *d_uPhi, float *d_pPhi, float *d_phiAxis, 
-                           float *d_lambdaDiff2);
-__global__ void computeQUP_hdf5(float *d_qImageArray, float *d_uImageArray, int nLOS,
-                           int nChan, float K, float *d_qPhi, float *d_uPhi,
-                           float *d_pPhi, float *d_phiAxis, int nPhi,
-                           float *d_lambdaDiff2);
 }
 
 /*************************************************************
@@ -164,111 +154,55 @@ struct deviceInfoList copySelectedDeviceInfo(struct deviceInfoList *gpuList,
 
 /*************************************************************
 *
-* Device code to compute Q(\phi) for HDF5 mode
-* 
-* In HDF5 mode, d_?ImageArray are such that the LOS varies 
-* fast than the frequency channel. Which means that each kernel
-* has to do strided read and write. 
-*
-* threadIdx.x and blockIdx.x tell us which phi to process
-* blockIdx.y tells us which LOS to process
+* Make deviceId the device of the calling thread, and release
+*  the devices when the program is done with them. The CLI tools
+*  are plain C and call the runtime through these.
 *
 *************************************************************/
 extern "C"
-__global__ void computeQUP_hdf5(float *d_qImageArray, float *d_uImageArray, int nLOS,
-                           int nChan, float K, float *d_qPhi, float *d_uPhi,
-                           float *d_pPhi, float *d_phiAxis, int nPhi,
-                           float *d_lambdaDiff2) {
-    int i, readIdx, writeIdx;
-    float myphi, mylambdaDiff2;
-    /* xIndex tells me what my phi is */
-    const int xIndex = blockIdx.x*blockDim.x + threadIdx.x;
-    /* yIndex tells me which LOS I am */
-    const int yIndex = blockIdx.y;
-    float qPhi, uPhi, pPhi;
-    float sinVal, cosVal;
-
-    if(xIndex < nPhi) {
-        myphi = d_phiAxis[xIndex];
-        /* qPhi and uPhi are accumulators. So initialize to 0 */
-        qPhi = 0.0; uPhi = 0.0;
-        for(i=0; i<nChan; i++) {
-            readIdx = yIndex + i*nLOS;
-            mylambdaDiff2 = d_lambdaDiff2[i];
-            sinVal = sinf(myphi*mylambdaDiff2);
-            cosVal = cosf(myphi*mylambdaDiff2);
-            qPhi += d_qImageArray[readIdx]*cosVal +
-                    d_uImageArray[readIdx]*sinVal;
-            uPhi += d_uImageArray[readIdx]*cosVal -
-                    d_qImageArray[readIdx]*sinVal;
-        }
-        pPhi = sqrt(qPhi*qPhi + uPhi*uPhi);
+void selectDevice(int deviceId) {
+    cudaSetDevice(deviceId);
+    checkCudaError();
+}
 
-        writeIdx = xIndex*nLOS + yIndex;
-        d_qPhi[writeIdx] = K*qPhi;
-        d_uPhi[writeIdx] = K*uPhi;
-        d_pPhi[writeIdx] = K*pPhi;
-    }
+extern "C"
+void resetDevices(void) {
+    cudaDeviceReset();
 }
 
 /*************************************************************
 *
-* Device code to compute Q(\phi)
-*
-* threadIdx.x and blockIdx.x tell us which phi to process
-* blockIdx.y tells us which LOS to process
+* Free global memory of a device in bytes, or 0 if it cannot
+*  be queried. Used by the memory planner.
 *
 *************************************************************/
 extern "C"
-__global__ void computeQUP_fits(float *d_qImageArray, float *d_uImageArray, 
-                           int nChan, int nPhi, float K, float *d_qPhi,  
-                           float *d_uPhi, float *d_pPhi, float *d_phiAxis, 
-                           float *d_lambdaDiff2) {
-    int i, readIdx, writeIdx;
-    float myphi, mylambdaDiff2;
-    /* xIndex tells me what my phi is */
-    const int xIndex = blockIdx.y*blockDim.x + threadIdx.x;
-    /* yIndex tells me which LOS I am */
-    const int yIndex = blockIdx.x;
-    float qPhi, uPhi, pPhi;
-    float sinVal, cosVal;
-
-    if(xIndex < nPhi) {
-        myphi = d_phiAxis[xIndex];
-        /* qPhi and uPhi are accumulators. So initialize to 0 */
-        qPhi = 0.0; uPhi = 0.0;
-        for(i=0; i<nChan; i++) {
-            mylambdaDiff2 = d_lambdaDiff2[i];
-            sinVal = sinf(myphi*mylambdaDiff2);
-            cosVal = cosf(myphi*mylambdaDiff2);
-            readIdx = yIndex*nChan + i;
-            qPhi += d_qImageArray[readIdx]*cosVal + 
-                    d_uImageArray[readIdx]*sinVal;
-            uPhi += d_uImageArray[readIdx]*cosVal -
-                    d_qImageArray[readIdx]*sinVal;
-        }
-        pPhi = sqrt(qPhi*qPhi + uPhi*uPhi);
-
-        writeIdx = yIndex*nPhi + xIndex;
-        d_qPhi[writeIdx] = K*qPhi;
-        d_uPhi[writeIdx] = K*uPhi;
-        d_pPhi[writeIdx] = K*pPhi;
+double getFreeDeviceMemory(int deviceId) {
+    size_t freeMem, totalMem;
+    if(cudaSetDevice(deviceId) != cudaSuccess ||
+       cudaMemGetInfo(&freeMem, &totalMem) != cudaSuccess) {
+        cudaGetLastError();
+        return(0.);
     }
+    return((double)freeMem);
 }
 
 /*************************************************************
 *
-* Initialize Q(\phi) and U(\phi)
+* Page-lock a block of host memory so that copies to and from
+*  the device use DMA directly. Used by the staging arena.
 *
 *************************************************************/
 extern "C"
-__global__ void initializeQUP(float *d_qPhi, float *d_uPhi, 
-                              float *d_pPhi, int nPhi) {
-    int index = blockIdx.x*blockDim.x + threadIdx.x;
-
-    if(index < nPhi) {
-        d_qPhi[index] = 0.0;
-        d_uPhi[index] = 0.0;
-        d_pPhi[index] = 0.0;
+int pinHostMemory(void *ptr, size_t bytes) {
+    if(cudaHostRegister(ptr, bytes, cudaHostRegisterDefault) != cudaSuccess) {
+        cudaGetLastError();
+        return(FAILURE);
     }
+    return(SUCCESS);
+}
+
+extern "C"
+void unpinHostMemory(void *ptr) {
+    cudaHostUnregister(ptr);
 }
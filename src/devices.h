@@ -23,20 +23,28 @@ sarrvesh.ss@gmail.com
 #ifndef DEVICES_H
 #define DEVICES_H
 
+#include<stddef.h>
+
 #ifdef __cplusplus
-extern "C"
+extern "C" {
 #endif
 
 struct deviceInfoList * getDeviceInformation(int *nDevices);
-int doRMSynthesis(struct optionsList *inOptions, struct parList *params,
-                  struct deviceInfoList selectedDeviceInfo,
-                  struct timeInfoList *t);
 int getBestDevice(struct deviceInfoList *gpuList, int nDevices);
 struct deviceInfoList copySelectedDeviceInfo(struct deviceInfoList *gpuList,  
                                              int selectedDevice);
 void checkCudaError(void);
+void selectDevice(int deviceId);
+void resetDevices(void);
+double getFreeDeviceMemory(int deviceId);
+int pinHostMemory(void *ptr, size_t bytes);
+void unpinHostMemory(void *ptr);
 void getGpuAllocForP(int *blockSize, int *threadSize, long *nFrames, 
                      int nImRows, int nRowElements, 
                      struct deviceInfoList selectedDeviceInfo);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,910 @@
+/******************************************************************************
+dosynthesis.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+
+#include "structures.h"
+#include "constants.h"
+#include "timing.h"
+#include "rmsynth.h"
+#include "fileaccess.h"
+#include "ranks.h"
+#include "planner.h"
+#include "arena.h"
+#include "products.h"
+#include "catalog.h"
+#include "dosynthesis.h"
+
+/*************************************************************
+*
+* Open the HDF5 datasets and set up the hyperslabs for reading
+*  one frame. Q and U are held interleaved in memory, so their
+*  memory spaces are twice the frame size and every other
+*  element is selected. Stokes I, if nIElements is not 0, is
+*  read into a plain array of that many elements. qName and
+*  uName are the Q and U datasets.
+*
+*************************************************************/
+static int openHDF5Inputs(struct IOFileDescriptors *descriptors, long nInElements,
+                          long nIElements, const char *qName, const char *uName) {
+    hsize_t dimIn = 2*nInElements, dimI = nIElements;
+
+    descriptors->iDataset = descriptors->iDataspace = descriptors->iMemspace = -1;
+    if(nIElements > 0) {
+        descriptors->iDataset   = H5Dopen2(descriptors->iFileh5, PRIMARYDATA, H5P_DEFAULT);
+        descriptors->iDataspace = H5Dget_space(descriptors->iDataset);
+        descriptors->iMemspace  = H5Screate_simple(1, &dimI, NULL);
+        if(descriptors->iDataset<0 || descriptors->iDataspace<0 ||
+           descriptors->iMemspace<0) {
+            printf("\nError: HDF5 allocation failed\n");
+            return(FAILURE);
+        }
+    }
+    descriptors->qDataset   = H5Dopen2(descriptors->qFileh5, qName, H5P_DEFAULT);
+    descriptors->qDataspace = H5Dget_space(descriptors->qDataset);
+    descriptors->uDataset   = H5Dopen2(descriptors->uFileh5, uName, H5P_DEFAULT);
+    descriptors->uDataspace = H5Dget_space(descriptors->uDataset);
+    descriptors->qMemspace  = H5Screate_simple(1, &dimIn, NULL);
+    descriptors->uMemspace  = H5Screate_simple(1, &dimIn, NULL);
+    if(descriptors->qDataset<0   || descriptors->uDataset<0   ||
+       descriptors->qDataspace<0 || descriptors->uDataspace<0 ||
+       descriptors->qMemspace<0  || descriptors->uMemspace<0) {
+        printf("\nError: HDF5 allocation failed\n");
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+/* Same for writing one frame of an output set. Ranks that do
+   not own the output cubes open nothing. */
+static int openHDF5Outputs(struct IOFileDescriptors *descriptors,
+                           long nOutElements, int openOutput) {
+    hsize_t dimOut = 2*nOutElements, dimP = nOutElements;
+
+    descriptors->qOutDataset   = descriptors->uOutDataset   = descriptors->pOutDataset   = -1;
+    descriptors->qOutDataspace = descriptors->uOutDataspace = descriptors->pOutDataspace = -1;
+    descriptors->qOutMemspace  = descriptors->uOutMemspace  = descriptors->pOutMemspace  = -1;
+    if(!openOutput) { return(SUCCESS); }
+
+    descriptors->qOutDataset   = H5Dopen2(descriptors->qDirtyH5, PRIMARYDATA, H5P_DEFAULT);
+    descriptors->qOutDataspace = H5Dget_space(descriptors->qOutDataset);
+    descriptors->uOutDataset   = H5Dopen2(descriptors->uDirtyH5, PRIMARYDATA, H5P_DEFAULT);
+    descriptors->uOutDataspace = H5Dget_space(descriptors->uOutDataset);
+    descriptors->pOutDataset   = H5Dopen2(descriptors->pDirtyH5, PRIMARYDATA, H5P_DEFAULT);
+    descriptors->pOutDataspace = H5Dget_space(descriptors->pOutDataset);
+    descriptors->qOutMemspace  = H5Screate_simple(1, &dimOut, NULL);
+    descriptors->uOutMemspace  = H5Screate_simple(1, &dimOut, NULL);
+    descriptors->pOutMemspace  = H5Screate_simple(1, &dimP, NULL);
+    if(descriptors->qOutDataset<0   || descriptors->uOutDataset<0   ||
+       descriptors->pOutDataset<0   || descriptors->qOutDataspace<0 ||
+       descriptors->uOutDataspace<0 || descriptors->pOutDataspace<0 ||
+       descriptors->qOutMemspace<0  || descriptors->uOutMemspace<0  ||
+       descriptors->pOutMemspace<0) {
+        printf("\nError: HDF5 output allocation failed\n");
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+static void closeHDF5Inputs(struct IOFileDescriptors *descriptors) {
+    hid_t spaces[] = {descriptors->qMemspace, descriptors->uMemspace,
+                      descriptors->iMemspace, descriptors->qDataspace,
+                      descriptors->uDataspace, descriptors->iDataspace};
+    hid_t datasets[] = {descriptors->qDataset, descriptors->uDataset,
+                        descriptors->iDataset};
+    unsigned int i;
+
+    for(i=0; i<sizeof(spaces)/sizeof(*spaces); i++)
+        if(spaces[i] >= 0) { H5Sclose(spaces[i]); }
+    for(i=0; i<sizeof(datasets)/sizeof(*datasets); i++)
+        if(datasets[i] >= 0) { H5Dclose(datasets[i]); }
+}
+
+/* Close whatever openHDF5Outputs() opened, then the output files.
+   With parallel HDF5 every rank must get here together. */
+static void closeHDF5Outputs(struct IOFileDescriptors *descriptors) {
+    hid_t spaces[] = {descriptors->qOutMemspace, descriptors->uOutMemspace,
+                      descriptors->pOutMemspace, descriptors->qOutDataspace,
+                      descriptors->uOutDataspace, descriptors->pOutDataspace};
+    hid_t datasets[] = {descriptors->qOutDataset, descriptors->uOutDataset,
+                        descriptors->pOutDataset};
+    hid_t files[] = {descriptors->qDirtyH5, descriptors->uDirtyH5,
+                     descriptors->pDirtyH5};
+    unsigned int i;
+
+    for(i=0; i<sizeof(spaces)/sizeof(*spaces); i++)
+        if(spaces[i] >= 0) { H5Sclose(spaces[i]); }
+    for(i=0; i<sizeof(datasets)/sizeof(*datasets); i++)
+        if(datasets[i] >= 0) { H5Dclose(datasets[i]); }
+    for(i=0; i<sizeof(files)/sizeof(*files); i++)
+        if(files[i] >= 0) { H5Fclose(files[i]); }
+}
+
+/*************************************************************
+*
+* Read Stokes I of a chunk of nLOS sightlines starting at los0
+*  of frame j (counting from 1) into iImageArray, laid out as
+*  the Q and U frame. A model is read as its two planes into
+*  iModel and evaluated for every channel as
+*  I(nu) = I0 (nu/nu0)^alpha, with logRatio = ln(nu/nu0).
+*
+*************************************************************/
+static int readStokesI(struct optionsList *inOptions,
+                       struct IOFileDescriptors *descriptors, int j,
+                       long los0, long nLOS, int nChan, const double *logRatio,
+                       float *iModel, float *iImageArray) {
+    hsize_t offsetIn[N_DIMS], countIn[N_DIMS], offsetMem = 0, countMem;
+    long fPixel[N_DIMS], los, idx;
+    int k, c, fitsStatus = 0;
+    herr_t error = 0;
+    float *dst = inOptions->stokesI == STOKES_I_CUBE ? iImageArray : iModel;
+
+    countIn[0] = inOptions->stokesI == STOKES_I_CUBE ? nChan : N_MODEL_PLANES;
+    switch(inOptions->fileFormat) {
+       case FITS:
+          if(inOptions->stokesI == STOKES_I_CUBE) {
+             fPixel[0] = 1; fPixel[1] = los0 + 1; fPixel[2] = j;
+             fits_read_pix(descriptors->iFile, TFLOAT, fPixel, nLOS*nChan, NULL,
+                           dst, NULL, &fitsStatus);
+          }
+          else {
+             /* Model planes are sky images, one read per plane */
+             for(k=0; k<N_MODEL_PLANES; k++) {
+                fPixel[0] = los0 + 1; fPixel[1] = j; fPixel[2] = k + 1;
+                fits_read_pix(descriptors->iFile, TFLOAT, fPixel, nLOS, NULL,
+                              dst + k*nLOS, NULL, &fitsStatus);
+             }
+          }
+          if(fitsStatus) {
+             fits_report_error(stdout, fitsStatus);
+             return(FAILURE);
+          }
+          break;
+       case HDF5:
+          offsetIn[0] = 0; offsetIn[1] = j-1; offsetIn[2] = los0;
+          countIn[1] = 1;  countIn[2] = nLOS;
+          countMem = countIn[0] * nLOS;
+          error |= H5Sselect_hyperslab(descriptors->iDataspace, H5S_SELECT_SET,
+                                       offsetIn, NULL, countIn, NULL);
+          error |= H5Sselect_hyperslab(descriptors->iMemspace, H5S_SELECT_SET,
+                                       &offsetMem, NULL, &countMem, NULL);
+          error |= H5Dread(descriptors->iDataset, H5T_NATIVE_FLOAT, descriptors->iMemspace,
+                           descriptors->iDataspace, H5P_DEFAULT, dst);
+          if(error < 0) {
+             printf("\nError: Unable to read the Stokes I input\n\n");
+             return(FAILURE);
+          }
+          break;
+    }
+    if(inOptions->stokesI == STOKES_I_MODEL) {
+       for(los=0; los<nLOS; los++) {
+          for(c=0; c<nChan; c++) {
+             idx = inOptions->fileFormat == HDF5 ? c*nLOS + los : los*nChan + c;
+             iImageArray[idx] = iModel[los] * exp(iModel[nLOS + los] * logRatio[c]);
+          }
+       }
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Read nLOS rows starting at los0 of a table input into the
+*  interleaved quImageArray. A FITS table row is one spectrum,
+*  which is the FITS frame layout already. HDF5 frames are
+*  channel first, so the rows of a chunk are read into scratch
+*  and transposed in blocks.
+*
+*************************************************************/
+static int readTableChunk(struct optionsList *inOptions,
+                          struct IOFileDescriptors *descriptors,
+                          long los0, long nLOS, int nChan,
+                          float *scratch, float *quImageArray) {
+    hsize_t offsetIn[2], countIn[2], offsetMem = 0, countMem;
+    long i0, i, iEnd, idx;
+    int comp, c0, c, cEnd, fitsStatus = 0;
+    herr_t error = 0;
+    fitsfile *files[NUM_INPUTS] = {descriptors->qFile, descriptors->uFile};
+    int colNums[NUM_INPUTS] = {descriptors->qColNum, descriptors->uColNum};
+    hid_t datasets[NUM_INPUTS] = {descriptors->qDataset, descriptors->uDataset};
+    hid_t dataspaces[NUM_INPUTS] = {descriptors->qDataspace, descriptors->uDataspace};
+    hid_t memspaces[NUM_INPUTS] = {descriptors->qMemspace, descriptors->uMemspace};
+
+    offsetIn[0] = los0; offsetIn[1] = 0;
+    countIn[0] = nLOS;  countIn[1] = nChan;
+    countMem = nLOS * nChan;
+    for(comp=0; comp<NUM_INPUTS; comp++) {
+       switch(inOptions->fileFormat) {
+          case FITS:
+             fits_read_col(files[comp], TFLOAT, colNums[comp], los0+1, 1, nLOS*nChan,
+                           NULL, scratch, NULL, &fitsStatus);
+             if(fitsStatus) {
+                fits_report_error(stdout, fitsStatus);
+                return(FAILURE);
+             }
+             for(idx=0; idx<nLOS*nChan; idx++)
+                quImageArray[2*idx+comp] = scratch[idx];
+             break;
+          case HDF5:
+             error |= H5Sselect_hyperslab(dataspaces[comp], H5S_SELECT_SET,
+                                          offsetIn, NULL, countIn, NULL);
+             error |= H5Sselect_hyperslab(memspaces[comp], H5S_SELECT_SET,
+                                          &offsetMem, NULL, &countMem, NULL);
+             error |= H5Dread(datasets[comp], H5T_NATIVE_FLOAT, memspaces[comp],
+                              dataspaces[comp], H5P_DEFAULT, scratch);
+             if(error < 0) {
+                printf("\nError: Unable to read the input tables\n\n");
+                return(FAILURE);
+             }
+             for(i0=0; i0<nLOS; i0+=TRANSPOSE_BLOCK) {
+                iEnd = i0+TRANSPOSE_BLOCK < nLOS ? i0+TRANSPOSE_BLOCK : nLOS;
+                for(c0=0; c0<nChan; c0+=TRANSPOSE_BLOCK) {
+                   cEnd = c0+TRANSPOSE_BLOCK < nChan ? c0+TRANSPOSE_BLOCK : nChan;
+                   for(i=i0; i<iEnd; i++)
+                      for(c=c0; c<cEnd; c++)
+                         quImageArray[2*(c*nLOS + i)+comp] = scratch[i*nChan + c];
+                }
+             }
+             break;
+       }
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Write a chunk of nLOS sightlines starting at los0 of a row of
+*  the output cubes. Q and U are taken from alternate elements
+*  of quPhi. In a collective write, a rank with nothing to write
+*  this step passes row = -1 and selects no elements, but still
+*  takes part.
+*
+*************************************************************/
+static int writeHDF5Frame(struct IOFileDescriptors *descriptors, int row,
+                          long los0, hsize_t *countOut,
+                          float *quPhi, float *pPhi) {
+    hid_t fileSpaces[] = {descriptors->qOutDataspace, descriptors->uOutDataspace,
+                          descriptors->pOutDataspace};
+    hid_t memSpaces[] = {descriptors->qOutMemspace, descriptors->uOutMemspace,
+                         descriptors->pOutMemspace};
+    hid_t datasets[] = {descriptors->qOutDataset, descriptors->uOutDataset,
+                        descriptors->pOutDataset};
+    float *data[] = {quPhi, quPhi, pPhi};
+    hsize_t offsetMem[] = {0, 1, 0}, strideMem[] = {2, 2, 1};
+    hsize_t offsetOut[N_DIMS] = {0, 0, 0};
+    hsize_t countMem;
+    herr_t error = 0;
+    int i;
+
+    offsetOut[1] = row;
+    offsetOut[2] = los0;
+    countMem = countOut[0] * countOut[1] * countOut[2];
+    for(i=0; i<NUM_OUTPUTS; i++) {
+        if(row >= 0) {
+            error |= H5Sselect_hyperslab(fileSpaces[i], H5S_SELECT_SET,
+                                         offsetOut, NULL, countOut, NULL);
+            error |= H5Sselect_hyperslab(memSpaces[i], H5S_SELECT_SET,
+                                         &offsetMem[i], &strideMem[i], &countMem, NULL);
+        }
+        else {
+            error |= H5Sselect_none(fileSpaces[i]);
+            error |= H5Sselect_none(memSpaces[i]);
+        }
+        error |= H5Dwrite(datasets[i], H5T_NATIVE_FLOAT, memSpaces[i], fileSpaces[i],
+                          outputTransferList(), data[i]);
+    }
+    if(error < 0) {
+        printf("\nError: Unable to write output data cubes\n\n");
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Sky ordered FITS output. A chunk of Q(phi) is [RA][phi] but
+*  the cube is [phi][DEC][RA], so chunks are transposed into a
+*  tile of nRows DEC rows per phi plane. A full tile is written
+*  as one contiguous run of DEC rows per plane, which avoids a
+*  separate pass to reorder the whole cube afterwards. stride is
+*  2 to pick Q or U out of an interleaved chunk.
+*
+*************************************************************/
+static void addFrameToTile(const float *frame, int stride, float *tile, int row,
+                           long los0, long nLOS, int nRows, int nRa, int nPhi) {
+    long plane = (long)nRows * nRa;
+    long i0, i, iEnd;
+    int k0, k, kEnd;
+
+    tile += (long)row*nRa + los0;
+    for(i0=0; i0<nLOS; i0+=TRANSPOSE_BLOCK) {
+       iEnd = i0+TRANSPOSE_BLOCK < nLOS ? i0+TRANSPOSE_BLOCK : nLOS;
+       for(k0=0; k0<nPhi; k0+=TRANSPOSE_BLOCK) {
+          kEnd = k0+TRANSPOSE_BLOCK < nPhi ? k0+TRANSPOSE_BLOCK : nPhi;
+          for(i=i0; i<iEnd; i++)
+             for(k=k0; k<kEnd; k++)
+                tile[k*plane + i] = frame[(i*nPhi + k)*stride];
+       }
+    }
+}
+
+static int writeSkyTile(fitsfile *file, int firstRow, int nHeld,
+                        int nRows, int nRa, int nPhi, float *tile) {
+    long fPixel[FITS_OUT_NAXIS];
+    long plane = (long)nRows * nRa;
+    int k, fitsStatus = 0;
+
+    fPixel[0] = 1; fPixel[1] = firstRow;
+    for(k=0; k<nPhi && fitsStatus == 0; k++) {
+       fPixel[2] = k+1;
+       fits_write_pix(file, TFLOAT, fPixel, (long)nHeld*nRa, tile+k*plane,
+                      &fitsStatus);
+    }
+    if(fitsStatus) {
+       fits_report_error(stdout, fitsStatus);
+       return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Take the frame buffers of an output set from the arena, and
+*  open its output datasets and products. Without cubes, only
+*  the buffers of the synthesis and of the products are
+*  needed. A sub-band of a FITS frame needs a buffer of its
+*  own; see bandFrame().
+*
+*************************************************************/
+static int openOutput(struct optionsList *inOptions, struct synthOutput *out,
+                      struct memoryPlan *plan, struct hostArena *arena,
+                      int nRa, int nChan, int ownsOutput) {
+    const struct rankInfo *ranks = getRanks();
+    long nOutElements = (long)out->options.nPhi * plan->losPerCall;
+    long tileSize = (long)plan->tileRows * nRa * out->options.nPhi;
+    int cubes = (inOptions->outputMode != OUTPUT_CATALOG);
+    int status = SUCCESS;
+
+    if(inOptions->fileFormat == HDF5 &&
+       openHDF5Outputs(&out->descriptors, nOutElements, ownsOutput && cubes))
+        status = FAILURE;
+    out->quBand = out->iBand = NULL;
+    if(inOptions->fileFormat == FITS && out->options.nChanBand < nChan) {
+        out->quBand = (float *)arenaAlloc(arena, 2L*out->options.nChanBand*plan->losPerCall*
+                                          sizeof(*out->quBand));
+        if(out->quBand == NULL) { status = FAILURE; }
+        if(inOptions->stokesI != STOKES_I_NONE) {
+            out->iBand = (float *)arenaAlloc(arena, (long)out->options.nChanBand*
+                                             plan->losPerCall*sizeof(*out->iBand));
+            if(out->iBand == NULL) { status = FAILURE; }
+        }
+    }
+    out->quPhi = (float *)arenaAlloc(arena, 2*nOutElements*sizeof(*out->quPhi));
+    out->pPhi = (float *)arenaAlloc(arena, nOutElements*sizeof(*out->pPhi));
+    if(out->quPhi == NULL || out->pPhi == NULL) {
+        printf("ERROR: Unable to allocate memory on host\n");
+        status = FAILURE;
+    }
+    if(tileSize > 0) {
+        out->qTile = (float *)arenaAlloc(arena, tileSize*sizeof(*out->qTile));
+        out->uTile = (float *)arenaAlloc(arena, tileSize*sizeof(*out->uTile));
+        out->pTile = (float *)arenaAlloc(arena, tileSize*sizeof(*out->pTile));
+        if(out->qTile == NULL || out->uTile == NULL || out->pTile == NULL) {
+            printf("ERROR: Unable to allocate the output tile; reduce tileMemory\n");
+            status = FAILURE;
+        }
+    }
+    if(cubes && !ranks->sharedOutput && ranks->rank == 0) {
+        out->quAll = (float *)arenaAlloc(arena, 2*ranks->size*nOutElements*sizeof(*out->quAll));
+        out->pAll = (float *)arenaAlloc(arena, ranks->size*nOutElements*sizeof(*out->pAll));
+        if(out->quAll == NULL || out->pAll == NULL) {
+            printf("ERROR: Unable to allocate memory for gathering frames\n");
+            status = FAILURE;
+        }
+    }
+    if(openProducts(&out->products, arena, plan->losPerCall)) {
+        printf("ERROR: Unable to set up the per-sightline products\n");
+        status = FAILURE;
+    }
+    out->peaks.phi  = productChunk(&out->products, PEAK_PHI);
+    out->peaks.p    = productChunk(&out->products, PEAK_P);
+    out->peaks.q    = productChunk(&out->products, PEAK_Q);
+    out->peaks.u    = productChunk(&out->products, PEAK_U);
+    out->peaks.phi0 = productChunk(&out->products, WINDOW_PHI0);
+    out->peaks.windowQ = productChunk(&out->products, WINDOW_Q);
+    out->peaks.windowU = productChunk(&out->products, WINDOW_U);
+    out->peaks.windowP = productChunk(&out->products, WINDOW_P);
+    out->noise.sigma     = productChunk(&out->products, NOISE_SIGMA);
+    out->noise.rms       = productChunk(&out->products, NOISE_RMS);
+    out->noise.sigmaBand = productChunk(&out->products, NOISE_BAND);
+    out->noise.snr       = productChunk(&out->products, PEAK_SNR);
+    out->fit.params = productChunk(&out->products, FIT_PARAMS);
+    out->fit.errors = productChunk(&out->products, FIT_ERRORS);
+    out->fit.chi2   = productChunk(&out->products, FIT_CHI2);
+    /* The catalog needs the noise even if it is not written */
+    if(inOptions->outputMode != OUTPUT_CUBES && out->noise.sigma == NULL) {
+        out->noise.sigma = (float *)arenaAlloc(arena, plan->losPerCall*sizeof(*out->noise.sigma));
+        if(out->noise.sigma == NULL) { status = FAILURE; }
+    }
+    return(status);
+}
+
+/*************************************************************
+*
+* The part of a chunk of nLOS sightlines and nChan channels
+*  that an output set synthesizes, with nComp floats per element
+*  (2 for interleaved Q and U, 1 for Stokes I). HDF5 chunks are
+*  [chan][los], so a sub-band is a contiguous block of them.
+*  FITS chunks are [los][chan] and the sub-band is copied out
+*  into band, sightline by sightline.
+*
+*************************************************************/
+static const float *bandFrame(struct synthOutput *out, const float *frame,
+                              float *band, int nComp, long nLOS, int nChan) {
+    int first = out->options.firstChan, nBand = out->options.nChanBand;
+    long i;
+
+    if(band == NULL) { return(frame + (long)nComp*first*nLOS); }
+    for(i=0; i<nLOS; i++)
+        memcpy(band + nComp*i*nBand, frame + nComp*(i*nChan + first),
+               nComp*nBand*sizeof(*frame));
+    return(band);
+}
+
+/*************************************************************
+*
+* Write a chunk of an output set in frame order: FITS frames
+*  through the scratch buffer, HDF5 frames straight from the
+*  interleaved buffers or, if only rank 0 owns the cubes,
+*  gathered there first. frames receives the frame index of
+*  every rank and is gathered with the first output only.
+*
+*************************************************************/
+static int writeOutputChunk(struct optionsList *inOptions, struct synthOutput *out,
+                            int row, long los0, long nLOS, long nOutElements,
+                            long *fPixel, float *scratch, int *frames, int first) {
+    const struct rankInfo *ranks = getRanks();
+    struct IOFileDescriptors *descriptors = &out->descriptors;
+    hsize_t countOut[N_DIMS];
+    int i, nPhi = out->options.nPhi, fitsStatus = 0;
+    long idx;
+
+    switch(inOptions->fileFormat) {
+       case FITS:
+          for(idx=0; idx<nLOS*nPhi; idx++)
+             scratch[idx] = out->quPhi[2*idx];
+          fits_write_pix(descriptors->qDirty, TFLOAT, fPixel, nLOS*nPhi, scratch, &fitsStatus);
+          for(idx=0; idx<nLOS*nPhi; idx++)
+             scratch[idx] = out->quPhi[2*idx+1];
+          fits_write_pix(descriptors->uDirty, TFLOAT, fPixel, nLOS*nPhi, scratch, &fitsStatus);
+          fits_write_pix(descriptors->pDirty, TFLOAT, fPixel, nLOS*nPhi, out->pPhi, &fitsStatus);
+          if(fitsStatus) {
+             fits_report_error(stdout, fitsStatus);
+             return(FAILURE);
+          }
+          break;
+       case HDF5:
+          countOut[0] = nPhi; countOut[1] = 1; countOut[2] = nLOS;
+          if(ranks->sharedOutput)
+             return(writeHDF5Frame(descriptors, row, los0, countOut, out->quPhi, out->pPhi));
+          /* Rank 0 writes the chunks of all ranks */
+          if(gatherFrames(first ? &row : NULL, frames, out->quPhi, out->quAll,
+                          2*nOutElements) ||
+             gatherFrames(NULL, NULL, out->pPhi, out->pAll, nOutElements)) {
+             printf("\nError: Unable to gather output frames\n\n");
+             return(FAILURE);
+          }
+          for(i=0; ranks->rank == 0 && i<ranks->size; i++) {
+             if(frames[i] < 0) { continue; }
+             if(writeHDF5Frame(descriptors, frames[i], los0, countOut,
+                               out->quAll+2*i*nOutElements,
+                               out->pAll+i*nOutElements)) { return(FAILURE); }
+          }
+          break;
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Read a frame at a time, synthesize it with librmsynth and
+*  write the result. In FITS mode, a frame is all RA pixels of
+*  one DEC row. In HDF5 mode, it is all LOS along the second
+*  axis. Frames that do not fit the memory plan are processed
+*  in chunks of plan->losPerCall sightlines, with buffers taken
+*  from the staging arena. Every chunk read is synthesized for
+*  each of the nOutputs output sets (sub-bands and phi grids) in
+*  turn, so the cubes are read only once. With a Stokes I cube
+*  or model, I is read alongside and the backends divide Q and
+*  U by it as they load them. With refinePeaks, the peaks of each
+*  chunk are refined right after synthesis and written to the
+*  per-sightline products. With noiseMaps, the noise and S/N of
+*  each sightline are estimated from the same chunk, so the
+*  output cubes need not be read back for them. A catalog lists
+*  the significant peaks of each chunk; with outputMode CATALOG
+*  no cubes are written at all. In an MPI run,
+*  each rank takes a contiguous block of frames; see ranks.c
+*  for how the output is shared.
+*
+*************************************************************/
+int doRMSynthesis(struct optionsList *inOptions,
+                  struct IOFileDescriptors *descriptors,
+                  struct parameters *params,
+                  struct DataArrays *data_arrays,
+                  struct memoryPlan *plan,
+                  struct hostArena *arena,
+                  struct synthOutput *outputs, int nOutputs,
+                  struct timeInfoList *t) {
+    int j, o, step, chunk, status = SUCCESS, rmsStatus;
+    int nFrequencies, nRa, nPhi, maxPhi, nFrames, nPlanes;
+    int firstFrame, nMyFrames, nSteps, active;
+    long los0, nLOS, nInElements, nOutElements, idx;
+    float *quImageArray, *scratch = NULL, *band = NULL;
+    float *iImageArray = NULL, *iModel = NULL;
+    double *logRatio = NULL;
+    const float *frame, *iFrame;
+    int *frames = NULL;
+    long *fPixel = NULL;
+    int tileRows = 0, tileHeld = 0, tileFirst = 0, skyOrder;
+    int fitsStatus = 0;
+    herr_t h5ErrorQ, h5ErrorU;
+    herr_t qerror, uerror;
+    hsize_t offsetIn[N_DIMS], countIn[N_DIMS];
+    hsize_t offsetMem[] = {0, 1}, strideMem = 2, countMem;
+    struct rmsRefineConfig refine;
+    struct rmsFitConfig fit;
+    const struct rmsComponent *components;
+    long nComponents;
+    struct synthOutput *out;
+    const struct rankInfo *ranks = getRanks();
+    int ownsOutput = (ranks->sharedOutput || ranks->rank == 0);
+
+    /* Compute the dimension of the computation. Buffers hold one
+       chunk of a frame */
+    nFrequencies = params->qAxisLen3;
+    switch(inOptions->fileFormat) {
+       case HDF5:
+          nRa = params->qAxisLen2;
+          nFrames = params->qAxisLen1;
+          break;
+       default:
+          nRa = params->qAxisLen1;
+          nFrames = params->qAxisLen2;
+          break;
+    }
+    maxPhi = nPlanes = 0;
+    for(o=0; o<nOutputs; o++) {
+       if(outputs[o].options.nPhi > maxPhi) { maxPhi = outputs[o].options.nPhi; }
+       nPlanes += productPlanes(&outputs[o].products);
+    }
+    nInElements  = (long)nFrequencies * plan->losPerCall;
+    getFrameRange(nFrames, &firstFrame, &nMyFrames, &nSteps);
+    skyOrder = (inOptions->fileFormat == FITS &&
+                inOptions->outputOrder == ORDER_SKY &&
+                inOptions->outputMode != OUTPUT_CATALOG);
+
+    /* Set mode-specific configuration */
+    switch(inOptions->fileFormat) {
+       case FITS:
+          /* For FITS, set some pixel access limits */
+          fPixel = (long *)calloc(params->qAxisNum, sizeof(*fPixel));
+          if(fPixel == NULL) { return(FAILURE); }
+          fPixel[0] = 1; fPixel[1] = 1;
+          /* Rows held back for sky ordered output */
+          tileRows = plan->tileRows;
+          /* Extra file descriptors for concurrent reads */
+          if(inOptions->readThreads > 1 && inOptions->inputType == INPUT_CUBE &&
+             openFitsReaders(inOptions, params, descriptors)) { status = FAILURE; }
+          break;
+       case HDF5:
+          /* For HDF5, set up the hyperslab and data subset */
+          if(openHDF5Inputs(descriptors, nInElements,
+                            inOptions->stokesI == STOKES_I_CUBE ? nInElements :
+                            inOptions->stokesI == STOKES_I_MODEL ?
+                            N_MODEL_PLANES*plan->losPerCall : 0,
+                            inOptions->inputType == INPUT_TABLE ? inOptions->qColumn : PRIMARYDATA,
+                            inOptions->inputType == INPUT_TABLE ? inOptions->uColumn : PRIMARYDATA))
+             status = FAILURE;
+          countIn[0] = nFrequencies;
+          countIn[1] = 1; countIn[2] = plan->losPerCall;
+          offsetIn[0] = 0; offsetIn[1] = 0; offsetIn[2] = 0;
+          break;
+    }
+
+    /* Take the frame buffers from the arena, which is page-locked
+       for the CUDA backend. If only rank 0 has the output cubes
+       open, it also holds one chunk per rank. */
+    startTimer(t, STAGE_SETUP);
+    if(reserveArena(arena, plan->stagingBytes, inOptions->backend == BACKEND_CUDA))
+        status = FAILURE;
+    quImageArray = (float *)arenaAlloc(arena, 2*nInElements*sizeof(*quImageArray));
+    /* cfitsio reads and writes contiguous pixels only, so FITS
+       frames are (de)interleaved through a scratch buffer. Table
+       rows are read through it as well */
+    if(inOptions->fileFormat == FITS || inOptions->inputType == INPUT_TABLE)
+        scratch = (float *)arenaAlloc(arena, (nFrequencies > maxPhi ? nFrequencies :
+                                      maxPhi)*plan->losPerCall*sizeof(*scratch));
+    /* Compressed tiles that span several rows are decoded a band
+       of rows at a time */
+    if(plan->bandFrames > 0) {
+        band = (float *)arenaAlloc(arena, (long)NUM_INPUTS*plan->bandFrames*nRa*nFrequencies*
+                                   sizeof(*band));
+        if(band != NULL) { setFitsBand(descriptors, params, band, firstFrame, nMyFrames); }
+    }
+    if(quImageArray == NULL || (scratch == NULL &&
+       (inOptions->fileFormat == FITS || inOptions->inputType == INPUT_TABLE)) ||
+       (band == NULL && plan->bandFrames > 0)) {
+        printf("ERROR: Unable to allocate memory on host\n");
+        status = FAILURE;
+    }
+    /* Stokes I is not interleaved. A model also needs its two
+       planes and ln(nu/nu0) of every channel */
+    if(inOptions->stokesI != STOKES_I_NONE) {
+        iImageArray = (float *)arenaAlloc(arena, nInElements*sizeof(*iImageArray));
+        if(iImageArray == NULL) { status = FAILURE; }
+    }
+    if(inOptions->stokesI == STOKES_I_MODEL) {
+        iModel = (float *)arenaAlloc(arena, N_MODEL_PLANES*plan->losPerCall*sizeof(*iModel));
+        logRatio = (double *)malloc(nFrequencies*sizeof(*logRatio));
+        if(iModel == NULL || logRatio == NULL) { status = FAILURE; }
+        for(idx=0; logRatio != NULL && idx<nFrequencies; idx++)
+            logRatio[idx] = log(data_arrays->freqList[idx] / inOptions->iModelFreq);
+    }
+    if(!ranks->sharedOutput && ranks->rank == 0) {
+        frames = (int *)arenaAlloc(arena, ranks->size*sizeof(*frames));
+        if(frames == NULL) { status = FAILURE; }
+    }
+    for(o=0; o<nOutputs; o++) {
+        if(openOutput(inOptions, &outputs[o], plan, arena, nRa, nFrequencies, ownsOutput))
+            status = FAILURE;
+        rmsSetTimer(outputs[o].ctx, t);
+    }
+    refine.maxPeaks  = inOptions->refinePeaks;
+    refine.threshold = inOptions->refineThreshold;
+    refine.nFine     = inOptions->refineSamples;
+    refine.dPhiFine  = inOptions->refineDPhi;
+    fit.model   = inOptions->fitModel;
+    fit.maxIter = inOptions->fitIterations;
+    stopTimer(t, STAGE_SETUP);
+    status = agreeStatus(status);
+    if(status != SUCCESS) { nSteps = 0; }
+
+    /* Process each frame. Every rank takes nSteps steps of
+       plan->nChunks chunks so that collective writes match up; a
+       rank that has run out of frames, or has failed, writes
+       nothing in its remaining steps. A single rank stops at the
+       first failure. */
+    for(step=0; step<nSteps; step++) {
+       if(status != SUCCESS && ranks->size == 1) { break; }
+       j = firstFrame + step + 1;
+       for(chunk=0; chunk<plan->nChunks; chunk++) {
+          active = (step < nMyFrames && status == SUCCESS);
+          los0 = chunk * plan->losPerCall;
+          nLOS = los0 + plan->losPerCall <= nRa ? plan->losPerCall : nRa - los0;
+          /* First pixel of the chunk in the FITS cubes. The output
+             is written there whichever reader the input takes */
+          if(fPixel != NULL) { fPixel[1] = los0 + 1; fPixel[2] = j; }
+
+          /* Read one chunk of a frame at a time. In the original
+             cube, a frame is all sightlines in one DEC row */
+          if(active) {
+             if(chunk == 0) { startRowTimer(t); }
+             startTimer(t, STAGE_READ);
+             if(inOptions->inputType == INPUT_TABLE) {
+                if(readTableChunk(inOptions, descriptors, los0, nLOS, nFrequencies,
+                                  scratch, quImageArray)) { status = FAILURE; }
+             }
+             else switch(inOptions->fileFormat) {
+                case FITS:
+                   if(descriptors->band != NULL) {
+                      if(readFitsBand(descriptors, j-1, los0, nLOS, quImageArray))
+                         status = FAILURE;
+                      break;
+                   }
+                   if(descriptors->nReaders > 0) {
+                      if(readFitsChunk(descriptors, ((long long)(j-1)*nRa + los0)*nFrequencies,
+                                       nLOS*nFrequencies, scratch, quImageArray))
+                         status = FAILURE;
+                      break;
+                   }
+                   fits_read_pix(descriptors->qFile, TFLOAT, fPixel, nLOS*nFrequencies, NULL,
+                                 scratch, NULL, &fitsStatus);
+                   for(idx=0; idx<nLOS*nFrequencies; idx++)
+                      quImageArray[2*idx] = scratch[idx];
+                   fits_read_pix(descriptors->uFile, TFLOAT, fPixel, nLOS*nFrequencies, NULL,
+                                 scratch, NULL, &fitsStatus);
+                   for(idx=0; idx<nLOS*nFrequencies; idx++)
+                      quImageArray[2*idx+1] = scratch[idx];
+                   if(fitsStatus) {
+                      fits_report_error(stdout, fitsStatus);
+                      status = FAILURE;
+                   }
+                   break;
+                case HDF5:
+                   offsetIn[1] = j-1;
+                   offsetIn[2] = los0;
+                   countIn[2] = nLOS;
+                   countMem = nLOS * nFrequencies;
+                   qerror = H5Sselect_hyperslab(descriptors->qDataspace, H5S_SELECT_SET,
+                                          offsetIn, NULL, countIn, NULL);
+                   uerror = H5Sselect_hyperslab(descriptors->uDataspace, H5S_SELECT_SET,
+                                          offsetIn, NULL, countIn, NULL);
+                   /* HDF5 scatters Q and U straight into alternate elements */
+                   qerror |= H5Sselect_hyperslab(descriptors->qMemspace, H5S_SELECT_SET,
+                                          &offsetMem[0], &strideMem, &countMem, NULL);
+                   uerror |= H5Sselect_hyperslab(descriptors->uMemspace, H5S_SELECT_SET,
+                                          &offsetMem[1], &strideMem, &countMem, NULL);
+                   h5ErrorQ = H5Dread(descriptors->qDataset, H5T_NATIVE_FLOAT,
+                                      descriptors->qMemspace, descriptors->qDataspace,
+                                      H5P_DEFAULT, quImageArray);
+                   h5ErrorU = H5Dread(descriptors->uDataset, H5T_NATIVE_FLOAT,
+                                      descriptors->uMemspace, descriptors->uDataspace,
+                                      H5P_DEFAULT, quImageArray);
+                   if(h5ErrorQ<0 || h5ErrorU<0 || qerror<0 || uerror<0) {
+                      printf("\nError: Unable to read input data cubes\n\n");
+                      status = FAILURE;
+                   }
+                   break;
+             }
+             if(inOptions->stokesI != STOKES_I_NONE && status == SUCCESS &&
+                readStokesI(inOptions, descriptors, j, los0, nLOS, nFrequencies,
+                            logRatio, iModel, iImageArray)) { status = FAILURE; }
+             stopTimer(t, STAGE_READ);
+             addStageBytes(t, STAGE_READ, 2.*nLOS*nFrequencies*sizeof(*quImageArray));
+             if(inOptions->stokesI != STOKES_I_NONE)
+                addStageBytes(t, STAGE_READ, (inOptions->stokesI == STOKES_I_CUBE ?
+                              nFrequencies : N_MODEL_PLANES)*nLOS*sizeof(*iImageArray));
+          }
+
+          /* Compute Q(\phi), U(\phi), and P(\phi) of every sub-band
+             and grid, and refine the peaks of P(phi) and estimate
+             the noise while the frame is at hand */
+          for(o=0; o<nOutputs && active && status == SUCCESS; o++) {
+             out = &outputs[o];
+             frame = bandFrame(out, quImageArray, out->quBand, 2, nLOS, nFrequencies);
+             iFrame = NULL;
+             if(iImageArray != NULL)
+                iFrame = bandFrame(out, iImageArray, out->iBand, 1, nLOS, nFrequencies);
+             rmsSetStokesI(out->ctx, iFrame);
+             rmsStatus = rmsSynthesizeInterleaved(out->ctx, frame, nLOS,
+                                                  out->quPhi, out->pPhi);
+             if(rmsStatus != RMS_SUCCESS) {
+                printf("\nError: RM Synthesis failed: %s\n\n", rmsStatusString(rmsStatus));
+                status = FAILURE;
+             }
+             else if(inOptions->refinePeaks > 0) {
+                rmsStatus = rmsRefine(out->ctx, frame, nLOS, out->pPhi,
+                                      &refine, &out->peaks);
+                if(rmsStatus != RMS_SUCCESS) {
+                   printf("\nError: Peak refinement failed: %s\n\n", rmsStatusString(rmsStatus));
+                   status = FAILURE;
+                }
+             }
+             if((inOptions->noiseMaps || inOptions->outputMode != OUTPUT_CUBES) &&
+                status == SUCCESS) {
+                rmsStatus = rmsEstimateNoise(out->ctx, frame, nLOS, out->quPhi,
+                                             out->pPhi, inOptions->noiseExclude,
+                                             &out->noise);
+                if(rmsStatus != RMS_SUCCESS) {
+                   printf("\nError: Noise estimation failed: %s\n\n", rmsStatusString(rmsStatus));
+                   status = FAILURE;
+                }
+             }
+             if(inOptions->outputMode != OUTPUT_CUBES && status == SUCCESS) {
+                rmsStatus = rmsFindComponents(out->ctx, nLOS, out->quPhi, out->pPhi,
+                                              out->noise.sigma,
+                                              inOptions->catalogThreshold,
+                                              inOptions->catalogSNR, &components,
+                                              &nComponents);
+                if(rmsStatus != RMS_SUCCESS) {
+                   printf("\nError: Component search failed: %s\n\n", rmsStatusString(rmsStatus));
+                   status = FAILURE;
+                }
+                else if(addComponents(&out->catalog, j-1, los0, components, nComponents))
+                   status = FAILURE;
+             }
+             if(inOptions->fitModel != FIT_NONE && status == SUCCESS) {
+                rmsStatus = rmsFitQU(out->ctx, frame, nLOS, out->quPhi, out->pPhi,
+                                     inOptions->refinePeaks > 0 ? &out->peaks : NULL,
+                                     &fit, &out->fit);
+                if(rmsStatus != RMS_SUCCESS) {
+                   printf("\nError: QU-fitting failed: %s\n\n", rmsStatusString(rmsStatus));
+                   status = FAILURE;
+                }
+             }
+          }
+          active = (active && status == SUCCESS);
+          if(!active && ranks->size == 1) { break; }
+
+          /* Write the output cubes, products and catalog to disk */
+          startTimer(t, STAGE_WRITE);
+          if(skyOrder) {
+             if(tileHeld == 0) { tileFirst = j; }
+             for(o=0; o<nOutputs; o++) {
+                out = &outputs[o];
+                nPhi = out->options.nPhi;
+                addFrameToTile(out->quPhi,   2, out->qTile, tileHeld, los0, nLOS, tileRows, nRa, nPhi);
+                addFrameToTile(out->quPhi+1, 2, out->uTile, tileHeld, los0, nLOS, tileRows, nRa, nPhi);
+                addFrameToTile(out->pPhi,    1, out->pTile, tileHeld, los0, nLOS, tileRows, nRa, nPhi);
+             }
+             if(chunk == plan->nChunks-1) { tileHeld++; }
+             if(chunk == plan->nChunks-1 &&
+                (tileHeld == tileRows || step == nMyFrames-1)) {
+                for(o=0; o<nOutputs && status == SUCCESS; o++) {
+                   out = &outputs[o];
+                   nPhi = out->options.nPhi;
+                   if(writeSkyTile(out->descriptors.qDirty, tileFirst, tileHeld,
+                                   tileRows, nRa, nPhi, out->qTile) ||
+                      writeSkyTile(out->descriptors.uDirty, tileFirst, tileHeld,
+                                   tileRows, nRa, nPhi, out->uTile) ||
+                      writeSkyTile(out->descriptors.pDirty, tileFirst, tileHeld,
+                                   tileRows, nRa, nPhi, out->pTile)) { status = FAILURE; }
+                }
+                tileHeld = 0;
+             }
+          }
+          for(o=0; o<nOutputs; o++) {
+             out = &outputs[o];
+             nOutElements = (long)out->options.nPhi * plan->losPerCall;
+             if(!skyOrder && inOptions->outputMode != OUTPUT_CATALOG &&
+                writeOutputChunk(inOptions, out, active ? j-1 : -1, los0, nLOS,
+                                 nOutElements, fPixel, scratch, frames, o == 0))
+                status = FAILURE;
+             if(writeProducts(&out->products, active ? j-1 : -1, los0, nLOS))
+                status = FAILURE;
+             if(active && inOptions->outputMode != OUTPUT_CATALOG)
+                addStageBytes(t, STAGE_WRITE, 3.*out->options.nPhi*nLOS*sizeof(*out->pPhi));
+             if(inOptions->outputMode != OUTPUT_CUBES) {
+                addStageBytes(t, STAGE_WRITE, (double)out->catalog.nPending*
+                              sizeof(struct catalogRow));
+                if(writeCatalog(&out->catalog)) { status = FAILURE; }
+             }
+          }
+          stopTimer(t, STAGE_WRITE);
+          if(active) {
+             addStageBytes(t, STAGE_WRITE, (double)nPlanes*nLOS*sizeof(*quImageArray));
+             if(chunk == plan->nChunks-1) { stopRowTimer(t); }
+          }
+       }
+    }
+
+    /* The frame buffers stay in the arena for the next job */
+    for(o=0; o<nOutputs; o++) {
+        rmsSetTimer(outputs[o].ctx, NULL);
+        rmsSetStokesI(outputs[o].ctx, NULL);
+    }
+    free(logRatio);
+    switch(inOptions->fileFormat) {
+    case FITS:
+       free(fPixel);
+       descriptors->band = NULL;
+       break;
+    case HDF5:
+       closeHDF5Inputs(descriptors);
+       for(o=0; o<nOutputs; o++) { closeHDF5Outputs(&outputs[o].descriptors); }
+       break;
+    }
+    return(agreeStatus(status));
+}
@@ -0,0 +1,64 @@
+/******************************************************************************
+dosynthesis.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef DOSYNTHESIS_H
+#define DOSYNTHESIS_H
+
+/* One set of output cubes made from the frames of a job, one per
+   sub-band and phi grid: its options (channels, phi axis,
+   outPrefix), output files,
+   products, catalog, librmsynth context and RMSF. Only the output fields
+   of descriptors are used. The RMSF arrays of rmsf are owned,
+   its channel arrays are the job's. The frame buffers and peaks
+   are set up by doRMSynthesis(). */
+struct synthOutput {
+    struct optionsList options;
+    char outPrefix[FILENAME_LEN];
+    struct parameters params;
+    struct IOFileDescriptors descriptors;
+    struct productSet products;
+    struct catalog catalog;
+    struct rmsPeaks peaks;
+    struct rmsNoise noise;
+    struct rmsFitResult fit;
+    struct DataArrays rmsf;
+    struct rmsContext *ctx;
+    int ownsContext;
+    float *quBand, *iBand;      /* Sub-band of a FITS frame, or NULL */
+    float *quPhi, *pPhi, *quAll, *pAll;
+    float *qTile, *uTile, *pTile;
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+
+int doRMSynthesis(struct optionsList *inOptions,
+                  struct IOFileDescriptors *descriptors,
+                  struct parameters *params,
+                  struct DataArrays *data_arrays,
+                  struct memoryPlan *plan,
+                  struct hostArena *arena,
+                  struct synthOutput *outputs, int nOutputs,
+                  struct timeInfoList *t);
+
+#endif
@@ -0,0 +1,327 @@
+/******************************************************************************
+engine.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<unistd.h>
+
+#include "constants.h"
+#include "engine.h"
+#include "cpusynth.h"
+#include "kernels.h"
+
+static const char *backendNames[N_BACKENDS] = { "cpu", "cuda" };
+static const char *variantNames[N_KERNELS]  = { "direct", "recurrence" };
+
+const char *backendName(int backend) { return(backendNames[backend]); }
+const char *variantName(int variant) { return(variantNames[variant]); }
+
+/*************************************************************
+*
+* Check whether a backend implements a kernel variant
+*
+*************************************************************/
+int engineHasVariant(int backend, int variant) {
+    switch(backend) {
+       case BACKEND_CPU:
+          return(variant == KERNEL_DIRECT || variant == KERNEL_RECURRENCE);
+       case BACKEND_CUDA:
+          #ifdef CUDA_ENABLE
+          return(variant == KERNEL_DIRECT);
+          #else
+          return(FALSE);
+          #endif
+       default:
+          return(FALSE);
+    }
+}
+
+/*************************************************************
+*
+* Set up an engine for frames of up to maxLOS sightlines. With
+*  stokesI, device backends also set aside room for a frame of
+*  Stokes I for setEngineStokesI().
+*
+*************************************************************/
+int initEngine(struct synthEngine *engine, int backend, int variant,
+               int layout, int nChan, int nPhi, long maxLOS, int stokesI,
+               const float *phiAxis, const double *lambda2, double lambda20,
+               const double *weights, int nThreads, int deviceId) {
+    double sumWeights = 0., dPhi;
+    int i;
+
+    memset(engine, 0, sizeof(*engine));
+    if(!engineHasVariant(backend, variant)) {
+        printf("Error: Backend %s does not provide the %s kernel\n",
+               backendName(backend), variantName(variant));
+        return(FAILURE);
+    }
+    engine->backend  = backend;
+    engine->variant  = variant;
+    engine->layout   = layout;
+    engine->nChan    = nChan;
+    engine->nPhi     = nPhi;
+    engine->maxLOS   = maxLOS;
+    engine->stokesI  = stokesI;
+    engine->deviceId = deviceId;
+    engine->nThreads = nThreads > 0 ? nThreads : sysconf(_SC_NPROCESSORS_ONLN);
+
+    engine->phiAxis     = calloc(nPhi,  sizeof(*engine->phiAxis));
+    engine->lambdaDiff2 = calloc(nChan, sizeof(*engine->lambdaDiff2));
+    engine->weights     = calloc(nChan, sizeof(*engine->weights));
+    engine->stepCos     = calloc(nChan, sizeof(*engine->stepCos));
+    engine->stepSin     = calloc(nChan, sizeof(*engine->stepSin));
+    if(engine->phiAxis == NULL || engine->lambdaDiff2 == NULL ||
+       engine->weights == NULL || engine->stepCos == NULL ||
+       engine->stepSin == NULL) {
+        printf("Error: Mem alloc failed while setting up the engine\n");
+        freeEngine(engine);
+        return(FAILURE);
+    }
+
+    /* Same constants as doRMSynthesis: 2(\lambda^2 - \lambda^2_0), w and K */
+    memcpy(engine->phiAxis, phiAxis, nPhi*sizeof(*phiAxis));
+    for(i=0; i<nChan; i++) {
+        engine->lambdaDiff2[i] = 2.0*(lambda2[i] - lambda20);
+        engine->weights[i]     = weights == NULL ? 1. : weights[i];
+        sumWeights += engine->weights[i];
+    }
+    engine->K = 1.0/sumWeights;
+    engine->lambda20 = lambda20;
+
+    /* The recurrence steps every channel phasor by exp(-i dPhi lambdaDiff2).
+       This needs a uniform phi axis. */
+    if(variant == KERNEL_RECURRENCE) {
+        dPhi = nPhi > 1 ? (double)phiAxis[1] - phiAxis[0] : 0.;
+        for(i=2; i<nPhi; i++) {
+            if(fabs(phiAxis[i] - (phiAxis[0] + i*dPhi)) > 1e-3*fabs(dPhi)) {
+                printf("Error: The recurrence kernel needs a uniform phi axis\n");
+                freeEngine(engine);
+                return(FAILURE);
+            }
+        }
+        for(i=0; i<nChan; i++) {
+            engine->stepCos[i] = cos(dPhi*engine->lambdaDiff2[i]);
+            engine->stepSin[i] = sin(dPhi*engine->lambdaDiff2[i]);
+        }
+    }
+
+    #ifdef CUDA_ENABLE
+    if(backend == BACKEND_CUDA && initDeviceEngine(engine)) {
+        freeEngine(engine);
+        return(FAILURE);
+    }
+    #endif
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Synthesize one frame of nLOS sightlines of interleaved Q and
+*  U into interleaved Q(\phi), U(\phi) and P(\phi)
+*
+*************************************************************/
+int runEngine(struct synthEngine *engine, const float *quImageArray,
+              long nLOS, float *quPhi, float *pPhi) {
+    if(nLOS > engine->maxLOS) {
+        printf("Error: Frame of %ld sightlines exceeds engine size %ld\n",
+               nLOS, engine->maxLOS);
+        return(FAILURE);
+    }
+    switch(engine->backend) {
+       #ifdef CUDA_ENABLE
+       case BACKEND_CUDA:
+          return(runDeviceEngine(engine, quImageArray, nLOS, quPhi, pPhi));
+       #endif
+       case BACKEND_CPU:
+          return(cpuComputeQUP(engine, quImageArray, nLOS, quPhi, pPhi));
+       default:
+          return(FAILURE);
+    }
+}
+
+/*************************************************************
+*
+* Evaluate Q(\phi)+iU(\phi) and P(\phi) at nPoints arbitrary
+*  points of a frame: point n is sightline losIndex[n] at
+*  Faraday depth phi[n]. quOut holds 2*nPoints and pOut nPoints
+*  values. The CUDA backend reuses the copy of the frame left on
+*  the device by runEngine() if quImageArray is that same frame.
+*
+*************************************************************/
+int runEngineSparse(struct synthEngine *engine, const float *quImageArray,
+                    long nLOS, long nPoints, const int *losIndex,
+                    const float *phi, float *quOut, float *pOut) {
+    if(nLOS > engine->maxLOS) {
+        printf("Error: Frame of %ld sightlines exceeds engine size %ld\n",
+               nLOS, engine->maxLOS);
+        return(FAILURE);
+    }
+    if(nPoints < 1) { return(SUCCESS); }
+    switch(engine->backend) {
+       #ifdef CUDA_ENABLE
+       case BACKEND_CUDA:
+          return(runDeviceSparse(engine, quImageArray, nLOS, nPoints,
+                                 losIndex, phi, quOut, pOut));
+       #endif
+       case BACKEND_CPU:
+          return(cpuSparseQUP(engine, quImageArray, nLOS, nPoints,
+                              losIndex, phi, quOut, pOut));
+       default:
+          return(FAILURE);
+    }
+}
+
+/*************************************************************
+*
+* Fit a model to the Q and U spectra of every sightline of a
+*  frame by Levenberg-Marquardt. params holds fitParameters()
+*  planes of nLOS values: the starting point on entry, the fit
+*  on return. errors (same shape) and chi2 (nLOS values) receive
+*  the uncertainties and the residual per degree of freedom.
+*  Sightlines whose start is NaN, or that cannot be fitted, get
+*  NaN. As for runEngineSparse(), the CUDA backend reuses the
+*  frame left on the device.
+*
+*************************************************************/
+int runEngineFit(struct synthEngine *engine, const float *quImageArray,
+                 long nLOS, int model, int maxIter, float *params,
+                 float *errors, float *chi2) {
+    if(nLOS > engine->maxLOS) {
+        printf("Error: Frame of %ld sightlines exceeds engine size %ld\n",
+               nLOS, engine->maxLOS);
+        return(FAILURE);
+    }
+    if(model != FIT_THIN && model != FIT_THICK) { return(FAILURE); }
+    switch(engine->backend) {
+       #ifdef CUDA_ENABLE
+       case BACKEND_CUDA:
+          return(runDeviceFit(engine, quImageArray, nLOS, model, maxIter,
+                              params, errors, chi2));
+       #endif
+       case BACKEND_CPU:
+          return(cpuFitQU(engine, quImageArray, nLOS, model, maxIter,
+                          params, errors, chi2));
+       default:
+          return(FAILURE);
+    }
+}
+
+/* Parameters of a fitted model: p0, psi0 and phi, and the width
+   of a Burn slab */
+int fitParameters(int model) {
+    return(model == FIT_THICK ? 4 : 3);
+}
+
+/*************************************************************
+*
+* Divide Q and U of the frames given to later runEngine*()
+*  calls by iImageArray, a frame of Stokes I in the same layout.
+*  Channels where I is not positive do not contribute. The
+*  frame is read in place; NULL switches the division off.
+*
+*************************************************************/
+void setEngineStokesI(struct synthEngine *engine, const float *iImageArray) {
+    engine->iFrame = iImageArray;
+    /* The copy of Q and U on the device goes with the old I */
+    engine->deviceFrame = NULL;
+}
+
+/*************************************************************
+*
+* Convert between separate Q and U arrays of n values and one
+*  interleaved array of 2n
+*
+*************************************************************/
+void interleaveQU(const float *q, const float *u, long n, float *qu) {
+    long i;
+    for(i=0; i<n; i++) {
+        qu[2*i]   = q[i];
+        qu[2*i+1] = u[i];
+    }
+}
+
+void splitQU(const float *qu, long n, float *q, float *u) {
+    long i;
+    for(i=0; i<n; i++) {
+        q[i] = qu[2*i];
+        u[i] = qu[2*i+1];
+    }
+}
+
+/*************************************************************
+*
+* Same as runEngine() for callers that hold Q and U in separate
+*  arrays. The frames are interleaved into buffers owned by the
+*  engine, which costs a copy each way.
+*
+*************************************************************/
+int runEngineSplit(struct synthEngine *engine, const float *qImageArray,
+                   const float *uImageArray, long nLOS,
+                   float *qPhi, float *uPhi, float *pPhi) {
+    long nIn  = nLOS * engine->nChan;
+    long nOut = nLOS * engine->nPhi;
+
+    if(nLOS > engine->maxLOS) {
+        printf("Error: Frame of %ld sightlines exceeds engine size %ld\n",
+               nLOS, engine->maxLOS);
+        return(FAILURE);
+    }
+    if(engine->quIn == NULL) {
+        engine->quIn  = malloc(2*engine->maxLOS*engine->nChan*sizeof(*engine->quIn));
+        engine->quOut = malloc(2*engine->maxLOS*engine->nPhi*sizeof(*engine->quOut));
+        if(engine->quIn == NULL || engine->quOut == NULL) {
+            printf("Error: Mem alloc failed while interleaving Q and U\n");
+            free(engine->quIn); free(engine->quOut);
+            engine->quIn = engine->quOut = NULL;
+            return(FAILURE);
+        }
+    }
+    interleaveQU(qImageArray, uImageArray, nIn, engine->quIn);
+    if(runEngine(engine, engine->quIn, nLOS, engine->quOut, pPhi)) { return(FAILURE); }
+    splitQU(engine->quOut, nOut, qPhi, uPhi);
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Release everything held by an engine
+*
+*************************************************************/
+void freeEngine(struct synthEngine *engine) {
+    #ifdef CUDA_ENABLE
+    if(engine->backend == BACKEND_CUDA)
+        freeDeviceEngine(engine);
+    #endif
+    free(engine->phiAxis);
+    free(engine->lambdaDiff2);
+    free(engine->weights);
+    free(engine->stepCos);
+    free(engine->stepSin);
+    free(engine->quIn);
+    free(engine->quOut);
+    engine->phiAxis = engine->lambdaDiff2 = engine->weights = NULL;
+    engine->stepCos = engine->stepSin = NULL;
+    engine->quIn = engine->quOut = NULL;
+}
@@ -0,0 +1,109 @@
+/******************************************************************************
+engine.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "constants.h"
+#include "timing.h"
+
+/* A synthesis engine turns frames of Q and U spectra into Q(phi),
+   U(phi) and P(phi) with one backend. It does not depend on cfitsio,
+   HDF5 or libconfig so that it can be linked on its own. Spectra are
+   held as interleaved complex values, Q and U of a channel (or of a
+   phi plane) next to each other, as in a C99 float complex array. */
+struct synthEngine {
+    int backend, variant, layout;
+    int nChan, nPhi;
+    long maxLOS;
+    int stokesI;                /* Room for a Stokes I frame reserved */
+    float K, lambda20;
+
+    /* Host copies of the per-channel and per-phi constants */
+    float *phiAxis, *lambdaDiff2, *weights;
+    float *stepCos, *stepSin;   /* Phasor step for KERNEL_RECURRENCE */
+    int nThreads;
+
+    /* Interleaved frames for runEngineSplit(), made on first use */
+    float *quIn, *quOut;
+
+    /* Points evaluated by runEngineSparse(), grown on demand */
+    long maxPoints;
+    /* Sightlines fitted by runEngineFit() on the device, same */
+    long maxFit;
+
+    /* Stokes I of the frames, laid out as they are but with one
+       float per element, or NULL. Q and U are divided by it as
+       they are loaded; see setEngineStokesI() */
+    const float *iFrame;
+
+    /* Optional timers */
+    struct timeInfoList *t;
+
+    /* Device state for BACKEND_CUDA */
+    int deviceId, warpSize;
+    float *d_phiAxis, *d_lambdaDiff2, *d_weights;
+    float *d_quImageArray, *d_quPhi, *d_pPhi;
+    void *d_pool;               /* One allocation holding the above */
+    int *d_pointLOS;
+    float *d_pointPhi, *d_pointQU, *d_pointP;
+    void *d_pointPool;          /* Same for the sparse points */
+    float *d_fitParams, *d_fitErrors, *d_fitChi2;
+    void *d_fitPool;            /* Same for QU-fitting, made on first use */
+    const float *deviceFrame;   /* Host frame last copied to d_quImageArray */
+    float *d_iImageArray;       /* Stokes I, in d_pool if stokesI is set */
+    void *evStart, *evStop;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int initEngine(struct synthEngine *engine, int backend, int variant,
+               int layout, int nChan, int nPhi, long maxLOS, int stokesI,
+               const float *phiAxis, const double *lambda2, double lambda20,
+               const double *weights, int nThreads, int deviceId);
+int runEngine(struct synthEngine *engine, const float *quImageArray,
+              long nLOS, float *quPhi, float *pPhi);
+int runEngineSplit(struct synthEngine *engine, const float *qImageArray,
+                   const float *uImageArray, long nLOS,
+                   float *qPhi, float *uPhi, float *pPhi);
+int runEngineSparse(struct synthEngine *engine, const float *quImageArray,
+                    long nLOS, long nPoints, const int *losIndex,
+                    const float *phi, float *quOut, float *pOut);
+int runEngineFit(struct synthEngine *engine, const float *quImageArray,
+                 long nLOS, int model, int maxIter, float *params,
+                 float *errors, float *chi2);
+int fitParameters(int model);
+void setEngineStokesI(struct synthEngine *engine, const float *iImageArray);
+void interleaveQU(const float *q, const float *u, long n, float *qu);
+void splitQU(const float *qu, long n, float *q, float *u);
+void freeEngine(struct synthEngine *engine);
+int engineHasVariant(int backend, int variant);
+const char *backendName(int backend);
+const char *variantName(int variant);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
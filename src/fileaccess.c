@@ -1,4 +1,4 @@
-params/******************************************************************************
+/******************************************************************************
 fileaccess.c
 Copyright (C) 2016  {fullname}
 
@@ -20,15 +20,21 @@ Correspondence concerning RMSynth_GPU should be addressed to:
 sarrvesh.ss@gmail.com
 
 ******************************************************************************/
+#include<stdlib.h>
+#include<string.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<pthread.h>
+#include<arpa/inet.h>
+
 #include "fitsio.h"
 #include "structures.h"
 #include "constants.h"
 #include "fileaccess.h"
 #include "hdf5.h"
 #include "hdf5_hl.h"
-
-#define BUNIT   "JY/BEAM"
-#define RM      "PHI"
+#include "ranks.h"
 
 /*************************************************************
 *
@@ -44,45 +50,621 @@ void checkFitsError(int status) {
     }
 }
 
+/* File holding the Stokes I cube or model of a job */
+const char *stokesIName(struct optionsList *inOptions) {
+   return(inOptions->stokesI == STOKES_I_CUBE ? inOptions->iCubeName :
+                                                inOptions->iModelName);
+}
+
 /*************************************************************
 *
 * Check of the input files are open-able
 *
 *************************************************************/
-void checkInputFiles(struct optionsList *inOptions, struct IOFileDescriptors *descriptors) {
+int checkInputFiles(struct optionsList *inOptions, struct IOFileDescriptors *descriptors) {
    int fitsStatus = SUCCESS;
    herr_t error;
    char buf[STRING_BUF_LEN];
 
+   descriptors->freq = NULL;
    if(inOptions->fileFormat == FITS) {
       /* Check if all the input fits files are accessible */
-      fits_open_file(&(descriptors->qFile), inOptions->qCubeName, READONLY, &fitsStatus);
-      fits_open_file(&(descriptors->uFile), inOptions->uCubeName, READONLY, &fitsStatus);
-      checkFitsError(fitsStatus);
+      descriptors->qFile = NULL; descriptors->uFile = NULL;
+      descriptors->iFile = NULL;
+      if(inOptions->inputType == INPUT_TABLE) {
+         /* Moves to the first table extension */
+         fits_open_table(&(descriptors->qFile), inOptions->qCubeName, READONLY, &fitsStatus);
+         fits_open_table(&(descriptors->uFile), inOptions->uCubeName, READONLY, &fitsStatus);
+      }
+      else {
+         /* Moves to the first image, which in a tile-compressed
+            (fpack) file is the first extension */
+         fits_open_image(&(descriptors->qFile), inOptions->qCubeName, READONLY, &fitsStatus);
+         fits_open_image(&(descriptors->uFile), inOptions->uCubeName, READONLY, &fitsStatus);
+      }
+      if(inOptions->stokesI != STOKES_I_NONE)
+         fits_open_image(&(descriptors->iFile), stokesIName(inOptions), READONLY, &fitsStatus);
+      if(fitsStatus) {
+         fits_report_error(stdout, fitsStatus);
+         closeInputFiles(inOptions, descriptors);
+         return(FAILURE);
+      }
    }
    else if(inOptions->fileFormat == HDF5) {
       /* Open HDF5 files */
+      descriptors->iFileh5 = -1;
       descriptors->qFileh5 = H5Fopen(inOptions->qCubeName, H5F_ACC_RDONLY, H5P_DEFAULT);
       descriptors->uFileh5 = H5Fopen(inOptions->uCubeName, H5F_ACC_RDONLY, H5P_DEFAULT);
       if(descriptors->qFileh5 < 0 || descriptors->uFileh5 < 0) {
          printf("Error: Unable to open the input HDF5 files\n\n");
-         exit(FAILURE);
+         closeInputFiles(inOptions, descriptors);
+         return(FAILURE);
       }
-      /* Check if the hdf5 files are compatible with HDFITS format */
-      error = H5LTget_attribute_string(descriptors->qFileh5, "/", "CLASS", buf);
+      if(inOptions->stokesI != STOKES_I_NONE) {
+         descriptors->iFileh5 = H5Fopen(stokesIName(inOptions), H5F_ACC_RDONLY, H5P_DEFAULT);
+         if(descriptors->iFileh5 < 0) {
+            printf("Error: Unable to open %s\n\n", stokesIName(inOptions));
+            closeInputFiles(inOptions, descriptors);
+            return(FAILURE);
+         }
+      }
+      /* Check if the hdf5 files are compatible with HDFITS format.
+         Tables are plain datasets. */
+      error = 0;
+      if(inOptions->inputType == INPUT_CUBE)
+         error = H5LTget_attribute_string(descriptors->qFileh5, "/", "CLASS", buf);
       if(error < 0) {
          printf("ERROR: Specified HDF5 file is not in HDFITS format\n\n");
-         exit(FAILURE);
+         closeInputFiles(inOptions, descriptors);
+         return(FAILURE);
       }
    }
    else {}
 
    /* Check if you can open the frequency file */
-   descriptors->freq = fopen(inOptions->freqFileName, FILE_READONLY);
-   if(descriptors->freq == NULL) {
-      printf("Error: Unable to open the frequency file\n\n");
-      exit(FAILURE);
+   if(inOptions->freqFormat == FREQ_TEXT || inOptions->freqFormat == FREQ_BINARY) {
+      descriptors->freq = fopen(inOptions->freqFileName,
+                 inOptions->freqFormat == FREQ_TEXT ? FILE_READONLY : FILE_READBINARY);
+      if(descriptors->freq == NULL) {
+         printf("Error: Unable to open the frequency file\n\n");
+         closeInputFiles(inOptions, descriptors);
+         return(FAILURE);
+      }
    }
+   return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Close whichever input files checkInputFiles() managed to
+*  open. Used on error paths so that a long-running process
+*  does not leak file handles.
+*
+*************************************************************/
+void closeInputFiles(struct optionsList *inOptions, struct IOFileDescriptors *descriptors) {
+   int fitsStatus = SUCCESS;
+
+   if(inOptions->fileFormat == FITS) {
+      if(descriptors->qFile != NULL) { fits_close_file(descriptors->qFile, &fitsStatus); }
+      fitsStatus = SUCCESS;
+      if(descriptors->uFile != NULL) { fits_close_file(descriptors->uFile, &fitsStatus); }
+      fitsStatus = SUCCESS;
+      if(descriptors->iFile != NULL) { fits_close_file(descriptors->iFile, &fitsStatus); }
+      descriptors->qFile = NULL; descriptors->uFile = NULL;
+      descriptors->iFile = NULL;
+   }
+   else if(inOptions->fileFormat == HDF5) {
+      if(descriptors->qFileh5 >= 0) { H5Fclose(descriptors->qFileh5); }
+      if(descriptors->uFileh5 >= 0) { H5Fclose(descriptors->uFileh5); }
+      if(descriptors->iFileh5 >= 0) { H5Fclose(descriptors->iFileh5); }
+      descriptors->qFileh5 = -1; descriptors->uFileh5 = -1;
+      descriptors->iFileh5 = -1;
+   }
+   if(descriptors->freq != NULL) {
+      fclose(descriptors->freq);
+      descriptors->freq = NULL;
+   }
+   closeFitsReaders(descriptors);
+}
+
+/*************************************************************
+*
+* Parallel reads of the FITS input cubes. cfitsio shares one
+*  internal file structure between all handles of the same file
+*  in a process, so handles opened with fits_open_file cannot
+*  read concurrently. An uncompressed cube of IEEE floats is a
+*  plain big-endian array after its header, so each reader
+*  thread gets its own file descriptor per cube and reads with
+*  pread. Tile-compressed cubes are decoded by cfitsio on the
+*  reader threads: each thread opens its own cfitsio handle on
+*  its descriptor, which cfitsio takes for a different file, and
+*  reads whole tiles so that no tile is decoded twice. This
+*  needs a thread safe (reentrant) cfitsio. Other cubes (scaled
+*  or not BITPIX = -32) keep the single handle. The reader threads
+*  are started with the descriptors and wait for the chunks until
+*  closeFitsReaders(), rather than being created for each one.
+*
+*************************************************************/
+static int fitsDataStart(fitsfile *file, long long *dataStart) {
+    LONGLONG headStart, start, dataEnd;
+    char fitsComment[FLEN_COMMENT];
+    double scale = 1., zero = 0.;
+    int type, compressed, status = 0, keyStatus = 0;
+
+    fits_get_img_equivtype(file, &type, &status);
+    compressed = fits_is_compressed_image(file, &status);
+    fits_get_hduaddrll(file, &headStart, &start, &dataEnd, &status);
+    /* Missing BSCALE and BZERO mean the pixels are not scaled */
+    fits_read_key(file, TDOUBLE, "BSCALE", &scale, fitsComment, &keyStatus);
+    keyStatus = 0;
+    fits_read_key(file, TDOUBLE, "BZERO", &zero, fitsComment, &keyStatus);
+    if(status || compressed || type != FLOAT_IMG || scale != 1. || zero != 0.)
+        return(FAILURE);
+    *dataStart = start;
+    return(SUCCESS);
+}
+
+static int openTileFile(fitsfile *cube, int fd, fitsfile **file) {
+    char name[FILENAME_LEN];
+    int hdu, status = 0;
+
+    sprintf(name, "/proc/self/fd/%d", fd);
+    fits_get_hdu_num(cube, &hdu);
+    fits_open_file(file, name, READONLY, &status);
+    fits_movabs_hdu(*file, hdu, NULL, &status);
+    return(status);
+}
+
+/* Reader threads, started by openFitsReaders() and joined by
+   closeFitsReaders(). readFitsChunk() hands out one job per reader
+   and bumps generation; readers 1..nActive-1 take theirs and count
+   pending down, reader 0 being the calling thread. */
+struct fitsReadJob;
+struct fitsReader {
+    struct fitsReaderPool *pool;
+    int index;
+    pthread_t thread;
+};
+struct fitsReaderPool {
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    struct fitsReader *readers;
+    struct fitsReadJob *jobs;
+    int nStarted, nActive, pending, quit;
+    long generation;
+};
+
+static int startReaders(struct IOFileDescriptors *descriptors);
+static void stopReaders(struct IOFileDescriptors *descriptors);
+
+int openFitsReaders(struct optionsList *inOptions, struct parameters *params,
+                    struct IOFileDescriptors *descriptors) {
+    int i, n = inOptions->readThreads, compressed = (params->tileLOS > 0);
+
+    descriptors->nReaders = 0;
+    descriptors->readUnit = 1;
+    if(compressed) {
+        if(!fits_is_reentrant()) {
+            printf("INFO: cfitsio is not thread safe, decoding the input cubes on one thread\n");
+            return(SUCCESS);
+        }
+        descriptors->readUnit = (long)params->tileLOS * params->qAxisLen3;
+    }
+    else if(fitsDataStart(descriptors->qFile, &descriptors->qDataStart) ||
+            fitsDataStart(descriptors->uFile, &descriptors->uDataStart)) {
+        printf("INFO: Input cubes need cfitsio to decode, reading on one thread\n");
+        return(SUCCESS);
+    }
+    descriptors->qReadFds = (int *)malloc(n*sizeof(int));
+    descriptors->uReadFds = (int *)malloc(n*sizeof(int));
+    if(compressed) {
+        descriptors->qTileFiles = (fitsfile **)calloc(n, sizeof(fitsfile *));
+        descriptors->uTileFiles = (fitsfile **)calloc(n, sizeof(fitsfile *));
+    }
+    if(descriptors->qReadFds == NULL || descriptors->uReadFds == NULL ||
+       (compressed && (descriptors->qTileFiles == NULL || descriptors->uTileFiles == NULL))) {
+        closeFitsReaders(descriptors);
+        printf("Error: Mem alloc failed while opening the readers\n\n");
+        return(FAILURE);
+    }
+    for(i=0; i<n; i++) { descriptors->qReadFds[i] = descriptors->uReadFds[i] = -1; }
+    descriptors->nReaders = n;
+    for(i=0; i<n; i++) {
+        descriptors->qReadFds[i] = open(inOptions->qCubeName, O_RDONLY);
+        descriptors->uReadFds[i] = open(inOptions->uCubeName, O_RDONLY);
+        if(descriptors->qReadFds[i] < 0 || descriptors->uReadFds[i] < 0) {
+            /* e.g. a name with cfitsio filters */
+            closeFitsReaders(descriptors);
+            printf("INFO: Unable to open the input cubes directly, reading on one thread\n");
+            return(SUCCESS);
+        }
+        if(compressed &&
+           (openTileFile(descriptors->qFile, descriptors->qReadFds[i], &descriptors->qTileFiles[i]) ||
+            openTileFile(descriptors->uFile, descriptors->uReadFds[i], &descriptors->uTileFiles[i]))) {
+            closeFitsReaders(descriptors);
+            printf("INFO: Unable to reopen the compressed cubes, decoding on one thread\n");
+            return(SUCCESS);
+        }
+    }
+    if(startReaders(descriptors)) {
+        closeFitsReaders(descriptors);
+        printf("Error: Unable to start reader thread\n\n");
+        return(FAILURE);
+    }
+    if(compressed)
+        printf("INFO: Decoding the input cubes on %d threads, %d sightlines per tile\n",
+               n, params->tileLOS);
+    else
+        printf("INFO: Reading the input cubes on %d threads\n", n);
+    return(SUCCESS);
+}
+
+void closeFitsReaders(struct IOFileDescriptors *descriptors) {
+    int i, status;
+
+    stopReaders(descriptors);
+    for(i=0; descriptors->qTileFiles != NULL && i<descriptors->nReaders; i++) {
+        status = 0;
+        if(descriptors->qTileFiles[i] != NULL) { fits_close_file(descriptors->qTileFiles[i], &status); }
+        status = 0;
+        if(descriptors->uTileFiles[i] != NULL) { fits_close_file(descriptors->uTileFiles[i], &status); }
+    }
+    free(descriptors->qTileFiles);
+    free(descriptors->uTileFiles);
+    descriptors->qTileFiles = descriptors->uTileFiles = NULL;
+    for(i=0; i<descriptors->nReaders; i++) {
+        if(descriptors->qReadFds[i] >= 0) { close(descriptors->qReadFds[i]); }
+        if(descriptors->uReadFds[i] >= 0) { close(descriptors->uReadFds[i]); }
+    }
+    free(descriptors->qReadFds);
+    free(descriptors->uReadFds);
+    descriptors->qReadFds = descriptors->uReadFds = NULL;
+    descriptors->nReaders = 0;
+}
+
+/* One reader's share of a chunk: pixels [start, stop) of Q and
+   of U, both read into scratch[start, stop) in turn. Compressed
+   cubes are read through qFile and uFile from pixel first. With
+   band set, the share is sightlines [start, stop) of bandRows
+   rows from bandFirst instead, read into band (see readFitsBand()) */
+struct fitsReadJob {
+    int qFd, uFd;
+    fitsfile *qFile, *uFile;
+    long long qOffset, uOffset, first;
+    long start, stop;
+    int uFirst;
+    float *scratch, *quImageArray;
+    float *band;
+    long bandSize, nChan;
+    int bandFirst, bandRows;
+    int status;
+};
+
+static int readFully(int fd, char *buf, size_t nBytes, off_t offset) {
+    ssize_t got;
+
+    while(nBytes > 0) {
+        got = pread(fd, buf, nBytes, offset);
+        if(got <= 0) { return(FAILURE); }
+        buf += got; nBytes -= got; offset += got;
+    }
+    return(SUCCESS);
+}
+
+static void *readFitsShare(void *arg) {
+    struct fitsReadJob *job = (struct fitsReadJob *)arg;
+    uint32_t *raw = (uint32_t *)(job->scratch + job->start);
+    union { uint32_t i; float f; } pixel;
+    long n = job->stop - job->start, idx;
+    long fPixel[N_DIMS], lPixel[N_DIMS], inc[N_DIMS] = {1, 1, 1};
+    int k, comp, fd, fitsStatus = 0;
+    long long offset;
+
+    job->status = SUCCESS;
+    /* Half the readers start on U so that both cubes stream at once */
+    for(k=0; k<NUM_INPUTS && job->status == SUCCESS; k++) {
+        comp   = job->uFirst ? 1-k : k;
+        if(job->band != NULL) {
+            fPixel[0] = 1;              lPixel[0] = job->nChan;
+            fPixel[1] = job->start + 1; lPixel[1] = job->stop;
+            fPixel[2] = job->bandFirst + 1;
+            lPixel[2] = job->bandFirst + job->bandRows;
+            fits_read_subset(comp ? job->uFile : job->qFile, TFLOAT, fPixel, lPixel, inc,
+                             NULL, job->band + comp*job->bandSize +
+                             job->bandRows*job->start*job->nChan, NULL, &fitsStatus);
+            if(fitsStatus) {
+                fits_report_error(stdout, fitsStatus);
+                job->status = FAILURE;
+            }
+            continue;
+        }
+        if(job->qFile != NULL) {
+            fits_read_img(comp ? job->uFile : job->qFile, TFLOAT, job->first + job->start + 1,
+                          n, NULL, job->scratch + job->start, NULL, &fitsStatus);
+            if(fitsStatus) {
+                fits_report_error(stdout, fitsStatus);
+                job->status = FAILURE;
+                break;
+            }
+            for(idx=0; idx<n; idx++)
+                job->quImageArray[2*(job->start+idx)+comp] = job->scratch[job->start+idx];
+            continue;
+        }
+        fd     = comp ? job->uFd : job->qFd;
+        offset = (comp ? job->uOffset : job->qOffset) + job->start*(long long)sizeof(float);
+        if(readFully(fd, (char *)raw, n*sizeof(float), offset)) {
+            job->status = FAILURE;
+            break;
+        }
+        for(idx=0; idx<n; idx++) {
+            pixel.i = ntohl(raw[idx]);
+            job->quImageArray[2*(job->start+idx)+comp] = pixel.f;
+        }
+    }
+    return(NULL);
+}
+
+static void *fitsReaderThread(void *arg) {
+    struct fitsReader *reader = (struct fitsReader *)arg;
+    struct fitsReaderPool *pool = reader->pool;
+    long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while(1) {
+        while(!pool->quit && pool->generation == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if(pool->quit) { break; }
+        seen = pool->generation;
+        if(reader->index >= pool->nActive) { continue; }
+        pthread_mutex_unlock(&pool->lock);
+        readFitsShare(&pool->jobs[reader->index]);
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->pending == 0) { pthread_cond_signal(&pool->done); }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return(NULL);
+}
+
+static int startReaders(struct IOFileDescriptors *descriptors) {
+    struct fitsReaderPool *pool;
+    int i, n = descriptors->nReaders;
+
+    pool = calloc(1, sizeof(*pool));
+    if(pool == NULL) { return(FAILURE); }
+    pool->readers = calloc(n, sizeof(*pool->readers));
+    pool->jobs = calloc(n, sizeof(*pool->jobs));
+    if(pool->readers == NULL || pool->jobs == NULL) {
+        free(pool->readers); free(pool->jobs); free(pool);
+        return(FAILURE);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    descriptors->readerPool = pool;
+    for(i=1; i<n; i++) {
+        pool->readers[i].pool = pool;
+        pool->readers[i].index = i;
+        if(pthread_create(&pool->readers[i].thread, NULL, fitsReaderThread,
+                          &pool->readers[i]))
+            return(FAILURE);
+        pool->nStarted = i;
+    }
+    return(SUCCESS);
+}
+
+static void stopReaders(struct IOFileDescriptors *descriptors) {
+    struct fitsReaderPool *pool = descriptors->readerPool;
+    int i;
+
+    if(pool == NULL) { return; }
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = TRUE;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for(i=1; i<=pool->nStarted; i++) { pthread_join(pool->readers[i].thread, NULL); }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->readers); free(pool->jobs); free(pool);
+    descriptors->readerPool = NULL;
+}
+
+/* Run nThreads jobs of the pool, the first on the calling thread.
+   Without a pool there is one job */
+static int runReadJobs(struct fitsReaderPool *pool, struct fitsReadJob *jobs,
+                       int nThreads) {
+    int i, status = SUCCESS;
+
+    if(pool != NULL) {
+        pthread_mutex_lock(&pool->lock);
+        pool->nActive = nThreads;
+        pool->pending = nThreads - 1;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    readFitsShare(&jobs[0]);
+    if(pool != NULL) {
+        pthread_mutex_lock(&pool->lock);
+        while(pool->pending > 0) { pthread_cond_wait(&pool->done, &pool->lock); }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    for(i=0; i<nThreads; i++) {
+        if(jobs[i].status != SUCCESS) { status = FAILURE; }
+    }
+    if(status) { printf("\nError: Unable to read input data cubes\n\n"); }
+    return(status);
+}
+
+/*************************************************************
+*
+* Read nElements pixels of both cubes, starting at pixel first,
+*  into the interleaved quImageArray. Each reader thread of the
+*  pool takes a contiguous share of whole tiles, and scratch
+*  (nElements floats) is where the pixels land before they are
+*  interleaved.
+*
+*************************************************************/
+int readFitsChunk(struct IOFileDescriptors *descriptors, long long first,
+                  long nElements, float *scratch, float *quImageArray) {
+    struct fitsReaderPool *pool = descriptors->readerPool;
+    struct fitsReadJob *jobs = pool->jobs;
+    int i, nThreads = descriptors->nReaders;
+    long perThread;
+
+    if(nThreads > nElements) { nThreads = nElements; }
+    if(nThreads < 1) { return(SUCCESS); }
+    perThread = (nElements + nThreads - 1)/nThreads;
+    perThread = (perThread + descriptors->readUnit - 1)/descriptors->readUnit *
+                descriptors->readUnit;
+    nThreads  = (nElements + perThread - 1)/perThread;
+    for(i=0; i<nThreads; i++) {
+        jobs[i].qFd = descriptors->qReadFds[i];
+        jobs[i].uFd = descriptors->uReadFds[i];
+        jobs[i].qFile = descriptors->qTileFiles != NULL ? descriptors->qTileFiles[i] : NULL;
+        jobs[i].uFile = descriptors->uTileFiles != NULL ? descriptors->uTileFiles[i] : NULL;
+        jobs[i].first = first;
+        jobs[i].qOffset = descriptors->qDataStart + first*(long long)sizeof(float);
+        jobs[i].uOffset = descriptors->uDataStart + first*(long long)sizeof(float);
+        jobs[i].start = i*perThread < nElements ? i*perThread : nElements;
+        jobs[i].stop  = (i+1)*perThread < nElements ? (i+1)*perThread : nElements;
+        jobs[i].uFirst = i%2;
+        jobs[i].scratch = scratch;
+        jobs[i].quImageArray = quImageArray;
+        jobs[i].band = NULL;
+        jobs[i].status = SUCCESS;
+    }
+    return(runReadJobs(pool, jobs, nThreads));
+}
+
+/*************************************************************
+*
+* Tiles of a compressed cube that span several DEC rows (ZTILE3
+*  > 1) would be decoded again for every row read from them. They
+*  are decoded a band of tileFrames rows at a time instead, for
+*  all sightlines of the rows between firstFrame and firstFrame +
+*  nFrames (this rank's), and the band is held in band (2
+*  tileFrames rows of Q and U) while its rows are synthesized.
+*  Each reader decodes a share of whole tiles of sightlines with
+*  one subset read per cube. In band, Q is followed by U, each as
+*  the shares one after another, [row][los][chan] within a share.
+*
+*************************************************************/
+void setFitsBand(struct IOFileDescriptors *descriptors, struct parameters *params,
+                 float *band, int firstFrame, int nFrames) {
+    int nShares = descriptors->nReaders > 0 ? descriptors->nReaders : 1;
+    long share;
+
+    descriptors->band = band;
+    descriptors->bandFirst = descriptors->bandRows = 0;
+    descriptors->tileFrames = params->tileFrames;
+    descriptors->frameStart = firstFrame;
+    descriptors->frameStop = firstFrame + nFrames;
+    descriptors->bandLOS = params->qAxisLen1;
+    descriptors->bandChan = params->qAxisLen3;
+    share = (descriptors->bandLOS + nShares - 1)/nShares;
+    descriptors->bandShare = (share + params->tileLOS - 1)/params->tileLOS * params->tileLOS;
+}
+
+/*************************************************************
+*
+* Read sightlines los0 to los0 + nLOS of DEC row frame (from 0)
+*  into the interleaved quImageArray, from the band set up by
+*  setFitsBand(), decoding the band that holds the row first if
+*  it is not the one held
+*
+*************************************************************/
+int readFitsBand(struct IOFileDescriptors *descriptors, int frame, long los0,
+                 long nLOS, float *quImageArray) {
+    struct fitsReaderPool *pool = descriptors->readerPool;
+    struct fitsReadJob single, *jobs = pool != NULL ? pool->jobs : &single;
+    long nChan = descriptors->bandChan, share = descriptors->bandShare;
+    long bandSize = descriptors->tileFrames * descriptors->bandLOS * nChan;
+    long los, first, width, idx;
+    const float *spectrum;
+    int i, c, comp, nThreads;
+
+    if(frame < descriptors->bandFirst ||
+       frame >= descriptors->bandFirst + descriptors->bandRows) {
+        first = frame - frame % descriptors->tileFrames;
+        if(first < descriptors->frameStart) { first = descriptors->frameStart; }
+        descriptors->bandFirst = first;
+        descriptors->bandRows = frame - frame % descriptors->tileFrames +
+                                descriptors->tileFrames - first;
+        if(first + descriptors->bandRows > descriptors->frameStop)
+            descriptors->bandRows = descriptors->frameStop - first;
+        nThreads = (descriptors->bandLOS + share - 1)/share;
+        for(i=0; i<nThreads; i++) {
+            memset(&jobs[i], 0, sizeof(jobs[i]));
+            jobs[i].qFile = pool != NULL ? descriptors->qTileFiles[i] : descriptors->qFile;
+            jobs[i].uFile = pool != NULL ? descriptors->uTileFiles[i] : descriptors->uFile;
+            jobs[i].start = i*share;
+            jobs[i].stop  = (i+1)*share < descriptors->bandLOS ? (i+1)*share :
+                            descriptors->bandLOS;
+            jobs[i].uFirst = i%2;
+            jobs[i].band = descriptors->band;
+            jobs[i].bandSize = bandSize;
+            jobs[i].nChan = nChan;
+            jobs[i].bandFirst = descriptors->bandFirst;
+            jobs[i].bandRows = descriptors->bandRows;
+        }
+        if(runReadJobs(pool, jobs, nThreads)) {
+            descriptors->bandRows = 0;
+            return(FAILURE);
+        }
+    }
+    for(los=los0; los<los0+nLOS; los++) {
+        first = los - los % share;
+        width = first + share < descriptors->bandLOS ? share : descriptors->bandLOS - first;
+        idx = descriptors->bandRows*first*nChan +
+              ((frame - descriptors->bandFirst)*width + los - first)*nChan;
+        for(comp=0; comp<NUM_INPUTS; comp++) {
+            spectrum = descriptors->band + comp*bandSize + idx;
+            for(c=0; c<nChan; c++)
+                quImageArray[2*((los-los0)*nChan + c) + comp] = spectrum[c];
+        }
+    }
+    return(SUCCESS);
+}
+
+/* Sightlines and DEC rows per tile of a cube, 0 if it is not
+   compressed. Missing ZTILEn keywords default to one */
+static void readTileGrid(fitsfile *file, int *tileLOS, int *tileFrames,
+                         int *fitsStatus) {
+    char fitsComment[FLEN_COMMENT];
+    int keyStatus = 0;
+
+    *tileLOS = *tileFrames = 0;
+    if(!fits_is_compressed_image(file, fitsStatus)) { return; }
+    *tileLOS = *tileFrames = 1;
+    fits_read_key(file, TINT, "ZTILE2", tileLOS, fitsComment, &keyStatus);
+    keyStatus = 0;
+    fits_read_key(file, TINT, "ZTILE3", tileFrames, fitsComment, &keyStatus);
+    if(*tileLOS < 1) { *tileLOS = 1; }
+    if(*tileFrames < 1) { *tileFrames = 1; }
+}
+
+/*************************************************************
+*
+* The readers decode Q and U tile by tile in step, with the
+*  chunks and bands laid out on the grid of Q, so U has to be
+*  tiled the same way
+*
+*************************************************************/
+int checkFitsTiles(struct parameters *params, struct IOFileDescriptors *descriptors) {
+    int tileLOS, tileFrames, fitsStatus = 0;
+
+    readTileGrid(descriptors->uFile, &tileLOS, &tileFrames, &fitsStatus);
+    if(fitsStatus) {
+        fits_report_error(stdout, fitsStatus);
+        return(FAILURE);
+    }
+    if(tileLOS != params->tileLOS || tileFrames != params->tileFrames) {
+        printf("Error: The U cube is not tiled like the Q cube (ZTILE2 x ZTILE3 %d x %d, Q has %d x %d)\n\n",
+               tileLOS, tileFrames, params->tileLOS, params->tileFrames);
+        return(FAILURE);
+    }
+    return(SUCCESS);
 }
 
 /*************************************************************
@@ -90,57 +672,57 @@ void checkInputFiles(struct optionsList *inOptions, struct IOFileDescriptors *de
 * Read header information from the fits files
 *
 *************************************************************/
-int getFitsHeader(struct optionsList *inOptions, struct fits_header_parameters *params, struct IOFileDescriptors *descriptors) {
+int getFitsHeader(struct fits_header_parameters *header_parameters,
+     struct parameters *params,
+     struct IOFileDescriptors *descriptors) {
     int fitsStatus = SUCCESS;
     char fitsComment[FLEN_COMMENT];
+    long naxes[N_DIMS] = {0, 0, 0};
 
     /* Remember that the input fits images are rotated. */
     /* Frequency is the first axis */
     /* RA is the second */
     /* Dec is the third */
 
-    /* Get the image dimensions from the Q cube */
-    fits_read_key(descriptors->qFile, TINT, "NAXIS", &params->qAxisNum,
-      fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TINT, "NAXIS1", &params->qAxisLen3,
-      fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TINT, "NAXIS2", &params->qAxisLen1,
-      fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TINT, "NAXIS3", &params->qAxisLen2,
-      fitsComment, &fitsStatus);
+    /* Get the image dimensions from the Q cube. Unlike the NAXISn
+       keywords, these are the image's also when it is compressed */
+    fits_get_img_dim(descriptors->qFile, &params->qAxisNum, &fitsStatus);
+    fits_get_img_size(descriptors->qFile, N_DIMS, naxes, &fitsStatus);
+    params->qAxisLen3 = naxes[0];
+    params->qAxisLen1 = naxes[1];
+    params->qAxisLen2 = naxes[2];
     /* Get the image dimensions from the U cube */
-    fits_read_key(descriptors->uFile, TINT, "NAXIS", &params->uAxisNum,
-      fitsComment, &fitsStatus);
-    fits_read_key(descriptors->uFile, TINT, "NAXIS1", &params->uAxisLen3,
-      fitsComment, &fitsStatus);
-    fits_read_key(descriptors->uFile, TINT, "NAXIS2", &params->uAxisLen1,
-      fitsComment, &fitsStatus);
-    fits_read_key(descriptors->uFile, TINT, "NAXIS3", &params->uAxisLen2,
-      fitsComment, &fitsStatus);
+    fits_get_img_dim(descriptors->uFile, &params->uAxisNum, &fitsStatus);
+    fits_get_img_size(descriptors->uFile, N_DIMS, naxes, &fitsStatus);
+    params->uAxisLen3 = naxes[0];
+    params->uAxisLen1 = naxes[1];
+    params->uAxisLen2 = naxes[2];
+    /* Tile grid of a compressed cube, one spectrum by default */
+    readTileGrid(descriptors->qFile, &params->tileLOS, &params->tileFrames, &fitsStatus);
     /* Get WCS information */
-    fits_read_key(descriptors->qFile, TFLOAT, "CRVAL1", &params->crval3,
+    fits_read_key(descriptors->qFile, TDOUBLE, "CRVAL1", &header_parameters->crval3,
       fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TFLOAT, "CRVAL2", &params->crval1,
+    fits_read_key(descriptors->qFile, TDOUBLE, "CRVAL2", &header_parameters->crval1,
       fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TFLOAT, "CRVAL3", &params->crval2,
+    fits_read_key(descriptors->qFile, TDOUBLE, "CRVAL3", &header_parameters->crval2,
       fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TFLOAT, "CRPIX1", &params->crpix3,
+    fits_read_key(descriptors->qFile, TDOUBLE, "CRPIX1", &header_parameters->crpix3,
       fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TFLOAT, "CRPIX2", &params->crpix1,
+    fits_read_key(descriptors->qFile, TDOUBLE, "CRPIX2", &header_parameters->crpix1,
       fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TFLOAT, "CRPIX3", &params->crpix2,
+    fits_read_key(descriptors->qFile, TDOUBLE, "CRPIX3", &header_parameters->crpix2,
       fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TFLOAT, "CDELT1", &params->cdelt3,
+    fits_read_key(descriptors->qFile, TDOUBLE, "CDELT1", &header_parameters->cdelt3,
       fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TFLOAT, "CDELT2", &params->cdelt1,
+    fits_read_key(descriptors->qFile, TDOUBLE, "CDELT2", &header_parameters->cdelt1,
       fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TFLOAT, "CDELT3", &params->cdelt2,
+    fits_read_key(descriptors->qFile, TDOUBLE, "CDELT3", &header_parameters->cdelt2,
       fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TSTRING, "CTYPE1", &params->ctype3,
+    fits_read_key(descriptors->qFile, TSTRING, "CTYPE1", header_parameters->ctype3,
       fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TSTRING, "CTYPE2", &params->ctype1,
+    fits_read_key(descriptors->qFile, TSTRING, "CTYPE2", header_parameters->ctype1,
       fitsComment, &fitsStatus);
-    fits_read_key(descriptors->qFile, TSTRING, "CTYPE3", &params->ctype2,
+    fits_read_key(descriptors->qFile, TSTRING, "CTYPE3", header_parameters->ctype2,
       fitsComment, &fitsStatus);
 
     return(fitsStatus);
@@ -151,8 +733,7 @@ int getFitsHeader(struct optionsList *inOptions, struct fits_header_parameters *
 * Read header information from the HDF5 files
 *
 *************************************************************/
-int getHDF5Header(struct optionsList *inOptions,
-     struct fits_header_parameters *header_parameters,
+int getHDF5Header(struct fits_header_parameters *header_parameters,
      struct parameters *params,
      struct IOFileDescriptors *descriptors) {
     hsize_t tempArr[N_DIMS];
@@ -176,15 +757,15 @@ int getHDF5Header(struct optionsList *inOptions,
     params->uAxisLen2 = tempArr[2];
     params->uAxisLen3 = tempArr[0];
     /* Get WCS information */
-    H5LTget_attribute_float(descriptors->qFileh5, PRIMARY, "CRVAL1", &header_parameters->crval1);
-    H5LTget_attribute_float(descriptors->qFileh5, PRIMARY, "CRVAL2", &header_parameters->crval2);
-    H5LTget_attribute_float(descriptors->qFileh5, PRIMARY, "CRVAL3", &header_parameters->crval3);
-    H5LTget_attribute_float(descriptors->qFileh5, PRIMARY, "CDELT1", &header_parameters->cdelt1);
-    H5LTget_attribute_float(descriptors->qFileh5, PRIMARY, "CDELT2", &header_parameters->cdelt2);
-    H5LTget_attribute_float(descriptors->qFileh5, PRIMARY, "CDELT3", &header_parameters->cdelt3);
-    H5LTget_attribute_float(descriptors->qFileh5, PRIMARY, "CRPIX1", &header_parameters->crpix1);
-    H5LTget_attribute_float(descriptors->qFileh5, PRIMARY, "CRPIX2", &header_parameters->crpix2);
-    H5LTget_attribute_float(descriptors->qFileh5, PRIMARY, "CRPIX3", &header_parameters->crpix3);
+    H5LTget_attribute_double(descriptors->qFileh5, PRIMARY, "CRVAL1", &header_parameters->crval1);
+    H5LTget_attribute_double(descriptors->qFileh5, PRIMARY, "CRVAL2", &header_parameters->crval2);
+    H5LTget_attribute_double(descriptors->qFileh5, PRIMARY, "CRVAL3", &header_parameters->crval3);
+    H5LTget_attribute_double(descriptors->qFileh5, PRIMARY, "CDELT1", &header_parameters->cdelt1);
+    H5LTget_attribute_double(descriptors->qFileh5, PRIMARY, "CDELT2", &header_parameters->cdelt2);
+    H5LTget_attribute_double(descriptors->qFileh5, PRIMARY, "CDELT3", &header_parameters->cdelt3);
+    H5LTget_attribute_double(descriptors->qFileh5, PRIMARY, "CRPIX1", &header_parameters->crpix1);
+    H5LTget_attribute_double(descriptors->qFileh5, PRIMARY, "CRPIX2", &header_parameters->crpix2);
+    H5LTget_attribute_double(descriptors->qFileh5, PRIMARY, "CRPIX3", &header_parameters->crpix3);
     H5LTget_attribute_string(descriptors->qFileh5, PRIMARY, "CTYPE1", header_parameters->ctype1);
     H5LTget_attribute_string(descriptors->qFileh5, PRIMARY, "CTYPE2", header_parameters->ctype2);
     H5LTget_attribute_string(descriptors->qFileh5, PRIMARY, "CTYPE3", header_parameters->ctype3);
@@ -192,12 +773,139 @@ int getHDF5Header(struct optionsList *inOptions,
     return error;
 }
 
+/*************************************************************
+*
+* Shape of a table input: nRows spectra of nChan channels each,
+*  in a 2-D HDF5 dataset [nRows][nChan] or a FITS binary table
+*  column of nChan elements per row. The Q and U tables must
+*  match. The table is described as a cube of one frame of nRows
+*  sightlines, with an axis that counts rows in place of the sky.
+*
+*************************************************************/
+int getTableHeader(struct optionsList *inOptions,
+     struct fits_header_parameters *header_parameters,
+     struct parameters *params,
+     struct IOFileDescriptors *descriptors) {
+    hsize_t dims[N_DIMS];
+    long nRows[NUM_INPUTS], repeat[NUM_INPUTS], width;
+    int i, rank, typecode, fitsStatus = SUCCESS;
+    fitsfile *files[NUM_INPUTS] = {descriptors->qFile, descriptors->uFile};
+    hid_t filesH5[NUM_INPUTS] = {descriptors->qFileh5, descriptors->uFileh5};
+    char *columns[NUM_INPUTS] = {inOptions->qColumn, inOptions->uColumn};
+    int *colNums[NUM_INPUTS] = {&descriptors->qColNum, &descriptors->uColNum};
+
+    for(i=0; i<NUM_INPUTS; i++) {
+        if(inOptions->fileFormat == FITS) {
+            fits_get_num_rows(files[i], &nRows[i], &fitsStatus);
+            fits_get_colnum(files[i], CASEINSEN, columns[i], colNums[i], &fitsStatus);
+            if(fitsStatus == SUCCESS)
+                fits_get_coltype(files[i], *colNums[i], &typecode, &repeat[i],
+                                 &width, &fitsStatus);
+            if(fitsStatus) {
+                fits_report_error(stdout, fitsStatus);
+                printf("Error: No column %s in the table\n\n", columns[i]);
+                return(FAILURE);
+            }
+        }
+        else {
+            if(H5LTget_dataset_ndims(filesH5[i], columns[i], &rank) < 0 || rank != 2 ||
+               H5LTget_dataset_info(filesH5[i], columns[i], dims, NULL, NULL) < 0) {
+                printf("Error: %s is not a 2-D dataset of spectra\n\n", columns[i]);
+                return(FAILURE);
+            }
+            nRows[i] = dims[0];
+            repeat[i] = dims[1];
+        }
+    }
+    if(nRows[0] != nRows[1] || repeat[0] != repeat[1] || nRows[0] < 1 || repeat[0] < 1) {
+        printf("Error: The Q and U tables do not match\n\n");
+        return(FAILURE);
+    }
+
+    /* One frame of nRows sightlines */
+    params->qAxisNum = params->uAxisNum = N_DIMS;
+    params->qAxisLen3 = params->uAxisLen3 = repeat[0];
+    if(inOptions->fileFormat == FITS) {
+        params->qAxisLen1 = params->uAxisLen1 = nRows[0];
+        params->qAxisLen2 = params->uAxisLen2 = 1;
+    }
+    else {
+        params->qAxisLen1 = params->uAxisLen1 = 1;
+        params->qAxisLen2 = params->uAxisLen2 = nRows[0];
+    }
+    memset(header_parameters, 0, sizeof(*header_parameters));
+    header_parameters->crval1 = header_parameters->crval2 = 1.;
+    header_parameters->crpix1 = header_parameters->crpix2 = 1.;
+    header_parameters->cdelt1 = header_parameters->cdelt2 = 1.;
+    strcpy(header_parameters->ctype1, TABLE_CTYPE);
+    strcpy(header_parameters->ctype2, TABLE_CTYPE);
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Check the shape of the Stokes I input against the Q cube. A
+*  cube has the same axes as Q. A model is laid out like the
+*  per-sightline products: a plane of I at iModelFreq and a
+*  plane of spectral index over the sky, i.e. RA x DEC x 2 in
+*  FITS and [2][qAxisLen1][qAxisLen2] in HDF5.
+*
+*************************************************************/
+int checkStokesI(struct optionsList *inOptions, struct parameters *params,
+                 struct IOFileDescriptors *descriptors) {
+   long naxes[N_DIMS] = {0, 0, 0}, expected[N_DIMS], found[N_DIMS];
+   hsize_t dims[N_DIMS];
+   int i, nAxis = 0, fitsStatus = SUCCESS;
+
+   if(inOptions->stokesI == STOKES_I_NONE) { return(SUCCESS); }
+   /* Axis lengths, slowest varying first */
+   if(inOptions->fileFormat == FITS) {
+      fits_get_img_dim(descriptors->iFile, &nAxis, &fitsStatus);
+      fits_get_img_size(descriptors->iFile, N_DIMS, naxes, &fitsStatus);
+      if(fitsStatus) {
+         fits_report_error(stdout, fitsStatus);
+         return(FAILURE);
+      }
+      for(i=0; i<N_DIMS; i++) { found[i] = naxes[N_DIMS-1-i]; }
+      expected[0] = params->qAxisLen2; expected[1] = params->qAxisLen1;
+      expected[2] = params->qAxisLen3;
+      if(inOptions->stokesI == STOKES_I_MODEL) {
+         expected[0] = N_MODEL_PLANES; expected[1] = params->qAxisLen2;
+         expected[2] = params->qAxisLen1;
+      }
+   }
+   else {
+      if(H5LTget_dataset_ndims(descriptors->iFileh5, PRIMARYDATA, &nAxis) < 0 ||
+         nAxis != N_DIMS ||
+         H5LTget_dataset_info(descriptors->iFileh5, PRIMARYDATA, dims, NULL, NULL) < 0) {
+         printf("Error: %s has no 3-D %s dataset\n\n", stokesIName(inOptions), PRIMARYDATA);
+         return(FAILURE);
+      }
+      for(i=0; i<N_DIMS; i++) { found[i] = dims[i]; }
+      expected[0] = params->qAxisLen3; expected[1] = params->qAxisLen1;
+      expected[2] = params->qAxisLen2;
+      if(inOptions->stokesI == STOKES_I_MODEL) { expected[0] = N_MODEL_PLANES; }
+   }
+   for(i=0; i<N_DIMS; i++) {
+      if(nAxis != N_DIMS || found[i] != expected[i]) {
+         if(inOptions->stokesI == STOKES_I_CUBE)
+            printf("Error: Stokes I cube %s does not match the Q and U cubes\n\n",
+                   inOptions->iCubeName);
+         else
+            printf("Error: Stokes I model %s needs %d planes of the Q and U sky\n\n",
+                   inOptions->iModelName, N_MODEL_PLANES);
+         return(FAILURE);
+      }
+   }
+   return(SUCCESS);
+}
+
 /*************************************************************
 *
 * Create output FITS images
 *
 *************************************************************/
-void makeOutputFitsImages(struct optionsList *inOptions,
+int makeOutputFitsImages(struct optionsList *inOptions,
     struct IOFileDescriptors *descriptors,
     struct fits_header_parameters *header_parameters,
     struct parameters *params) {
@@ -205,7 +913,10 @@ void makeOutputFitsImages(struct optionsList *inOptions,
    char filenamefull[FILENAME_LEN];
    long naxis[FITS_OUT_NAXIS];
    char fComment[FILENAME_LEN];
+   char key[FLEN_KEYWORD];
    float tempVar;
+   fitsfile *out[NUM_OUTPUTS];
+   int i, phiAxis, raAxis, decAxis;
 
    /* Create the output Q, U, and P images */
    sprintf(filenamefull, "%s%s.fits", inOptions->outPrefix, Q_DIRTY);
@@ -214,77 +925,76 @@ void makeOutputFitsImages(struct optionsList *inOptions,
    fits_create_file(&descriptors->uDirty, filenamefull, &stat);
    sprintf(filenamefull, "%s%s.fits", inOptions->outPrefix, P_DIRTY);
    fits_create_file(&descriptors->pDirty, filenamefull, &stat);
-   checkFitsError(stat);
+   if(stat) {
+      fits_report_error(stdout, stat);
+      return(FAILURE);
+   }
 
    /* Assign empty string to fComment */
    sprintf(fComment, " ");
 
-   /* What are the output cube sizes */
-   naxis[0] = params->nPhi;
-   naxis[1] = params->qAxisLen1;
-   naxis[2] = params->qAxisLen2;
+   /* What are the output cube sizes? By default phi varies
+      fastest; sky ordered cubes have phi as the third axis */
+   if(inOptions->outputOrder == ORDER_SKY) {
+      phiAxis = 3; raAxis = 1; decAxis = 2;
+   }
+   else {
+      phiAxis = 1; raAxis = 2; decAxis = 3;
+   }
+   naxis[phiAxis-1] = params->nPhi;
+   naxis[raAxis-1]  = params->qAxisLen1;
+   naxis[decAxis-1] = params->qAxisLen2;
 
    /* Create the header for each output image */
    fits_create_img(descriptors->qDirty, FLOAT_IMG, FITS_OUT_NAXIS, naxis, &stat);
    fits_create_img(descriptors->uDirty, FLOAT_IMG, FITS_OUT_NAXIS, naxis, &stat);
    fits_create_img(descriptors->pDirty, FLOAT_IMG, FITS_OUT_NAXIS, naxis, &stat);
-   checkFitsError(stat);
+   if(stat) {
+      fits_report_error(stdout, stat);
+      return(FAILURE);
+   }
 
    /* Set the relevant keyvalues */
-   fits_write_key(descriptors->qDirty, TSTRING, "BUNIT", BUNIT, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TSTRING, "BUNIT", BUNIT, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TSTRING, "BUNIT", BUNIT, fComment, &stat);
-
-   fits_write_key(descriptors->qDirty, TDOUBLE, "CRVAL1", &params->phiMin, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TDOUBLE, "CRVAL1", &params->phiMin, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TDOUBLE, "CRVAL1", &params->phiMin, fComment, &stat);
-
-   fits_write_key(descriptors->qDirty, TDOUBLE, "CDELT1", &params->dPhi, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TDOUBLE, "CDELT1", &params->dPhi, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TDOUBLE, "CDELT1", &params->dPhi, fComment, &stat);
-
+   out[0] = descriptors->qDirty;
+   out[1] = descriptors->uDirty;
+   out[2] = descriptors->pDirty;
    tempVar = 1;
-   fits_write_key(descriptors->qDirty, TFLOAT, "CRPIX1", &tempVar, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TFLOAT, "CRPIX1", &tempVar, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TFLOAT, "CRPIX1", &tempVar, fComment, &stat);
+   for(i=0; i<NUM_OUTPUTS; i++) {
+      fits_write_key(out[i], TSTRING, "BUNIT", BUNIT, fComment, &stat);
 
-   fits_write_key(descriptors->qDirty, TSTRING, "CTYPE1", RM, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TSTRING, "CTYPE1", RM, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TSTRING, "CTYPE1", RM, fComment, &stat);
+      sprintf(key, "CRVAL%d", phiAxis);
+      fits_write_key(out[i], TDOUBLE, key, &params->phiMin, fComment, &stat);
+      sprintf(key, "CDELT%d", phiAxis);
+      fits_write_key(out[i], TDOUBLE, key, &params->dPhi, fComment, &stat);
+      sprintf(key, "CRPIX%d", phiAxis);
+      fits_write_key(out[i], TFLOAT, key, &tempVar, fComment, &stat);
+      sprintf(key, "CTYPE%d", phiAxis);
+      fits_write_key(out[i], TSTRING, key, RM, fComment, &stat);
 
-   fits_write_key(descriptors->qDirty, TFLOAT, "CRVAL2", &header_parameters->crval1, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TFLOAT, "CRVAL2", &header_parameters->crval1, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TFLOAT, "CRVAL2", &header_parameters->crval1, fComment, &stat);
+      sprintf(key, "CRVAL%d", raAxis);
+      fits_write_key(out[i], TDOUBLE, key, &header_parameters->crval1, fComment, &stat);
+      sprintf(key, "CDELT%d", raAxis);
+      fits_write_key(out[i], TDOUBLE, key, &header_parameters->cdelt1, fComment, &stat);
+      sprintf(key, "CRPIX%d", raAxis);
+      fits_write_key(out[i], TDOUBLE, key, &header_parameters->crpix1, fComment, &stat);
+      sprintf(key, "CTYPE%d", raAxis);
+      fits_write_key(out[i], TSTRING, key, header_parameters->ctype1, fComment, &stat);
 
-   fits_write_key(descriptors->qDirty, TFLOAT, "CDELT2", &header_parameters->cdelt1, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TFLOAT, "CDELT2", &header_parameters->cdelt1, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TFLOAT, "CDELT2", &header_parameters->cdelt1, fComment, &stat);
-
-   fits_write_key(descriptors->qDirty, TFLOAT, "CRPIX2", &header_parameters->crpix1, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TFLOAT, "CRPIX2", &header_parameters->crpix1, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TFLOAT, "CRPIX2", &header_parameters->crpix1, fComment, &stat);
-
-   fits_write_key(descriptors->qDirty, TSTRING, "CTYPE2", header_parameters->ctype1, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TSTRING, "CTYPE2", header_parameters->ctype1, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TSTRING, "CTYPE2", header_parameters->ctype1, fComment, &stat);
-
-   fits_write_key(descriptors->qDirty, TFLOAT, "CRVAL3", &header_parameters->crval2, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TFLOAT, "CRVAL3", &header_parameters->crval2, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TFLOAT, "CRVAL3", &header_parameters->crval2, fComment, &stat);
-
-   fits_write_key(descriptors->qDirty, TFLOAT, "CDELT3", &header_parameters->cdelt2, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TFLOAT, "CDELT3", &header_parameters->cdelt2, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TFLOAT, "CDELT3", &header_parameters->cdelt2, fComment, &stat);
-
-   fits_write_key(descriptors->qDirty, TFLOAT, "CRPIX3", &header_parameters->crpix2, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TFLOAT, "CRPIX3", &header_parameters->crpix2, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TFLOAT, "CRPIX3", &header_parameters->crpix2, fComment, &stat);
-
-   fits_write_key(descriptors->qDirty, TSTRING, "CTYPE3", header_parameters->ctype2, fComment, &stat);
-   fits_write_key(descriptors->uDirty, TSTRING, "CTYPE3", header_parameters->ctype2, fComment, &stat);
-   fits_write_key(descriptors->pDirty, TSTRING, "CTYPE3", header_parameters->ctype2, fComment, &stat);
+      sprintf(key, "CRVAL%d", decAxis);
+      fits_write_key(out[i], TDOUBLE, key, &header_parameters->crval2, fComment, &stat);
+      sprintf(key, "CDELT%d", decAxis);
+      fits_write_key(out[i], TDOUBLE, key, &header_parameters->cdelt2, fComment, &stat);
+      sprintf(key, "CRPIX%d", decAxis);
+      fits_write_key(out[i], TDOUBLE, key, &header_parameters->crpix2, fComment, &stat);
+      sprintf(key, "CTYPE%d", decAxis);
+      fits_write_key(out[i], TSTRING, key, header_parameters->ctype2, fComment, &stat);
+   }
 
-   checkFitsError(stat);
+   if(stat) {
+      fits_report_error(stdout, stat);
+      return(FAILURE);
+   }
+   return(SUCCESS);
 }
 
 /*************************************************************
@@ -292,7 +1002,7 @@ void makeOutputFitsImages(struct optionsList *inOptions,
 * Create output HDF5 cubes
 *
 *************************************************************/
-void makeOutputHDF5Images(struct optionsList *inOptions,
+int makeOutputHDF5Images(struct optionsList *inOptions,
     struct IOFileDescriptors *descriptors,
     struct parameters *params,
     struct fits_header_parameters *header) {
@@ -305,11 +1015,11 @@ void makeOutputHDF5Images(struct optionsList *inOptions,
 
    /* Create the output Q, U, and P images */
    sprintf(filenamefull, "%s%s.h5", inOptions->outPrefix, Q_DIRTY);
-   descriptors->qDirtyH5 = H5Fcreate(filenamefull, H5F_ACC_EXCL, H5P_DEFAULT, H5P_DEFAULT);
+   descriptors->qDirtyH5 = H5Fcreate(filenamefull, H5F_ACC_EXCL, H5P_DEFAULT, outputAccessList());
    sprintf(filenamefull, "%s%s.h5", inOptions->outPrefix, U_DIRTY);
-   descriptors->uDirtyH5 = H5Fcreate(filenamefull, H5F_ACC_EXCL, H5P_DEFAULT, H5P_DEFAULT);
+   descriptors->uDirtyH5 = H5Fcreate(filenamefull, H5F_ACC_EXCL, H5P_DEFAULT, outputAccessList());
    sprintf(filenamefull, "%s%s.h5", inOptions->outPrefix, P_DIRTY);
-   descriptors->pDirtyH5 = H5Fcreate(filenamefull, H5F_ACC_EXCL, H5P_DEFAULT, H5P_DEFAULT);
+   descriptors->pDirtyH5 = H5Fcreate(filenamefull, H5F_ACC_EXCL, H5P_DEFAULT, outputAccessList());
 
    /* Create the primary group */
    qGrp = H5Gcreate(descriptors->qDirtyH5, PRIMARY, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
@@ -317,7 +1027,7 @@ void makeOutputHDF5Images(struct optionsList *inOptions,
    pGrp = H5Gcreate(descriptors->pDirtyH5, PRIMARY, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
    if( qGrp<0 || uGrp<0 || pGrp<0) {
       printf("Error: Unable to create groups in output HDF5 files\n");
-      exit(FAILURE);
+      return(FAILURE);
    }
    H5Gclose(qGrp); H5Gclose(uGrp); H5Gclose(pGrp);
 
@@ -330,7 +1040,7 @@ void makeOutputHDF5Images(struct optionsList *inOptions,
    pErr = H5LTmake_dataset_float(descriptors->pDirtyH5, PRIMARYDATA, N_DIMS, dims, NULL);
    if( qErr<0 || uErr<0 || pErr<0) {
       printf("Error: Unable to create output datasets in HDF5\n");
-      exit(FAILURE);
+      return(FAILURE);
    }
 
    /* CLASS attribute of ROOT should be set to HDFITS */
@@ -339,46 +1049,46 @@ void makeOutputHDF5Images(struct optionsList *inOptions,
    H5LTset_attribute_string(descriptors->pDirtyH5, ROOT, "CLASS", HDFITS);
 
    /* Position attribute of /PRIMARY must be set to 1 */
-   H5LTset_attribute_int(descriptors->qDirtyH5, PRIMARY, "POSITION", &positionID, sizeof(positionID));
-   H5LTset_attribute_int(descriptors->uDirtyH5, PRIMARY, "POSITION", &positionID, sizeof(positionID));
-   H5LTset_attribute_int(descriptors->pDirtyH5, PRIMARY, "POSITION", &positionID, sizeof(positionID));
+   H5LTset_attribute_int(descriptors->qDirtyH5, PRIMARY, "POSITION", &positionID, 1);
+   H5LTset_attribute_int(descriptors->uDirtyH5, PRIMARY, "POSITION", &positionID, 1);
+   H5LTset_attribute_int(descriptors->pDirtyH5, PRIMARY, "POSITION", &positionID, 1);
 
    /* Create attributes for the /PRIMARY group */
-   H5LTset_attribute_float(descriptors->qDirtyH5, PRIMARY, "CRVAL1", &(header->crval1), sizeof(header->crval1));
-   H5LTset_attribute_float(descriptors->qDirtyH5, PRIMARY, "CRVAL2", &(header->crval2), sizeof(header->crval2));
-   H5LTset_attribute_double(descriptors->qDirtyH5, PRIMARY, "CRVAL3", &(params->phiMin), sizeof(params->phiMin));
-   H5LTset_attribute_float(descriptors->qDirtyH5, PRIMARY, "CRPIX1", &(header->crpix1), sizeof(header->crpix1));
-   H5LTset_attribute_float(descriptors->qDirtyH5, PRIMARY, "CRPIX2", &(header->crpix2), sizeof(header->crpix2));
-   H5LTset_attribute_float(descriptors->qDirtyH5, PRIMARY, "CRPIX3", &tempVar, sizeof(tempVar));
-   H5LTset_attribute_float(descriptors->qDirtyH5, PRIMARY, "CDELT1", &(header->cdelt1), sizeof(header->cdelt1));
-   H5LTset_attribute_float(descriptors->qDirtyH5, PRIMARY, "CDELT2", &(header->cdelt2), sizeof(header->cdelt2));
-   H5LTset_attribute_double(descriptors->qDirtyH5, PRIMARY, "CDELT3", &(params->dPhi), sizeof(params->dPhi));
+   H5LTset_attribute_double(descriptors->qDirtyH5, PRIMARY, "CRVAL1", &(header->crval1), 1);
+   H5LTset_attribute_double(descriptors->qDirtyH5, PRIMARY, "CRVAL2", &(header->crval2), 1);
+   H5LTset_attribute_double(descriptors->qDirtyH5, PRIMARY, "CRVAL3", &(params->phiMin), 1);
+   H5LTset_attribute_double(descriptors->qDirtyH5, PRIMARY, "CRPIX1", &(header->crpix1), 1);
+   H5LTset_attribute_double(descriptors->qDirtyH5, PRIMARY, "CRPIX2", &(header->crpix2), 1);
+   H5LTset_attribute_float(descriptors->qDirtyH5, PRIMARY, "CRPIX3", &tempVar, 1);
+   H5LTset_attribute_double(descriptors->qDirtyH5, PRIMARY, "CDELT1", &(header->cdelt1), 1);
+   H5LTset_attribute_double(descriptors->qDirtyH5, PRIMARY, "CDELT2", &(header->cdelt2), 1);
+   H5LTset_attribute_double(descriptors->qDirtyH5, PRIMARY, "CDELT3", &(params->dPhi), 1);
    H5LTset_attribute_string(descriptors->qDirtyH5, PRIMARY, "CTYPE1", header->ctype1);
    H5LTset_attribute_string(descriptors->qDirtyH5, PRIMARY, "CTYPE2", header->ctype2);
    H5LTset_attribute_string(descriptors->qDirtyH5, PRIMARY, "CTYPE3", RM);
 
-   H5LTset_attribute_float(descriptors->uDirtyH5, PRIMARY, "CRVAL1", &(header->crval1), sizeof(header->crval1));
-   H5LTset_attribute_float(descriptors->uDirtyH5, PRIMARY, "CRVAL2", &(header->crval2), sizeof(header->crval2));
-   H5LTset_attribute_double(descriptors->uDirtyH5, PRIMARY, "CRVAL3", &(params->phiMin), sizeof(params->phiMin));
-   H5LTset_attribute_float(descriptors->uDirtyH5, PRIMARY, "CRPIX1", &(header->crpix1), sizeof(header->crpix1));
-   H5LTset_attribute_float(descriptors->uDirtyH5, PRIMARY, "CRPIX2", &(header->crpix2), sizeof(header->crpix2));
-   H5LTset_attribute_float(descriptors->uDirtyH5, PRIMARY, "CRPIX3", &tempVar, sizeof(tempVar));
-   H5LTset_attribute_float(descriptors->uDirtyH5, PRIMARY, "CDELT1", &(header->cdelt1), sizeof(header->cdelt1));
-   H5LTset_attribute_float(descriptors->uDirtyH5, PRIMARY, "CDELT2", &(header->cdelt2), sizeof(header->cdelt2));
-   H5LTset_attribute_double(descriptors->uDirtyH5, PRIMARY, "CDELT3", &(params->dPhi), sizeof(params->dPhi));
+   H5LTset_attribute_double(descriptors->uDirtyH5, PRIMARY, "CRVAL1", &(header->crval1), 1);
+   H5LTset_attribute_double(descriptors->uDirtyH5, PRIMARY, "CRVAL2", &(header->crval2), 1);
+   H5LTset_attribute_double(descriptors->uDirtyH5, PRIMARY, "CRVAL3", &(params->phiMin), 1);
+   H5LTset_attribute_double(descriptors->uDirtyH5, PRIMARY, "CRPIX1", &(header->crpix1), 1);
+   H5LTset_attribute_double(descriptors->uDirtyH5, PRIMARY, "CRPIX2", &(header->crpix2), 1);
+   H5LTset_attribute_float(descriptors->uDirtyH5, PRIMARY, "CRPIX3", &tempVar, 1);
+   H5LTset_attribute_double(descriptors->uDirtyH5, PRIMARY, "CDELT1", &(header->cdelt1), 1);
+   H5LTset_attribute_double(descriptors->uDirtyH5, PRIMARY, "CDELT2", &(header->cdelt2), 1);
+   H5LTset_attribute_double(descriptors->uDirtyH5, PRIMARY, "CDELT3", &(params->dPhi), 1);
    H5LTset_attribute_string(descriptors->uDirtyH5, PRIMARY, "CTYPE1", header->ctype1);
    H5LTset_attribute_string(descriptors->uDirtyH5, PRIMARY, "CTYPE2", header->ctype2);
    H5LTset_attribute_string(descriptors->uDirtyH5, PRIMARY, "CTYPE3", RM);
 
-   H5LTset_attribute_float(descriptors->pDirtyH5, PRIMARY, "CRVAL1", &(header->crval1), sizeof(header->crval1));
-   H5LTset_attribute_float(descriptors->pDirtyH5, PRIMARY, "CRVAL2", &(header->crval2), sizeof(header->crval2));
-   H5LTset_attribute_double(descriptors->pDirtyH5, PRIMARY, "CRVAL3", &(params->phiMin), sizeof(params->phiMin));
-   H5LTset_attribute_float(descriptors->pDirtyH5, PRIMARY, "CRPIX1", &(header->crpix1), sizeof(header->crpix1));
-   H5LTset_attribute_float(descriptors->pDirtyH5, PRIMARY, "CRPIX2", &(header->crpix2), sizeof(header->crpix2));
-   H5LTset_attribute_float(descriptors->pDirtyH5, PRIMARY, "CRPIX3", &tempVar, sizeof(tempVar));
-   H5LTset_attribute_float(descriptors->pDirtyH5, PRIMARY, "CDELT1", &(header->cdelt1), sizeof(header->cdelt1));
-   H5LTset_attribute_float(descriptors->pDirtyH5, PRIMARY, "CDELT2", &(header->cdelt2), sizeof(header->cdelt2));
-   H5LTset_attribute_double(descriptors->pDirtyH5, PRIMARY, "CDELT3", &(params->dPhi), sizeof(params->dPhi));
+   H5LTset_attribute_double(descriptors->pDirtyH5, PRIMARY, "CRVAL1", &(header->crval1), 1);
+   H5LTset_attribute_double(descriptors->pDirtyH5, PRIMARY, "CRVAL2", &(header->crval2), 1);
+   H5LTset_attribute_double(descriptors->pDirtyH5, PRIMARY, "CRVAL3", &(params->phiMin), 1);
+   H5LTset_attribute_double(descriptors->pDirtyH5, PRIMARY, "CRPIX1", &(header->crpix1), 1);
+   H5LTset_attribute_double(descriptors->pDirtyH5, PRIMARY, "CRPIX2", &(header->crpix2), 1);
+   H5LTset_attribute_float(descriptors->pDirtyH5, PRIMARY, "CRPIX3", &tempVar, 1);
+   H5LTset_attribute_double(descriptors->pDirtyH5, PRIMARY, "CDELT1", &(header->cdelt1), 1);
+   H5LTset_attribute_double(descriptors->pDirtyH5, PRIMARY, "CDELT2", &(header->cdelt2), 1);
+   H5LTset_attribute_double(descriptors->pDirtyH5, PRIMARY, "CDELT3", &(params->dPhi), 1);
    H5LTset_attribute_string(descriptors->pDirtyH5, PRIMARY, "CTYPE1", header->ctype1);
    H5LTset_attribute_string(descriptors->pDirtyH5, PRIMARY, "CTYPE2", header->ctype2);
    H5LTset_attribute_string(descriptors->pDirtyH5, PRIMARY, "CTYPE3", RM);
@@ -387,48 +1097,286 @@ void makeOutputHDF5Images(struct optionsList *inOptions,
    H5LTset_attribute_string(descriptors->qDirtyH5, PRIMARYDATA, "CLASS", H5IMAGE);
    H5LTset_attribute_string(descriptors->uDirtyH5, PRIMARYDATA, "CLASS", H5IMAGE);
    H5LTset_attribute_string(descriptors->pDirtyH5, PRIMARYDATA, "CLASS", H5IMAGE);
+   return(SUCCESS);
 }
 
 /*************************************************************
 *
-* Read the list of frequencies from the input freq file
+* Read the list of frequencies from a text file
 *
 *************************************************************/
-int getFreqList(struct IOFileDescriptors *descriptors,
-    struct parameters *params,
-    struct DataArrays *data_array) {
+int readFreqText(FILE *freq, double *freqList, int nFreq) {
     int i;
-    float tempFloat;
+    double tempDouble;
 
-    params->freqList = calloc(data_array->nFreqList, sizeof(data_array->freqList[0]));
-    if(params->freqList == NULL) {
-        printf("Error: Mem alloc failed while reading in frequency list\n\n");
-        return(FAILURE);
-    }
-    for(i=0; i<params->nFreq; i++) {
-        fscanf(descriptors->freq, "%f", &data_array->freqList[i]);
-        if(feof(descriptors->freq)) {
+    for(i=0; i<nFreq; i++) {
+        if(fscanf(freq, "%lf", &freqList[i]) != 1) {
             printf("Error: Frequency values and fits frames don't match\n");
             return(FAILURE);
         }
     }
-    fscanf(descriptors->freq, "%f", &tempFloat);
-    if(! feof(descriptors->freq)) {
+    if(fscanf(freq, "%lf", &tempDouble) == 1) {
         printf("Error: More frequency values present than fits frames\n\n");
         return(FAILURE);
     }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Read the list of frequencies from a binary table of native
+*  doubles. The file size is checked against the cube first.
+*
+*************************************************************/
+int readFreqBinary(FILE *freq, double *freqList, int nFreq) {
+    long nBytes;
+
+    fseek(freq, 0, SEEK_END);
+    nBytes = ftell(freq);
+    rewind(freq);
+    if(nBytes != (long)(nFreq*sizeof(*freqList))) {
+        printf("Error: Binary frequency table has %ld values, cube has %d frames\n\n",
+               nBytes/(long)sizeof(*freqList), nFreq);
+        return(FAILURE);
+    }
+    if(fread(freqList, sizeof(*freqList), nFreq, freq) != (size_t)nFreq) {
+        printf("Error: Unable to read the binary frequency table\n\n");
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
 
-    /* Compute \lambda^2 from the list of generated frequencies */
-    params->lambda2  = calloc(data_array->nFreq, sizeof(data_array->lambda2[0]));
-    if(params->lambda2 == NULL) {
+/*************************************************************
+*
+* Read the list of frequencies from a 1-D HDF5 dataset. If no
+*  frequency file is given, the dataset is looked up in the
+*  input Q cube.
+*
+*************************************************************/
+int readFreqHDF5(struct optionsList *inOptions,
+    struct IOFileDescriptors *descriptors,
+    double *freqList, int nFreq) {
+    hid_t file;
+    hsize_t dims[N_DIMS];
+    int rank;
+    herr_t error;
+
+    if(inOptions->freqFileName != NULL)
+        file = H5Fopen(inOptions->freqFileName, H5F_ACC_RDONLY, H5P_DEFAULT);
+    else
+        file = descriptors->qFileh5;
+    if(file < 0) {
+        printf("Error: Unable to open %s\n\n", inOptions->freqFileName);
+        return(FAILURE);
+    }
+
+    error = H5LTget_dataset_ndims(file, inOptions->freqDataset, &rank);
+    if(error >= 0 && rank == 1)
+        error = H5LTget_dataset_info(file, inOptions->freqDataset, dims, NULL, NULL);
+    if(error < 0 || rank != 1) {
+        printf("Error: %s is not a 1-D dataset\n\n", inOptions->freqDataset);
+        error = -1;
+    }
+    else if(dims[0] != (hsize_t)nFreq) {
+        printf("Error: %s has %llu values, cube has %d frames\n\n",
+               inOptions->freqDataset, (unsigned long long)dims[0], nFreq);
+        error = -1;
+    }
+    else
+        error = H5LTread_dataset_double(file, inOptions->freqDataset, freqList);
+
+    if(inOptions->freqFileName != NULL)
+        H5Fclose(file);
+    return(error < 0 ? FAILURE : SUCCESS);
+}
+
+/*************************************************************
+*
+* Generate the list of frequencies from the spectral axis of
+*  the input cube (CRVAL/CDELT/CRPIX of the frequency axis)
+*
+*************************************************************/
+int readFreqWCS(struct fits_header_parameters *header,
+    double *freqList, int nFreq) {
+    int i;
+
+    if(header->cdelt3 == 0.) {
+        printf("Error: Spectral axis of the input cube has CDELT = 0\n\n");
+        return(FAILURE);
+    }
+    for(i=0; i<nFreq; i++)
+        freqList[i] = header->crval3 + (i + 1 - header->crpix3)*header->cdelt3;
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Read the list of frequencies and compute \lambda^2
+*
+*************************************************************/
+int getFreqList(struct optionsList *inOptions,
+    struct IOFileDescriptors *descriptors,
+    struct fits_header_parameters *header,
+    struct parameters *params,
+    struct DataArrays *data_array) {
+    int i, status;
+    double *freqList, *lambda2;
+
+    data_array->nFreq = params->qAxisLen3;
+    data_array->freqList = calloc(data_array->nFreq, sizeof(*data_array->freqList));
+    data_array->lambda2  = calloc(data_array->nFreq, sizeof(*data_array->lambda2));
+    if(data_array->freqList == NULL || data_array->lambda2 == NULL) {
         printf("Error: Mem alloc failed while reading in frequency list\n\n");
         return(FAILURE);
     }
-    // TODO refactor
-    params->lambda20 = 0.0;
+
+    switch(inOptions->freqFormat) {
+       case FREQ_TEXT:
+          status = readFreqText(descriptors->freq, data_array->freqList,
+                                data_array->nFreq);
+          break;
+       case FREQ_BINARY:
+          status = readFreqBinary(descriptors->freq, data_array->freqList,
+                                  data_array->nFreq);
+          break;
+       case FREQ_HDF5:
+          status = readFreqHDF5(inOptions, descriptors, data_array->freqList,
+                                data_array->nFreq);
+          break;
+       case FREQ_WCS:
+          status = readFreqWCS(header, data_array->freqList, data_array->nFreq);
+          break;
+       default:
+          status = FAILURE;
+          break;
+    }
+    if(descriptors->freq != NULL) {
+        fclose(descriptors->freq);
+        descriptors->freq = NULL;
+    }
+    if(status != SUCCESS) { return(FAILURE); }
+
+    /* Compute \lambda^2 from the list of frequencies in one pass */
+    freqList = data_array->freqList;
+    lambda2  = data_array->lambda2;
+    for(i=0; i<data_array->nFreq; i++) {
+        if(freqList[i] <= 0.) {
+            printf("Error: Frequency %d is not positive (%g Hz)\n\n", i+1, freqList[i]);
+            return(FAILURE);
+        }
+    }
+    for(i=0; i<data_array->nFreq; i++)
+        lambda2[i] = (LIGHTSPEED*LIGHTSPEED) / (freqList[i]*freqList[i]);
+    data_array->lambda20 = 0.0;
+
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Read the per-channel weights. Without a weight file, all
+*  channels get unit weight.
+*
+*************************************************************/
+int getWeightList(struct optionsList *inOptions,
+    struct DataArrays *data_array) {
+    FILE *weightFile;
+    int i;
+    double tempDouble;
+
+    data_array->weights = calloc(data_array->nFreq, sizeof(*data_array->weights));
+    if(data_array->weights == NULL) {
+        printf("Error: Mem alloc failed while reading in weights\n\n");
+        return(FAILURE);
+    }
+    if(inOptions->weightFileName == NULL) {
+        for(i=0; i<data_array->nFreq; i++)
+            data_array->weights[i] = 1.;
+    }
+    else {
+        weightFile = fopen(inOptions->weightFileName, FILE_READONLY);
+        if(weightFile == NULL) {
+            printf("Error: Unable to open the weight file\n\n");
+            return(FAILURE);
+        }
+        for(i=0; i<data_array->nFreq; i++) {
+            if(fscanf(weightFile, "%lf", &data_array->weights[i]) != 1 ||
+               data_array->weights[i] < 0.) {
+                printf("Error: Weight %d is missing or negative\n\n", i+1);
+                fclose(weightFile);
+                return(FAILURE);
+            }
+        }
+        if(fscanf(weightFile, "%lf", &tempDouble) == 1) {
+            printf("Error: More weights present than fits frames\n\n");
+            fclose(weightFile);
+            return(FAILURE);
+        }
+        fclose(weightFile);
+    }
+
+    data_array->sumWeights = 0.;
     for(i=0; i<data_array->nFreq; i++)
-        params->lambda2[i] = (LIGHTSPEED / data_array->freqList[i]) *
-                             (LIGHTSPEED / data_array->freqList[i]);
+        data_array->sumWeights += data_array->weights[i];
+    if(data_array->sumWeights <= 0.) {
+        printf("Error: All channel weights are zero\n\n");
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Write RMSF to disk
+*
+*************************************************************/
+int writeRMSF(struct optionsList inOptions, struct DataArrays data_arrays) {
+    FILE *rmsf;
+    char filename[FILENAME_LEN];
+    int i;
+
+    /* Open a text file */
+    sprintf(filename, "%srmsf.txt", inOptions.outPrefix);
+    printf("INFO: Writing RMSF to %s\n", filename);
+    rmsf = fopen(filename, FILE_READWRITE);
+    if(rmsf == NULL)
+        return(FAILURE);
+
+    for(i=0; i<inOptions.nPhi; i++)
+        fprintf(rmsf, "%f\t%f\t%f\t%f\n", data_arrays.phiAxis[i], data_arrays.rmsfReal[i],
+                data_arrays.rmsfImag[i], data_arrays.rmsf[i]);
+
+    fclose(rmsf);
+    return(SUCCESS);
+}
+
+#ifdef GNUPLOT_ENABLE
+/*************************************************************
+*
+* Plot RMSF
+*
+*************************************************************/
+int plotRMSF(struct optionsList inOptions) {
+    FILE *gnuplotPipe;
+    char commands[STRING_BUF_LEN];
+
+    gnuplotPipe = popen("gnuplot -persist", FILE_READWRITE);
+    if(gnuplotPipe == NULL)
+        return(FAILURE);
+
+    /* Plot the RMSF using the file that was written in writeRMSF() */
+    sprintf(commands, "set title \"Rotation Measure Spread Function\"\n");
+    sprintf(commands, "%sset xlabel \"Faraday Depth\"\n", commands);
+    sprintf(commands, "%sset autoscale\n", commands);
+    sprintf(commands,"%splot \"%srmsf.txt\" using 1:2 title 'RMSF' with lines,",
+            commands, inOptions.outPrefix);
+    sprintf(commands, "%s \"%srmsf.txt\" using 1:3 title 'Real' with lines,",
+            commands, inOptions.outPrefix);
+    sprintf(commands, "%s \"%srmsf.txt\" using 1:4 title 'Imag' with lines\n",
+            commands, inOptions.outPrefix);
+    fprintf(gnuplotPipe, "%s", commands);
+    pclose(gnuplotPipe);
 
     return(SUCCESS);
 }
+#endif
@@ -28,15 +28,32 @@ extern "C"
 #endif
 
 void checkFitsError(int status);
-void checkInputFiles(struct optionsList *inOptions, struct IOFileDescriptors *descriptors);
-
-int getFitsHeader(struct optionsList *inOptions, struct fits_header_parameters *params, struct IOFileDescriptors *descriptors);
-int getHDF5Header(struct optionsList *inOptions, struct fits_header_parameters *header_parameters, struct parameters *params, struct IOFileDescriptors *descriptors);
-
-void makeOutputFitsImages(struct optionsList *inOptions, struct IOFileDescriptors *descriptors, struct fits_header_parameters *header_parameters, struct parameters *params);
-void makeOutputHDF5Images(struct optionsList *inOptions, struct IOFileDescriptors *descriptors, struct parameters *params, struct fits_header_parameters *header);
-
-int getFreqList(struct IOFileDescriptors *descriptors, struct parameters *params, struct DataArrays *data_array);
+int checkInputFiles(struct optionsList *inOptions, struct IOFileDescriptors *descriptors);
+void closeInputFiles(struct optionsList *inOptions, struct IOFileDescriptors *descriptors);
+int openFitsReaders(struct optionsList *inOptions, struct parameters *params, struct IOFileDescriptors *descriptors);
+int readFitsChunk(struct IOFileDescriptors *descriptors, long long first, long nElements, float *scratch, float *quImageArray);
+void closeFitsReaders(struct IOFileDescriptors *descriptors);
+int checkFitsTiles(struct parameters *params, struct IOFileDescriptors *descriptors);
+void setFitsBand(struct IOFileDescriptors *descriptors, struct parameters *params, float *band, int firstFrame, int nFrames);
+int readFitsBand(struct IOFileDescriptors *descriptors, int frame, long los0, long nLOS, float *quImageArray);
+const char *stokesIName(struct optionsList *inOptions);
+int checkStokesI(struct optionsList *inOptions, struct parameters *params, struct IOFileDescriptors *descriptors);
+
+int getFitsHeader(struct fits_header_parameters *header_parameters, struct parameters *params, struct IOFileDescriptors *descriptors);
+int getHDF5Header(struct fits_header_parameters *header_parameters, struct parameters *params, struct IOFileDescriptors *descriptors);
+int getTableHeader(struct optionsList *inOptions, struct fits_header_parameters *header_parameters, struct parameters *params, struct IOFileDescriptors *descriptors);
+
+int makeOutputFitsImages(struct optionsList *inOptions, struct IOFileDescriptors *descriptors, struct fits_header_parameters *header_parameters, struct parameters *params);
+int makeOutputHDF5Images(struct optionsList *inOptions, struct IOFileDescriptors *descriptors, struct parameters *params, struct fits_header_parameters *header);
+
+int readFreqText(FILE *freq, double *freqList, int nFreq);
+int readFreqBinary(FILE *freq, double *freqList, int nFreq);
+int readFreqHDF5(struct optionsList *inOptions, struct IOFileDescriptors *descriptors, double *freqList, int nFreq);
+int readFreqWCS(struct fits_header_parameters *header, double *freqList, int nFreq);
+int getWeightList(struct optionsList *inOptions, struct DataArrays *data_array);
+int getFreqList(struct optionsList *inOptions, struct IOFileDescriptors *descriptors, struct fits_header_parameters *header, struct parameters *params, struct DataArrays *data_array);
+int writeRMSF(struct optionsList inOptions, struct DataArrays data_arrays);
+int plotRMSF(struct optionsList inOptions);
 
 /* Define the output file names here */
 #define DIRTY_P "dirtyP.fits"
@@ -24,139 +24,850 @@ sarrvesh.ss@gmail.com
 #include "structures.h"
 #include<stdlib.h>
 #include<string.h>
+#include<strings.h>
 
 #include "inputparser.h"
 
 #define FITS_STR "FITS"
 #define HDF5_STR "HDF5"
+#define FREQ_TEXT_STR   "TEXT"
+#define FREQ_BINARY_STR "BINARY"
+#define FREQ_HDF5_STR   "HDF5"
+#define FREQ_WCS_STR    "WCS"
+#define LAMBDA20_MEDIAN_STR   "MEDIAN"
+#define LAMBDA20_WEIGHTED_STR "WEIGHTED"
+#define BACKEND_CPU_STR  "CPU"
+#define BACKEND_CUDA_STR "GPU"
+#define KERNEL_DIRECT_STR     "DIRECT"
+#define KERNEL_RECURRENCE_STR "RECURRENCE"
+#define ORDER_PHI_FIRST_STR "PHI"
+#define ORDER_SKY_STR       "SKY"
+#define OUTPUT_CUBES_STR    "CUBES"
+#define OUTPUT_CATALOG_STR  "CATALOG"
+#define OUTPUT_BOTH_STR     "BOTH"
+#define INPUT_CUBE_STR  "CUBE"
+#define INPUT_TABLE_STR "TABLE"
+#define FIT_THIN_STR  "THIN"
+#define FIT_THICK_STR "THICK"
+
+/* Copy an optional string of a field, NULL if it is not set */
+static int copyFieldString(config_setting_t *field, const char *key, char **dst) {
+    const char *str;
+
+    *dst = NULL;
+    if(!config_setting_lookup_string(field, key, &str)) { return(SUCCESS); }
+    *dst = malloc(strlen(str)+1);
+    if(*dst == NULL) { return(FAILURE); }
+    strcpy(*dst, str);
+    return(SUCCESS);
+}
 
 /*************************************************************
 *
-* Parse the input file and extract the relevant keywords
+* Read the optional list of fields of a batch parset:
+*  fields = ( { qCubeName = "..."; uCubeName = "...";
+*               outPrefix = "..."; }, ... );
+*  Every field needs its own outPrefix. A field may name its
+*  own Stokes I with iCubeName or iModelName.
 *
 *************************************************************/
-struct optionsList parseInput(char *parsetFileName) {
-    config_t cfg;
-    struct optionsList inOptions;
-    const char *str;
-    char *tempStr;
+static int parseFields(config_t *cfg, struct optionsList *inOptions) {
+    config_setting_t *list, *field;
+    const char *q, *u, *prefix;
+    int i, j, nFields;
 
-    /* Initialize configuration */
-    config_init(&cfg);
+    list = config_lookup(cfg, "fields");
+    if(list == NULL) { return(SUCCESS); }
+    nFields = config_setting_length(list);
+    if(nFields <= 0) {
+        printf("Error: 'fields' is empty\n\n");
+        return(FAILURE);
+    }
+    inOptions->fields = calloc(nFields, sizeof(*inOptions->fields));
+    if(inOptions->fields == NULL) {
+        printf("Error: Mem alloc failed while reading 'fields'\n\n");
+        return(FAILURE);
+    }
+    inOptions->nFields = nFields;
+    for(i=0; i<nFields; i++) {
+        field = config_setting_get_elem(list, i);
+        if(field == NULL ||
+           !config_setting_lookup_string(field, "qCubeName", &q) ||
+           !config_setting_lookup_string(field, "uCubeName", &u) ||
+           !config_setting_lookup_string(field, "outPrefix", &prefix)) {
+            printf("Error: Field %d needs qCubeName, uCubeName and outPrefix\n\n", i+1);
+            return(FAILURE);
+        }
+        for(j=0; j<i; j++) {
+            if(strcmp(inOptions->fields[j].outPrefix, prefix) == SUCCESS) {
+                printf("Error: Fields %d and %d have the same outPrefix\n\n", j+1, i+1);
+                return(FAILURE);
+            }
+        }
+        inOptions->fields[i].qCubeName = malloc(strlen(q)+1);
+        inOptions->fields[i].uCubeName = malloc(strlen(u)+1);
+        inOptions->fields[i].outPrefix = malloc(strlen(prefix)+1);
+        if(inOptions->fields[i].qCubeName == NULL ||
+           inOptions->fields[i].uCubeName == NULL ||
+           inOptions->fields[i].outPrefix == NULL) {
+            printf("Error: Mem alloc failed while reading 'fields'\n\n");
+            return(FAILURE);
+        }
+        strcpy(inOptions->fields[i].qCubeName, q);
+        strcpy(inOptions->fields[i].uCubeName, u);
+        strcpy(inOptions->fields[i].outPrefix, prefix);
+        if(copyFieldString(field, "iCubeName", &inOptions->fields[i].iCubeName) ||
+           copyFieldString(field, "iModelName", &inOptions->fields[i].iModelName)) {
+            printf("Error: Mem alloc failed while reading 'fields'\n\n");
+            return(FAILURE);
+        }
+        if(inOptions->fields[i].iCubeName != NULL &&
+           inOptions->fields[i].iModelName != NULL) {
+            printf("Error: Field %d sets both iCubeName and iModelName\n\n", i+1);
+            return(FAILURE);
+        }
+    }
+    return(SUCCESS);
+}
 
-    /* Read in the configuration file */
-    if(!config_read_file(&cfg, parsetFileName)) {
-        printf("Error: Error reading parset file. %s\n\n",
-               config_error_text(&cfg));
-        config_destroy(&cfg);
-        exit(FAILURE);
+/*************************************************************
+*
+* Read the optional list of phi axes:
+*  phiGrids = ( { phiMin = ...; dPhi = ...; nPhi = ...;
+*                 outSuffix = "..."; }, ... );
+*  Every grid needs its own outSuffix. The first grid also
+*  sets phiMin, dPhi and nPhi of the job.
+*
+*************************************************************/
+static int parseGrids(config_t *cfg, struct optionsList *inOptions) {
+    config_setting_t *list, *entry;
+    struct phiGrid *grid;
+    const char *suffix;
+    int i, j, nGrids;
+
+    list = config_lookup(cfg, "phiGrids");
+    if(list == NULL) { return(SUCCESS); }
+    nGrids = config_setting_length(list);
+    if(nGrids <= 0) {
+        printf("Error: 'phiGrids' is empty\n\n");
+        return(FAILURE);
+    }
+    inOptions->grids = calloc(nGrids, sizeof(*inOptions->grids));
+    if(inOptions->grids == NULL) {
+        printf("Error: Mem alloc failed while reading 'phiGrids'\n\n");
+        return(FAILURE);
     }
+    inOptions->nGrids = nGrids;
+    for(i=0; i<nGrids; i++) {
+        grid = &inOptions->grids[i];
+        entry = config_setting_get_elem(list, i);
+        if(entry == NULL ||
+           !config_setting_lookup_float(entry, "phiMin", &grid->phiMin) ||
+           !config_setting_lookup_float(entry, "dPhi", &grid->dPhi) ||
+           !config_setting_lookup_int(entry, "nPhi", &grid->nPhi) ||
+           !config_setting_lookup_string(entry, "outSuffix", &suffix)) {
+            printf("Error: Grid %d needs phiMin, dPhi, nPhi and outSuffix\n\n", i+1);
+            return(FAILURE);
+        }
+        if(grid->dPhi <= ZERO || grid->nPhi <= ZERO) {
+            printf("Error: dPhi and nPhi of grid %d have to be positive\n\n", i+1);
+            return(FAILURE);
+        }
+        for(j=0; j<i; j++) {
+            if(strcmp(inOptions->grids[j].outSuffix, suffix) == SUCCESS) {
+                printf("Error: Grids %d and %d have the same outSuffix\n\n", j+1, i+1);
+                return(FAILURE);
+            }
+        }
+        grid->outSuffix = malloc(strlen(suffix)+1);
+        if(grid->outSuffix == NULL) {
+            printf("Error: Mem alloc failed while reading 'phiGrids'\n\n");
+            return(FAILURE);
+        }
+        strcpy(grid->outSuffix, suffix);
+    }
+    inOptions->phiMin = inOptions->grids[0].phiMin;
+    inOptions->dPhi = inOptions->grids[0].dPhi;
+    inOptions->nPhi = inOptions->grids[0].nPhi;
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Read the optional sub-bands, either listed:
+*  subbands = ( { firstChan = ...; nChan = ...;
+*                 outSuffix = "..."; }, ... );
+*  or as a sliding window of subbandWidth channels moved by
+*  subbandStep (default subbandWidth) channels. Channels count
+*  from 0 and are checked against the cube by checkOutputs().
+*
+*************************************************************/
+static int parseBands(config_t *cfg, struct optionsList *inOptions) {
+    config_setting_t *list, *entry;
+    struct subband *band;
+    const char *suffix;
+    int i, j, nBands;
+
+    if(config_lookup_int(cfg, "subbandWidth", &inOptions->bandWidth)) {
+        if(! config_lookup_int(cfg, "subbandStep", &inOptions->bandStep))
+            inOptions->bandStep = inOptions->bandWidth;
+        if(inOptions->bandWidth < 1 || inOptions->bandStep < 1) {
+            printf("Error: subbandWidth and subbandStep have to be positive\n\n");
+            return(FAILURE);
+        }
+    }
+    list = config_lookup(cfg, "subbands");
+    if(list == NULL) { return(SUCCESS); }
+    if(inOptions->bandWidth > 0) {
+        printf("Error: Set either 'subbands' or 'subbandWidth', not both\n\n");
+        return(FAILURE);
+    }
+    nBands = config_setting_length(list);
+    if(nBands <= 0) {
+        printf("Error: 'subbands' is empty\n\n");
+        return(FAILURE);
+    }
+    inOptions->bands = calloc(nBands, sizeof(*inOptions->bands));
+    if(inOptions->bands == NULL) {
+        printf("Error: Mem alloc failed while reading 'subbands'\n\n");
+        return(FAILURE);
+    }
+    inOptions->nBands = nBands;
+    for(i=0; i<nBands; i++) {
+        band = &inOptions->bands[i];
+        entry = config_setting_get_elem(list, i);
+        if(entry == NULL ||
+           !config_setting_lookup_int(entry, "firstChan", &band->firstChan) ||
+           !config_setting_lookup_int(entry, "nChan", &band->nChan) ||
+           !config_setting_lookup_string(entry, "outSuffix", &suffix)) {
+            printf("Error: Sub-band %d needs firstChan, nChan and outSuffix\n\n", i+1);
+            return(FAILURE);
+        }
+        if(band->firstChan < 0 || band->nChan < 1) {
+            printf("Error: Sub-band %d has no channels\n\n", i+1);
+            return(FAILURE);
+        }
+        for(j=0; j<i; j++) {
+            if(strcmp(inOptions->bands[j].outSuffix, suffix) == SUCCESS) {
+                printf("Error: Sub-bands %d and %d have the same outSuffix\n\n", j+1, i+1);
+                return(FAILURE);
+            }
+        }
+        band->outSuffix = malloc(strlen(suffix)+1);
+        if(band->outSuffix == NULL) {
+            printf("Error: Mem alloc failed while reading 'subbands'\n\n");
+            return(FAILURE);
+        }
+        strcpy(band->outSuffix, suffix);
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Extract the relevant keywords from a parsed configuration.
+*  Returns FAILURE with a message on invalid input; strings
+*  allocated so far are released by freeOptions().
+*
+*************************************************************/
+static int parseConfig(config_t *cfg, struct optionsList *inOptions) {
+    const char *str;
+    char *tempStr;
+    int i, hasModel, hasI;
+
+    memset(inOptions, 0, sizeof(*inOptions));
 
     /* Get the input file format */
-    if(config_lookup_string(&cfg, "fileFormat", &str)) {
+    if(config_lookup_string(cfg, "fileFormat", &str)) {
         tempStr = malloc(strlen(str)+1);
         strcpy(tempStr, str);
     }
     else {
         printf("Error: 'fileFormat' undefined in parset\n\n");
-        config_destroy(&cfg);
-        exit(FAILURE);
+        return(FAILURE);
     }
     if(((strcasecmp(tempStr, FITS_STR)!=SUCCESS) &&
          strcasecmp(tempStr, HDF5_STR)!=SUCCESS)) {
         printf("Error: 'fileFormat' has to be FITS or HDF5\n\n");
-        config_destroy(&cfg);
-        exit(FAILURE);
+        free(tempStr);
+        return(FAILURE);
     } // Note strcasecmp is not standard C
     if(strcasecmp(tempStr, HDF5_STR)==SUCCESS) {
-        inOptions.fileFormat = HDF5;
+        inOptions->fileFormat = HDF5;
     }
-    else { inOptions.fileFormat = FITS; }
+    else { inOptions->fileFormat = FITS; }
     free(tempStr);
 
+    /* A batch parset lists its cubes in 'fields' */
+    if(parseFields(cfg, inOptions)) { return(FAILURE); }
+
     /* Get the names of fits files */
-    if(config_lookup_string(&cfg, "qCubeName", &str)) {
-        inOptions.qCubeName = malloc(strlen(str)+1);
-        strcpy(inOptions.qCubeName, str);
+    if(config_lookup_string(cfg, "qCubeName", &str)) {
+        inOptions->qCubeName = malloc(strlen(str)+1);
+        strcpy(inOptions->qCubeName, str);
     }
-    else {
+    else if(inOptions->nFields == 0) {
         printf("Error: 'qCubeName' undefined in parset\n\n");
-        config_destroy(&cfg);
-        exit(FAILURE);
+        return(FAILURE);
     }
-    if(config_lookup_string(&cfg, "uCubeName", &str)) {
-        inOptions.uCubeName = malloc(strlen(str)+1);
-        strcpy(inOptions.uCubeName, str);
+    if(config_lookup_string(cfg, "uCubeName", &str)) {
+        inOptions->uCubeName = malloc(strlen(str)+1);
+        strcpy(inOptions->uCubeName, str);
     }
-    else {
+    else if(inOptions->nFields == 0) {
         printf("Error: 'uCubeName' undefined in parset\n\n");
-        config_destroy(&cfg);
-        exit(FAILURE);
+        return(FAILURE);
+    }
+
+    /* Cubes, or tables with one spectrum per row */
+    inOptions->inputType = INPUT_CUBE;
+    if(config_lookup_string(cfg, "inputType", &str)) {
+        if(strcasecmp(str, INPUT_CUBE_STR) == SUCCESS)
+            inOptions->inputType = INPUT_CUBE;
+        else if(strcasecmp(str, INPUT_TABLE_STR) == SUCCESS)
+            inOptions->inputType = INPUT_TABLE;
+        else {
+            printf("Error: 'inputType' has to be CUBE or TABLE\n\n");
+            return(FAILURE);
+        }
+    }
+    if(! config_lookup_string(cfg, "qColumn", &str)) { str = DEFAULT_Q_COLUMN; }
+    inOptions->qColumn = malloc(strlen(str)+1);
+    strcpy(inOptions->qColumn, str);
+    if(! config_lookup_string(cfg, "uColumn", &str)) { str = DEFAULT_U_COLUMN; }
+    inOptions->uColumn = malloc(strlen(str)+1);
+    strcpy(inOptions->uColumn, str);
+
+    /* Optional Stokes I, as a cube or as a spectral model */
+    if(config_lookup_string(cfg, "iCubeName", &str)) {
+        inOptions->iCubeName = malloc(strlen(str)+1);
+        strcpy(inOptions->iCubeName, str);
+    }
+    if(config_lookup_string(cfg, "iModelName", &str)) {
+        inOptions->iModelName = malloc(strlen(str)+1);
+        strcpy(inOptions->iModelName, str);
+    }
+    if(inOptions->iCubeName != NULL && inOptions->iModelName != NULL) {
+        printf("Error: Set either 'iCubeName' or 'iModelName', not both\n\n");
+        return(FAILURE);
+    }
+    if(! config_lookup_float(cfg, "iModelFreq", &inOptions->iModelFreq)) {
+        inOptions->iModelFreq = 0.;
+    }
+    inOptions->stokesI = STOKES_I_NONE;
+    if(inOptions->iCubeName != NULL) { inOptions->stokesI = STOKES_I_CUBE; }
+    if(inOptions->iModelName != NULL) { inOptions->stokesI = STOKES_I_MODEL; }
+    hasModel = (inOptions->iModelName != NULL);
+    for(i=0; i<inOptions->nFields; i++) {
+        if(inOptions->fields[i].iModelName != NULL) { hasModel = TRUE; }
+    }
+    if(hasModel && inOptions->iModelFreq <= ZERO) {
+        printf("Error: A Stokes I model needs a positive 'iModelFreq' in Hz\n\n");
+        return(FAILURE);
     }
 
     /* Get the name of the frequency file */
-    if(config_lookup_string(&cfg, "freqFileName", &str)) {
-        inOptions.freqFileName = malloc(strlen(str)+1);
-        strcpy(inOptions.freqFileName, str);
+    if(config_lookup_string(cfg, "freqFileName", &str)) {
+        inOptions->freqFileName = malloc(strlen(str)+1);
+        strcpy(inOptions->freqFileName, str);
     }
-    else {
+    else { inOptions->freqFileName = NULL; }
+
+    /* How is the frequency information stored? */
+    if(config_lookup_string(cfg, "freqFormat", &str)) {
+        if(strcasecmp(str, FREQ_TEXT_STR) == SUCCESS)
+            inOptions->freqFormat = FREQ_TEXT;
+        else if(strcasecmp(str, FREQ_BINARY_STR) == SUCCESS)
+            inOptions->freqFormat = FREQ_BINARY;
+        else if(strcasecmp(str, FREQ_HDF5_STR) == SUCCESS)
+            inOptions->freqFormat = FREQ_HDF5;
+        else if(strcasecmp(str, FREQ_WCS_STR) == SUCCESS)
+            inOptions->freqFormat = FREQ_WCS;
+        else {
+            printf("Error: 'freqFormat' has to be TEXT, BINARY, HDF5 or WCS\n\n");
+            return(FAILURE);
+        }
+    }
+    else if(inOptions->freqFileName == NULL) {
+        /* No frequency file. Fall back to the spectral axis of the cube */
+        printf("INFO: 'freqFileName' undefined. Using the cube spectral axis.\n");
+        inOptions->freqFormat = FREQ_WCS;
+    }
+    else { inOptions->freqFormat = FREQ_TEXT; }
+    if((inOptions->freqFormat == FREQ_TEXT ||
+        inOptions->freqFormat == FREQ_BINARY) &&
+        inOptions->freqFileName == NULL) {
         printf("Error: 'freqFileName' undefined in parset\n\n");
-        config_destroy(&cfg);
-        exit(FAILURE);
+        return(FAILURE);
+    }
+    if(inOptions->freqFormat == FREQ_HDF5 &&
+       inOptions->freqFileName == NULL && inOptions->fileFormat != HDF5) {
+        printf("Error: 'freqFormat = HDF5' needs 'freqFileName' or HDF5 input cubes\n\n");
+        return(FAILURE);
+    }
+
+    /* Name of the frequency dataset inside an HDF5 file */
+    if(config_lookup_string(cfg, "freqDataset", &str)) {
+        inOptions->freqDataset = malloc(strlen(str)+1);
+        strcpy(inOptions->freqDataset, str);
+    }
+    else {
+        inOptions->freqDataset = malloc(strlen(DEFAULT_FREQ_DATASET)+1);
+        strcpy(inOptions->freqDataset, DEFAULT_FREQ_DATASET);
+    }
+
+    /* A table has no spectral axis to fall back to */
+    if(inOptions->inputType == INPUT_TABLE) {
+        if(inOptions->freqFormat == FREQ_WCS) {
+            printf("Error: Table input needs 'freqFileName' or 'freqFormat = HDF5'\n\n");
+            return(FAILURE);
+        }
+        hasI = (inOptions->stokesI != STOKES_I_NONE);
+        for(i=0; i<inOptions->nFields; i++)
+            if(inOptions->fields[i].iCubeName != NULL ||
+               inOptions->fields[i].iModelName != NULL) { hasI = TRUE; }
+        if(hasI) {
+            printf("Error: Stokes I is only supported with cube input\n\n");
+            return(FAILURE);
+        }
+    }
+
+    /* Get the name of the optional channel weight file */
+    if(config_lookup_string(cfg, "weightFileName", &str)) {
+        inOptions->weightFileName = malloc(strlen(str)+1);
+        strcpy(inOptions->weightFileName, str);
+    }
+    else { inOptions->weightFileName = NULL; }
+
+    /* How should \lambda^2_0 be chosen? A numeric 'lambda20'
+       overrides 'lambda20Mode' */
+    inOptions->lambda20Mode = LAMBDA20_MEDIAN;
+    inOptions->lambda20 = 0.;
+    if(config_lookup_string(cfg, "lambda20Mode", &str)) {
+        if(strcasecmp(str, LAMBDA20_MEDIAN_STR) == SUCCESS)
+            inOptions->lambda20Mode = LAMBDA20_MEDIAN;
+        else if(strcasecmp(str, LAMBDA20_WEIGHTED_STR) == SUCCESS)
+            inOptions->lambda20Mode = LAMBDA20_WEIGHTED;
+        else {
+            printf("Error: 'lambda20Mode' has to be MEDIAN or WEIGHTED\n\n");
+            return(FAILURE);
+        }
+    }
+    if(config_lookup_float(cfg, "lambda20", &inOptions->lambda20)) {
+        if(inOptions->lambda20 < ZERO) {
+            printf("Error: lambda20 cannot be less than 0\n\n");
+            return(FAILURE);
+        }
+        inOptions->lambda20Mode = LAMBDA20_USER;
     }
 
     /* Get prefix for output files */
-    if(config_lookup_string(&cfg, "outPrefix", &str)) {
-        inOptions.outPrefix = malloc(strlen(str)+1);
-        strcpy(inOptions.outPrefix, str);
+    if(config_lookup_string(cfg, "outPrefix", &str)) {
+        inOptions->outPrefix = malloc(strlen(str)+1);
+        strcpy(inOptions->outPrefix, str);
     }
     else {
         printf("INFO: 'outPrefix' is not defined. Defaulting to %s\n\n",
                 DEFAULT_OUT_PREFIX);
-        inOptions.outPrefix = malloc(strlen(DEFAULT_OUT_PREFIX)+1);
-        strcpy(inOptions.outPrefix, DEFAULT_OUT_PREFIX);
+        inOptions->outPrefix = malloc(strlen(DEFAULT_OUT_PREFIX)+1);
+        strcpy(inOptions->outPrefix, DEFAULT_OUT_PREFIX);
     }
 
-    /* Get Faraday depth */
-    if(! config_lookup_float(&cfg, "phiMin", &inOptions.phiMin)) {
+    /* Get Faraday depth, from the first grid if there are several,
+       and the sub-bands to synthesize on their own */
+    if(parseGrids(cfg, inOptions)) { return(FAILURE); }
+    if(parseBands(cfg, inOptions)) { return(FAILURE); }
+    if(inOptions->nGrids > 0) {
+        printf("INFO: %d phi grids; phiMin, dPhi and nPhi are those of the first\n",
+               inOptions->nGrids);
+    }
+    else if(! config_lookup_float(cfg, "phiMin", &inOptions->phiMin)) {
         printf("Error: 'phiMin' undefined in parset\n\n");
-        config_destroy(&cfg);
-        exit(FAILURE);
+        return(FAILURE);
     }
     /* Get number of output phi planes */
-    if(! config_lookup_float(&cfg, "dPhi", &inOptions.dPhi)) {
+    if(inOptions->nGrids == 0 && ! config_lookup_float(cfg, "dPhi", &inOptions->dPhi)) {
         printf("Error: 'dPhi' undefined in parset\n\n");
-        config_destroy(&cfg);
-        exit(FAILURE);
+        return(FAILURE);
     }
-    if(inOptions.dPhi <= ZERO) {
+    if(inOptions->dPhi <= ZERO) {
        printf("Error: dPhi cannot be less than 0\n\n");
-       config_destroy(&cfg);
-       exit(FAILURE);
+       return(FAILURE);
     }
-    if(! config_lookup_int(&cfg, "nPhi", &inOptions.nPhi)) {
+    if(inOptions->nGrids == 0 && ! config_lookup_int(cfg, "nPhi", &inOptions->nPhi)) {
         printf("Error: 'nPhi' undefined in parset\n\n");
-        config_destroy(&cfg);
-        exit(FAILURE);
+        return(FAILURE);
     }
-    if(inOptions.nPhi <= ZERO) {
+    if(inOptions->nPhi <= ZERO) {
        printf("Error: nPhi cannot be less than 0\n\n");
-       config_destroy(&cfg);
-       exit(FAILURE);
+       return(FAILURE);
     }
-    if(! config_lookup_bool(&cfg, "plotRMSF", &inOptions.plotRMSF)) {
+    if(! config_lookup_bool(cfg, "plotRMSF", &inOptions->plotRMSF)) {
         printf("INFO: 'plotRMSF' undefined in parset\n");
-        inOptions.plotRMSF = FALSE;
+        inOptions->plotRMSF = FALSE;
     }
-    if(! config_lookup_int(&cfg, "nGPU", &inOptions.nGPU)) {
+    if(! config_lookup_int(cfg, "nGPU", &inOptions->nGPU)) {
         printf("INFO: 'nGPU' undefined in parset. Will use 1 device.\n");
-        inOptions.nGPU = 1;
+        inOptions->nGPU = 1;
+    }
+
+    /* Where and how to compute */
+    inOptions->backend = BACKEND_CUDA;
+    if(config_lookup_string(cfg, "backend", &str)) {
+        if(strcasecmp(str, BACKEND_CPU_STR) == SUCCESS)
+            inOptions->backend = BACKEND_CPU;
+        else if(strcasecmp(str, BACKEND_CUDA_STR) == SUCCESS)
+            inOptions->backend = BACKEND_CUDA;
+        else {
+            printf("Error: 'backend' has to be GPU or CPU\n\n");
+            return(FAILURE);
+        }
+    }
+    inOptions->variant = KERNEL_DIRECT;
+    if(config_lookup_string(cfg, "kernel", &str)) {
+        if(strcasecmp(str, KERNEL_DIRECT_STR) == SUCCESS)
+            inOptions->variant = KERNEL_DIRECT;
+        else if(strcasecmp(str, KERNEL_RECURRENCE_STR) == SUCCESS)
+            inOptions->variant = KERNEL_RECURRENCE;
+        else {
+            printf("Error: 'kernel' has to be DIRECT or RECURRENCE\n\n");
+            return(FAILURE);
+        }
+    }
+    if(! config_lookup_int(cfg, "nThreads", &inOptions->nThreads)) {
+        inOptions->nThreads = 0;
+    }
+    if(inOptions->nThreads < 0) {
+        printf("Error: nThreads cannot be less than 0\n\n");
+        return(FAILURE);
+    }
+
+    /* Axis order of the FITS output cubes. HDF5 output is always
+       stored as [phi][DEC][RA], i.e. already in sky order */
+    inOptions->outputOrder = ORDER_PHI_FIRST;
+    if(config_lookup_string(cfg, "outputOrder", &str)) {
+        if(strcasecmp(str, ORDER_PHI_FIRST_STR) == SUCCESS)
+            inOptions->outputOrder = ORDER_PHI_FIRST;
+        else if(strcasecmp(str, ORDER_SKY_STR) == SUCCESS)
+            inOptions->outputOrder = ORDER_SKY;
+        else {
+            printf("Error: 'outputOrder' has to be PHI or SKY\n\n");
+            return(FAILURE);
+        }
+    }
+    if(! config_lookup_int(cfg, "tileMemory", &inOptions->tileMemory)) {
+        inOptions->tileMemory = DEFAULT_TILE_MEMORY;
+    }
+    if(inOptions->tileMemory <= 0) {
+        printf("Error: tileMemory has to be positive\n\n");
+        return(FAILURE);
+    }
+    if(! config_lookup_int(cfg, "readThreads", &inOptions->readThreads)) {
+        inOptions->readThreads = DEFAULT_READ_THREADS;
+    }
+    if(inOptions->readThreads < 1) {
+        printf("Error: readThreads has to be positive\n\n");
+        return(FAILURE);
+    }
+
+    /* Memory budgets for the planner, and whether to stop after
+       printing the plan */
+    if(! config_lookup_int(cfg, "hostMemory", &inOptions->hostMemory)) {
+        inOptions->hostMemory = 0;
+    }
+    if(! config_lookup_int(cfg, "deviceMemory", &inOptions->deviceMemory)) {
+        inOptions->deviceMemory = 0;
+    }
+    if(inOptions->hostMemory < 0 || inOptions->deviceMemory < 0) {
+        printf("Error: hostMemory and deviceMemory cannot be less than 0\n\n");
+        return(FAILURE);
     }
+    if(! config_lookup_bool(cfg, "dryRun", &inOptions->dryRun)) {
+        inOptions->dryRun = FALSE;
+    }
+
+    /* Refinement of the peaks of the coarse phi axis. The window
+       defaults to one coarse plane either side of the peak,
+       sampled ten times finer */
+    if(! config_lookup_int(cfg, "refinePeaks", &inOptions->refinePeaks)) {
+        inOptions->refinePeaks = 0;
+    }
+    if(! config_lookup_float(cfg, "refineThreshold", &inOptions->refineThreshold)) {
+        inOptions->refineThreshold = 0.;
+    }
+    if(! config_lookup_float(cfg, "refineDPhi", &inOptions->refineDPhi)) {
+        inOptions->refineDPhi = inOptions->dPhi / 10.;
+    }
+    if(! config_lookup_float(cfg, "refineWidth", &inOptions->refineWidth)) {
+        inOptions->refineWidth = inOptions->dPhi;
+    }
+    if(inOptions->refinePeaks < 0) {
+        printf("Error: refinePeaks cannot be less than 0\n\n");
+        return(FAILURE);
+    }
+    if(inOptions->refineDPhi <= ZERO || inOptions->refineWidth < ZERO) {
+        printf("Error: refineDPhi has to be positive and refineWidth cannot be less than 0\n\n");
+        return(FAILURE);
+    }
+    if(inOptions->refineWidth/inOptions->refineDPhi > MAX_REFINE_SAMPLES/2) {
+        printf("Error: refineWidth/refineDPhi cannot exceed %d\n\n", MAX_REFINE_SAMPLES/2);
+        return(FAILURE);
+    }
+    inOptions->refineSamples = 2*(int)(inOptions->refineWidth/inOptions->refineDPhi + 0.5) + 1;
+
+    /* Per-sightline noise and S/N maps */
+    if(! config_lookup_bool(cfg, "noiseMaps", &inOptions->noiseMaps)) {
+        inOptions->noiseMaps = FALSE;
+    }
+    if(! config_lookup_float(cfg, "noiseExclude", &inOptions->noiseExclude)) {
+        inOptions->noiseExclude = 0.;
+    }
+    if(inOptions->noiseExclude < ZERO) {
+        printf("Error: noiseExclude cannot be less than 0\n\n");
+        return(FAILURE);
+    }
+
+    /* Cubes, a catalog of significant peaks, or both */
+    inOptions->outputMode = OUTPUT_CUBES;
+    if(config_lookup_string(cfg, "outputMode", &str)) {
+        if(strcasecmp(str, OUTPUT_CUBES_STR) == SUCCESS)
+            inOptions->outputMode = OUTPUT_CUBES;
+        else if(strcasecmp(str, OUTPUT_CATALOG_STR) == SUCCESS)
+            inOptions->outputMode = OUTPUT_CATALOG;
+        else if(strcasecmp(str, OUTPUT_BOTH_STR) == SUCCESS)
+            inOptions->outputMode = OUTPUT_BOTH;
+        else {
+            printf("Error: 'outputMode' has to be CUBES, CATALOG or BOTH\n\n");
+            return(FAILURE);
+        }
+    }
+    if(! config_lookup_float(cfg, "catalogThreshold", &inOptions->catalogThreshold)) {
+        inOptions->catalogThreshold = 0.;
+    }
+    if(! config_lookup_float(cfg, "catalogSNR", &inOptions->catalogSNR)) {
+        inOptions->catalogSNR = 0.;
+    }
+    if(inOptions->catalogThreshold < ZERO || inOptions->catalogSNR < ZERO) {
+        printf("Error: catalogThreshold and catalogSNR cannot be less than 0\n\n");
+        return(FAILURE);
+    }
+    if(inOptions->outputMode != OUTPUT_CUBES &&
+       inOptions->catalogThreshold <= ZERO && inOptions->catalogSNR <= ZERO) {
+        printf("Error: A catalog needs catalogThreshold or catalogSNR\n\n");
+        return(FAILURE);
+    }
+
+    /* Model fitted to the spectra of every sightline */
+    inOptions->fitModel = FIT_NONE;
+    if(config_lookup_string(cfg, "fitModel", &str)) {
+        if(strcasecmp(str, FIT_THIN_STR) == SUCCESS)
+            inOptions->fitModel = FIT_THIN;
+        else if(strcasecmp(str, FIT_THICK_STR) == SUCCESS)
+            inOptions->fitModel = FIT_THICK;
+        else {
+            printf("Error: 'fitModel' has to be THIN or THICK\n\n");
+            return(FAILURE);
+        }
+    }
+    if(! config_lookup_int(cfg, "fitIterations", &inOptions->fitIterations)) {
+        inOptions->fitIterations = DEFAULT_FIT_ITERATIONS;
+    }
+    if(inOptions->fitIterations < 1) {
+        printf("Error: fitIterations has to be at least 1\n\n");
+        return(FAILURE);
+    }
+
+    return(SUCCESS);
+}
 
+/*************************************************************
+*
+* Parse the input file and extract the relevant keywords
+*
+*************************************************************/
+struct optionsList parseInput(char *parsetFileName) {
+    config_t cfg;
+    struct optionsList inOptions;
+
+    /* Initialize configuration */
+    config_init(&cfg);
+
+    /* Read in the configuration file */
+    if(!config_read_file(&cfg, parsetFileName)) {
+        printf("Error: Error reading parset file. %s\n\n",
+               config_error_text(&cfg));
+        config_destroy(&cfg);
+        exit(FAILURE);
+    }
+    if(parseConfig(&cfg, &inOptions)) {
+        config_destroy(&cfg);
+        exit(FAILURE);
+    }
     config_destroy(&cfg);
     return(inOptions);
 }
 
+/*************************************************************
+*
+* Parse a parset held in memory, e.g. a job sent to the daemon
+*
+*************************************************************/
+int parseInputString(const char *parset, struct optionsList *inOptions) {
+    config_t cfg;
+    int status;
+
+    config_init(&cfg);
+    if(!config_read_string(&cfg, parset)) {
+        printf("Error: Error reading parset. %s (line %d)\n\n",
+               config_error_text(&cfg), config_error_line(&cfg));
+        config_destroy(&cfg);
+        memset(inOptions, 0, sizeof(*inOptions));
+        return(FAILURE);
+    }
+    status = parseConfig(&cfg, inOptions);
+    config_destroy(&cfg);
+    return(status);
+}
+
+/*************************************************************
+*
+* Release the strings held by an optionsList
+*
+*************************************************************/
+void freeOptions(struct optionsList *inOptions) {
+    int i;
+
+    free(inOptions->qCubeName);
+    free(inOptions->uCubeName);
+    free(inOptions->freqFileName);
+    free(inOptions->freqDataset);
+    free(inOptions->weightFileName);
+    free(inOptions->outPrefix);
+    free(inOptions->iCubeName);
+    free(inOptions->iModelName);
+    free(inOptions->qColumn);
+    free(inOptions->uColumn);
+    inOptions->qCubeName = inOptions->uCubeName = NULL;
+    inOptions->qColumn = inOptions->uColumn = NULL;
+    inOptions->iCubeName = inOptions->iModelName = NULL;
+    inOptions->freqFileName = inOptions->freqDataset = NULL;
+    inOptions->weightFileName = inOptions->outPrefix = NULL;
+    for(i=0; i<inOptions->nFields; i++) {
+        free(inOptions->fields[i].qCubeName);
+        free(inOptions->fields[i].uCubeName);
+        free(inOptions->fields[i].outPrefix);
+        free(inOptions->fields[i].iCubeName);
+        free(inOptions->fields[i].iModelName);
+    }
+    free(inOptions->fields);
+    inOptions->fields = NULL;
+    inOptions->nFields = 0;
+    for(i=0; i<inOptions->nGrids; i++) { free(inOptions->grids[i].outSuffix); }
+    free(inOptions->grids);
+    inOptions->grids = NULL;
+    inOptions->nGrids = 0;
+    for(i=0; i<inOptions->nBands; i++) { free(inOptions->bands[i].outSuffix); }
+    free(inOptions->bands);
+    inOptions->bands = NULL;
+    inOptions->nBands = 0;
+}
+
+/*************************************************************
+*
+* Fill field with the options of field i of a batch parset.
+*  The strings are shared with batch; do not free field.
+*
+*************************************************************/
+void selectField(struct optionsList *batch, int i, struct optionsList *field) {
+    *field = *batch;
+    field->qCubeName = batch->fields[i].qCubeName;
+    field->uCubeName = batch->fields[i].uCubeName;
+    field->outPrefix = batch->fields[i].outPrefix;
+    if(batch->fields[i].iCubeName != NULL || batch->fields[i].iModelName != NULL) {
+        field->iCubeName = batch->fields[i].iCubeName;
+        field->iModelName = batch->fields[i].iModelName;
+        field->stokesI = field->iCubeName != NULL ? STOKES_I_CUBE : STOKES_I_MODEL;
+    }
+    field->nFields = 0;
+    field->fields = NULL;
+}
+
+/* Sub-bands of a job with nChan channels, or 1 for the full band */
+static int countBands(struct optionsList *inOptions, int nChan) {
+    if(inOptions->nBands > 0) { return(inOptions->nBands); }
+    if(inOptions->bandWidth > 0 && inOptions->bandWidth <= nChan)
+        return((nChan - inOptions->bandWidth) / inOptions->bandStep + 1);
+    return(1);
+}
+
+/* Number of output sets of a job, one per sub-band and phi grid */
+int countOutputs(struct optionsList *inOptions, int nChan) {
+    return(countBands(inOptions, nChan) *
+           (inOptions->nGrids > 0 ? inOptions->nGrids : 1));
+}
+
+/* Check the sub-bands against the nChan channels of the cube */
+int checkOutputs(struct optionsList *inOptions, int nChan) {
+    int i;
+
+    if(inOptions->bandWidth > nChan) {
+        printf("Error: subbandWidth is larger than the %d channels of the cube\n\n", nChan);
+        return(FAILURE);
+    }
+    for(i=0; i<inOptions->nBands; i++) {
+        if(inOptions->bands[i].firstChan + inOptions->bands[i].nChan > nChan) {
+            printf("Error: Sub-band %s runs past the %d channels of the cube\n\n",
+                   inOptions->bands[i].outSuffix, nChan);
+            return(FAILURE);
+        }
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Fill output with the options of output set i of a job with
+*  nChan channels: its channels and phi axis, and outPrefix
+*  followed by the sub-band and grid suffixes, which is written
+*  to prefix (FILENAME_LEN). Windows of a sliding sub-band are
+*  named after their channels, e.g. ch0-63_. Other strings are
+*  shared with job; do not free output.
+*
+*************************************************************/
+void selectOutput(struct optionsList *job, int i, int nChan,
+                  struct optionsList *output, char *prefix) {
+    int nGrids = job->nGrids > 0 ? job->nGrids : 1;
+    int band = i / nGrids, grid = i % nGrids;
+    char bandSuffix[FILENAME_LEN] = "";
+
+    *output = *job;
+    output->nGrids = output->nBands = 0;
+    output->grids = NULL;
+    output->bands = NULL;
+    output->bandWidth = output->bandStep = 0;
+    output->outPrefix = prefix;
+    output->firstChan = 0;
+    output->nChanBand = nChan;
+    if(job->nBands > 0) {
+        output->firstChan = job->bands[band].firstChan;
+        output->nChanBand = job->bands[band].nChan;
+        snprintf(bandSuffix, FILENAME_LEN, "%s", job->bands[band].outSuffix);
+    }
+    else if(job->bandWidth > 0) {
+        output->firstChan = band * job->bandStep;
+        output->nChanBand = job->bandWidth;
+        snprintf(bandSuffix, FILENAME_LEN, "ch%d-%d_", output->firstChan,
+                 output->firstChan + output->nChanBand - 1);
+    }
+    if(job->nGrids > 0) {
+        output->phiMin = job->grids[grid].phiMin;
+        output->dPhi = job->grids[grid].dPhi;
+        output->nPhi = job->grids[grid].nPhi;
+    }
+    snprintf(prefix, FILENAME_LEN, "%s%s%s", job->outPrefix, bandSuffix,
+             job->nGrids > 0 ? job->grids[grid].outSuffix : "");
+}
+
 /*************************************************************
 *
 * Print parsed input to screen
@@ -168,18 +879,88 @@ void printOptions(struct optionsList inOptions, struct parameters params) {
     printf("\n");
     for(i=0; i<SCREEN_WIDTH; i++) { printf("#"); }
     printf("\n");
-    printf("Q Cube: %s\n", inOptions.qCubeName);
-    printf("U Cube: %s\n", inOptions.uCubeName);
-    printf("phi min: %.2f\n", inOptions.phiMin);
-    printf("# of phi planes: %d\n", params.nPhi);
-    printf("delta phi: %.2lf\n", params.dPhi);
+    if(inOptions.inputType == INPUT_TABLE) {
+        printf("Q Table: %s, column %s\n", inOptions.qCubeName, inOptions.qColumn);
+        printf("U Table: %s, column %s\n", inOptions.uCubeName, inOptions.uColumn);
+    }
+    else {
+        printf("Q Cube: %s\n", inOptions.qCubeName);
+        printf("U Cube: %s\n", inOptions.uCubeName);
+    }
+    switch(inOptions.freqFormat) {
+       case FREQ_TEXT:
+       case FREQ_BINARY:
+          printf("Frequencies: %s\n", inOptions.freqFileName);
+          break;
+       case FREQ_HDF5:
+          printf("Frequencies: %s:%s\n", inOptions.freqFileName ?
+                 inOptions.freqFileName : inOptions.qCubeName,
+                 inOptions.freqDataset);
+          break;
+       case FREQ_WCS:
+          printf("Frequencies: spectral axis of the Q cube\n");
+          break;
+    }
+    if(inOptions.stokesI == STOKES_I_CUBE)
+        printf("I Cube: %s\n", inOptions.iCubeName);
+    else if(inOptions.stokesI == STOKES_I_MODEL)
+        printf("I Model: %s at %g Hz\n", inOptions.iModelName, inOptions.iModelFreq);
+    if(inOptions.nGrids > 0) {
+        for(i=0; i<inOptions.nGrids; i++)
+            printf("phi grid %s: %d planes from %.2f, delta phi %.2lf\n",
+                   inOptions.grids[i].outSuffix, inOptions.grids[i].nPhi,
+                   inOptions.grids[i].phiMin, inOptions.grids[i].dPhi);
+    }
+    else {
+        printf("phi min: %.2f\n", inOptions.phiMin);
+        printf("# of phi planes: %d\n", params.nPhi);
+        printf("delta phi: %.2lf\n", params.dPhi);
+    }
+    printf("Backend: %s\n", inOptions.backend == BACKEND_CPU ?
+           BACKEND_CPU_STR : BACKEND_CUDA_STR);
     printf("\n");
     printf("Input dimension: %d x %d x %d\n", params.qAxisLen1,
                                               params.qAxisLen2,
                                               params.qAxisLen3);
-    printf("Output dimension: %d x %d x %d\n", params.qAxisLen1,
-                                               params.qAxisLen2,
-                                               params.nPhi);
+    printf("Output dimension: %d x %d x %d", params.qAxisLen1,
+                                             params.qAxisLen2,
+                                             params.nPhi);
+    for(i=1; i<inOptions.nGrids; i++) { printf(", %d", inOptions.grids[i].nPhi); }
+    printf("\n");
+    if(inOptions.fileFormat == FITS) {
+        printf("Output order: %s\n", inOptions.outputOrder == ORDER_SKY ?
+               "RA, DEC, phi" : "phi, RA, DEC");
+    }
+    if(inOptions.nBands > 0) {
+        for(i=0; i<inOptions.nBands; i++)
+            printf("Sub-band %s: channels %d to %d\n", inOptions.bands[i].outSuffix,
+                   inOptions.bands[i].firstChan,
+                   inOptions.bands[i].firstChan + inOptions.bands[i].nChan - 1);
+    }
+    else if(inOptions.bandWidth > 0) {
+        printf("Sub-bands: %d channels every %d channels\n", inOptions.bandWidth,
+               inOptions.bandStep);
+    }
+    if(inOptions.refinePeaks > 0) {
+        printf("Refined peaks: %d per sightline, %d samples of %.3lf\n",
+               inOptions.refinePeaks, inOptions.refineSamples, inOptions.refineDPhi);
+    }
+    if(inOptions.noiseMaps) {
+        if(inOptions.noiseExclude > ZERO)
+            printf("Noise maps: excluding +/- %.3lf around the peak\n", inOptions.noiseExclude);
+        else
+            printf("Noise maps: excluding +/- one RMSF FWHM around the peak\n");
+    }
+    if(inOptions.outputMode != OUTPUT_CUBES) {
+        printf("Catalog: peaks above %g and %g sigma%s\n", inOptions.catalogThreshold,
+               inOptions.catalogSNR,
+               inOptions.outputMode == OUTPUT_CATALOG ? ", no cubes" : "");
+    }
+    if(inOptions.fitModel != FIT_NONE) {
+        printf("QU-fitting: %s model, up to %d iterations\n",
+               inOptions.fitModel == FIT_THICK ? "Burn slab" : "thin",
+               inOptions.fitIterations);
+    }
     for(i=0; i<SCREEN_WIDTH; i++) { printf("#"); }
     printf("\n");
 }
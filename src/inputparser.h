@@ -28,6 +28,13 @@ extern "C"
 #endif
 
 struct optionsList parseInput(char *parsetFileName);
-void printOptions(struct optionsList inOptions, struct parList params);
+int parseInputString(const char *parset, struct optionsList *inOptions);
+void freeOptions(struct optionsList *inOptions);
+void selectField(struct optionsList *batch, int i, struct optionsList *field);
+int countOutputs(struct optionsList *inOptions, int nChan);
+int checkOutputs(struct optionsList *inOptions, int nChan);
+void selectOutput(struct optionsList *job, int i, int nChan,
+                  struct optionsList *output, char *prefix);
+void printOptions(struct optionsList inOptions, struct parameters params);
 
 #endif
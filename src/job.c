@@ -0,0 +1,689 @@
+/******************************************************************************
+job.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<pthread.h>
+
+#include "structures.h"
+#include "constants.h"
+#include "timing.h"
+#include "fileaccess.h"
+#include "inputparser.h"
+#include "rmsynth.h"
+#include "devices.h"
+#include "planner.h"
+#include "arena.h"
+#include "products.h"
+#include "catalog.h"
+#include "dosynthesis.h"
+#include "ranks.h"
+#include "job.h"
+
+/*************************************************************
+*
+* Context cache. A job reuses a cached context when the
+*  channels, weights, phi axis and backend all match and the
+*  cached context was sized for at least as many sightlines.
+*  This skips the RMSF computation and the device allocations.
+*
+*************************************************************/
+void initContextCache(struct contextCache *cache) {
+    memset(cache, 0, sizeof(*cache));
+    initArena(&cache->arena);
+}
+
+static void clearCachedContext(struct cachedContext *entry) {
+    if(entry->ctx != NULL) { rmsDestroy(entry->ctx); }
+    free(entry->lambda2);
+    free(entry->weights);
+    memset(entry, 0, sizeof(*entry));
+}
+
+void freeContextCache(struct contextCache *cache) {
+    int i;
+    for(i=0; i<N_CACHED_CONTEXTS; i++) {
+        clearCachedContext(&cache->entries[i]);
+    }
+    freeArena(&cache->arena);
+}
+
+static int sameArray(const double *a, const double *b, int n) {
+    if(a == NULL || b == NULL) { return(a == b); }
+    return(memcmp(a, b, n*sizeof(*a)) == 0);
+}
+
+static int sameConfig(const struct rmsConfig *a, const struct rmsConfig *b) {
+    if(a->nChan != b->nChan || a->nPhi != b->nPhi ||
+       a->phiMin != b->phiMin || a->dPhi != b->dPhi ||
+       a->lambda20Mode != b->lambda20Mode ||
+       a->backend != b->backend || a->variant != b->variant ||
+       a->layout != b->layout || a->nThreads != b->nThreads ||
+       a->deviceId != b->deviceId) { return(FALSE); }
+    if(a->lambda20Mode == LAMBDA20_USER && a->lambda20 != b->lambda20)
+        return(FALSE);
+    return(sameArray(a->lambda2, b->lambda2, a->nChan) &&
+           sameArray(a->weights, b->weights, a->nChan));
+}
+
+static int cacheConfig(struct cachedContext *entry, const struct rmsConfig *config) {
+    entry->config = *config;
+    entry->lambda2 = malloc(config->nChan * sizeof(*entry->lambda2));
+    if(entry->lambda2 == NULL) { return(FAILURE); }
+    memcpy(entry->lambda2, config->lambda2, config->nChan * sizeof(*entry->lambda2));
+    entry->config.lambda2 = entry->lambda2;
+    if(config->weights != NULL) {
+        entry->weights = malloc(config->nChan * sizeof(*entry->weights));
+        if(entry->weights == NULL) { return(FAILURE); }
+        memcpy(entry->weights, config->weights, config->nChan * sizeof(*entry->weights));
+        entry->config.weights = entry->weights;
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Return a context for config, from the cache if possible.
+*  Entries handed out to the current job are busy and never
+*  replaced. Without a cache, or if every entry is busy, a new
+*  context is created, *owned is set and the caller must
+*  destroy it.
+*
+*************************************************************/
+static int getContext(struct contextCache *cache, struct rmsConfig *config,
+                      struct rmsContext **ctx, int *owned) {
+    int i, status;
+    struct cachedContext *entry = NULL;
+
+    *owned = (cache == NULL);
+    if(cache == NULL) { return(rmsCreate(config, ctx)); }
+
+    cache->clock++;
+    for(i=0; i<N_CACHED_CONTEXTS; i++) {
+        if(cache->entries[i].ctx != NULL &&
+           sameConfig(&cache->entries[i].config, config)) {
+            entry = &cache->entries[i];
+            break;
+        }
+    }
+    if(entry != NULL && entry->config.maxLOS >= config->maxLOS &&
+       entry->config.stokesI >= config->stokesI) {
+        printf("INFO: Reusing cached context\n");
+        cache->hits++;
+        entry->lastUsed = cache->clock;
+        entry->busy = TRUE;
+        *ctx = entry->ctx;
+        return(RMS_SUCCESS);
+    }
+    /* Otherwise take the matching but undersized entry, an empty
+       slot, or the least recently used one that is not busy */
+    if(entry != NULL && entry->busy) { entry = NULL; }
+    if(entry == NULL) {
+        for(i=0; i<N_CACHED_CONTEXTS; i++) {
+            if(cache->entries[i].busy) { continue; }
+            if(cache->entries[i].ctx == NULL) { entry = &cache->entries[i]; break; }
+            if(entry == NULL || cache->entries[i].lastUsed < entry->lastUsed)
+                entry = &cache->entries[i];
+        }
+    }
+    cache->misses++;
+    if(entry == NULL) {
+        *owned = TRUE;
+        return(rmsCreate(config, ctx));
+    }
+    clearCachedContext(entry);
+    status = rmsCreate(config, ctx);
+    if(status != RMS_SUCCESS) { return(status); }
+    if(cacheConfig(entry, config)) {
+        clearCachedContext(entry);
+        rmsDestroy(*ctx);
+        return(RMS_ERR_NOMEM);
+    }
+    entry->ctx = *ctx;
+    entry->lastUsed = cache->clock;
+    entry->busy = TRUE;
+    return(RMS_SUCCESS);
+}
+
+/* Make the contexts of a finished job available again */
+static void releaseContexts(struct contextCache *cache) {
+    int i;
+    if(cache == NULL) { return; }
+    for(i=0; i<N_CACHED_CONTEXTS; i++) { cache->entries[i].busy = FALSE; }
+}
+
+/*************************************************************
+*
+* Set up the output sets of a job with nChan channels, one per
+*  sub-band and phi grid, before anything is opened.
+*  Descriptors that are not open are NULL (FITS) or negative
+*  (HDF5).
+*
+*************************************************************/
+static void initOutputs(struct optionsList *inOptions, int nChan,
+                        struct synthOutput *outputs, int nOutputs) {
+    struct IOFileDescriptors *descriptors;
+    int o;
+
+    for(o=0; o<nOutputs; o++) {
+        selectOutput(inOptions, o, nChan, &outputs[o].options, outputs[o].outPrefix);
+        defineProducts(&outputs[o].options, &outputs[o].products);
+        initCatalog(&outputs[o].catalog, inOptions->fileFormat);
+        descriptors = &outputs[o].descriptors;
+        descriptors->qDirtyH5 = descriptors->uDirtyH5 = descriptors->pDirtyH5 = -1;
+        descriptors->qDataset = descriptors->uDataset = -1;
+        descriptors->qDataspace = descriptors->uDataspace = -1;
+        descriptors->qMemspace = descriptors->uMemspace = -1;
+    }
+}
+
+/*************************************************************
+*
+* Create the output cubes, products and catalog of every
+*  output set. Unless HDF5 output is shared, only rank 0
+*  creates them.
+*
+*************************************************************/
+static int createOutputs(struct optionsList *inOptions,
+                         struct synthOutput *outputs, int nOutputs,
+                         struct fits_header_parameters *header,
+                         struct parameters *params) {
+    const struct rankInfo *ranks = getRanks();
+    struct synthOutput *out;
+    int o, status = SUCCESS;
+
+    for(o=0; o<nOutputs && status == SUCCESS; o++) {
+        out = &outputs[o];
+        out->params = *params;
+        out->params.phiMin = out->options.phiMin;
+        out->params.dPhi = out->options.dPhi;
+        out->params.nPhi = out->options.nPhi;
+        if(inOptions->dryRun) { continue; }
+        if(inOptions->fileFormat == FITS) {
+            if(inOptions->outputMode != OUTPUT_CATALOG)
+                status = makeOutputFitsImages(&out->options, &out->descriptors,
+                                              header, &out->params);
+            if(status == SUCCESS)
+                status = createProducts(&out->options, &out->products, header,
+                                        params->qAxisLen1, params->qAxisLen2);
+        }
+        else if(ranks->sharedOutput || ranks->rank == 0) {
+            if(inOptions->outputMode != OUTPUT_CATALOG)
+                status = makeOutputHDF5Images(&out->options, &out->descriptors,
+                                              &out->params, header);
+            if(status == SUCCESS)
+                status = createProducts(&out->options, &out->products, header,
+                                        params->qAxisLen2, params->qAxisLen1);
+        }
+        /* The catalog is written by rank 0 alone */
+        if(status == SUCCESS && inOptions->outputMode != OUTPUT_CUBES &&
+           ranks->rank == 0)
+            status = createCatalog(&out->options, &out->catalog, header);
+    }
+    return(status);
+}
+
+/*************************************************************
+*
+* Close the output cubes, products and catalog of every output
+*  set. Returns FAILURE if any file could not be flushed.
+*
+*************************************************************/
+static int closeOutputFiles(struct optionsList *inOptions,
+                            struct synthOutput *outputs, int nOutputs) {
+    struct IOFileDescriptors *descriptors;
+    int o, fitsStatus = SUCCESS, status = SUCCESS;
+
+    for(o=0; o<nOutputs; o++) {
+        if(closeProducts(&outputs[o].products)) { status = FAILURE; }
+        if(closeCatalog(&outputs[o].catalog)) { status = FAILURE; }
+        descriptors = &outputs[o].descriptors;
+        if(inOptions->fileFormat == FITS) {
+            if(descriptors->qDirty != NULL) { fits_close_file(descriptors->qDirty, &fitsStatus); }
+            if(descriptors->uDirty != NULL) { fits_close_file(descriptors->uDirty, &fitsStatus); }
+            if(descriptors->pDirty != NULL) { fits_close_file(descriptors->pDirty, &fitsStatus); }
+            if(fitsStatus) {
+                fits_report_error(stdout, fitsStatus);
+                status = FAILURE;
+                fitsStatus = SUCCESS;
+            }
+            descriptors->qDirty = NULL; descriptors->uDirty = NULL; descriptors->pDirty = NULL;
+        }
+        else {
+            if(descriptors->qDirtyH5 >= 0) { H5Fclose(descriptors->qDirtyH5); }
+            if(descriptors->uDirtyH5 >= 0) { H5Fclose(descriptors->uDirtyH5); }
+            if(descriptors->pDirtyH5 >= 0) { H5Fclose(descriptors->pDirtyH5); }
+            descriptors->qDirtyH5 = -1; descriptors->uDirtyH5 = -1; descriptors->pDirtyH5 = -1;
+        }
+    }
+    return(status);
+}
+
+static void freeDataArrays(struct DataArrays *data_arrays) {
+    free(data_arrays->rmsf);
+    free(data_arrays->rmsfReal);
+    free(data_arrays->rmsfImag);
+    free(data_arrays->phiAxis);
+    free(data_arrays->freqList);
+    free(data_arrays->lambda2);
+    free(data_arrays->weights);
+}
+
+/* Release the contexts the job owns and the RMSF of each output
+   set; the channel arrays belong to the job */
+static void freeOutputs(struct synthOutput *outputs, int nOutputs) {
+    int o;
+
+    for(o=0; o<nOutputs; o++) {
+        if(outputs[o].ownsContext) { rmsDestroy(outputs[o].ctx); }
+        free(outputs[o].rmsf.rmsf);
+        free(outputs[o].rmsf.rmsfReal);
+        free(outputs[o].rmsf.rmsfImag);
+        free(outputs[o].rmsf.phiAxis);
+    }
+    free(outputs);
+}
+
+/*************************************************************
+*
+* Set up librmsynth for an output set, from the channels of its
+*  sub-band. It chooses lambda20 and computes the RMSF, which is
+*  written next to the cubes.
+*
+*************************************************************/
+static int setupOutput(struct synthOutput *out, struct DataArrays *data_arrays,
+                       struct memoryPlan *plan, int deviceId,
+                       struct contextCache *cache) {
+    struct optionsList *options = &out->options;
+    struct rmsConfig config;
+    const struct rankInfo *ranks = getRanks();
+    int status;
+
+    rmsDefaultConfig(&config);
+    config.nChan    = options->nChanBand;
+    config.lambda2  = data_arrays->lambda2 + options->firstChan;
+    config.weights  = data_arrays->weights == NULL ? NULL :
+                      data_arrays->weights + options->firstChan;
+    config.lambda20Mode = options->lambda20Mode;
+    config.lambda20 = options->lambda20;
+    config.nPhi     = options->nPhi;
+    config.phiMin   = options->phiMin;
+    config.dPhi     = options->dPhi;
+    config.backend  = options->backend;
+    config.variant  = options->variant;
+    config.nThreads = options->nThreads;
+    config.deviceId = deviceId;
+    config.maxLOS   = plan->losPerCall;
+    config.stokesI  = options->stokesI != STOKES_I_NONE;
+    if(options->fileFormat == HDF5)
+        config.layout = LAYOUT_LOS_FIRST;
+    else
+        config.layout = LAYOUT_FREQ_FIRST;
+    printf("INFO: Computing RMSF of %s\n", out->outPrefix);
+    status = getContext(cache, &config, &out->ctx, &out->ownsContext);
+    if(status != RMS_SUCCESS) {
+        printf("Error: Unable to set up RM Synthesis: %s\n\n",
+               rmsStatusString(status));
+        out->ctx = NULL;
+        out->ownsContext = FALSE;
+        return(FAILURE);
+    }
+    out->rmsf = *data_arrays;
+    out->rmsf.lambda20 = rmsGetLambda20(out->ctx);
+    switch(options->lambda20Mode) {
+       case LAMBDA20_WEIGHTED:
+          printf("INFO: Using weighted mean lambda20 = %g m^2\n", out->rmsf.lambda20);
+          break;
+       case LAMBDA20_USER:
+          printf("INFO: Using lambda20 = %g m^2 from parset\n", out->rmsf.lambda20);
+          break;
+       default:
+          printf("INFO: Using median lambda20 = %g m^2\n", out->rmsf.lambda20);
+          break;
+    }
+    out->rmsf.nPhi     = options->nPhi;
+    out->rmsf.rmsf     = calloc(options->nPhi, sizeof(*out->rmsf.rmsf));
+    out->rmsf.rmsfReal = calloc(options->nPhi, sizeof(*out->rmsf.rmsfReal));
+    out->rmsf.rmsfImag = calloc(options->nPhi, sizeof(*out->rmsf.rmsfImag));
+    out->rmsf.phiAxis  = calloc(options->nPhi, sizeof(*out->rmsf.phiAxis));
+    if(out->rmsf.rmsf     == NULL || out->rmsf.rmsfReal == NULL ||
+       out->rmsf.rmsfImag == NULL || out->rmsf.phiAxis  == NULL) {
+        printf("Error: Mem alloc failed while generating RMSF\n");
+        return(FAILURE);
+    }
+    rmsGetPhiAxis(out->ctx, out->rmsf.phiAxis);
+    rmsGetRMSF(out->ctx, out->rmsf.rmsfReal, out->rmsf.rmsfImag, out->rmsf.rmsf);
+
+    /* Write RMSF to disk */
+    if(ranks->rank == 0 && writeRMSF(*options, out->rmsf)) {
+        printf("Error: Unable to write RMSF to disk\n\n");
+        return(FAILURE);
+    }
+    /* Plot RMSF */
+    #ifdef GNUPLOT_ENABLE
+    if(ranks->rank == 0 && options->plotRMSF == TRUE) {
+        printf("INFO: Plotting RMSF with gnuplot\n");
+        if(plotRMSF(*options)) {
+            printf("Error: Unable to plot RMSF\n\n");
+            return(FAILURE);
+        }
+    }
+    #endif
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Run one RM synthesis job described by inOptions: open the
+*  cubes, set up librmsynth for every phi grid, write the RMSFs
+*  and the output cubes, and report timing. The selected device
+*  must already be current. Returns SUCCESS or FAILURE; nothing
+*  here exits, so a failed job leaves the calling process
+*  usable. In an MPI run every rank calls runJob() and the ranks
+*  agree on the status before each step they must enter
+*  together.
+*
+*************************************************************/
+int runJob(struct optionsList *inOptions, int deviceId,
+           struct contextCache *cache, struct timeInfoList *t) {
+    struct IOFileDescriptors descriptors;
+    struct parameters params;
+    struct fits_header_parameters header_parameters;
+    struct DataArrays data_arrays;
+    struct memoryPlan plan;
+    struct hostArena localArena, *arena;
+    struct synthOutput *outputs = NULL;
+    int fitsStatus = SUCCESS;
+    int o, status, nPhiTotal, nOutputs = 0;
+    double deviceFree = 0.;
+    char filename[FILENAME_LEN];
+    const struct rankInfo *ranks = getRanks();
+
+    memset(&descriptors, 0, sizeof(descriptors));
+    memset(&params, 0, sizeof(params));
+    memset(&data_arrays, 0, sizeof(data_arrays));
+    descriptors.qDirtyH5 = -1; descriptors.uDirtyH5 = -1; descriptors.pDirtyH5 = -1;
+    params.nPhi = inOptions->nPhi;
+    params.dPhi = inOptions->dPhi;
+    params.phiMin = inOptions->phiMin;
+
+    /* FITS output cannot be shared between ranks, and a table is
+       a single frame */
+    if(ranks->size > 1 && (inOptions->fileFormat != HDF5 ||
+                           inOptions->inputType != INPUT_CUBE)) {
+        if(ranks->rank == 0)
+            printf("Error: MPI runs with more than one rank need HDF5 cubes\n\n");
+        return(FAILURE);
+    }
+    /* Check input files */
+    printf("INFO: Checking input files\n");
+    status = checkInputFiles(inOptions, &descriptors);
+    if(agreeStatus(status)) {
+        if(status == SUCCESS) { closeInputFiles(inOptions, &descriptors); }
+        return(FAILURE);
+    }
+
+    /* Gather information from input fits header and setup output images */
+    startTimer(t, STAGE_SETUP);
+    if(inOptions->inputType == INPUT_TABLE)
+       status = getTableHeader(inOptions, &header_parameters, &params, &descriptors);
+    else switch(inOptions->fileFormat) {
+       case FITS:
+          fitsStatus = getFitsHeader(&header_parameters, &params, &descriptors);
+          if(fitsStatus) {
+             fits_report_error(stdout, fitsStatus);
+             status = FAILURE;
+          }
+          else status = checkFitsTiles(&params, &descriptors);
+          break;
+       case HDF5:
+          getHDF5Header(&header_parameters, &params, &descriptors);
+          status = SUCCESS;
+          break;
+       default:
+          printf("ERROR: Unknown file format\n");
+          status = FAILURE;
+          break;
+    }
+    /* One output set per sub-band and phi grid */
+    if(status == SUCCESS) { status = checkOutputs(inOptions, params.qAxisLen3); }
+    if(status == SUCCESS) { status = checkStokesI(inOptions, &params, &descriptors); }
+    if(status == SUCCESS) {
+       nOutputs = countOutputs(inOptions, params.qAxisLen3);
+       outputs = calloc(nOutputs, sizeof(*outputs));
+       if(outputs == NULL) {
+          printf("Error: Mem alloc failed while setting up the outputs\n\n");
+          status = FAILURE;
+          nOutputs = 0;
+       }
+       else {
+          initOutputs(inOptions, params.qAxisLen3, outputs, nOutputs);
+          status = createOutputs(inOptions, outputs, nOutputs, &header_parameters, &params);
+       }
+    }
+    if(agreeStatus(status)) {
+       closeOutputFiles(inOptions, outputs, nOutputs);
+       closeInputFiles(inOptions, &descriptors);
+       freeOutputs(outputs, nOutputs);
+       return(FAILURE);
+    }
+
+    /* Print some useful information */
+    if(ranks->rank == 0) { printOptions(*inOptions, params); }
+
+    /* Read frequency list */
+    status = getFreqList(inOptions, &descriptors, &header_parameters,
+                         &params, &data_arrays);
+    if(status == SUCCESS) { status = getWeightList(inOptions, &data_arrays); }
+    if(agreeStatus(status)) {
+       freeDataArrays(&data_arrays);
+       closeOutputFiles(inOptions, outputs, nOutputs);
+       closeInputFiles(inOptions, &descriptors);
+       freeOutputs(outputs, nOutputs);
+       return(FAILURE);
+    }
+
+    /* Cut the frames into chunks that fit the host and device
+       memory. A dry run stops here */
+    if(inOptions->backend == BACKEND_CUDA) { deviceFree = getFreeDeviceMemory(deviceId); }
+    status = planMemory(inOptions, &params, data_arrays.nFreq, deviceFree, &plan);
+    if(status)
+       printf("Error: Not even one sightline fits in the memory budget\n\n");
+    else if(ranks->rank == 0)
+       printPlan(inOptions, &plan);
+    if(agreeStatus(status) || inOptions->dryRun) {
+       freeDataArrays(&data_arrays);
+       closeOutputFiles(inOptions, outputs, nOutputs);
+       closeInputFiles(inOptions, &descriptors);
+       freeOutputs(outputs, nOutputs);
+       return(status ? FAILURE : SUCCESS);
+    }
+
+    /* Set up librmsynth and write the RMSF of every output set.
+       Each sub-band has its own lambda20 */
+    for(o=0; o<nOutputs && status == SUCCESS; o++)
+        status = setupOutput(&outputs[o], &data_arrays, &plan, deviceId, cache);
+    stopTimer(t, STAGE_SETUP);
+
+    /* Start RM Synthesis. doRMSynthesis closes the HDF5 outputs */
+    status = agreeStatus(status);
+    if(status == SUCCESS) {
+        printf("INFO: Starting RM Synthesis\n");
+        if(cache == NULL) { initArena(&localArena); }
+        arena = cache == NULL ? &localArena : &cache->arena;
+        if(doRMSynthesis(inOptions, &descriptors, &params, &data_arrays, &plan, arena,
+                         outputs, nOutputs, t)) {
+            printf("Error: RM Synthesis failed\n\n");
+            status = FAILURE;
+        }
+        for(o=0; o<nOutputs; o++) {
+            outputs[o].descriptors.qDirtyH5 = -1;
+            outputs[o].descriptors.uDirtyH5 = -1;
+            outputs[o].descriptors.pDirtyH5 = -1;
+        }
+        if(ranks->rank == 0) { printArenaStats(arena); }
+        if(cache == NULL) { freeArena(&localArena); }
+    }
+    releaseContexts(cache);
+    freeDataArrays(&data_arrays);
+
+    /* Close all open files. Closing flushes the output cubes */
+    startTimer(t, STAGE_WRITE);
+    if(closeOutputFiles(inOptions, outputs, nOutputs)) { status = FAILURE; }
+    closeInputFiles(inOptions, &descriptors);
+    stopTimer(t, STAGE_WRITE);
+    nPhiTotal = 0;
+    for(o=0; o<nOutputs; o++) { nPhiTotal += outputs[o].options.nPhi; }
+    freeOutputs(outputs, nOutputs);
+    if(status) { return(FAILURE); }
+
+    /* Write timing information to stdout and disk. In an MPI
+       run, rank 0 reports its own share of the work */
+    stopTotalTimer(t);
+    if(ranks->rank != 0) { return(SUCCESS); }
+    printTimingInfo(t);
+    sprintf(filename, "%s%s", inOptions->outPrefix, TIMING_JSON);
+    if(writeTimingJSON(t, filename, params.qAxisLen1, params.qAxisLen2,
+                       params.qAxisLen3, nPhiTotal)) {
+        printf("Error: Unable to write timing information to disk\n\n");
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Read ahead of a batch. While one field is synthesized, a
+*  thread reads the next field's cubes so that they are in the
+*  page cache when its turn comes. At most a quarter of the
+*  physical memory is read per cube, and the read stops as
+*  soon as the current field is done.
+*
+*************************************************************/
+struct prefetchJob {
+    const char *names[NUM_INPUTS+1];    /* Q, U and Stokes I, if any */
+    long limit;
+    int stop, running;
+    pthread_mutex_t lock;
+    pthread_t thread;
+};
+
+static int prefetchStopped(struct prefetchJob *job) {
+    int stop;
+    pthread_mutex_lock(&job->lock);
+    stop = job->stop;
+    pthread_mutex_unlock(&job->lock);
+    return(stop);
+}
+
+static void *prefetchCubes(void *arg) {
+    struct prefetchJob *job = (struct prefetchJob *)arg;
+    char *buffer = malloc(PREFETCH_CHUNK);
+    long done;
+    ssize_t nRead;
+    int i, fd;
+
+    for(i=0; buffer != NULL && i<NUM_INPUTS+1 && !prefetchStopped(job); i++) {
+        if(job->names[i] == NULL) { continue; }
+        fd = open(job->names[i], O_RDONLY);
+        if(fd < 0) { continue; }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        done = 0;
+        while(done < job->limit && !prefetchStopped(job) &&
+              (nRead = read(fd, buffer, PREFETCH_CHUNK)) > 0) { done += nRead; }
+        close(fd);
+    }
+    free(buffer);
+    return(NULL);
+}
+
+static void startPrefetch(struct prefetchJob *job, struct batchField *field) {
+    job->names[0] = field->qCubeName;
+    job->names[1] = field->uCubeName;
+    job->names[2] = field->iCubeName != NULL ? field->iCubeName : field->iModelName;
+    job->limit = (long)sysconf(_SC_PHYS_PAGES) / 4 * sysconf(_SC_PAGESIZE);
+    job->stop = FALSE;
+    pthread_mutex_init(&job->lock, NULL);
+    job->running = (pthread_create(&job->thread, NULL, prefetchCubes, job) == 0);
+    if(!job->running) { pthread_mutex_destroy(&job->lock); }
+}
+
+static void stopPrefetch(struct prefetchJob *job) {
+    if(!job->running) { return; }
+    pthread_mutex_lock(&job->lock);
+    job->stop = TRUE;
+    pthread_mutex_unlock(&job->lock);
+    pthread_join(job->thread, NULL);
+    pthread_mutex_destroy(&job->lock);
+    job->running = FALSE;
+}
+
+/*************************************************************
+*
+* Run every field of a batch parset, or the single job of an
+*  ordinary one. The parset is parsed once, and the fields
+*  share a context cache, so fields with the same channels and
+*  phi axis reuse the RMSF and the device buffers. A failed
+*  field is reported and the batch carries on. Returns FAILURE
+*  if any field failed.
+*
+*************************************************************/
+int runBatch(struct optionsList *inOptions, int deviceId,
+             struct contextCache *cache, struct timeInfoList *t) {
+    struct contextCache localCache;
+    struct optionsList field;
+    struct prefetchJob prefetch;
+    const struct rankInfo *ranks = getRanks();
+    long hits;
+    int i, nFailed = 0;
+
+    if(inOptions->nFields == 0) { return(runJob(inOptions, deviceId, cache, t)); }
+    if(cache == NULL) {
+        initContextCache(&localCache);
+        cache = &localCache;
+    }
+    hits = cache->hits;
+    prefetch.running = FALSE;
+    for(i=0; i<inOptions->nFields; i++) {
+        if(ranks->rank == 0)
+            printf("\nINFO: Field %d of %d: %s\n", i+1, inOptions->nFields,
+                   inOptions->fields[i].outPrefix);
+        selectField(inOptions, i, &field);
+
+        /* One reader per node is enough to warm its page cache */
+        if(i+1 < inOptions->nFields && ranks->localRank == 0)
+            startPrefetch(&prefetch, &inOptions->fields[i+1]);
+        initTimer(t);
+        if(runJob(&field, deviceId, cache, t)) {
+            if(ranks->rank == 0) printf("Error: Field %s failed\n", field.outPrefix);
+            nFailed++;
+        }
+        stopPrefetch(&prefetch);
+    }
+    if(ranks->rank == 0)
+        printf("\nINFO: %d of %d fields done, %ld reused the RM synthesis setup\n",
+               inOptions->nFields - nFailed, inOptions->nFields, cache->hits - hits);
+    if(cache == &localCache) { freeContextCache(&localCache); }
+    return(nFailed ? FAILURE : SUCCESS);
+}
@@ -0,0 +1,66 @@
+/******************************************************************************
+job.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef JOB_H
+#define JOB_H
+
+#include "rmsynth.h"
+#include "arena.h"
+
+#define N_CACHED_CONTEXTS 4
+/* Read size of the batch read ahead */
+#define PREFETCH_CHUNK    (4 << 20)
+
+/* A librmsynth context kept alive between jobs along with a copy
+   of the configuration it was built from. lambda2 and weights in
+   config point to the copies owned by the entry. An entry is busy
+   while the running job uses it. */
+struct cachedContext {
+    struct rmsConfig config;
+    double *lambda2, *weights;
+    struct rmsContext *ctx;
+    unsigned long lastUsed;
+    int busy;
+};
+
+/* Least recently used set of contexts, and the host staging arena
+   the jobs share. Not thread safe; the daemon runs all its jobs
+   from a single worker thread. */
+struct contextCache {
+    struct cachedContext entries[N_CACHED_CONTEXTS];
+    struct hostArena arena;
+    unsigned long clock;
+    long hits, misses;
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+
+void initContextCache(struct contextCache *cache);
+void freeContextCache(struct contextCache *cache);
+int runJob(struct optionsList *inOptions, int deviceId,
+           struct contextCache *cache, struct timeInfoList *t);
+int runBatch(struct optionsList *inOptions, int deviceId,
+             struct contextCache *cache, struct timeInfoList *t);
+
+#endif
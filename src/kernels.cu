@@ -0,0 +1,805 @@
+/******************************************************************************
+kernels.cu
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+extern "C" {
+#include<stdio.h>
+#include<cuda_runtime.h>
+#include<cuda.h>
+#include<math_constants.h>
+#include "constants.h"
+#include "engine.h"
+#include "kernels.h"
+}
+
+/* Device buffers held by an engine and their alignment in bytes */
+#define N_DEVICE_BUFFERS 7
+#define N_POINT_BUFFERS  4
+#define N_FIT_BUFFERS    3
+#define DEVICE_ALIGN     256
+/* Threads per block of the sparse and QU-fitting kernels */
+#define SPARSE_BLOCK     256
+#define FIT_BLOCK        64
+
+/*************************************************************
+*
+* Load Q and U of element idx of a frame. With a Stokes I frame
+*  they are divided by I here, so that fractional polarization
+*  never goes through memory; channels where I is not positive
+*  count as zero. Same arithmetic as stokesScale() in cpusynth.c.
+*
+*************************************************************/
+__device__ static float2 loadQU(const float2 *d_quImageArray,
+                                const float *d_iImageArray, int idx) {
+    float2 quIn = d_quImageArray[idx];
+    float iIn, scale;
+
+    if(d_iImageArray != NULL) {
+        iIn = d_iImageArray[idx];
+        scale = iIn > 0.0f ? 1.0f/iIn : 0.0f;
+        quIn.x *= scale;
+        quIn.y *= scale;
+    }
+    return(quIn);
+}
+
+/*************************************************************
+*
+* Device code to compute Q(\phi) for HDF5 mode
+* 
+* In HDF5 mode, d_quImageArray is such that the LOS varies 
+* fast than the frequency channel. Which means that each kernel
+* has to do strided read and write. Q and U of a channel are
+* interleaved and fetched with a single float2 load.
+*
+* threadIdx.x and blockIdx.x tell us which phi to process
+* blockIdx.y tells us which LOS to process
+*
+*************************************************************/
+extern "C"
+__global__ void computeQUP_hdf5(const float2 *d_quImageArray,
+                           const float *d_iImageArray, int nLOS,
+                           int nChan, float K, float2 *d_quPhi,
+                           float *d_pPhi, float *d_phiAxis, int nPhi,
+                           float *d_lambdaDiff2, float *d_weights) {
+    int i, readIdx, writeIdx;
+    float myphi, mylambdaDiff2, myweight;
+    /* xIndex tells me what my phi is */
+    const int xIndex = blockIdx.x*blockDim.x + threadIdx.x;
+    /* yIndex tells me which LOS I am */
+    const int yIndex = blockIdx.y;
+    float qPhi, uPhi, pPhi;
+    float sinVal, cosVal;
+    float2 quIn;
+
+    if(xIndex < nPhi) {
+        myphi = d_phiAxis[xIndex];
+        /* qPhi and uPhi are accumulators. So initialize to 0 */
+        qPhi = 0.0; uPhi = 0.0;
+        for(i=0; i<nChan; i++) {
+            readIdx = yIndex + i*nLOS;
+            mylambdaDiff2 = d_lambdaDiff2[i];
+            myweight = d_weights[i];
+            sinVal = myweight*sinf(myphi*mylambdaDiff2);
+            cosVal = myweight*cosf(myphi*mylambdaDiff2);
+            quIn = loadQU(d_quImageArray, d_iImageArray, readIdx);
+            qPhi += quIn.x*cosVal + quIn.y*sinVal;
+            uPhi += quIn.y*cosVal - quIn.x*sinVal;
+        }
+        pPhi = sqrt(qPhi*qPhi + uPhi*uPhi);
+
+        writeIdx = xIndex*nLOS + yIndex;
+        d_quPhi[writeIdx] = make_float2(K*qPhi, K*uPhi);
+        d_pPhi[writeIdx] = K*pPhi;
+    }
+}
+
+/*************************************************************
+*
+* Device code to compute Q(\phi)
+*
+* threadIdx.x and blockIdx.x tell us which phi to process
+* blockIdx.y tells us which LOS to process
+*
+*************************************************************/
+extern "C"
+__global__ void computeQUP_fits(const float2 *d_quImageArray,
+                           const float *d_iImageArray,
+                           int nChan, int nPhi, float K, float2 *d_quPhi,
+                           float *d_pPhi, float *d_phiAxis, 
+                           float *d_lambdaDiff2, float *d_weights) {
+    int i, readIdx, writeIdx;
+    float myphi, mylambdaDiff2, myweight;
+    /* xIndex tells me what my phi is */
+    const int xIndex = blockIdx.y*blockDim.x + threadIdx.x;
+    /* yIndex tells me which LOS I am */
+    const int yIndex = blockIdx.x;
+    float qPhi, uPhi, pPhi;
+    float sinVal, cosVal;
+    float2 quIn;
+
+    if(xIndex < nPhi) {
+        myphi = d_phiAxis[xIndex];
+        /* qPhi and uPhi are accumulators. So initialize to 0 */
+        qPhi = 0.0; uPhi = 0.0;
+        for(i=0; i<nChan; i++) {
+            mylambdaDiff2 = d_lambdaDiff2[i];
+            myweight = d_weights[i];
+            sinVal = myweight*sinf(myphi*mylambdaDiff2);
+            cosVal = myweight*cosf(myphi*mylambdaDiff2);
+            readIdx = yIndex*nChan + i;
+            quIn = loadQU(d_quImageArray, d_iImageArray, readIdx);
+            qPhi += quIn.x*cosVal + quIn.y*sinVal;
+            uPhi += quIn.y*cosVal - quIn.x*sinVal;
+        }
+        pPhi = sqrt(qPhi*qPhi + uPhi*uPhi);
+
+        writeIdx = yIndex*nPhi + xIndex;
+        d_quPhi[writeIdx] = make_float2(K*qPhi, K*uPhi);
+        d_pPhi[writeIdx] = K*pPhi;
+    }
+}
+
+/*************************************************************
+*
+* Device code to evaluate Q(\phi) at arbitrary points
+*
+* Each thread takes one point: sightline d_pointLOS[n] at
+* Faraday depth d_pointPhi[n]. The frame is read in either
+* layout.
+*
+*************************************************************/
+extern "C"
+__global__ void computeQUP_sparse(const float2 *d_quImageArray,
+                           const float *d_iImageArray, int nLOS,
+                           int nChan, int layout, float K,
+                           const int *d_pointLOS, const float *d_pointPhi,
+                           int nPoints, float2 *d_pointQU, float *d_pointP,
+                           float *d_lambdaDiff2, float *d_weights) {
+    int i, readIdx, los;
+    float myphi, mylambdaDiff2, myweight;
+    const int index = blockIdx.x*blockDim.x + threadIdx.x;
+    float qPhi, uPhi, pPhi;
+    float sinVal, cosVal;
+    float2 quIn;
+
+    if(index < nPoints) {
+        los = d_pointLOS[index];
+        myphi = d_pointPhi[index];
+        qPhi = 0.0; uPhi = 0.0;
+        for(i=0; i<nChan; i++) {
+            if(layout == LAYOUT_LOS_FIRST) readIdx = los + i*nLOS;
+            else readIdx = los*nChan + i;
+            mylambdaDiff2 = d_lambdaDiff2[i];
+            myweight = d_weights[i];
+            sinVal = myweight*sinf(myphi*mylambdaDiff2);
+            cosVal = myweight*cosf(myphi*mylambdaDiff2);
+            quIn = loadQU(d_quImageArray, d_iImageArray, readIdx);
+            qPhi += quIn.x*cosVal + quIn.y*sinVal;
+            uPhi += quIn.y*cosVal - quIn.x*sinVal;
+        }
+        pPhi = sqrt(qPhi*qPhi + uPhi*uPhi);
+        d_pointQU[index] = make_float2(K*qPhi, K*uPhi);
+        d_pointP[index] = K*pPhi;
+    }
+}
+
+/*************************************************************
+*
+* Device code to fit a model to the Q and U spectra
+*
+* Each thread fits one sightline by Levenberg-Marquardt, starting
+* from the parameters in d_params (nPar planes of nLOS values) and
+* leaving the fit, its uncertainties and the reduced chi^2 there.
+* Same arithmetic as fitModel(), fitChi2(), fitNoise(), fitSolve()
+* and cpuFit() in cpusynth.c.
+*
+*************************************************************/
+__device__ static void fitModelDevice(int model, const double *a, double x,
+                                      double lambda20, double *q, double *u,
+                                      double J[2][FIT_MAX_PARAMS], int wantJ) {
+    double lambda2 = 0.5*x + lambda20;
+    double arg, s = 1.0, ds = 0.0, amp, c, sn;
+
+    if(model == FIT_THICK) {
+        arg = a[3]*lambda2;
+        if(fabs(arg) < 1e-4) { s = 1.0 - arg*arg/6.0; ds = -arg/3.0; }
+        else {
+            s = sin(arg)/arg;
+            ds = (arg*cos(arg) - sin(arg))/(arg*arg);
+        }
+    }
+    amp = a[0]*s;
+    c  = cos(2.0*a[1] + a[2]*x);
+    sn = sin(2.0*a[1] + a[2]*x);
+    *q = amp*c; *u = amp*sn;
+    if(!wantJ) return;
+    J[0][0] = s*c;          J[1][0] = s*sn;
+    J[0][1] = -2.0*amp*sn;  J[1][1] = 2.0*amp*c;
+    J[0][2] = -x*amp*sn;    J[1][2] = x*amp*c;
+    if(model == FIT_THICK) {
+        J[0][3] = a[0]*lambda2*ds*c;
+        J[1][3] = a[0]*lambda2*ds*sn;
+    }
+}
+
+__device__ static double fitChi2Device(const float2 *d_quImageArray,
+                           const float *d_iImageArray, int nLOS, int nChan,
+                           int layout, int model, double lambda20, int los,
+                           const double *a, int nPar, double *A, double *g,
+                           int wantA, int *nObs, const float *d_lambdaDiff2,
+                           const float *d_weights) {
+    double J[2][FIT_MAX_PARAMS], q, u, rq, ru, w, chi2 = 0.0;
+    int i, j, k, readIdx;
+    float2 quIn;
+    float iIn;
+
+    if(wantA) {
+        for(j=0; j<nPar*nPar; j++) A[j] = 0.0;
+        for(j=0; j<nPar; j++) g[j] = 0.0;
+    }
+    *nObs = 0;
+    for(i=0; i<nChan; i++) {
+        if(layout == LAYOUT_LOS_FIRST) readIdx = los + i*nLOS;
+        else readIdx = los*nChan + i;
+        w = d_weights[i];
+        if(d_iImageArray != NULL) {
+            iIn = d_iImageArray[readIdx];
+            if(!(iIn > 0.0f)) continue;
+        }
+        quIn = loadQU(d_quImageArray, d_iImageArray, readIdx);
+        if(w <= 0.0 || isnan(quIn.x) || isnan(quIn.y)) continue;
+        fitModelDevice(model, a, d_lambdaDiff2[i], lambda20, &q, &u, J, wantA);
+        rq = quIn.x - q; ru = quIn.y - u;
+        chi2 += w*(rq*rq + ru*ru);
+        *nObs += 2;
+        if(!wantA) continue;
+        for(j=0; j<nPar; j++) {
+            g[j] += w*(J[0][j]*rq + J[1][j]*ru);
+            for(k=0; k<=j; k++)
+                A[j*nPar+k] += w*(J[0][j]*J[0][k] + J[1][j]*J[1][k]);
+        }
+    }
+    if(wantA)
+        for(j=0; j<nPar; j++)
+            for(k=j+1; k<nPar; k++) A[j*nPar+k] = A[k*nPar+j];
+    return(chi2);
+}
+
+__device__ static double fitNoiseDevice(const float2 *d_quImageArray,
+                           const float *d_iImageArray, int nLOS, int nChan,
+                           int layout, int model, double lambda20, int los,
+                           const double *a, const float *d_lambdaDiff2,
+                           const float *d_weights) {
+    double q, u, rq, ru, w, prevQ = 0.0, prevU = 0.0, prevW = 0.0, sum = 0.0;
+    int i, n = 0, readIdx;
+    float2 quIn;
+    float iIn;
+
+    for(i=0; i<nChan; i++) {
+        if(layout == LAYOUT_LOS_FIRST) readIdx = los + i*nLOS;
+        else readIdx = los*nChan + i;
+        w = d_weights[i];
+        if(d_iImageArray != NULL) {
+            iIn = d_iImageArray[readIdx];
+            if(!(iIn > 0.0f)) continue;
+        }
+        quIn = loadQU(d_quImageArray, d_iImageArray, readIdx);
+        if(w <= 0.0 || isnan(quIn.x) || isnan(quIn.y)) continue;
+        fitModelDevice(model, a, d_lambdaDiff2[i], lambda20, &q, &u, NULL, 0);
+        rq = quIn.x - q; ru = quIn.y - u;
+        if(prevW > 0.0) {
+            sum += ((rq-prevQ)*(rq-prevQ) + (ru-prevU)*(ru-prevU))/(1.0/w + 1.0/prevW);
+            n += 2;
+        }
+        prevQ = rq; prevU = ru; prevW = w;
+    }
+    return(n > 0 ? sum/n : CUDART_NAN);
+}
+
+__device__ static int fitSolveDevice(double *M, double *b, double *x, int n) {
+    int r, c, k, pivot;
+    double f, t;
+
+    for(c=0; c<n; c++) {
+        pivot = c;
+        for(r=c+1; r<n; r++)
+            if(fabs(M[r*n+c]) > fabs(M[pivot*n+c])) pivot = r;
+        if(!(fabs(M[pivot*n+c]) > 0.0)) return(FAILURE);
+        if(pivot != c) {
+            for(k=0; k<n; k++) {
+                t = M[c*n+k]; M[c*n+k] = M[pivot*n+k]; M[pivot*n+k] = t;
+            }
+            t = b[c]; b[c] = b[pivot]; b[pivot] = t;
+        }
+        for(r=c+1; r<n; r++) {
+            f = M[r*n+c]/M[c*n+c];
+            for(k=c; k<n; k++) M[r*n+k] -= f*M[c*n+k];
+            b[r] -= f*b[c];
+        }
+    }
+    for(r=n-1; r>=0; r--) {
+        x[r] = b[r];
+        for(k=r+1; k<n; k++) x[r] -= M[r*n+k]*x[k];
+        x[r] /= M[r*n+r];
+    }
+    return(SUCCESS);
+}
+
+extern "C"
+__global__ void fitQU(const float2 *d_quImageArray, const float *d_iImageArray,
+                      int nLOS, int nChan, int layout, int model, int maxIter,
+                      double lambda20, float *d_params, float *d_errors,
+                      float *d_chi2, const float *d_lambdaDiff2,
+                      const float *d_weights) {
+    const int los = blockIdx.x*blockDim.x + threadIdx.x;
+    const int nPar = model == FIT_THICK ? 4 : 3;
+    double a[FIT_MAX_PARAMS], trial[FIT_MAX_PARAMS], delta[FIT_MAX_PARAMS];
+    double A[FIT_MAX_PARAMS*FIT_MAX_PARAMS], g[FIT_MAX_PARAMS];
+    double M[FIT_MAX_PARAMS*FIT_MAX_PARAMS], b[FIT_MAX_PARAMS];
+    double chi2, chi2Trial, lambda, dof;
+    int j, k, iter, nObs, valid = 1;
+
+    if(los >= nLOS) return;
+    for(j=0; j<nPar; j++) {
+        a[j] = d_params[j*nLOS+los];
+        if(isnan(a[j])) valid = 0;
+    }
+    chi2 = fitChi2Device(d_quImageArray, d_iImageArray, nLOS, nChan, layout,
+                         model, lambda20, los, a, nPar, A, g, 1, &nObs,
+                         d_lambdaDiff2, d_weights);
+    dof = nObs - nPar;
+    if(!valid || dof <= 0) {
+        for(j=0; j<nPar; j++)
+            d_params[j*nLOS+los] = d_errors[j*nLOS+los] = CUDART_NAN_F;
+        d_chi2[los] = CUDART_NAN_F;
+        return;
+    }
+    lambda = FIT_LAMBDA_START;
+    for(iter=0; iter<maxIter && lambda<FIT_LAMBDA_MAX; iter++) {
+        for(j=0; j<nPar*nPar; j++) M[j] = A[j];
+        for(j=0; j<nPar; j++) {
+            M[j*nPar+j] *= 1.0 + lambda;
+            b[j] = g[j];
+        }
+        if(fitSolveDevice(M, b, delta, nPar) != SUCCESS) { lambda *= 10.0; continue; }
+        for(j=0; j<nPar; j++) trial[j] = a[j] + delta[j];
+        chi2Trial = fitChi2Device(d_quImageArray, d_iImageArray, nLOS, nChan,
+                                  layout, model, lambda20, los, trial, nPar,
+                                  A, g, 0, &nObs, d_lambdaDiff2, d_weights);
+        if(!(chi2Trial < chi2)) { lambda *= 10.0; continue; }
+        for(j=0; j<nPar; j++) a[j] = trial[j];
+        if(chi2 - chi2Trial < FIT_TOLERANCE*chi2) { chi2 = chi2Trial; break; }
+        chi2 = fitChi2Device(d_quImageArray, d_iImageArray, nLOS, nChan,
+                             layout, model, lambda20, los, a, nPar, A, g, 1,
+                             &nObs, d_lambdaDiff2, d_weights);
+        lambda /= 10.0;
+    }
+
+    fitChi2Device(d_quImageArray, d_iImageArray, nLOS, nChan, layout, model,
+                  lambda20, los, a, nPar, A, g, 1, &nObs, d_lambdaDiff2,
+                  d_weights);
+    for(j=0; j<nPar; j++) {
+        for(k=0; k<nPar*nPar; k++) M[k] = A[k];
+        for(k=0; k<nPar; k++) b[k] = k == j ? 1.0 : 0.0;
+        if(fitSolveDevice(M, b, delta, nPar) != SUCCESS || delta[j] < 0.0)
+            d_errors[j*nLOS+los] = CUDART_NAN_F;
+        else d_errors[j*nLOS+los] = sqrt(delta[j]*chi2/dof);
+    }
+
+    if(a[0] < 0.0) { a[0] = -a[0]; a[1] += 0.5*M_PI; }
+    a[1] = fmod(a[1], M_PI);
+    if(a[1] <= -0.5*M_PI) a[1] += M_PI;
+    if(a[1] > 0.5*M_PI) a[1] -= M_PI;
+    if(nPar > 3) a[3] = fabs(a[3]);
+    for(j=0; j<nPar; j++) d_params[j*nLOS+los] = a[j];
+    d_chi2[los] = chi2/(dof*fitNoiseDevice(d_quImageArray, d_iImageArray,
+                                           nLOS, nChan, layout, model,
+                                           lambda20, los, a, d_lambdaDiff2,
+                                           d_weights));
+}
+
+/*************************************************************
+*
+* Initialize Q(\phi) and U(\phi)
+*
+*************************************************************/
+extern "C"
+__global__ void initializeQUP(float *d_qPhi, float *d_uPhi, 
+                              float *d_pPhi, int nPhi) {
+    int index = blockIdx.x*blockDim.x + threadIdx.x;
+
+    if(index < nPhi) {
+        d_qPhi[index] = 0.0;
+        d_uPhi[index] = 0.0;
+        d_pPhi[index] = 0.0;
+    }
+}
+
+/*************************************************************
+*
+* Report a pending CUDA error. Unlike checkCudaError() this
+*  does not exit, so that engines can be used from libraries.
+*
+*************************************************************/
+static int deviceErrorStatus(const char *what) {
+    cudaError_t errorID = cudaGetLastError();
+    if(errorID != cudaSuccess) {
+        printf("ERROR: %s: %s\n", what, cudaGetErrorString(errorID));
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+static double deviceEventSeconds(void *start, void *stop) {
+    float ms;
+    cudaEventSynchronize((cudaEvent_t)stop);
+    cudaEventElapsedTime(&ms, (cudaEvent_t)start, (cudaEvent_t)stop);
+    return(ms/KILO);
+}
+
+/*************************************************************
+*
+* Copy the Stokes I frame set by setEngineStokesI() to the
+*  device, into the room initDeviceEngine() set aside for it
+*
+*************************************************************/
+static int uploadStokesI(struct synthEngine *engine, long nInElements) {
+    if(engine->d_iImageArray == NULL) {
+        printf("ERROR: The engine was set up without room for Stokes I\n");
+        return(FAILURE);
+    }
+    cudaMemcpy(engine->d_iImageArray, engine->iFrame, nInElements*sizeof(float),
+               cudaMemcpyHostToDevice);
+    if(engine->t != NULL)
+        addStageBytes(engine->t, STAGE_H2D, 1.*nInElements*sizeof(float));
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Make one device allocation for nBuffers buffers of sizes[i]
+*  4-byte values, each starting on a DEVICE_ALIGN boundary, and
+*  point *buffers[i] at them
+*
+*************************************************************/
+static int allocDevicePool(void **pool, int nBuffers, const long *sizes,
+                           void **buffers[]) {
+    size_t poolSize = 0;
+    int i;
+
+    for(i=0; i<nBuffers; i++)
+        poolSize += (sizes[i]*sizeof(float) + DEVICE_ALIGN - 1) / DEVICE_ALIGN * DEVICE_ALIGN;
+    cudaMalloc(pool, poolSize);
+    if(deviceErrorStatus("Unable to allocate device memory")) {
+        *pool = NULL;
+        return(FAILURE);
+    }
+    for(poolSize=0, i=0; i<nBuffers; i++) {
+        *buffers[i] = (char *)*pool + poolSize;
+        poolSize += (sizes[i]*sizeof(float) + DEVICE_ALIGN - 1) / DEVICE_ALIGN * DEVICE_ALIGN;
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Allocate device buffers for frames of engine->maxLOS sightlines,
+*  and their Stokes I if engine->stokesI is set, and upload the
+*  constants
+*
+*************************************************************/
+extern "C"
+int initDeviceEngine(struct synthEngine *engine) {
+    struct cudaDeviceProp deviceProp;
+    long nInElements  = engine->maxLOS * engine->nChan;
+    long nOutElements = engine->maxLOS * engine->nPhi;
+    long sizes[N_DEVICE_BUFFERS];
+    void **buffers[N_DEVICE_BUFFERS];
+    cudaEvent_t evStart, evStop;
+
+    cudaSetDevice(engine->deviceId);
+    cudaGetDeviceProperties(&deviceProp, engine->deviceId);
+    engine->warpSize = deviceProp.warpSize;
+    if(engine->layout == LAYOUT_LOS_FIRST && engine->maxLOS > MAX_GRID_Y) {
+        printf("ERROR: At most %d sightlines per frame in this layout\n", MAX_GRID_Y);
+        return(FAILURE);
+    }
+    if(nInElements > MAX_FRAME_ELEMENTS || nOutElements > MAX_FRAME_ELEMENTS) {
+        printf("ERROR: At most %ld values per frame\n", MAX_FRAME_ELEMENTS);
+        return(FAILURE);
+    }
+
+    /* All device buffers come from one allocation */
+    sizes[0] = engine->nPhi;    sizes[1] = engine->nChan; sizes[2] = engine->nChan;
+    sizes[3] = 2*nInElements;   sizes[4] = 2*nOutElements; sizes[5] = nOutElements;
+    sizes[6] = engine->stokesI ? nInElements : 0;
+    buffers[0] = (void **)&engine->d_phiAxis;     buffers[1] = (void **)&engine->d_lambdaDiff2;
+    buffers[2] = (void **)&engine->d_weights;
+    buffers[3] = (void **)&engine->d_quImageArray; buffers[4] = (void **)&engine->d_quPhi;
+    buffers[5] = (void **)&engine->d_pPhi;        buffers[6] = (void **)&engine->d_iImageArray;
+    if(allocDevicePool(&engine->d_pool, N_DEVICE_BUFFERS, sizes, buffers)) { return(FAILURE); }
+    if(!engine->stokesI) { engine->d_iImageArray = NULL; }
+
+    cudaMemcpy(engine->d_phiAxis, engine->phiAxis, engine->nPhi*sizeof(float),
+               cudaMemcpyHostToDevice);
+    cudaMemcpy(engine->d_lambdaDiff2, engine->lambdaDiff2,
+               engine->nChan*sizeof(float), cudaMemcpyHostToDevice);
+    cudaMemcpy(engine->d_weights, engine->weights, engine->nChan*sizeof(float),
+               cudaMemcpyHostToDevice);
+    cudaEventCreate(&evStart);
+    cudaEventCreate(&evStop);
+    engine->evStart = evStart;
+    engine->evStop  = evStop;
+    return(deviceErrorStatus("Unable to initialize the device engine"));
+}
+
+/*************************************************************
+*
+* Transfer a frame to the device, synthesize and copy it back.
+*  Interleaved Q and U go over in one copy and come back in one;
+*  Stokes I, if set, follows in a second.
+*
+*************************************************************/
+extern "C"
+int runDeviceEngine(struct synthEngine *engine, const float *quImageArray,
+                    long nLOS, float *quPhi, float *pPhi) {
+    long nInElements  = nLOS * engine->nChan;
+    long nOutElements = nLOS * engine->nPhi;
+    dim3 calcThreadSize, calcBlockSize;
+    cudaEvent_t evStart = (cudaEvent_t)engine->evStart;
+    cudaEvent_t evStop  = (cudaEvent_t)engine->evStop;
+    const float *d_iImageArray;
+
+    cudaSetDevice(engine->deviceId);
+
+    /* Transfer input images to device */
+    cudaEventRecord(evStart);
+    cudaMemcpy(engine->d_quImageArray, quImageArray, 2*nInElements*sizeof(float),
+               cudaMemcpyHostToDevice);
+    if(engine->iFrame != NULL && uploadStokesI(engine, nInElements)) { return(FAILURE); }
+    d_iImageArray = engine->iFrame != NULL ? engine->d_iImageArray : NULL;
+    cudaEventRecord(evStop);
+    engine->deviceFrame = quImageArray;
+    if(engine->t != NULL) {
+        addStageTime(engine->t, STAGE_H2D, deviceEventSeconds(evStart, evStop));
+        addStageBytes(engine->t, STAGE_H2D, 2.*nInElements*sizeof(float));
+    }
+
+    /* Launch kernels to compute Q(\phi), U(\phi), and P(\phi) */
+    calcThreadSize.x = engine->warpSize;
+    cudaEventRecord(evStart);
+    switch(engine->layout) {
+       case LAYOUT_FREQ_FIRST:
+          calcBlockSize.x = nLOS;
+          calcBlockSize.y = engine->nPhi/calcThreadSize.x + 1;
+          computeQUP_fits<<<calcBlockSize, calcThreadSize>>>(
+                   (const float2 *)engine->d_quImageArray, d_iImageArray,
+                   engine->nChan, engine->nPhi, engine->K,
+                   (float2 *)engine->d_quPhi, engine->d_pPhi,
+                   engine->d_phiAxis, engine->d_lambdaDiff2, engine->d_weights);
+          break;
+       case LAYOUT_LOS_FIRST:
+          calcBlockSize.x = engine->nPhi/calcThreadSize.x + 1;
+          calcBlockSize.y = nLOS;
+          computeQUP_hdf5<<<calcBlockSize, calcThreadSize>>>(
+                   (const float2 *)engine->d_quImageArray, d_iImageArray, nLOS,
+                   engine->nChan, engine->K,
+                   (float2 *)engine->d_quPhi, engine->d_pPhi,
+                   engine->d_phiAxis, engine->nPhi,
+                   engine->d_lambdaDiff2, engine->d_weights);
+          break;
+    }
+    cudaEventRecord(evStop);
+    if(engine->t != NULL) {
+        addStageTime(engine->t, STAGE_COMPUTE, deviceEventSeconds(evStart, evStop));
+        addFlops(engine->t, (double)FLOPS_PER_TERM*nLOS*engine->nChan*engine->nPhi);
+    }
+    else { cudaEventSynchronize(evStop); }
+    if(deviceErrorStatus("Kernel launch failed")) { return(FAILURE); }
+
+    /* Move Q(\phi), U(\phi) and P(\phi) to host */
+    cudaEventRecord(evStart);
+    cudaMemcpy(quPhi, engine->d_quPhi, 2*nOutElements*sizeof(float), cudaMemcpyDeviceToHost);
+    cudaMemcpy(pPhi, engine->d_pPhi, nOutElements*sizeof(float), cudaMemcpyDeviceToHost);
+    cudaEventRecord(evStop);
+    if(engine->t != NULL) {
+        addStageTime(engine->t, STAGE_D2H, deviceEventSeconds(evStart, evStop));
+        addStageBytes(engine->t, STAGE_D2H, 3.*nOutElements*sizeof(float));
+    }
+    return(deviceErrorStatus("Unable to copy results to host"));
+}
+
+/*************************************************************
+*
+* Evaluate nPoints (sightline, phi) points of a frame. The frame
+*  is only copied to the device if it is not the one runDeviceEngine()
+*  left there. The point buffers come from a second allocation,
+*  which grows with the largest request seen.
+*
+*************************************************************/
+extern "C"
+int runDeviceSparse(struct synthEngine *engine, const float *quImageArray,
+                    long nLOS, long nPoints, const int *losIndex,
+                    const float *phi, float *quOut, float *pOut) {
+    long nInElements = nLOS * engine->nChan;
+    long sizes[N_POINT_BUFFERS];
+    void **buffers[N_POINT_BUFFERS];
+    cudaEvent_t evStart = (cudaEvent_t)engine->evStart;
+    cudaEvent_t evStop  = (cudaEvent_t)engine->evStop;
+    const float *d_iImageArray;
+
+    cudaSetDevice(engine->deviceId);
+    if(nPoints > engine->maxPoints) {
+        cudaFree(engine->d_pointPool);
+        engine->d_pointPool = NULL;
+        engine->maxPoints = 0;
+        sizes[0] = nPoints; sizes[1] = nPoints; sizes[2] = 2*nPoints; sizes[3] = nPoints;
+        buffers[0] = (void **)&engine->d_pointLOS; buffers[1] = (void **)&engine->d_pointPhi;
+        buffers[2] = (void **)&engine->d_pointQU;  buffers[3] = (void **)&engine->d_pointP;
+        if(allocDevicePool(&engine->d_pointPool, N_POINT_BUFFERS, sizes, buffers))
+            return(FAILURE);
+        engine->maxPoints = nPoints;
+    }
+
+    /* Transfer the frame, unless it is still on the device, and the points */
+    cudaEventRecord(evStart);
+    if(quImageArray != engine->deviceFrame) {
+        cudaMemcpy(engine->d_quImageArray, quImageArray, 2*nInElements*sizeof(float),
+                   cudaMemcpyHostToDevice);
+        if(engine->iFrame != NULL && uploadStokesI(engine, nInElements)) { return(FAILURE); }
+        engine->deviceFrame = quImageArray;
+        if(engine->t != NULL)
+            addStageBytes(engine->t, STAGE_H2D, 2.*nInElements*sizeof(float));
+    }
+    d_iImageArray = engine->iFrame != NULL ? engine->d_iImageArray : NULL;
+    cudaMemcpy(engine->d_pointLOS, losIndex, nPoints*sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(engine->d_pointPhi, phi, nPoints*sizeof(float), cudaMemcpyHostToDevice);
+    cudaEventRecord(evStop);
+    if(engine->t != NULL) {
+        addStageTime(engine->t, STAGE_H2D, deviceEventSeconds(evStart, evStop));
+        addStageBytes(engine->t, STAGE_H2D, 2.*nPoints*sizeof(float));
+    }
+
+    cudaEventRecord(evStart);
+    computeQUP_sparse<<<(nPoints + SPARSE_BLOCK - 1)/SPARSE_BLOCK, SPARSE_BLOCK>>>(
+             (const float2 *)engine->d_quImageArray, d_iImageArray, nLOS,
+             engine->nChan, engine->layout, engine->K, engine->d_pointLOS, engine->d_pointPhi,
+             nPoints, (float2 *)engine->d_pointQU, engine->d_pointP,
+             engine->d_lambdaDiff2, engine->d_weights);
+    cudaEventRecord(evStop);
+    if(engine->t != NULL) {
+        addStageTime(engine->t, STAGE_COMPUTE, deviceEventSeconds(evStart, evStop));
+        addFlops(engine->t, (double)FLOPS_PER_TERM*nPoints*engine->nChan);
+    }
+    else { cudaEventSynchronize(evStop); }
+    if(deviceErrorStatus("Kernel launch failed")) { return(FAILURE); }
+
+    cudaEventRecord(evStart);
+    cudaMemcpy(quOut, engine->d_pointQU, 2*nPoints*sizeof(float), cudaMemcpyDeviceToHost);
+    cudaMemcpy(pOut, engine->d_pointP, nPoints*sizeof(float), cudaMemcpyDeviceToHost);
+    cudaEventRecord(evStop);
+    if(engine->t != NULL) {
+        addStageTime(engine->t, STAGE_D2H, deviceEventSeconds(evStart, evStop));
+        addStageBytes(engine->t, STAGE_D2H, 3.*nPoints*sizeof(float));
+    }
+    return(deviceErrorStatus("Unable to copy results to host"));
+}
+
+/*************************************************************
+*
+* Fit a model to the Q and U spectra of nLOS sightlines. As in
+*  runDeviceSparse(), the frame is only copied if it is not
+*  already on the device, and the parameter buffers grow with
+*  the largest frame seen.
+*
+*************************************************************/
+extern "C"
+int runDeviceFit(struct synthEngine *engine, const float *quImageArray,
+                 long nLOS, int model, int maxIter, float *params,
+                 float *errors, float *chi2) {
+    long nInElements = nLOS * engine->nChan;
+    int nPar = fitParameters(model);
+    long sizes[N_FIT_BUFFERS];
+    void **buffers[N_FIT_BUFFERS];
+    cudaEvent_t evStart = (cudaEvent_t)engine->evStart;
+    cudaEvent_t evStop  = (cudaEvent_t)engine->evStop;
+    const float *d_iImageArray;
+
+    cudaSetDevice(engine->deviceId);
+    if(nLOS > engine->maxFit) {
+        cudaFree(engine->d_fitPool);
+        engine->d_fitPool = NULL;
+        engine->maxFit = 0;
+        sizes[0] = FIT_MAX_PARAMS*nLOS; sizes[1] = FIT_MAX_PARAMS*nLOS; sizes[2] = nLOS;
+        buffers[0] = (void **)&engine->d_fitParams; buffers[1] = (void **)&engine->d_fitErrors;
+        buffers[2] = (void **)&engine->d_fitChi2;
+        if(allocDevicePool(&engine->d_fitPool, N_FIT_BUFFERS, sizes, buffers))
+            return(FAILURE);
+        engine->maxFit = nLOS;
+    }
+
+    /* Transfer the frame, unless it is still on the device, and the seeds */
+    cudaEventRecord(evStart);
+    if(quImageArray != engine->deviceFrame) {
+        cudaMemcpy(engine->d_quImageArray, quImageArray, 2*nInElements*sizeof(float),
+                   cudaMemcpyHostToDevice);
+        if(engine->iFrame != NULL && uploadStokesI(engine, nInElements)) { return(FAILURE); }
+        engine->deviceFrame = quImageArray;
+        if(engine->t != NULL)
+            addStageBytes(engine->t, STAGE_H2D, 2.*nInElements*sizeof(float));
+    }
+    d_iImageArray = engine->iFrame != NULL ? engine->d_iImageArray : NULL;
+    cudaMemcpy(engine->d_fitParams, params, nPar*nLOS*sizeof(float), cudaMemcpyHostToDevice);
+    cudaEventRecord(evStop);
+    if(engine->t != NULL) {
+        addStageTime(engine->t, STAGE_H2D, deviceEventSeconds(evStart, evStop));
+        addStageBytes(engine->t, STAGE_H2D, 1.*nPar*nLOS*sizeof(float));
+    }
+
+    cudaEventRecord(evStart);
+    fitQU<<<(nLOS + FIT_BLOCK - 1)/FIT_BLOCK, FIT_BLOCK>>>(
+             (const float2 *)engine->d_quImageArray, d_iImageArray, nLOS,
+             engine->nChan, engine->layout, model, maxIter, engine->lambda20,
+             engine->d_fitParams, engine->d_fitErrors, engine->d_fitChi2,
+             engine->d_lambdaDiff2, engine->d_weights);
+    cudaEventRecord(evStop);
+    if(engine->t != NULL)
+        addStageTime(engine->t, STAGE_COMPUTE, deviceEventSeconds(evStart, evStop));
+    else { cudaEventSynchronize(evStop); }
+    if(deviceErrorStatus("Kernel launch failed")) { return(FAILURE); }
+
+    cudaEventRecord(evStart);
+    cudaMemcpy(params, engine->d_fitParams, nPar*nLOS*sizeof(float), cudaMemcpyDeviceToHost);
+    cudaMemcpy(errors, engine->d_fitErrors, nPar*nLOS*sizeof(float), cudaMemcpyDeviceToHost);
+    cudaMemcpy(chi2, engine->d_fitChi2, nLOS*sizeof(float), cudaMemcpyDeviceToHost);
+    cudaEventRecord(evStop);
+    if(engine->t != NULL) {
+        addStageTime(engine->t, STAGE_D2H, deviceEventSeconds(evStart, evStop));
+        addStageBytes(engine->t, STAGE_D2H, (2.*nPar + 1.)*nLOS*sizeof(float));
+    }
+    return(deviceErrorStatus("Unable to copy results to host"));
+}
+
+/*************************************************************
+*
+* Free the device buffers of an engine
+*
+*************************************************************/
+extern "C"
+void freeDeviceEngine(struct synthEngine *engine) {
+    cudaSetDevice(engine->deviceId);
+    cudaFree(engine->d_pool);
+    cudaFree(engine->d_pointPool);
+    cudaFree(engine->d_fitPool);
+    engine->d_pool = engine->d_pointPool = engine->d_fitPool = NULL;
+    engine->d_iImageArray = NULL;
+    engine->maxPoints = engine->maxFit = 0;
+    if(engine->evStart != NULL) cudaEventDestroy((cudaEvent_t)engine->evStart);
+    if(engine->evStop != NULL)  cudaEventDestroy((cudaEvent_t)engine->evStop);
+    engine->d_phiAxis = engine->d_lambdaDiff2 = engine->d_weights = NULL;
+    engine->d_quImageArray = engine->d_quPhi = engine->d_pPhi = NULL;
+    engine->d_pointPhi = engine->d_pointQU = engine->d_pointP = NULL;
+    engine->d_pointLOS = NULL;
+    engine->d_fitParams = engine->d_fitErrors = engine->d_fitChi2 = NULL;
+    engine->deviceFrame = NULL;
+    engine->evStart = engine->evStop = NULL;
+}
@@ -0,0 +1,294 @@
+/******************************************************************************
+planner.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<string.h>
+#include<unistd.h>
+
+#include "structures.h"
+#include "constants.h"
+#include "ranks.h"
+#include "arena.h"
+#include "products.h"
+#include "inputparser.h"
+#include "planner.h"
+
+#define MB (1024.*1024.)
+
+/* What the output sets (sub-bands and phi grids) of a job add up to */
+struct outputTotals {
+    int nOutputs;
+    int nPhi, maxPhi;       /* Summed over the outputs, and largest */
+    int nChan;              /* Channels summed over the outputs */
+    int nBandChan;          /* Same for sub-bands copied out of FITS frames */
+    int nPlanes, nProducts; /* Per-sightline products of all outputs */
+};
+
+static void sumOutputs(struct optionsList *inOptions, int nChan,
+                       struct outputTotals *sum) {
+    struct optionsList output;
+    struct productSet products;
+    char prefix[FILENAME_LEN];
+    int i;
+
+    memset(sum, 0, sizeof(*sum));
+    sum->nOutputs = countOutputs(inOptions, nChan);
+    for(i=0; i<sum->nOutputs; i++) {
+        selectOutput(inOptions, i, nChan, &output, prefix);
+        defineProducts(&output, &products);
+        sum->nChan += output.nChanBand;
+        if(inOptions->fileFormat == FITS && output.nChanBand < nChan)
+            sum->nBandChan += output.nChanBand;
+        sum->nPhi += output.nPhi;
+        if(output.nPhi > sum->maxPhi) { sum->maxPhi = output.nPhi; }
+        sum->nPlanes += productPlanes(&products);
+        sum->nProducts += products.nProducts;
+    }
+}
+
+/* Stokes I values read per sightline */
+static int stokesIPerLOS(struct optionsList *inOptions, int nChan) {
+    if(inOptions->stokesI == STOKES_I_CUBE) { return(nChan); }
+    if(inOptions->stokesI == STOKES_I_MODEL) { return(N_MODEL_PLANES); }
+    return(0);
+}
+
+/*************************************************************
+*
+* Bytes of host and device memory needed per sightline of a
+*  chunk: the Q and U spectra in, and the sub-bands copied out
+*  of FITS frames, Q, U and P(phi) out of every output set, and
+*  the per-sightline products. Stokes I adds a spectrum, its
+*  sub-bands and the model planes, and a catalog the noise of
+*  every output set. If rank 0 gathers the other ranks' frames,
+*  it also holds a chunk of output for every rank, of which
+*  the cubes are left out without cube output.
+*
+*************************************************************/
+static double hostBytesPerLOS(struct optionsList *inOptions, int nChan,
+                              struct outputTotals *sum) {
+    const struct rankInfo *ranks = getRanks();
+    int nCubes = inOptions->outputMode != OUTPUT_CATALOG ? NUM_OUTPUTS : 0;
+    double bytes;
+
+    bytes = (2.*(nChan + sum->nBandChan) + NUM_OUTPUTS*sum->nPhi + sum->nPlanes) *
+            sizeof(float);
+    if(inOptions->stokesI != STOKES_I_NONE)
+        bytes += (nChan + sum->nBandChan) * sizeof(float);
+    if(inOptions->stokesI == STOKES_I_MODEL)
+        bytes += N_MODEL_PLANES * sizeof(float);
+    if(inOptions->outputMode != OUTPUT_CUBES && !inOptions->noiseMaps)
+        bytes += sum->nOutputs * sizeof(float);
+    /* FITS frames and table rows go through a scratch buffer */
+    if(inOptions->fileFormat == FITS || inOptions->inputType == INPUT_TABLE)
+        bytes += (nChan > sum->maxPhi ? nChan : sum->maxPhi) * sizeof(float);
+    if(inOptions->fileFormat == HDF5 && !ranks->sharedOutput && ranks->rank == 0)
+        bytes += (double)ranks->size * (nCubes*sum->nPhi + sum->nPlanes) *
+                 sizeof(float);
+    return(bytes);
+}
+
+/* Points of the peak refinement: sightline, phi, Q+iU and P of
+   every window sample, held by the librmsynth context of each
+   output set on the host and on the device */
+static double refineBytesPerLOS(struct optionsList *inOptions,
+                                struct outputTotals *sum) {
+    return((double)sum->nOutputs * inOptions->refinePeaks *
+           (inOptions->refineSamples * (sizeof(int) + 4.*sizeof(float)) +
+            2.*sizeof(int)));
+}
+
+/* Every output set has its own context, which holds a chunk of
+   its channels, and of Stokes I if there is one, plus the
+   refinement points and the QU-fit parameters */
+static double deviceBytesPerLOS(struct optionsList *inOptions,
+                                struct outputTotals *sum) {
+    int nComp = inOptions->stokesI != STOKES_I_NONE ? 3 : 2;
+
+    if(inOptions->backend != BACKEND_CUDA) { return(0.); }
+    return(((double)nComp*sum->nChan + NUM_OUTPUTS*sum->nPhi) * sizeof(float) +
+           (double)sum->nOutputs * inOptions->refinePeaks * inOptions->refineSamples *
+           (sizeof(int) + 4.*sizeof(float)) +
+           (inOptions->fitModel != FIT_NONE ?
+            (double)sum->nOutputs * (2*FIT_MAX_PARAMS + 1) * sizeof(float) : 0.));
+}
+
+/*************************************************************
+*
+* Choose how many sightlines to process at a time so that the
+*  buffers fit in the host budget (hostMemory, or half of the
+*  physical memory) and in the free device memory (capped by
+*  deviceMemory). deviceFree is ignored for the CPU backend.
+*  All ranks agree on the smallest chunk. Returns FAILURE if
+*  not even one sightline fits.
+*
+*************************************************************/
+int planMemory(struct optionsList *inOptions, struct parameters *params,
+               int nChan, double deviceFree, struct memoryPlan *plan) {
+    double perLOS, fixed, tileBytes, bandBytes, rowOut, nWritesPerFrame;
+    long nFits;
+    int nFrames, firstFrame, nSteps, nStokesReads, cubes;
+    struct outputTotals sum;
+
+    if(inOptions->fileFormat == HDF5) {
+        plan->nLOS = params->qAxisLen2;
+        nFrames = params->qAxisLen1;
+    }
+    else {
+        plan->nLOS = params->qAxisLen1;
+        nFrames = params->qAxisLen2;
+    }
+    getFrameRange(nFrames, &firstFrame, &plan->nMyFrames, &nSteps);
+    sumOutputs(inOptions, nChan, &sum);
+
+    /* Budgets */
+    if(inOptions->hostMemory > 0)
+        plan->hostBudget = inOptions->hostMemory * MB;
+    else
+        plan->hostBudget = (double)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 2.;
+    plan->deviceBudget = 0.;
+    if(inOptions->backend == BACKEND_CUDA) {
+        plan->deviceBudget = deviceFree * DEVICE_MEMORY_FRACTION;
+        if(inOptions->deviceMemory > 0 && inOptions->deviceMemory*MB < plan->deviceBudget)
+            plan->deviceBudget = inOptions->deviceMemory * MB;
+    }
+
+    /* Sky ordered output holds whole rows, whatever the chunk size.
+       A catalog alone writes no rows of the cubes; what it writes
+       depends on the detections and is not predicted */
+    cubes = (inOptions->outputMode != OUTPUT_CATALOG);
+    rowOut = cubes ? (double)plan->nLOS * sum.nPhi * NUM_OUTPUTS * sizeof(float) : 0.;
+    plan->tileRows = 0;
+    tileBytes = 0.;
+    if(inOptions->fileFormat == FITS && inOptions->outputOrder == ORDER_SKY && cubes) {
+        plan->tileRows = inOptions->tileMemory * MB / rowOut;
+        if(plan->tileRows < 1) { plan->tileRows = 1; }
+        if(plan->tileRows > nFrames) { plan->tileRows = nFrames; }
+        tileBytes = plan->tileRows * rowOut;
+    }
+    /* Compressed input tiles that span several rows are held for
+       all sightlines of their rows; see readFitsBand() */
+    plan->bandFrames = 0;
+    bandBytes = 0.;
+    if(inOptions->fileFormat == FITS && params->tileFrames > 1) {
+        plan->bandFrames = params->tileFrames < nFrames ? params->tileFrames : nFrames;
+        bandBytes = (double)NUM_INPUTS * plan->bandFrames * plan->nLOS * nChan * sizeof(float);
+    }
+    fixed = tileBytes + bandBytes + (2.*nChan*sizeof(double) + 4.*sum.nPhi*sizeof(float));
+
+    /* Sightlines per call */
+    plan->losPerCall = plan->nLOS;
+    perLOS = hostBytesPerLOS(inOptions, nChan, &sum) + refineBytesPerLOS(inOptions, &sum);
+    nFits = plan->hostBudget > fixed ? (plan->hostBudget - fixed) / perLOS : 0;
+    if(nFits < plan->losPerCall) { plan->losPerCall = nFits; }
+    perLOS = deviceBytesPerLOS(inOptions, &sum);
+    if(perLOS > 0.) {
+        nFits = plan->deviceBudget / perLOS;
+        if(nFits < plan->losPerCall) { plan->losPerCall = nFits; }
+        /* computeQUP_hdf5 puts the sightlines on gridDim.y */
+        if(inOptions->fileFormat == HDF5 && plan->losPerCall > MAX_GRID_Y)
+            plan->losPerCall = MAX_GRID_Y;
+        /* The kernels index a frame of Q+iU or an output with int */
+        nFits = MAX_FRAME_ELEMENTS / (nChan > sum.maxPhi ? nChan : sum.maxPhi);
+        if(nFits < plan->losPerCall) { plan->losPerCall = nFits; }
+    }
+    /* Gathers and collective writes need the same chunks everywhere */
+    plan->losPerCall = agreeMinimum(plan->losPerCall);
+    /* cfitsio decodes a compressed cube a tile at a time, so chunks
+       of a single row hold whole tiles and start on tile boundaries
+       if at least one tile fits. Smaller chunks keep to the limits
+       above and decode the tiles they cut more than once */
+    plan->splitTiles = FALSE;
+    if(inOptions->fileFormat == FITS && params->tileLOS > 1 &&
+       plan->bandFrames == 0 && plan->losPerCall > 0 && plan->losPerCall < plan->nLOS) {
+        if(plan->losPerCall >= params->tileLOS)
+            plan->losPerCall -= plan->losPerCall % params->tileLOS;
+        else
+            plan->splitTiles = TRUE;
+    }
+    if(plan->losPerCall < 1) {
+        plan->losPerCall = 0;
+        plan->nChunks = 0;
+        return(FAILURE);
+    }
+    plan->nChunks = (plan->nLOS + plan->losPerCall - 1) / plan->losPerCall;
+    plan->hostBytes = fixed + plan->losPerCall * (hostBytesPerLOS(inOptions, nChan, &sum) +
+                                                  refineBytesPerLOS(inOptions, &sum));
+    plan->deviceBytes = plan->losPerCall * deviceBytesPerLOS(inOptions, &sum);
+    /* Each output set and product takes up to a few more buffers
+       and a frame list */
+    plan->stagingBytes = tileBytes + bandBytes + plan->losPerCall * hostBytesPerLOS(inOptions, nChan, &sum) +
+                         (1. + sum.nOutputs) * getRanks()->size * sizeof(int) +
+                         (ARENA_MAX_BUFFERS*sum.nOutputs + 2*sum.nProducts + 1) * ARENA_ALIGN;
+
+    /* Predicted I/O of this rank */
+    plan->readBytes  = (double)plan->nMyFrames * plan->nLOS *
+                       (2.*nChan + stokesIPerLOS(inOptions, nChan)) * sizeof(float);
+    plan->writeBytes = (double)plan->nMyFrames * (rowOut + plan->nLOS * sum.nPlanes * sizeof(float));
+    /* FITS model planes are read one at a time */
+    nStokesReads = inOptions->stokesI != STOKES_I_NONE;
+    if(inOptions->stokesI == STOKES_I_MODEL && inOptions->fileFormat == FITS)
+        nStokesReads = N_MODEL_PLANES;
+    plan->nReads = (double)plan->nMyFrames * plan->nChunks * (NUM_INPUTS + nStokesReads);
+    if(plan->bandFrames > 0)
+        plan->nReads = (double)((plan->nMyFrames + plan->bandFrames - 1) / plan->bandFrames) * NUM_INPUTS +
+                       (double)plan->nMyFrames * plan->nChunks * nStokesReads;
+    if(plan->tileRows > 0)
+        nWritesPerFrame = (double)NUM_OUTPUTS * sum.nPhi / plan->tileRows;
+    else if(cubes)
+        nWritesPerFrame = (double)NUM_OUTPUTS * sum.nOutputs * plan->nChunks;
+    else
+        nWritesPerFrame = 0.;
+    /* FITS products are written a plane at a time */
+    if(inOptions->fileFormat == FITS)
+        nWritesPerFrame += (double)sum.nPlanes * plan->nChunks;
+    else
+        nWritesPerFrame += (double)sum.nProducts * plan->nChunks;
+    plan->nWrites = plan->nMyFrames * nWritesPerFrame;
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Print the plan
+*
+*************************************************************/
+void printPlan(struct optionsList *inOptions, struct memoryPlan *plan) {
+    printf("INFO: Memory plan\n");
+    printf("   Frames: %d of %ld sightlines", plan->nMyFrames, plan->nLOS);
+    if(plan->nChunks > 1)
+        printf(", %d chunks of %ld", plan->nChunks, plan->losPerCall);
+    printf("\n");
+    printf("   Host memory: %.1f of %.1f MB\n", plan->hostBytes/MB, plan->hostBudget/MB);
+    printf("   Staging buffers: %.1f MB\n", plan->stagingBytes/MB);
+    if(inOptions->backend == BACKEND_CUDA)
+        printf("   Device memory: %.1f of %.1f MB\n", plan->deviceBytes/MB,
+               plan->deviceBudget/MB);
+    if(plan->tileRows > 0)
+        printf("   Sky ordered output: %d rows per tile\n", plan->tileRows);
+    if(plan->bandFrames > 0)
+        printf("   Compressed input: %d rows per band of tiles\n", plan->bandFrames);
+    if(plan->splitTiles)
+        printf("   Compressed input: a tile does not fit, chunks decode the tiles they cut\n");
+    printf("   Reads: %.1f MB in %.0f requests\n", plan->readBytes/MB, plan->nReads);
+    printf("   Writes: %.1f MB in %.0f requests\n", plan->writeBytes/MB, plan->nWrites);
+}
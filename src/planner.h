@@ -0,0 +1,55 @@
+/******************************************************************************
+planner.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef PLANNER_H
+#define PLANNER_H
+
+/* How a job is cut up to fit the host and device memory. A frame
+   (one row of the cube) is read, synthesized and written in chunks
+   of losPerCall sightlines; librmsynth contexts are sized for one
+   chunk. All sizes are per rank. */
+struct memoryPlan {
+    long nLOS;              /* Sightlines in a frame */
+    long losPerCall;        /* Sightlines per rmsSynthesize() call */
+    int nChunks;            /* Calls per frame */
+    int nMyFrames;          /* Frames handled by this rank */
+    int tileRows;           /* DEC rows per sky ordered tile, or 0 */
+    int bandFrames;         /* DEC rows per band of compressed input
+                               tiles held, or 0 */
+    int splitTiles;         /* Chunks are smaller than a compressed
+                               tile and cut through tiles */
+    double hostBytes, hostBudget;
+    double stagingBytes;    /* Frame buffers taken from the arena */
+    double deviceBytes, deviceBudget;
+    double readBytes, writeBytes;
+    double nReads, nWrites; /* I/O requests */
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+
+int planMemory(struct optionsList *inOptions, struct parameters *params,
+               int nChan, double deviceFree, struct memoryPlan *plan);
+void printPlan(struct optionsList *inOptions, struct memoryPlan *plan);
+
+#endif
@@ -0,0 +1,370 @@
+/******************************************************************************
+products.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include "structures.h"
+#include "constants.h"
+#include "hdf5_hl.h"
+#include "ranks.h"
+#include "arena.h"
+#include "engine.h"
+#include "products.h"
+
+static void addProduct(struct productSet *set, const char *name,
+                       const char *unit, int depth) {
+    struct skyProduct *product = &set->list[set->nProducts++];
+
+    strncpy(product->name, name, PRODUCT_NAME_LEN-1);
+    product->unit = unit;
+    product->depth = depth;
+}
+
+/*************************************************************
+*
+* Work out which products the options ask for. Nothing is
+*  allocated or opened yet, so the planner can use this too.
+*
+*************************************************************/
+void defineProducts(struct optionsList *inOptions, struct productSet *set) {
+    int i, nWindow;
+
+    memset(set, 0, sizeof(*set));
+    set->fileFormat = inOptions->fileFormat;
+    if(inOptions->refinePeaks > 0) {
+        nWindow = inOptions->refinePeaks * inOptions->refineSamples;
+        addProduct(set, PEAK_PHI, RM_UNIT, inOptions->refinePeaks);
+        addProduct(set, PEAK_P, BUNIT, inOptions->refinePeaks);
+        addProduct(set, PEAK_Q, BUNIT, inOptions->refinePeaks);
+        addProduct(set, PEAK_U, BUNIT, inOptions->refinePeaks);
+        addProduct(set, WINDOW_PHI0, RM_UNIT, inOptions->refinePeaks);
+        addProduct(set, WINDOW_Q, BUNIT, nWindow);
+        addProduct(set, WINDOW_U, BUNIT, nWindow);
+        addProduct(set, WINDOW_P, BUNIT, nWindow);
+    }
+    if(inOptions->noiseMaps) {
+        addProduct(set, NOISE_SIGMA, BUNIT, 1);
+        addProduct(set, NOISE_RMS, BUNIT, 1);
+        addProduct(set, NOISE_BAND, BUNIT, 1);
+        addProduct(set, PEAK_SNR, "", 1);
+    }
+    if(inOptions->fitModel != FIT_NONE) {
+        /* One plane per parameter, each in its own unit */
+        addProduct(set, FIT_PARAMS, "", fitParameters(inOptions->fitModel));
+        addProduct(set, FIT_ERRORS, "", fitParameters(inOptions->fitModel));
+        addProduct(set, FIT_CHI2, "", 1);
+    }
+    for(i=0; i<set->nProducts; i++) {
+        set->list[i].file = set->list[i].dataset = -1;
+        set->list[i].dataspace = set->list[i].memspace = -1;
+    }
+}
+
+/* Values held per sightline over all products */
+int productPlanes(const struct productSet *set) {
+    int i, nPlanes = 0;
+    for(i=0; i<set->nProducts; i++) { nPlanes += set->list[i].depth; }
+    return(nPlanes);
+}
+
+/* Chunk buffer of the named product, or NULL if not produced */
+float *productChunk(struct productSet *set, const char *name) {
+    int i;
+    for(i=0; i<set->nProducts; i++)
+        if(strcmp(set->list[i].name, name) == SUCCESS) { return(set->list[i].chunk); }
+    return(NULL);
+}
+
+/*************************************************************
+*
+* Create a FITS product. Sightlines run along NAXIS1 and frames
+*  along NAXIS2, as in sky ordered cubes, with the planes of a
+*  product on NAXIS3.
+*
+*************************************************************/
+static int createFitsProduct(char *filename, struct skyProduct *product,
+                             struct fits_header_parameters *header,
+                             int nRa, int nFrames) {
+    long naxis[FITS_OUT_NAXIS];
+    float one = 1;
+    int stat = SUCCESS;
+
+    naxis[0] = nRa; naxis[1] = nFrames; naxis[2] = product->depth;
+    fits_create_file(&product->fits, filename, &stat);
+    fits_create_img(product->fits, FLOAT_IMG, product->depth > 1 ? 3 : 2,
+                    naxis, &stat);
+    fits_write_key(product->fits, TSTRING, "BUNIT", (char *)product->unit, " ", &stat);
+    fits_write_key(product->fits, TDOUBLE, "CRVAL1", &header->crval1, " ", &stat);
+    fits_write_key(product->fits, TDOUBLE, "CDELT1", &header->cdelt1, " ", &stat);
+    fits_write_key(product->fits, TDOUBLE, "CRPIX1", &header->crpix1, " ", &stat);
+    fits_write_key(product->fits, TSTRING, "CTYPE1", header->ctype1, " ", &stat);
+    fits_write_key(product->fits, TDOUBLE, "CRVAL2", &header->crval2, " ", &stat);
+    fits_write_key(product->fits, TDOUBLE, "CDELT2", &header->cdelt2, " ", &stat);
+    fits_write_key(product->fits, TDOUBLE, "CRPIX2", &header->crpix2, " ", &stat);
+    fits_write_key(product->fits, TSTRING, "CTYPE2", header->ctype2, " ", &stat);
+    if(product->depth > 1) {
+        fits_write_key(product->fits, TFLOAT, "CRVAL3", &one, " ", &stat);
+        fits_write_key(product->fits, TFLOAT, "CDELT3", &one, " ", &stat);
+        fits_write_key(product->fits, TFLOAT, "CRPIX3", &one, " ", &stat);
+        fits_write_key(product->fits, TSTRING, "CTYPE3", PRODUCT_AXIS, " ", &stat);
+    }
+    if(stat) {
+        fits_report_error(stdout, stat);
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Create an HDF5 product as /PRIMARY/DATA of [plane][frame][los],
+*  or [frame][los] for a single plane, with the same attributes
+*  as the output cubes
+*
+*************************************************************/
+static int createHDF5Product(char *filename, struct skyProduct *product,
+                             struct fits_header_parameters *header,
+                             int nRa, int nFrames) {
+    hsize_t dims[N_DIMS];
+    int rank = product->depth > 1 ? 3 : 2;
+    int positionID = POSITION_ID;
+    float one = 1;
+    hid_t group;
+    herr_t error;
+
+    dims[0] = product->depth; dims[1] = nFrames; dims[2] = nRa;
+    product->file = H5Fcreate(filename, H5F_ACC_EXCL, H5P_DEFAULT, outputAccessList());
+    if(product->file < 0) { return(FAILURE); }
+    group = H5Gcreate(product->file, PRIMARY, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if(group < 0) { return(FAILURE); }
+    H5Gclose(group);
+    error = H5LTmake_dataset_float(product->file, PRIMARYDATA, rank,
+                                   dims + N_DIMS - rank, NULL);
+    error |= H5LTset_attribute_string(product->file, ROOT, "CLASS", HDFITS);
+    error |= H5LTset_attribute_int(product->file, PRIMARY, "POSITION", &positionID, 1);
+    error |= H5LTset_attribute_string(product->file, PRIMARY, "BUNIT", product->unit);
+    error |= H5LTset_attribute_double(product->file, PRIMARY, "CRVAL1", &(header->crval1), 1);
+    error |= H5LTset_attribute_double(product->file, PRIMARY, "CRVAL2", &(header->crval2), 1);
+    error |= H5LTset_attribute_double(product->file, PRIMARY, "CRPIX1", &(header->crpix1), 1);
+    error |= H5LTset_attribute_double(product->file, PRIMARY, "CRPIX2", &(header->crpix2), 1);
+    error |= H5LTset_attribute_double(product->file, PRIMARY, "CDELT1", &(header->cdelt1), 1);
+    error |= H5LTset_attribute_double(product->file, PRIMARY, "CDELT2", &(header->cdelt2), 1);
+    error |= H5LTset_attribute_string(product->file, PRIMARY, "CTYPE1", header->ctype1);
+    error |= H5LTset_attribute_string(product->file, PRIMARY, "CTYPE2", header->ctype2);
+    if(product->depth > 1) {
+        error |= H5LTset_attribute_float(product->file, PRIMARY, "CRVAL3", &one, 1);
+        error |= H5LTset_attribute_float(product->file, PRIMARY, "CRPIX3", &one, 1);
+        error |= H5LTset_attribute_float(product->file, PRIMARY, "CDELT3", &one, 1);
+        error |= H5LTset_attribute_string(product->file, PRIMARY, "CTYPE3", PRODUCT_AXIS);
+    }
+    error |= H5LTset_attribute_string(product->file, PRIMARYDATA, "CLASS", H5IMAGE);
+    return(error < 0 ? FAILURE : SUCCESS);
+}
+
+/*************************************************************
+*
+* Create the product files of a job whose frames are nRa
+*  sightlines long. Called where the output cubes are created.
+*
+*************************************************************/
+int createProducts(struct optionsList *inOptions, struct productSet *set,
+                   struct fits_header_parameters *header, int nRa, int nFrames) {
+    char filename[FILENAME_LEN];
+    int i;
+
+    for(i=0; i<set->nProducts; i++) {
+        if(set->fileFormat == FITS) {
+            sprintf(filename, "%s%s.fits", inOptions->outPrefix, set->list[i].name);
+            if(createFitsProduct(filename, &set->list[i], header, nRa, nFrames))
+                return(FAILURE);
+        }
+        else {
+            sprintf(filename, "%s%s.h5", inOptions->outPrefix, set->list[i].name);
+            if(createHDF5Product(filename, &set->list[i], header, nRa, nFrames)) {
+                printf("Error: Unable to create %s\n", filename);
+                return(FAILURE);
+            }
+        }
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Take the chunk buffers from the arena and, for HDF5, open the
+*  datasets. Rank 0 also holds a chunk of every rank if it
+*  gathers them.
+*
+*************************************************************/
+int openProducts(struct productSet *set, struct hostArena *arena, long losPerCall) {
+    const struct rankInfo *ranks = getRanks();
+    int gather = (set->fileFormat == HDF5 && !ranks->sharedOutput && ranks->rank == 0);
+    struct skyProduct *product;
+    hsize_t dimMem;
+    int i;
+
+    if(set->nProducts == 0) { return(SUCCESS); }
+    set->losPerCall = losPerCall;
+    if(gather) {
+        set->frames = (int *)arenaAlloc(arena, ranks->size*sizeof(*set->frames));
+        if(set->frames == NULL) { return(FAILURE); }
+    }
+    for(i=0; i<set->nProducts; i++) {
+        product = &set->list[i];
+        product->chunk = (float *)arenaAlloc(arena, product->depth*losPerCall*sizeof(float));
+        if(product->chunk == NULL) { return(FAILURE); }
+        if(gather) {
+            product->all = (float *)arenaAlloc(arena, ranks->size*product->depth*
+                                               losPerCall*sizeof(float));
+            if(product->all == NULL) { return(FAILURE); }
+        }
+        if(product->file < 0) { continue; }
+        dimMem = product->depth * losPerCall;
+        product->dataset   = H5Dopen2(product->file, PRIMARYDATA, H5P_DEFAULT);
+        product->dataspace = H5Dget_space(product->dataset);
+        product->memspace  = H5Screate_simple(1, &dimMem, NULL);
+        if(product->dataset < 0 || product->dataspace < 0 || product->memspace < 0) {
+            printf("\nError: Unable to open %s for writing\n", product->name);
+            return(FAILURE);
+        }
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Write a chunk of nLOS sightlines of one product starting at
+*  los0 of a row. row = -1 selects nothing but still takes part
+*  in a collective write.
+*
+*************************************************************/
+static int writeProductHDF5(struct skyProduct *product, int row, long los0,
+                            long nLOS, float *data) {
+    hsize_t offset[N_DIMS], count[N_DIMS];
+    hsize_t start = 0, countMem = product->depth * nLOS;
+    int rank = product->depth > 1 ? 3 : 2;
+    herr_t error = 0;
+
+    offset[0] = 0; offset[1] = row; offset[2] = los0;
+    count[0] = product->depth; count[1] = 1; count[2] = nLOS;
+    if(row >= 0) {
+        error |= H5Sselect_hyperslab(product->dataspace, H5S_SELECT_SET,
+                                     offset + N_DIMS - rank, NULL,
+                                     count + N_DIMS - rank, NULL);
+        error |= H5Sselect_hyperslab(product->memspace, H5S_SELECT_SET,
+                                     &start, NULL, &countMem, NULL);
+    }
+    else {
+        error |= H5Sselect_none(product->dataspace);
+        error |= H5Sselect_none(product->memspace);
+    }
+    error |= H5Dwrite(product->dataset, H5T_NATIVE_FLOAT, product->memspace,
+                      product->dataspace, outputTransferList(), data);
+    return(error < 0 ? FAILURE : SUCCESS);
+}
+
+/*************************************************************
+*
+* Write the current chunk of every product. Every rank calls
+*  this at every step, with row = -1 if it has nothing to
+*  write; see writeHDF5Frame() for the cubes.
+*
+*************************************************************/
+int writeProducts(struct productSet *set, int row, long los0, long nLOS) {
+    const struct rankInfo *ranks = getRanks();
+    struct skyProduct *product;
+    long fPixel[FITS_OUT_NAXIS], n;
+    int i, k, r, stat = SUCCESS, status = SUCCESS;
+
+    if(set->nProducts == 0) { return(SUCCESS); }
+    if(set->fileFormat == FITS) {
+        if(row < 0) { return(SUCCESS); }
+        fPixel[0] = los0 + 1; fPixel[1] = row + 1;
+        for(i=0; i<set->nProducts; i++) {
+            for(k=0; k<set->list[i].depth; k++) {
+                fPixel[2] = k + 1;
+                fits_write_pix(set->list[i].fits, TFLOAT, fPixel, nLOS,
+                               set->list[i].chunk + k*nLOS, &stat);
+            }
+        }
+        if(stat) {
+            fits_report_error(stdout, stat);
+            return(FAILURE);
+        }
+        return(SUCCESS);
+    }
+
+    for(i=0; i<set->nProducts; i++) {
+        product = &set->list[i];
+        if(ranks->sharedOutput) {
+            if(writeProductHDF5(product, row, los0, nLOS, product->chunk))
+                status = FAILURE;
+            continue;
+        }
+        /* Rank 0 writes the chunks of all ranks */
+        n = product->depth * set->losPerCall;
+        if(gatherFrames(i == 0 ? &row : NULL, set->frames, product->chunk,
+                        product->all, n)) {
+            printf("\nError: Unable to gather %s\n\n", product->name);
+            return(FAILURE);
+        }
+        for(r=0; ranks->rank == 0 && r<ranks->size; r++) {
+            if(set->frames[r] < 0) { continue; }
+            if(writeProductHDF5(product, set->frames[r], los0, nLOS,
+                                product->all + r*n)) { status = FAILURE; }
+        }
+    }
+    if(status) { printf("\nError: Unable to write the per-sightline products\n\n"); }
+    return(status);
+}
+
+/*************************************************************
+*
+* Close whatever was opened. Safe to call more than once; with
+*  parallel HDF5 every rank must get here together.
+*
+*************************************************************/
+int closeProducts(struct productSet *set) {
+    struct skyProduct *product;
+    int i, stat = SUCCESS;
+
+    for(i=0; i<set->nProducts; i++) {
+        product = &set->list[i];
+        if(product->memspace >= 0)  { H5Sclose(product->memspace); }
+        if(product->dataspace >= 0) { H5Sclose(product->dataspace); }
+        if(product->dataset >= 0)   { H5Dclose(product->dataset); }
+        if(product->file >= 0)      { H5Fclose(product->file); }
+        if(product->fits != NULL)   { fits_close_file(product->fits, &stat); }
+        product->file = product->dataset = -1;
+        product->dataspace = product->memspace = -1;
+        product->fits = NULL;
+        product->chunk = product->all = NULL;
+    }
+    set->frames = NULL;
+    if(stat) {
+        fits_report_error(stdout, stat);
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
@@ -0,0 +1,95 @@
+/******************************************************************************
+products.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef PRODUCTS_H
+#define PRODUCTS_H
+
+#include "fitsio.h"
+#include "hdf5.h"
+#include "arena.h"
+
+#define MAX_PRODUCTS      16
+#define PRODUCT_NAME_LEN  32
+/* CTYPE of the plane axis of products with more than one plane */
+#define PRODUCT_AXIS      "INDEX"
+
+/* Products of the peak refinement */
+#define PEAK_PHI    "peak.phi"
+#define PEAK_P      "peak.p"
+#define PEAK_Q      "peak.q"
+#define PEAK_U      "peak.u"
+#define WINDOW_PHI0 "window.phi0"
+#define WINDOW_Q    "window.q"
+#define WINDOW_U    "window.u"
+#define WINDOW_P    "window.p"
+
+/* Noise and S/N maps */
+#define NOISE_SIGMA "noise.sigma"
+#define NOISE_RMS   "noise.rms"
+#define NOISE_BAND  "noise.band"
+#define PEAK_SNR    "peak.snr"
+
+/* Model fitted to Q and U: parameters, uncertainties, reduced chi^2 */
+#define FIT_PARAMS  "fit.params"
+#define FIT_ERRORS  "fit.errors"
+#define FIT_CHI2    "fit.chi2"
+
+/* A per-sightline product, e.g. the refined peak phi. It holds
+   depth values per sightline and is written next to the output
+   cubes as <outPrefix><name>.fits or .h5: a map of the sky, or
+   a cube of depth maps. chunk holds the current chunk as depth
+   planes of nLOS values. */
+struct skyProduct {
+    char name[PRODUCT_NAME_LEN];
+    const char *unit;
+    int depth;
+    float *chunk;
+    float *all;             /* Chunks of every rank, on rank 0 */
+    fitsfile *fits;
+    hid_t file, dataset, dataspace, memspace;
+};
+
+/* The products of a job. Chunks are written with the same row
+   and sightline offsets as the cubes, and gathered on rank 0 the
+   same way when the output is not shared. */
+struct productSet {
+    int nProducts;
+    long losPerCall;
+    int fileFormat;
+    int *frames;
+    struct skyProduct list[MAX_PRODUCTS];
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+
+void defineProducts(struct optionsList *inOptions, struct productSet *set);
+int productPlanes(const struct productSet *set);
+float *productChunk(struct productSet *set, const char *name);
+int createProducts(struct optionsList *inOptions, struct productSet *set,
+                   struct fits_header_parameters *header, int nRa, int nFrames);
+int openProducts(struct productSet *set, struct hostArena *arena, long losPerCall);
+int writeProducts(struct productSet *set, int row, long los0, long nLOS);
+int closeProducts(struct productSet *set);
+
+#endif
@@ -0,0 +1,243 @@
+/******************************************************************************
+ranks.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#ifdef MPI_ENABLE
+#include<mpi.h>
+#endif
+
+#include "constants.h"
+#include "ranks.h"
+
+static struct rankInfo ranks = {0, 1, 0, TRUE};
+static hid_t accessList = H5P_DEFAULT;
+static hid_t transferList = H5P_DEFAULT;
+
+/*************************************************************
+*
+* Start MPI and work out how the output cubes are shared.
+*  With a parallel HDF5 library every rank opens the output
+*  and writes its own rows collectively. Otherwise rank 0
+*  owns the output and gathers the other ranks' frames.
+*
+*************************************************************/
+int initRanks(int *argc, char ***argv) {
+#ifdef MPI_ENABLE
+    MPI_Comm node;
+
+    if(MPI_Init(argc, argv) != MPI_SUCCESS) {
+        printf("Error: Unable to initialise MPI\n\n");
+        return(FAILURE);
+    }
+    MPI_Comm_rank(MPI_COMM_WORLD, &ranks.rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks.size);
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, ranks.rank,
+                        MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &ranks.localRank);
+    MPI_Comm_free(&node);
+    if(ranks.size > 1) {
+#ifdef H5_HAVE_PARALLEL
+        accessList = H5Pcreate(H5P_FILE_ACCESS);
+        H5Pset_fapl_mpio(accessList, MPI_COMM_WORLD, MPI_INFO_NULL);
+        transferList = H5Pcreate(H5P_DATASET_XFER);
+        H5Pset_dxpl_mpio(transferList, H5FD_MPIO_COLLECTIVE);
+        ranks.sharedOutput = TRUE;
+#else
+        ranks.sharedOutput = FALSE;
+#endif
+    }
+    if(ranks.rank == 0 && ranks.size > 1) {
+        printf("INFO: Running on %d MPI ranks, %s\n", ranks.size,
+               ranks.sharedOutput ? "collective HDF5 output" :
+                                    "output gathered on rank 0");
+    }
+#else
+    (void)argc;
+    (void)argv;
+#endif
+    return(SUCCESS);
+}
+
+void finalizeRanks(void) {
+    if(accessList != H5P_DEFAULT) { H5Pclose(accessList); }
+    if(transferList != H5P_DEFAULT) { H5Pclose(transferList); }
+    accessList = transferList = H5P_DEFAULT;
+#ifdef MPI_ENABLE
+    MPI_Finalize();
+#endif
+}
+
+/* Tear down every rank, e.g. when one fails outside a collective */
+void abortRanks(int status) {
+#ifdef MPI_ENABLE
+    if(ranks.size > 1) { MPI_Abort(MPI_COMM_WORLD, status); }
+#endif
+    exit(status);
+}
+
+const struct rankInfo *getRanks(void) {
+    return(&ranks);
+}
+
+/*************************************************************
+*
+* Split nFrames into contiguous blocks, one per rank. nSteps
+*  is the largest block; every rank steps that many times so
+*  that collective writes stay matched.
+*
+*************************************************************/
+void getFrameRange(int nFrames, int *firstFrame, int *nMyFrames, int *nSteps) {
+    int base = nFrames / ranks.size;
+    int extra = nFrames % ranks.size;
+
+    *nMyFrames  = base + (ranks.rank < extra ? 1 : 0);
+    *firstFrame = ranks.rank*base + (ranks.rank < extra ? ranks.rank : extra);
+    *nSteps     = base + (extra ? 1 : 0);
+}
+
+/*************************************************************
+*
+* Return FAILURE on every rank if any rank failed. Called
+*  before steps that all ranks must enter together.
+*
+*************************************************************/
+int agreeStatus(int status) {
+#ifdef MPI_ENABLE
+    int global;
+    if(ranks.size > 1) {
+        MPI_Allreduce(&status, &global, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        return(global);
+    }
+#endif
+    return(status);
+}
+
+/*************************************************************
+*
+* Return the smallest value over all ranks. Used where every
+*  rank must take the same decision, e.g. the chunk size.
+*
+*************************************************************/
+long agreeMinimum(long value) {
+#ifdef MPI_ENABLE
+    long global;
+    if(ranks.size > 1) {
+        MPI_Allreduce(&value, &global, 1, MPI_LONG, MPI_MIN, MPI_COMM_WORLD);
+        return(global);
+    }
+#endif
+    return(value);
+}
+
+/*************************************************************
+*
+* Collect one frame of n values from every rank on rank 0.
+*  frame points to this rank's frame index, or -1 if it has
+*  none this step; it may be NULL to send only data. On rank 0,
+*  frames[r] and dst + r*n receive rank r's index and data.
+*
+*************************************************************/
+int gatherFrames(int *frame, int *frames, const float *src, float *dst, long n) {
+#ifdef MPI_ENABLE
+    if(ranks.size > 1) {
+        if(frame != NULL &&
+           MPI_Gather(frame, 1, MPI_INT, frames, 1, MPI_INT, 0,
+                      MPI_COMM_WORLD) != MPI_SUCCESS) { return(FAILURE); }
+        if(MPI_Gather((void *)src, (int)n, MPI_FLOAT, dst, (int)n, MPI_FLOAT, 0,
+                      MPI_COMM_WORLD) != MPI_SUCCESS) { return(FAILURE); }
+        return(SUCCESS);
+    }
+#endif
+    if(frame != NULL) { frames[0] = *frame; }
+    memcpy(dst, src, n*sizeof(*src));
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Collect n records of size bytes from every rank on rank 0,
+*  where the count differs from rank to rank. *dst, holding
+*  *capacity records, is grown as needed and receives the
+*  records of rank 0, 1, ... in turn; *nAll is their total.
+*  Other ranks only send.
+*
+*************************************************************/
+int gatherRecords(const void *src, long n, size_t size, void **dst, long *capacity,
+                  long *nAll) {
+    long total = n;
+    void *grown;
+#ifdef MPI_ENABLE
+    int r, nBytes = (int)(n*size), *counts = NULL, *displs = NULL, status;
+
+    if(ranks.size > 1) {
+        if(ranks.rank == 0) {
+            counts = malloc(2*ranks.size*sizeof(*counts));
+            if(counts == NULL) { abortRanks(FAILURE); }
+            displs = counts + ranks.size;
+        }
+        if(MPI_Gather(&nBytes, 1, MPI_INT, counts, 1, MPI_INT, 0,
+                      MPI_COMM_WORLD) != MPI_SUCCESS) {
+            free(counts);
+            return(FAILURE);
+        }
+        *nAll = 0;
+        if(ranks.rank == 0) {
+            for(r=0, total=0; r<ranks.size; r++) {
+                displs[r] = (int)(total*size);
+                total += counts[r]/size;
+            }
+            if(total > *capacity) {
+                /* The other ranks are already waiting to send */
+                grown = realloc(*dst, total*size);
+                if(grown == NULL) { abortRanks(FAILURE); }
+                *dst = grown;
+                *capacity = total;
+            }
+            *nAll = total;
+        }
+        status = MPI_Gatherv((void *)src, nBytes, MPI_BYTE, *dst, counts, displs,
+                             MPI_BYTE, 0, MPI_COMM_WORLD);
+        free(counts);
+        return(status == MPI_SUCCESS ? SUCCESS : FAILURE);
+    }
+#endif
+    if(total > *capacity) {
+        grown = realloc(*dst, total*size);
+        if(grown == NULL) { return(FAILURE); }
+        *dst = grown;
+        *capacity = total;
+    }
+    if(n > 0) { memcpy(*dst, src, n*size); }
+    *nAll = total;
+    return(SUCCESS);
+}
+
+/* Property lists for creating and writing the output cubes */
+hid_t outputAccessList(void) {
+    return(accessList);
+}
+
+hid_t outputTransferList(void) {
+    return(transferList);
+}
@@ -0,0 +1,55 @@
+/******************************************************************************
+ranks.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef RANKS_H
+#define RANKS_H
+
+#include "hdf5.h"
+
+/* Where this process sits in an MPI run. Without MPI_ENABLE, or
+   before initRanks(), there is a single rank. */
+struct rankInfo {
+    int rank, size;
+    int localRank;      /* Rank among the processes on this node */
+    int sharedOutput;   /* TRUE if every rank opens the output cubes.
+                           FALSE if only rank 0 does and the other
+                           ranks send it their frames. */
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+
+int initRanks(int *argc, char ***argv);
+void finalizeRanks(void);
+void abortRanks(int status);
+const struct rankInfo *getRanks(void);
+void getFrameRange(int nFrames, int *firstFrame, int *nMyFrames, int *nSteps);
+int agreeStatus(int status);
+long agreeMinimum(long value);
+int gatherFrames(int *frame, int *frames, const float *src, float *dst, long n);
+int gatherRecords(const void *src, long n, size_t size, void **dst, long *capacity,
+                  long *nAll);
+hid_t outputAccessList(void);
+hid_t outputTransferList(void);
+
+#endif
@@ -0,0 +1,101 @@
+/******************************************************************************
+reference.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdlib.h>
+#include<math.h>
+
+#include "constants.h"
+#include "reference.h"
+
+/*************************************************************
+*
+* Straightforward double precision RM synthesis (Brentjens &
+*  de Bruijn 2005, eq. 25) used to check the optimized
+*  backends. Inputs and outputs use the same frame layout as
+*  the engines; weights may be NULL for uniform weighting.
+*
+*************************************************************/
+void referenceComputeQUP(const float *qImageArray, const float *uImageArray,
+                         long nLOS, int nChan, int layout, int nPhi,
+                         const double *phiAxis, const double *lambda2,
+                         double lambda20, const double *weights,
+                         double *qPhi, double *uPhi, double *pPhi) {
+    long los, readIdx, writeIdx;
+    int i, p;
+    double K = 0., w, arg, q, u, qSum, uSum;
+
+    for(i=0; i<nChan; i++)
+        K += weights == NULL ? 1. : weights[i];
+    K = 1./K;
+
+    for(los=0; los<nLOS; los++) {
+        for(p=0; p<nPhi; p++) {
+            qSum = 0.; uSum = 0.;
+            for(i=0; i<nChan; i++) {
+                if(layout == LAYOUT_LOS_FIRST) readIdx = los + i*nLOS;
+                else readIdx = los*nChan + i;
+                w = weights == NULL ? 1. : weights[i];
+                q = qImageArray[readIdx];
+                u = uImageArray[readIdx];
+                /* (q + iu) exp(-2i phi (lambda^2 - lambda^2_0)) */
+                arg = 2.*phiAxis[p]*(lambda2[i] - lambda20);
+                qSum += w*( q*cos(arg) + u*sin(arg));
+                uSum += w*( u*cos(arg) - q*sin(arg));
+            }
+            if(layout == LAYOUT_LOS_FIRST) writeIdx = los + p*nLOS;
+            else writeIdx = los*nPhi + p;
+            qPhi[writeIdx] = K*qSum;
+            uPhi[writeIdx] = K*uSum;
+            pPhi[writeIdx] = K*sqrt(qSum*qSum + uSum*uSum);
+        }
+    }
+}
+
+/*************************************************************
+*
+* Double precision RMSF on the given phi axis. Matches the
+*  response of the engines to q=1, u=0 in every channel.
+*
+*************************************************************/
+void referenceRMSF(int nChan, const double *lambda2, double lambda20,
+                   const double *weights, int nPhi, const double *phiAxis,
+                   double *rmsfReal, double *rmsfImag, double *rmsf) {
+    int i, p;
+    double K = 0., w, arg, re, im;
+
+    for(i=0; i<nChan; i++)
+        K += weights == NULL ? 1. : weights[i];
+    K = 1./K;
+
+    for(p=0; p<nPhi; p++) {
+        re = 0.; im = 0.;
+        for(i=0; i<nChan; i++) {
+            w = weights == NULL ? 1. : weights[i];
+            arg = 2.*phiAxis[p]*(lambda2[i] - lambda20);
+            re += w*cos(arg);
+            im -= w*sin(arg);
+        }
+        rmsfReal[p] = K*re;
+        rmsfImag[p] = K*im;
+        rmsf[p]     = K*sqrt(re*re + im*im);
+    }
+}
@@ -0,0 +1,39 @@
+/******************************************************************************
+reference.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+#ifdef __cplusplus
+extern "C"
+#endif
+
+void referenceComputeQUP(const float *qImageArray, const float *uImageArray,
+                         long nLOS, int nChan, int layout, int nPhi,
+                         const double *phiAxis, const double *lambda2,
+                         double lambda20, const double *weights,
+                         double *qPhi, double *uPhi, double *pPhi);
+void referenceRMSF(int nChan, const double *lambda2, double lambda20,
+                   const double *weights, int nPhi, const double *phiAxis,
+                   double *rmsfReal, double *rmsfImag, double *rmsf);
+
+#endif
@@ -20,59 +20,79 @@ Correspondence concerning RMSynth_GPU should be addressed to:
 sarrvesh.ss@gmail.com
 
 ******************************************************************************/
-#include "structures.h"
 #include<math.h>
+#include<stdlib.h>
 
+#include "constants.h"
 #include "rmsf.h"
 
 /*************************************************************
 *
-* Generate Rotation Measure Spread Function
+* Generate Rotation Measure Spread Function on the given phi
+*  axis. weights may be NULL for uniform weighting.
 *
 *************************************************************/
-int generateRMSF(struct optionsList *inOptions, struct DataArrays *data_arrays, struct parameters *params) {
+void generateRMSF(int nChan, const double *lambda2, double lambda20,
+                  const double *weights, int nPhi, const float *phiAxis,
+                  float *rmsfReal, float *rmsfImag, float *rmsf) {
     int i, j;
-
-    data_arrays->nPhi = inOptions->nPhi;
-    data_arrays->rmsf     = calloc(inOptions->nPhi, sizeof(data_arrays->rmsf));
-    data_arrays->rmsfReal = calloc(inOptions->nPhi, sizeof(data_arrays->rmsfReal));
-    data_arrays->rmsfImag = calloc(inOptions->nPhi, sizeof(data_arrays->rmsfImag));
-    data_arrays->phiAxis  = calloc(inOptions->nPhi, sizeof(data_arrays->phiAxis));
-
-    if(data_arrays->rmsf     == NULL || data_arrays->rmsfReal == NULL ||
-       data_arrays->rmsfImag == NULL || data_arrays->phiAxis  == NULL)
-        return(FAILURE);
+    double re, im, arg, w, K = 0.;
 
     /* Get the normalization factor K */
-    params->K = 1.0 / params->qAxisLen3;
-
-    /* First generate the phi axis */
-    for(i=0; i<inOptions->nPhi; i++) {
-        data_arrays->phiAxis[i] = inOptions->phiMin + i * inOptions->dPhi;
-
-        /* For each phi value, compute the corresponding RMSF */
-        for(j=0; j<params->qAxisLen3; j++) {
-            data_arrays->rmsfReal[i] += cos(2 * data_arrays->phiAxis[i] *
-                                   (data_arrays->lambda2[j] - data_arrays->lambda20 ));
-            data_arrays->rmsfImag[i] -= sin(2 * data_arrays->phiAxis[i] *
-                                   (data_arrays->lambda2[j] - data_arrays->lambda20 ));
+    for(j=0; j<nChan; j++)
+        K += weights == NULL ? 1. : weights[j];
+    K = 1.0 / K;
+
+    /* For each phi value, compute the corresponding RMSF */
+    for(i=0; i<nPhi; i++) {
+        re = 0.; im = 0.;
+        for(j=0; j<nChan; j++) {
+            w = weights == NULL ? 1. : weights[j];
+            arg = 2 * phiAxis[i] * (lambda2[j] - lambda20);
+            re += w * cos(arg);
+            im -= w * sin(arg);
         }
         // Normalize with K
-        data_arrays->rmsfReal[i] *= params->K;
-        data_arrays->rmsfImag[i] *= params->K;
-        data_arrays->rmsf[i] = sqrt( data_arrays->rmsfReal[i] * data_arrays->rmsfReal[i] +
-                                data_arrays->rmsfImag[i] * data_arrays->rmsfImag[i] );
+        rmsfReal[i] = re * K;
+        rmsfImag[i] = im * K;
+        rmsf[i] = sqrt( rmsfReal[i] * rmsfReal[i] + rmsfImag[i] * rmsfImag[i] );
     }
-    return(SUCCESS);
 }
 
 /*************************************************************
 *
-* Comparison function used by quick sort.
+* Return the k-th smallest element of array in O(n) on average.
+*  The array is partially reordered in place.
 *
 *************************************************************/
-int compFunc(const void * a, const void * b) {
-   return ( *(double*)a - *(double*)b );
+double selectKth(double *array, int n, int k) {
+    int left = 0, right = n-1;
+    int i, j, mid;
+    double pivot, temp;
+
+    while(left < right) {
+        /* Median of three pivot */
+        mid = left + (right-left)/2;
+        if(array[mid]   < array[left]) { temp=array[mid];   array[mid]=array[left];   array[left]=temp; }
+        if(array[right] < array[left]) { temp=array[right]; array[right]=array[left]; array[left]=temp; }
+        if(array[right] < array[mid])  { temp=array[right]; array[right]=array[mid];  array[mid]=temp; }
+        pivot = array[mid];
+
+        /* Hoare partition */
+        i = left; j = right;
+        while(i <= j) {
+            while(array[i] < pivot) i++;
+            while(array[j] > pivot) j--;
+            if(i <= j) {
+                temp = array[i]; array[i] = array[j]; array[j] = temp;
+                i++; j--;
+            }
+        }
+        if(k <= j) right = j;
+        else if(k >= i) left = i;
+        else break;
+    }
+    return(array[k]);
 }
 
 /*************************************************************
@@ -80,74 +100,35 @@ int compFunc(const void * a, const void * b) {
 * Find the median \lambda^2_0
 *
 *************************************************************/
-void getMedianLambda20(struct parameters *params, struct DataArrays *data_arrays) {
+int getMedianLambda20(const double *lambda2, int nChan, double *lambda20) {
     double *tempArray;
     int i;
 
-    tempArray = calloc(params->qAxisLen3, sizeof(tempArray));
-    for(i=0; i<params->qAxisLen3; i++)
-        tempArray[i] = data_arrays->lambda2[i];
-
-    /* Sort the list of lambda2 freq */
-    qsort(tempArray, params->qAxisLen3, sizeof(tempArray), compFunc);
-
-    /* Find the median value of the sorted list */
-    params->lambda20 = tempArray[params->qAxisLen3/2];
-    free(tempArray);
-}
-
-/*************************************************************
-*
-* Write RMSF to disk
-*
-*************************************************************/
-int writeRMSF(struct optionsList inOptions, struct DataArrays data_arrays) {
-    FILE *rmsf;
-    char filename[FILENAME_LEN];
-    int i;
-
-    /* Open a text file */
-    sprintf(filename, "%srmsf.txt", inOptions.outPrefix);
-    printf("INFO: Writing RMSF to %s\n", filename);
-    rmsf = fopen(filename, FILE_READWRITE);
-    if(rmsf == NULL)
+    tempArray = calloc(nChan, sizeof(*tempArray));
+    if(tempArray == NULL)
         return(FAILURE);
+    for(i=0; i<nChan; i++)
+        tempArray[i] = lambda2[i];
 
-    for(i=0; i<inOptions.nPhi; i++)
-        fprintf(rmsf, "%f\t%f\t%f\t%f\n", data_arrays.phiAxis[i], data_arrays.rmsfReal[i],
-                data_arrays.rmsfImag[i], data_arrays.rmsf[i]);
-
-    fclose(rmsf);
+    /* Same element a full sort would put in the middle */
+    *lambda20 = selectKth(tempArray, nChan, nChan/2);
+    free(tempArray);
     return(SUCCESS);
 }
 
-#ifdef GNUPLOT_ENABLE
 /*************************************************************
 *
-* Plot RMSF
+* Find the weighted mean \lambda^2_0 (Brentjens & de Bruijn 2005)
 *
 *************************************************************/
-int plotRMSF(struct optionsList inOptions) {
-    FILE *gnuplotPipe;
-    char commands[STRING_BUF_LEN];
-
-    gnuplotPipe = popen("gnuplot -persist", FILE_READWRITE);
-    if(gnuplotPipe == NULL)
-        return(FAILURE);
-
-    /* Plot the RMSF using the file that was written in writeRMSF() */
-    sprintf(commands, "set title \"Rotation Measure Spread Function\"\n");
-    sprintf(commands, "%sset xlabel \"Faraday Depth\"\n", commands);
-    sprintf(commands, "%sset autoscale\n", commands);
-    sprintf(commands,"%splot \"%srmsf.txt\" using 1:2 title 'RMSF' with lines,",
-            commands, inOptions.outPrefix);
-    sprintf(commands, "%s \"%srmsf.txt\" using 1:3 title 'Real' with lines,",
-            commands, inOptions.outPrefix);
-    sprintf(commands, "%s \"%srmsf.txt\" using 1:4 title 'Imag' with lines\n",
-            commands, inOptions.outPrefix);
-    fprintf(gnuplotPipe, "%s", commands);
-    pclose(gnuplotPipe);
+double getWeightedLambda20(const double *lambda2, const double *weights,
+                           int nChan) {
+    double sum = 0., sumWeights = 0.;
+    int i;
 
-    return(SUCCESS);
+    for(i=0; i<nChan; i++) {
+        sum += (weights == NULL ? 1. : weights[i]) * lambda2[i];
+        sumWeights += weights == NULL ? 1. : weights[i];
+    }
+    return(sum / sumWeights);
 }
-#endif
@@ -27,10 +27,12 @@ sarrvesh.ss@gmail.com
 extern "C"
 #endif
 
-int generateRMSF(struct optionsList *inOptions, struct DataArrays *data_arrays, struct parameters *params);
-int compFunc(const void * a, const void * b);
-void getMedianLambda20(struct DataArrays *params);
-int writeRMSF(struct optionsList inOptions, struct DataArrays params);
-int plotRMSF(struct optionsList inOptions);
+void generateRMSF(int nChan, const double *lambda2, double lambda20,
+                  const double *weights, int nPhi, const float *phiAxis,
+                  float *rmsfReal, float *rmsfImag, float *rmsf);
+double selectKth(double *array, int n, int k);
+int getMedianLambda20(const double *lambda2, int nChan, double *lambda20);
+double getWeightedLambda20(const double *lambda2, const double *weights,
+                           int nChan);
 
 #endif
@@ -0,0 +1,938 @@
+/******************************************************************************
+rmsynth.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+
+#include "constants.h"
+#include "engine.h"
+#include "rmsf.h"
+#include "rmsynth.h"
+
+/* Library state behind the opaque handle */
+struct rmsContext {
+    struct rmsConfig config;
+    double *lambda2, *weights;
+    double lambda20;
+    float *phiAxis;
+    float *rmsfReal, *rmsfImag, *rmsf;
+    struct synthEngine engine;
+    int engineReady;
+
+    /* Scratch of rmsRefine(), grown on demand */
+    int *nFound, *peakIndex;
+    int *pointLOS;
+    float *pointPhi, *pointQU, *pointP;
+    long maxRefineLOS, maxPoints;
+
+    /* Scratch of rmsEstimateNoise(), one sightline's worth */
+    double *noiseScratch;
+    long maxNoise;
+
+    /* Complex RMSF at offsets 0, dPhi/RMSF_OVERSAMPLE, ... as
+       Re, Im pairs, made on first use */
+    double *rmsfTable;
+    long nTable;
+
+    /* Components found by rmsFindComponents(), grown on demand,
+       and the cleaned spectrum and sources of one sightline */
+    struct rmsComponent *components;
+    long maxComponents;
+    double *residual;
+};
+
+static const char *statusStrings[RMS_N_STATUS] = {
+    "success",
+    "invalid argument",
+    "out of memory",
+    "backend or kernel not available",
+    "synthesis failed"
+};
+
+/*************************************************************
+*
+* Defaults: median \lambda^2_0, direct kernel on all CPU cores
+*  with the FITS (frequency first) layout
+*
+*************************************************************/
+void rmsDefaultConfig(struct rmsConfig *config) {
+    memset(config, 0, sizeof(*config));
+    config->lambda20Mode = LAMBDA20_MEDIAN;
+    config->backend  = BACKEND_CPU;
+    config->variant  = KERNEL_DIRECT;
+    config->layout   = LAYOUT_FREQ_FIRST;
+    config->maxLOS   = 1;
+}
+
+/*************************************************************
+*
+* Check a configuration before anything is allocated
+*
+*************************************************************/
+static int checkConfig(const struct rmsConfig *config) {
+    double sumWeights = 0.;
+    int i;
+
+    if(config->nChan < 1 || config->lambda2 == NULL ||
+       config->nPhi < 1 || config->dPhi <= 0. || config->maxLOS < 1 ||
+       config->nThreads < 0)
+        return(RMS_ERR_ARGUMENT);
+    if(config->layout != LAYOUT_FREQ_FIRST && config->layout != LAYOUT_LOS_FIRST)
+        return(RMS_ERR_ARGUMENT);
+    if(config->lambda20Mode != LAMBDA20_MEDIAN &&
+       config->lambda20Mode != LAMBDA20_WEIGHTED &&
+       config->lambda20Mode != LAMBDA20_USER)
+        return(RMS_ERR_ARGUMENT);
+    if(config->lambda20Mode == LAMBDA20_USER && config->lambda20 < 0.)
+        return(RMS_ERR_ARGUMENT);
+    if(config->backend < 0 || config->backend >= N_BACKENDS ||
+       config->variant < 0 || config->variant >= N_KERNELS ||
+       !engineHasVariant(config->backend, config->variant))
+        return(RMS_ERR_BACKEND);
+    if(config->weights != NULL) {
+        for(i=0; i<config->nChan; i++) {
+            if(config->weights[i] < 0.) return(RMS_ERR_ARGUMENT);
+            sumWeights += config->weights[i];
+        }
+        if(sumWeights <= 0.) return(RMS_ERR_ARGUMENT);
+    }
+    return(RMS_SUCCESS);
+}
+
+/*************************************************************
+*
+* Set up a context: copy \lambda^2 and the weights, choose
+*  \lambda^2_0, build the phi axis and the RMSF, and prepare
+*  the backend
+*
+*************************************************************/
+int rmsCreate(const struct rmsConfig *config, struct rmsContext **ctx) {
+    struct rmsContext *c;
+    int i, status;
+
+    if(ctx == NULL || config == NULL) { return(RMS_ERR_ARGUMENT); }
+    *ctx = NULL;
+    if((status = checkConfig(config)) != RMS_SUCCESS) { return(status); }
+
+    c = calloc(1, sizeof(*c));
+    if(c == NULL) { return(RMS_ERR_NOMEM); }
+    c->config   = *config;
+    c->lambda2  = calloc(config->nChan, sizeof(*c->lambda2));
+    c->weights  = calloc(config->nChan, sizeof(*c->weights));
+    c->phiAxis  = calloc(config->nPhi, sizeof(*c->phiAxis));
+    c->rmsfReal = calloc(config->nPhi, sizeof(*c->rmsfReal));
+    c->rmsfImag = calloc(config->nPhi, sizeof(*c->rmsfImag));
+    c->rmsf     = calloc(config->nPhi, sizeof(*c->rmsf));
+    if(c->lambda2 == NULL || c->weights == NULL || c->phiAxis == NULL ||
+       c->rmsfReal == NULL || c->rmsfImag == NULL || c->rmsf == NULL) {
+        rmsDestroy(c);
+        return(RMS_ERR_NOMEM);
+    }
+    /* The context does not keep pointers into the configuration */
+    c->config.lambda2 = c->lambda2;
+    c->config.weights = c->weights;
+    for(i=0; i<config->nChan; i++) {
+        c->lambda2[i] = config->lambda2[i];
+        c->weights[i] = config->weights == NULL ? 1. : config->weights[i];
+    }
+    for(i=0; i<config->nPhi; i++)
+        c->phiAxis[i] = config->phiMin + i * config->dPhi;
+
+    /* The same \lambda^2_0 is used for the RMSF and for the kernels */
+    switch(config->lambda20Mode) {
+       case LAMBDA20_WEIGHTED:
+          c->lambda20 = getWeightedLambda20(c->lambda2, c->weights, config->nChan);
+          break;
+       case LAMBDA20_USER:
+          c->lambda20 = config->lambda20;
+          break;
+       default:
+          if(getMedianLambda20(c->lambda2, config->nChan, &c->lambda20)) {
+              rmsDestroy(c);
+              return(RMS_ERR_NOMEM);
+          }
+          break;
+    }
+    generateRMSF(config->nChan, c->lambda2, c->lambda20, c->weights,
+                 config->nPhi, c->phiAxis, c->rmsfReal, c->rmsfImag, c->rmsf);
+
+    if(initEngine(&c->engine, config->backend, config->variant,
+                  config->layout, config->nChan, config->nPhi,
+                  config->maxLOS, config->stokesI, c->phiAxis, c->lambda2, c->lambda20,
+                  c->weights, config->nThreads, config->deviceId)) {
+        rmsDestroy(c);
+        return(config->backend == BACKEND_CUDA ? RMS_ERR_BACKEND : RMS_ERR_NOMEM);
+    }
+    c->engineReady = TRUE;
+    *ctx = c;
+    return(RMS_SUCCESS);
+}
+
+/*************************************************************
+*
+* Synthesize nLOS sightlines. The input and output buffers
+*  belong to the caller and are laid out as configured:
+*  LAYOUT_FREQ_FIRST is [los][chan] in and [los][phi] out,
+*  LAYOUT_LOS_FIRST is [chan][los] in and [phi][los] out.
+*  Q and U are interleaved for the backends, so separate
+*  arrays are copied on the way in and out; callers that can
+*  hold interleaved data should use rmsSynthesizeInterleaved().
+*
+*************************************************************/
+int rmsSynthesize(struct rmsContext *ctx, const float *qImageArray,
+                  const float *uImageArray, long nLOS,
+                  float *qPhi, float *uPhi, float *pPhi) {
+    if(ctx == NULL || qImageArray == NULL || uImageArray == NULL ||
+       qPhi == NULL || uPhi == NULL || pPhi == NULL ||
+       nLOS < 1 || nLOS > ctx->config.maxLOS)
+        return(RMS_ERR_ARGUMENT);
+    if(runEngineSplit(&ctx->engine, qImageArray, uImageArray, nLOS,
+                      qPhi, uPhi, pPhi))
+        return(RMS_ERR_COMPUTE);
+    return(RMS_SUCCESS);
+}
+
+/*************************************************************
+*
+* Synthesize nLOS sightlines of interleaved Q and U (Q, U of
+*  each channel next to each other) into interleaved Q(\phi),
+*  U(\phi) and P(\phi). The layouts are as above, with every
+*  element a pair of floats. No copies are made.
+*
+*************************************************************/
+int rmsSynthesizeInterleaved(struct rmsContext *ctx, const float *quImageArray,
+                             long nLOS, float *quPhi, float *pPhi) {
+    if(ctx == NULL || quImageArray == NULL || quPhi == NULL || pPhi == NULL ||
+       nLOS < 1 || nLOS > ctx->config.maxLOS)
+        return(RMS_ERR_ARGUMENT);
+    if(runEngine(&ctx->engine, quImageArray, nLOS, quPhi, pPhi))
+        return(RMS_ERR_COMPUTE);
+    return(RMS_SUCCESS);
+}
+
+/*************************************************************
+*
+* Make room for refining nLOS sightlines into nPoints samples
+*
+*************************************************************/
+static int growRefineBuffers(struct rmsContext *ctx, long nLOS, int maxPeaks,
+                             long nPoints) {
+    if(nLOS * maxPeaks > ctx->maxRefineLOS) {
+        free(ctx->nFound); free(ctx->peakIndex);
+        /* nFound needs only nLOS, but this keeps one capacity */
+        ctx->nFound    = malloc(nLOS * maxPeaks * sizeof(*ctx->nFound));
+        ctx->peakIndex = malloc(nLOS * maxPeaks * sizeof(*ctx->peakIndex));
+        ctx->maxRefineLOS = 0;
+        if(ctx->nFound == NULL || ctx->peakIndex == NULL) { return(RMS_ERR_NOMEM); }
+        ctx->maxRefineLOS = nLOS * maxPeaks;
+    }
+    if(nPoints > ctx->maxPoints) {
+        free(ctx->pointLOS); free(ctx->pointPhi);
+        free(ctx->pointQU);  free(ctx->pointP);
+        ctx->pointLOS = malloc(nPoints * sizeof(*ctx->pointLOS));
+        ctx->pointPhi = malloc(nPoints * sizeof(*ctx->pointPhi));
+        ctx->pointQU  = malloc(2 * nPoints * sizeof(*ctx->pointQU));
+        ctx->pointP   = malloc(nPoints * sizeof(*ctx->pointP));
+        ctx->maxPoints = 0;
+        if(ctx->pointLOS == NULL || ctx->pointPhi == NULL ||
+           ctx->pointQU == NULL || ctx->pointP == NULL) { return(RMS_ERR_NOMEM); }
+        ctx->maxPoints = nPoints;
+    }
+    return(RMS_SUCCESS);
+}
+
+/* Plane i of a sightline's P(phi), stride apart, is a local
+   maximum. The first plane of a plateau counts, and so do maxima
+   at either end of the axis. */
+static int isLocalMax(const float *pPhi, int i, int nPhi, long stride) {
+    if(i > 0 && pPhi[(i-1)*stride] >= pPhi[i*stride]) return(FALSE);
+    if(i < nPhi-1 && pPhi[(i+1)*stride] > pPhi[i*stride]) return(FALSE);
+    return(TRUE);
+}
+
+/*************************************************************
+*
+* Find up to maxPeaks local maxima of P(phi) of sightline los
+*  that reach the threshold. Their phi planes go to index,
+*  strongest first.
+*
+*************************************************************/
+static int findPeaks(const struct rmsContext *ctx, const float *pPhi, long los,
+                     long nLOS, const struct rmsRefineConfig *refine, int *index) {
+    int i, k, nFound = 0, nPhi = ctx->config.nPhi;
+    long stride = ctx->config.layout == LAYOUT_LOS_FIRST ? nLOS : 1;
+    float here;
+
+    if(ctx->config.layout == LAYOUT_LOS_FIRST) pPhi += los;
+    else pPhi += los * nPhi;
+    for(i=0; i<nPhi; i++) {
+        here = pPhi[i*stride];
+        /* Also skips NaN */
+        if(!(here >= refine->threshold)) continue;
+        if(!isLocalMax(pPhi, i, nPhi, stride)) continue;
+        for(k=nFound; k>0 && pPhi[index[k-1]*stride] < here; k--)
+            if(k < refine->maxPeaks) index[k] = index[k-1];
+        if(k < refine->maxPeaks) {
+            index[k] = i;
+            if(nFound < refine->maxPeaks) nFound++;
+        }
+    }
+    return(nFound);
+}
+
+/*************************************************************
+*
+* Refine the peaks of a frame synthesized by the last call to
+*  rmsSynthesizeInterleaved(). quImageArray must be that frame,
+*  unchanged, and pPhi its P(phi); the CUDA backend then reuses
+*  the copy of the frame already on the device. Only the window
+*  samples are computed, so the cost grows with the number of
+*  peaks rather than with the extent of the coarse phi axis.
+*  The refined phi of a peak is the vertex of a parabola through
+*  the best sample and its neighbours.
+*
+*************************************************************/
+int rmsRefine(struct rmsContext *ctx, const float *quImageArray, long nLOS,
+              const float *pPhi, const struct rmsRefineConfig *refine,
+              struct rmsPeaks *peaks) {
+    long los, n, plane, wPlane, nPoints;
+    int k, f, m, status, nFine;
+    float phi0, *window, a, b, c, denom, delta;
+
+    if(ctx == NULL || quImageArray == NULL || pPhi == NULL || refine == NULL ||
+       peaks == NULL || peaks->phi == NULL || peaks->p == NULL ||
+       nLOS < 1 || nLOS > ctx->config.maxLOS ||
+       refine->maxPeaks < 1 || refine->nFine < 1 || refine->nFine % 2 == 0 ||
+       refine->dPhiFine <= 0.)
+        return(RMS_ERR_ARGUMENT);
+    nFine = refine->nFine;
+    status = growRefineBuffers(ctx, nLOS, refine->maxPeaks,
+                               nLOS * refine->maxPeaks * nFine);
+    if(status != RMS_SUCCESS) { return(status); }
+
+    /* Lay out a window of samples around every peak */
+    nPoints = 0;
+    for(los=0; los<nLOS; los++) {
+        ctx->nFound[los] = findPeaks(ctx, pPhi, los, nLOS, refine,
+                                     ctx->peakIndex + los*refine->maxPeaks);
+        for(k=0; k<refine->maxPeaks; k++) {
+            plane = k*nLOS + los;
+            peaks->phi[plane] = peaks->p[plane] = NAN;
+            if(peaks->q != NULL) peaks->q[plane] = NAN;
+            if(peaks->u != NULL) peaks->u[plane] = NAN;
+            if(peaks->phi0 != NULL) peaks->phi0[plane] = NAN;
+            for(f=0; f<nFine; f++) {
+                wPlane = ((long)k*nFine + f)*nLOS + los;
+                if(peaks->windowQ != NULL) peaks->windowQ[wPlane] = NAN;
+                if(peaks->windowU != NULL) peaks->windowU[wPlane] = NAN;
+                if(peaks->windowP != NULL) peaks->windowP[wPlane] = NAN;
+            }
+        }
+        for(k=0; k<ctx->nFound[los]; k++) {
+            phi0 = ctx->phiAxis[ctx->peakIndex[los*refine->maxPeaks + k]] -
+                   (nFine-1)/2 * refine->dPhiFine;
+            if(peaks->phi0 != NULL) peaks->phi0[k*nLOS + los] = phi0;
+            for(f=0; f<nFine; f++) {
+                ctx->pointLOS[nPoints] = los;
+                ctx->pointPhi[nPoints] = phi0 + f*refine->dPhiFine;
+                nPoints++;
+            }
+        }
+    }
+    if(runEngineSparse(&ctx->engine, quImageArray, nLOS, nPoints, ctx->pointLOS,
+                       ctx->pointPhi, ctx->pointQU, ctx->pointP))
+        return(RMS_ERR_COMPUTE);
+
+    /* Pick the best sample of each window */
+    n = 0;
+    for(los=0; los<nLOS; los++) {
+        for(k=0; k<ctx->nFound[los]; k++, n+=nFine) {
+            plane = k*nLOS + los;
+            window = ctx->pointP + n;
+            for(m=0, f=1; f<nFine; f++)
+                if(window[f] > window[m]) m = f;
+            peaks->phi[plane] = ctx->pointPhi[n+m];
+            peaks->p[plane] = window[m];
+            if(m > 0 && m < nFine-1) {
+                a = window[m-1]; b = window[m]; c = window[m+1];
+                denom = a - 2.*b + c;
+                if(denom < 0.) {
+                    delta = 0.5*(a - c)/denom;
+                    peaks->phi[plane] += delta*refine->dPhiFine;
+                    peaks->p[plane] = b - 0.25*(a - c)*delta;
+                }
+            }
+            if(peaks->q != NULL) peaks->q[plane] = ctx->pointQU[2*(n+m)];
+            if(peaks->u != NULL) peaks->u[plane] = ctx->pointQU[2*(n+m)+1];
+            for(f=0; f<nFine; f++) {
+                wPlane = ((long)k*nFine + f)*nLOS + los;
+                if(peaks->windowQ != NULL) peaks->windowQ[wPlane] = ctx->pointQU[2*(n+f)];
+                if(peaks->windowU != NULL) peaks->windowU[wPlane] = ctx->pointQU[2*(n+f)+1];
+                if(peaks->windowP != NULL) peaks->windowP[wPlane] = window[f];
+            }
+        }
+    }
+    return(RMS_SUCCESS);
+}
+
+/*************************************************************
+*
+* Robust standard deviation of n values: 1.4826 times their
+*  median absolute deviation. values is reordered in place.
+*
+*************************************************************/
+static double robustSigma(double *values, int n) {
+    double median;
+    int i;
+
+    if(n < 2) return(NAN);
+    median = selectKth(values, n, n/2);
+    for(i=0; i<n; i++) values[i] = fabs(values[i] - median);
+    return(MAD_TO_SIGMA * selectKth(values, n, n/2));
+}
+
+/*************************************************************
+*
+* Tabulate the complex RMSF finely enough to be interpolated
+*  linearly at any offset within the phi axis. Each channel
+*  phasor is stepped along the table in double precision.
+*
+*************************************************************/
+static int makeRMSFTable(struct rmsContext *ctx) {
+    double step = ctx->config.dPhi/RMSF_OVERSAMPLE, sumW = 0.;
+    double re, im, tmp, stepCos, stepSin;
+    long t;
+    int c;
+
+    if(ctx->rmsfTable != NULL) { return(RMS_SUCCESS); }
+    ctx->nTable = (ctx->config.nPhi + 1L)*RMSF_OVERSAMPLE + 2;
+    ctx->rmsfTable = calloc(2*ctx->nTable, sizeof(*ctx->rmsfTable));
+    if(ctx->rmsfTable == NULL) { return(RMS_ERR_NOMEM); }
+    for(c=0; c<ctx->config.nChan; c++) {
+        sumW += ctx->weights[c];
+        if(ctx->weights[c] == 0.) continue;
+        stepCos = cos(2.*step*(ctx->lambda2[c] - ctx->lambda20));
+        stepSin = -sin(2.*step*(ctx->lambda2[c] - ctx->lambda20));
+        re = ctx->weights[c]; im = 0.;
+        for(t=0; t<ctx->nTable; t++) {
+            ctx->rmsfTable[2*t]   += re;
+            ctx->rmsfTable[2*t+1] += im;
+            tmp = re*stepCos - im*stepSin;
+            im  = re*stepSin + im*stepCos;
+            re  = tmp;
+        }
+    }
+    for(t=0; t<2*ctx->nTable; t++) ctx->rmsfTable[t] /= sumW;
+    return(RMS_SUCCESS);
+}
+
+/* Complex RMSF at offset from the table; R(-x) is the conjugate
+   of R(x). Zero beyond the table. */
+static void rmsfAt(const struct rmsContext *ctx, double offset,
+                   double *re, double *im) {
+    double x = fabs(offset)*RMSF_OVERSAMPLE/ctx->config.dPhi, f;
+    long t = (long)x;
+
+    if(t >= ctx->nTable - 1) { *re = *im = 0.; return; }
+    f = x - t;
+    *re = (1.-f)*ctx->rmsfTable[2*t]   + f*ctx->rmsfTable[2*t+2];
+    *im = (1.-f)*ctx->rmsfTable[2*t+1] + f*ctx->rmsfTable[2*t+3];
+    if(offset < 0.) *im = -*im;
+}
+
+/*************************************************************
+*
+* Least squares fit of the RMSF shifted to phi to planes i-1,
+*  i and i+1 (those within the axis) of qu, the complex spectrum
+*  of one sightline. Returns the squared misfit; the amplitude
+*  goes to ampRe, ampIm.
+*
+*************************************************************/
+static double peakMisfit(const struct rmsContext *ctx, int i, const double *qu,
+                         double phi, double *ampRe, double *ampIm) {
+    double rRe, rIm, numRe = 0., numIm = 0., den = 0., sum2 = 0.;
+    int j;
+
+    for(j=i-1; j<=i+1; j++) {
+        if(j < 0 || j >= ctx->config.nPhi) continue;
+        rmsfAt(ctx, ctx->phiAxis[j] - phi, &rRe, &rIm);
+        numRe += qu[2*j]*rRe + qu[2*j+1]*rIm;
+        numIm += qu[2*j+1]*rRe - qu[2*j]*rIm;
+        den   += rRe*rRe + rIm*rIm;
+        sum2  += qu[2*j]*qu[2*j] + qu[2*j+1]*qu[2*j+1];
+    }
+    *ampRe = den > 0. ? numRe/den : 0.;
+    *ampIm = den > 0. ? numIm/den : 0.;
+    return(den > 0. ? sum2 - (numRe*numRe + numIm*numIm)/den : sum2);
+}
+
+/*************************************************************
+*
+* Fit a Faraday-thin source to the peak of qu at plane i: golden
+*  section search within a plane either side for the phi whose
+*  RMSF best matches planes i-1 to i+1, and the complex
+*  amplitude there. source gets phi, Re and Im.
+*
+*************************************************************/
+static void fitPeak(const struct rmsContext *ctx, int i, const double *qu,
+                    double *source) {
+    const double g = 0.5*(sqrt(5.) - 1.);
+    double lo = ctx->phiAxis[i] - ctx->config.dPhi;
+    double hi = ctx->phiAxis[i] + ctx->config.dPhi;
+    double x1 = hi - g*(hi - lo), x2 = lo + g*(hi - lo), f1, f2;
+    int k;
+
+    f1 = peakMisfit(ctx, i, qu, x1, source+1, source+2);
+    f2 = peakMisfit(ctx, i, qu, x2, source+1, source+2);
+    for(k=0; k<PEAK_FIT_STEPS; k++) {
+        if(f1 < f2) {
+            hi = x2; x2 = x1; f2 = f1;
+            x1 = hi - g*(hi - lo);
+            f1 = peakMisfit(ctx, i, qu, x1, source+1, source+2);
+        }
+        else {
+            lo = x1; x1 = x2; f1 = f2;
+            x2 = lo + g*(hi - lo);
+            f2 = peakMisfit(ctx, i, qu, x2, source+1, source+2);
+        }
+    }
+    source[0] = 0.5*(lo + hi);
+    peakMisfit(ctx, i, qu, source[0], source+1, source+2);
+}
+
+/* Subtract sign times the RMSF of a source (phi, Re, Im) from
+   the complex spectrum of one sightline */
+static void subtractSource(const struct rmsContext *ctx, const double *source,
+                           double sign, double *resid) {
+    double rRe, rIm;
+    int i;
+
+    for(i=0; i<ctx->config.nPhi; i++) {
+        rmsfAt(ctx, ctx->phiAxis[i] - source[0], &rRe, &rIm);
+        resid[2*i]   -= sign*(source[1]*rRe - source[2]*rIm);
+        resid[2*i+1] -= sign*(source[1]*rIm + source[2]*rRe);
+    }
+}
+
+/* Plane of the highest point of a complex spectrum */
+static int highestPlane(const struct rmsContext *ctx, const double *qu,
+                        int lo, int hi) {
+    int i, peak;
+
+    if(lo < 0) { lo = 0; }
+    if(hi > ctx->config.nPhi-1) { hi = ctx->config.nPhi-1; }
+    for(peak=lo, i=lo+1; i<=hi; i++)
+        if(qu[2*i]*qu[2*i] + qu[2*i+1]*qu[2*i+1] >
+           qu[2*peak]*qu[2*peak] + qu[2*peak+1]*qu[2*peak+1])
+            peak = i;
+    return(peak);
+}
+
+/*************************************************************
+*
+* One step of cleaning the complex spectrum resid of a sightline
+*  that already had nSources sources (phi, Re, Im) subtracted:
+*  fit a Faraday-thin source to its highest point and subtract
+*  its RMSF. Sources whose sidelobes overlap pull each other's
+*  fits, so all of them are then fitted again in turn, each to
+*  the spectrum with only the others subtracted. Returns the
+*  new number of sources.
+*
+*************************************************************/
+static int cleanStep(const struct rmsContext *ctx, double *resid,
+                     double *sources, int nSources) {
+    int pass, k, plane;
+
+    plane = highestPlane(ctx, resid, 0, ctx->config.nPhi-1);
+    fitPeak(ctx, plane, resid, sources + 3*nSources);
+    subtractSource(ctx, sources + 3*nSources, 1., resid);
+    nSources++;
+    for(pass=0; pass<CLEAN_PASSES && nSources > 1; pass++) {
+        for(k=0; k<nSources; k++) {
+            subtractSource(ctx, sources + 3*k, -1., resid);
+            plane = (int)floor((sources[3*k] - ctx->phiAxis[0])/ctx->config.dPhi + 0.5);
+            plane = highestPlane(ctx, resid, plane-1, plane+1);
+            fitPeak(ctx, plane, resid, sources + 3*k);
+            subtractSource(ctx, sources + 3*k, 1., resid);
+        }
+    }
+    return(nSources);
+}
+
+/*************************************************************
+*
+* Per-sightline noise of a frame synthesized by the last call
+*  to rmsSynthesizeInterleaved(), while quImageArray, quPhi and
+*  pPhi are still at hand (and in cache). The sightline is
+*  cleaned first: its brightest peak is fitted as a Faraday-thin
+*  source and the RMSF shifted to its phi and scaled to its
+*  amplitude is subtracted, and so on for the next brightest
+*  while that reaches NOISE_CLEAN_SNR times the noise of what is
+*  left, up to NOISE_CLEAN_MAX sources, fitting those found
+*  earlier again each time (see cleanStep()). The sidelobes of
+*  bright sources are thus not taken for noise.
+*   - sigma and rms: MAD based and plain standard deviation of
+*     the cleaned Q(phi) and U(phi) taken together, leaving out
+*     phi within exclude of the sources. exclude <= 0 leaves
+*     out one RMSF FWHM, 2\sqrt{3}/\Delta\lambda^2, either side.
+*   - sigmaBand: the channel noise of Q and U, from the MAD of
+*     the differences of adjacent weighted channels once the
+*     same sources are subtracted from them, so that Faraday
+*     rotation does not add to the differences, carried over
+*     to phi as \sigma K \sqrt{\sum w^2}
+*   - snr: the amplitude of the brightest source over sigma
+*  Each is a caller buffer of nLOS values and may be NULL.
+*  Sightlines without enough samples get NaN. With a Stokes I
+*  frame set, the channel noise is that of Q/I and U/I.
+*
+*************************************************************/
+int rmsEstimateNoise(struct rmsContext *ctx, const float *quImageArray,
+                     long nLOS, const float *quPhi, const float *pPhi,
+                     double exclude, struct rmsNoise *noise) {
+    int nChan, nPhi, i, c, k, prev, n, peak, layout, status, nSources;
+    long los, idx, inStride, outStride, need;
+    double lambda2Min, lambda2Max, sum2, sumW, sumW2, scale;
+    double sigma, rms, *values, *resid, arg, re, im, prevRe = 0., prevIm = 0.;
+    double sources[3*NOISE_CLEAN_MAX];
+    const float *iIn;
+
+    if(ctx == NULL || quImageArray == NULL || quPhi == NULL || pPhi == NULL ||
+       noise == NULL || nLOS < 1 || nLOS > ctx->config.maxLOS)
+        return(RMS_ERR_ARGUMENT);
+    nChan = ctx->config.nChan;
+    nPhi  = ctx->config.nPhi;
+    layout = ctx->config.layout;
+    need = 2L * (nPhi > nChan ? nPhi : nChan) + 2L * nPhi;
+    if(need > ctx->maxNoise) {
+        free(ctx->noiseScratch);
+        ctx->noiseScratch = malloc(need * sizeof(*ctx->noiseScratch));
+        ctx->maxNoise = 0;
+        if(ctx->noiseScratch == NULL) { return(RMS_ERR_NOMEM); }
+        ctx->maxNoise = need;
+    }
+    resid  = ctx->noiseScratch;
+    values = ctx->noiseScratch + 2L*nPhi;
+    if((status = makeRMSFTable(ctx)) != RMS_SUCCESS) { return(status); }
+    if(exclude <= 0.) {
+        lambda2Min = lambda2Max = ctx->lambda2[0];
+        for(c=1; c<nChan; c++) {
+            if(ctx->lambda2[c] < lambda2Min) lambda2Min = ctx->lambda2[c];
+            if(ctx->lambda2[c] > lambda2Max) lambda2Max = ctx->lambda2[c];
+        }
+        exclude = lambda2Max > lambda2Min ?
+                  2.*sqrt(3.)/(lambda2Max - lambda2Min) : INFINITY;
+    }
+    sumW = sumW2 = 0.;
+    for(c=0; c<nChan; c++) {
+        sumW  += ctx->weights[c];
+        sumW2 += ctx->weights[c]*ctx->weights[c];
+    }
+    inStride  = layout == LAYOUT_LOS_FIRST ? nLOS : 1;
+    outStride = inStride;
+    iIn = ctx->engine.iFrame;
+
+    for(los=0; los<nLOS; los++) {
+        /* Clean, then take the noise away from the sources */
+        idx = layout == LAYOUT_LOS_FIRST ? los : los*nPhi;
+        for(i=0; i<nPhi; i++) {
+            resid[2*i]   = quPhi[2*(idx + i*outStride)];
+            resid[2*i+1] = quPhi[2*(idx + i*outStride) + 1];
+        }
+        sigma = rms = NAN;
+        nSources = 0;
+        while(nSources < NOISE_CLEAN_MAX) {
+            peak = highestPlane(ctx, resid, 0, nPhi-1);
+            if(nSources > 0 && !(hypot(resid[2*peak], resid[2*peak+1]) >=
+                                 NOISE_CLEAN_SNR*sigma))
+                break;
+            nSources = cleanStep(ctx, resid, sources, nSources);
+            sum2 = 0.;
+            for(n=0, i=0; i<nPhi; i++) {
+                for(k=0; k<nSources; k++)
+                    if(fabs(ctx->phiAxis[i] - sources[3*k]) <= exclude) break;
+                if(k < nSources) continue;
+                values[n++] = resid[2*i];
+                values[n++] = resid[2*i+1];
+                sum2 += values[n-2]*values[n-2] + values[n-1]*values[n-1];
+            }
+            rms = n < 2 ? NAN : sqrt(sum2/n);
+            sigma = robustSigma(values, n);
+        }
+        if(noise->rms != NULL) noise->rms[los] = rms;
+        if(noise->sigma != NULL) noise->sigma[los] = sigma;
+        if(noise->snr != NULL)
+            noise->snr[los] = sigma > 0. ? sqrt(sources[1]*sources[1] +
+                                                sources[2]*sources[2])/sigma : NAN;
+
+        /* Channel noise from differences of adjacent channels */
+        if(noise->sigmaBand == NULL) continue;
+        idx = layout == LAYOUT_LOS_FIRST ? los : los*nChan;
+        for(n=0, prev=-1, c=0; c<nChan; c++) {
+            if(ctx->weights[c] <= 0.) continue;
+            scale = 1.;
+            if(iIn != NULL)
+                scale = iIn[idx + c*inStride] > 0. ? 1./iIn[idx + c*inStride] : 0.;
+            if(scale == 0.) continue;
+            re = scale*quImageArray[2*(idx + c*inStride)];
+            im = scale*quImageArray[2*(idx + c*inStride) + 1];
+            for(k=0; k<nSources; k++) {
+                arg = 2.*sources[3*k]*(ctx->lambda2[c] - ctx->lambda20);
+                re -= sources[3*k+1]*cos(arg) - sources[3*k+2]*sin(arg);
+                im -= sources[3*k+1]*sin(arg) + sources[3*k+2]*cos(arg);
+            }
+            if(prev >= 0) {
+                values[n++] = re - prevRe;
+                values[n++] = im - prevIm;
+            }
+            prev = c; prevRe = re; prevIm = im;
+        }
+        noise->sigmaBand[los] = robustSigma(values, n)/sqrt(2.) * sqrt(sumW2)/sumW;
+    }
+    return(RMS_SUCCESS);
+}
+
+/*************************************************************
+*
+* List the components of a frame synthesized by the last call
+*  to rmsSynthesizeInterleaved() down to a limit: threshold
+*  and, if snr > 0, snr times the noise of the sightline in
+*  sigma (e.g. from rmsEstimateNoise()). Sightlines whose noise
+*  is NaN give none. Each sightline is cleaned: the highest
+*  point of Q(phi), U(phi) is fitted as a Faraday-thin source
+*  and its RMSF subtracted, as long as what is left reaches the
+*  limit, and for at most as many sources as P(phi) has local
+*  maxima that reach it; see cleanStep(). The sidelobes of a
+*  bright source are thus not listed as components of their
+*  own, nor do they pull the fits of fainter ones. The list holds
+*  the fitted sources; it belongs to the context and is valid
+*  until the next call, and it is in sightline order, and in
+*  phi order within a sightline.
+*
+*************************************************************/
+int rmsFindComponents(struct rmsContext *ctx, long nLOS, const float *quPhi,
+                      const float *pPhi, const float *sigma, float threshold,
+                      float snr, const struct rmsComponent **components,
+                      long *nComponents) {
+    struct rmsComponent *grown, tmp;
+    long los, idx, stride, n = 0, first, c;
+    int i, k, peak, nPhi, nMax, nSources, status;
+    double limit, *resid, *sources;
+
+    if(ctx == NULL || quPhi == NULL || pPhi == NULL || components == NULL ||
+       nComponents == NULL || (snr > 0. && sigma == NULL) ||
+       nLOS < 1 || nLOS > ctx->config.maxLOS)
+        return(RMS_ERR_ARGUMENT);
+    nPhi = ctx->config.nPhi;
+    if((status = makeRMSFTable(ctx)) != RMS_SUCCESS) { return(status); }
+    if(ctx->residual == NULL) {
+        ctx->residual = malloc(5L*nPhi*sizeof(*ctx->residual));
+        if(ctx->residual == NULL) { return(RMS_ERR_NOMEM); }
+    }
+    resid = ctx->residual;
+    sources = ctx->residual + 2L*nPhi;
+    stride = ctx->config.layout == LAYOUT_LOS_FIRST ? nLOS : 1;
+    for(los=0; los<nLOS; los++) {
+        limit = threshold;
+        if(snr > 0.) {
+            if(isnan(sigma[los])) continue;
+            if(snr*sigma[los] > limit) limit = snr*sigma[los];
+        }
+        idx = ctx->config.layout == LAYOUT_LOS_FIRST ? los : los*nPhi;
+        for(nMax=0, i=0; i<nPhi; i++) {
+            /* Also skips NaN */
+            if(pPhi[idx + i*stride] >= limit && isLocalMax(pPhi + idx, i, nPhi, stride))
+                nMax++;
+            resid[2*i]   = quPhi[2*(idx + i*stride)];
+            resid[2*i+1] = quPhi[2*(idx + i*stride) + 1];
+        }
+
+        first = n;
+        nSources = 0;
+        while(nSources < nMax) {
+            peak = highestPlane(ctx, resid, 0, nPhi-1);
+            if(!(hypot(resid[2*peak], resid[2*peak+1]) >= limit)) break;
+            nSources = cleanStep(ctx, resid, sources, nSources);
+        }
+        for(k=0; k<nSources; k++) {
+            if(n == ctx->maxComponents) {
+                grown = realloc(ctx->components, (2*n + nLOS)*sizeof(*grown));
+                if(grown == NULL) { return(RMS_ERR_NOMEM); }
+                ctx->components = grown;
+                ctx->maxComponents = 2*n + nLOS;
+            }
+            ctx->components[n].los = los;
+            ctx->components[n].phi = sources[3*k];
+            ctx->components[n].p = hypot(sources[3*k+1], sources[3*k+2]);
+            ctx->components[n].q = sources[3*k+1];
+            ctx->components[n].u = sources[3*k+2];
+            ctx->components[n].sigma = sigma == NULL ? NAN : sigma[los];
+            /* Keep the sightline in phi order */
+            for(c=n++; c>first && ctx->components[c-1].phi > ctx->components[c].phi; c--) {
+                tmp = ctx->components[c];
+                ctx->components[c] = ctx->components[c-1];
+                ctx->components[c-1] = tmp;
+            }
+        }
+    }
+    *components = ctx->components;
+    *nComponents = n;
+    return(RMS_SUCCESS);
+}
+
+/*************************************************************
+*
+* Fit a thin source or a Burn slab directly to the Q and U
+*  spectra of a frame synthesized by the last call to
+*  rmsSynthesizeInterleaved(). Each sightline starts from its
+*  strongest peak: the refined one in plane 0 of peaks if given
+*  (sightlines without a refined peak are not fitted), otherwise
+*  the maximum of pPhi. psi0 starts from the angle of Q(phi),
+*  U(phi) there and a slab from a width of 1/\lambda^2_{max}.
+*  The fits run on the backend of the context, which on CUDA
+*  reuses the frame already on the device.
+*
+*************************************************************/
+int rmsFitQU(struct rmsContext *ctx, const float *quImageArray, long nLOS,
+             const float *quPhi, const float *pPhi,
+             const struct rmsPeaks *peaks, const struct rmsFitConfig *fit,
+             struct rmsFitResult *result) {
+    long los, idx, stride;
+    int i, c, peak, nPhi;
+    double lambda2Max, q, u;
+    float *params;
+
+    if(ctx == NULL || quImageArray == NULL || quPhi == NULL || pPhi == NULL ||
+       fit == NULL || result == NULL || result->params == NULL ||
+       result->errors == NULL || result->chi2 == NULL ||
+       (fit->model != FIT_THIN && fit->model != FIT_THICK) ||
+       fit->maxIter < 1 || nLOS < 1 || nLOS > ctx->config.maxLOS)
+        return(RMS_ERR_ARGUMENT);
+    nPhi = ctx->config.nPhi;
+    stride = ctx->config.layout == LAYOUT_LOS_FIRST ? nLOS : 1;
+    lambda2Max = ctx->lambda2[0];
+    for(c=1; c<ctx->config.nChan; c++)
+        if(ctx->lambda2[c] > lambda2Max) lambda2Max = ctx->lambda2[c];
+
+    /* Starting points */
+    params = result->params;
+    for(los=0; los<nLOS; los++) {
+        idx = ctx->config.layout == LAYOUT_LOS_FIRST ? los : los*nPhi;
+        for(peak=0, i=1; i<nPhi; i++)
+            if(pPhi[idx + i*stride] > pPhi[idx + peak*stride]) peak = i;
+        q = quPhi[2*(idx + peak*stride)];
+        u = quPhi[2*(idx + peak*stride) + 1];
+        params[los]        = pPhi[idx + peak*stride];
+        params[2*nLOS+los] = ctx->phiAxis[peak];
+        if(peaks != NULL) {
+            params[los]        = peaks->p[los];
+            params[2*nLOS+los] = peaks->phi[los];
+            if(peaks->q != NULL && peaks->u != NULL) {
+                q = peaks->q[los]; u = peaks->u[los];
+            }
+        }
+        params[nLOS+los] = 0.5*atan2(u, q);
+        if(fit->model == FIT_THICK) params[3*nLOS+los] = 1./lambda2Max;
+    }
+    if(runEngineFit(&ctx->engine, quImageArray, nLOS, fit->model, fit->maxIter,
+                    result->params, result->errors, result->chi2))
+        return(RMS_ERR_COMPUTE);
+    return(RMS_SUCCESS);
+}
+
+/*************************************************************
+*
+* Copy the phi axis or the RMSF into caller buffers of nPhi
+*  elements
+*
+*************************************************************/
+int rmsGetPhiAxis(const struct rmsContext *ctx, float *phiAxis) {
+    if(ctx == NULL || phiAxis == NULL) { return(RMS_ERR_ARGUMENT); }
+    memcpy(phiAxis, ctx->phiAxis, ctx->config.nPhi*sizeof(*phiAxis));
+    return(RMS_SUCCESS);
+}
+
+int rmsGetRMSF(const struct rmsContext *ctx, float *rmsfReal,
+               float *rmsfImag, float *rmsf) {
+    if(ctx == NULL || rmsfReal == NULL || rmsfImag == NULL || rmsf == NULL)
+        return(RMS_ERR_ARGUMENT);
+    memcpy(rmsfReal, ctx->rmsfReal, ctx->config.nPhi*sizeof(*rmsfReal));
+    memcpy(rmsfImag, ctx->rmsfImag, ctx->config.nPhi*sizeof(*rmsfImag));
+    memcpy(rmsf,     ctx->rmsf,     ctx->config.nPhi*sizeof(*rmsf));
+    return(RMS_SUCCESS);
+}
+
+double rmsGetLambda20(const struct rmsContext *ctx) {
+    return(ctx == NULL ? 0. : ctx->lambda20);
+}
+
+/*************************************************************
+*
+* Accumulate stage times of later rmsSynthesize() calls into t.
+*  NULL switches timing off.
+*
+*************************************************************/
+void rmsSetTimer(struct rmsContext *ctx, struct timeInfoList *t) {
+    if(ctx != NULL) ctx->engine.t = t;
+}
+
+/*************************************************************
+*
+* Synthesize fractional polarization: later rmsSynthesize*()
+*  and rmsRefine() calls divide Q and U by iImageArray, a frame
+*  of Stokes I laid out as the Q and U frames but with one float
+*  per element. Channels where I is not positive contribute nothing.
+*  The frame is read in place, so set it again whenever its
+*  contents change. NULL switches the division off. Ignored
+*  unless the context was created with config.stokesI.
+*
+*************************************************************/
+void rmsSetStokesI(struct rmsContext *ctx, const float *iImageArray) {
+    if(ctx != NULL && ctx->engineReady && ctx->config.stokesI)
+        setEngineStokesI(&ctx->engine, iImageArray);
+}
+
+/*************************************************************
+*
+* Release a context. Safe to call with NULL.
+*
+*************************************************************/
+void rmsDestroy(struct rmsContext *ctx) {
+    if(ctx == NULL) { return; }
+    if(ctx->engineReady) { freeEngine(&ctx->engine); }
+    free(ctx->nFound); free(ctx->peakIndex);
+    free(ctx->pointLOS); free(ctx->pointPhi);
+    free(ctx->pointQU); free(ctx->pointP);
+    free(ctx->noiseScratch); free(ctx->components);
+    free(ctx->rmsfTable);
+    free(ctx->residual);
+    free(ctx->lambda2); free(ctx->weights);
+    free(ctx->phiAxis);
+    free(ctx->rmsfReal); free(ctx->rmsfImag); free(ctx->rmsf);
+    free(ctx);
+}
+
+const char *rmsStatusString(int status) {
+    if(status < 0 || status >= RMS_N_STATUS) { return("unknown status"); }
+    return(statusStrings[status]);
+}
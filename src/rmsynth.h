@@ -0,0 +1,169 @@
+/******************************************************************************
+rmsynth.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef RMSYNTH_H
+#define RMSYNTH_H
+
+#include "constants.h"
+
+/* librmsynth runs RM synthesis on spectra held by the caller. All
+   buffers are owned by the caller and are used in place; errors are
+   returned as one of the status codes below and never terminate the
+   calling process. The backends work on interleaved Q and U (a C99
+   float complex or NumPy complex64 array); rmsSynthesize() also
+   accepts separate arrays at the cost of a copy. With
+   rmsSetStokesI() the backends synthesize Q/I and U/I, dividing
+   as they load the spectra; the context has to be created with
+   stokesI set so that the device can hold the I frame. */
+
+/* Status codes */
+#define RMS_SUCCESS       0
+#define RMS_ERR_ARGUMENT  1  /* Invalid configuration or arguments */
+#define RMS_ERR_NOMEM     2  /* Host or device allocation failed */
+#define RMS_ERR_BACKEND   3  /* Backend or kernel variant unavailable */
+#define RMS_ERR_COMPUTE   4  /* Backend failed while synthesizing */
+#define RMS_N_STATUS      5
+
+/* Everything needed to set up a context. Fill in with
+   rmsDefaultConfig() and override what is needed. lambda2 and
+   weights are copied by rmsCreate(). */
+struct rmsConfig {
+    int nChan;
+    const double *lambda2;   /* nChan values in m^2 */
+    const double *weights;   /* nChan values, NULL for uniform */
+    int lambda20Mode;        /* LAMBDA20_MEDIAN, _WEIGHTED or _USER */
+    double lambda20;         /* Used with LAMBDA20_USER */
+
+    int nPhi;
+    double phiMin, dPhi;     /* rad/m/m */
+
+    int backend;             /* BACKEND_CPU or BACKEND_CUDA */
+    int variant;             /* KERNEL_DIRECT or KERNEL_RECURRENCE */
+    int layout;              /* LAYOUT_FREQ_FIRST or LAYOUT_LOS_FIRST */
+    long maxLOS;             /* Largest nLOS passed to rmsSynthesize() */
+    int stokesI;             /* TRUE to allow rmsSetStokesI() */
+    int nThreads;            /* CPU threads, 0 for all cores */
+    int deviceId;            /* CUDA device */
+};
+
+/* Peak refinement by rmsRefine(): up to maxPeaks local maxima of
+   the coarse P(phi) of each sightline that reach threshold are
+   sampled again in windows of nFine points dPhiFine apart,
+   centred on the coarse peak; nFine has to be odd. */
+struct rmsRefineConfig {
+    int maxPeaks;
+    float threshold;         /* Smallest coarse P(phi) refined */
+    int nFine;               /* Samples per window, odd */
+    double dPhiFine;         /* rad/m/m */
+};
+
+/* Results of rmsRefine(), in caller buffers of maxPeaks planes of
+   nLOS values (plane k holds the k-th strongest peak of every
+   sightline) or, for the windows, maxPeaks*nFine planes. Slots
+   without a peak are NaN. phi and p are required; the others may
+   be NULL. */
+struct rmsPeaks {
+    float *phi;              /* Refined Faraday depth of the peak */
+    float *p;                /* Interpolated P(phi) at phi */
+    float *q, *u;            /* Q(phi), U(phi) of the best sample */
+    float *phi0;             /* Faraday depth of the first window sample */
+    float *windowQ, *windowU, *windowP;
+};
+
+/* Per-sightline noise from rmsEstimateNoise(), in caller buffers
+   of nLOS values. Any of them may be NULL. */
+struct rmsNoise {
+    float *sigma;            /* 1.4826 MAD of Q(phi), U(phi) off the
+                                sources, with their RMSFs subtracted */
+    float *rms;              /* Their standard deviation */
+    float *sigmaBand;        /* Channel noise carried over to phi */
+    float *snr;              /* Amplitude of the brightest over sigma */
+};
+
+/* A Faraday-thin source cleaned by rmsFindComponents() */
+struct rmsComponent {
+    long los;                /* Sightline within the frame */
+    float phi, p, q, u;      /* Fitted Faraday depth (between the planes)
+                                and amplitude: |P|, Q and U at lambda20 */
+    float sigma;             /* Noise of the sightline, NaN if not given */
+};
+
+/* Model fitting by rmsFitQU(): model is FIT_THIN (p0, psi0, phi)
+   or FIT_THICK, a Burn slab that adds its width in phi. */
+struct rmsFitConfig {
+    int model;
+    int maxIter;             /* Levenberg-Marquardt iterations */
+};
+
+/* Results of rmsFitQU(), in caller buffers: params and errors hold
+   one plane of nLOS values per parameter (p0, psi0 in rad at
+   lambda^2_0, phi and the slab width in rad/m/m), chi2 the reduced
+   chi^2 of each sightline against its channel noise, measured from
+   the residuals of neighbouring channels with the weights taken as
+   relative inverse variances. Sightlines not fitted are NaN. */
+struct rmsFitResult {
+    float *params, *errors, *chi2;
+};
+
+/* Opaque handle */
+struct rmsContext;
+struct timeInfoList;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void rmsDefaultConfig(struct rmsConfig *config);
+int rmsCreate(const struct rmsConfig *config, struct rmsContext **ctx);
+int rmsSynthesize(struct rmsContext *ctx, const float *qImageArray,
+                  const float *uImageArray, long nLOS,
+                  float *qPhi, float *uPhi, float *pPhi);
+int rmsSynthesizeInterleaved(struct rmsContext *ctx, const float *quImageArray,
+                             long nLOS, float *quPhi, float *pPhi);
+int rmsRefine(struct rmsContext *ctx, const float *quImageArray, long nLOS,
+              const float *pPhi, const struct rmsRefineConfig *refine,
+              struct rmsPeaks *peaks);
+int rmsEstimateNoise(struct rmsContext *ctx, const float *quImageArray,
+                     long nLOS, const float *quPhi, const float *pPhi,
+                     double exclude, struct rmsNoise *noise);
+int rmsFindComponents(struct rmsContext *ctx, long nLOS, const float *quPhi,
+                      const float *pPhi, const float *sigma, float threshold,
+                      float snr, const struct rmsComponent **components,
+                      long *nComponents);
+int rmsFitQU(struct rmsContext *ctx, const float *quImageArray, long nLOS,
+             const float *quPhi, const float *pPhi,
+             const struct rmsPeaks *peaks, const struct rmsFitConfig *fit,
+             struct rmsFitResult *result);
+int rmsGetPhiAxis(const struct rmsContext *ctx, float *phiAxis);
+int rmsGetRMSF(const struct rmsContext *ctx, float *rmsfReal,
+               float *rmsfImag, float *rmsf);
+double rmsGetLambda20(const struct rmsContext *ctx);
+void rmsSetTimer(struct rmsContext *ctx, struct timeInfoList *t);
+void rmsSetStokesI(struct rmsContext *ctx, const float *iImageArray);
+void rmsDestroy(struct rmsContext *ctx);
+const char *rmsStatusString(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -22,16 +22,17 @@ sarrvesh.ss@gmail.com
 ******************************************************************************/
 
 #include<stdio.h>
-#include<time.h>
+#include<stdlib.h>
 #include<string.h>
 
 #include "structures.h"
 #include "constants.h"
 #include "version.h"
+#include "timing.h"
 #include "devices.h"
-#include "fileaccess.h"
 #include "inputparser.h"
-#include "rmsf.h"
+#include "ranks.h"
+#include "job.h"
 
 /*************************************************************
 *
@@ -40,28 +41,20 @@ sarrvesh.ss@gmail.com
 *************************************************************/
 int main(int argc, char *argv[]) {
     /* Host Variable declaration */
-    char *parsetFileName = argv[1];
+    char *parsetFileName;
     struct optionsList inOptions;
-    struct IOFileDescriptors descriptors;
-    struct parameters params;
-    struct fits_header_parameters header_parameters;
-    struct DataArrays data_array;
-
-    int fitsStatus;
     int nDevices;
-    int selectedDevice;
+    int selectedDevice = 0;
     struct deviceInfoList *gpuList;
-    struct deviceInfoList selectedDeviceInfo;
     struct timeInfoList t;
-    unsigned int hours, mins, secs;
+    int status;
 
-    /* Initialize the clock variables */
-    t.cpuTime = 0; t.msRead = 0;
-    t.msWrite = 0; t.msProc = 0;
-    t.msX = 0;
+    /* Start MPI if this is an MPI build */
+    if(initRanks(&argc, &argv)) { return(FAILURE); }
+    parsetFileName = argv[1];
 
-    /* Start the clock */
-    t.startTime = clock();
+    /* Initialize the timers and start the clock */
+    initTimer(&t);
 
     printf("\n");
     printf("RM Synthesis v%s\n", VERSION_STR);
@@ -71,11 +64,13 @@ int main(int argc, char *argv[]) {
     if(argc!=NUM_INPUTS) {
         printf("ERROR: Invalid command line input. Terminating Execution!\n");
         printf("Usage: %s <parset filename>\n\n", argv[0]);
+        finalizeRanks();
         return(FAILURE);
     }
     if(strcmp(parsetFileName, "-h") == 0) {
         /* Print help and exit */
         printf("Usage: %s <parset filename>\n\n", argv[0]);
+        finalizeRanks();
         return(SUCCESS);
     }
 
@@ -83,148 +78,26 @@ int main(int argc, char *argv[]) {
     printf("INFO: Parsing input file %s\n", parsetFileName);
     inOptions = parseInput(parsetFileName);
 
-    params.nPhi = inOptions.nPhi;
-    params.dPhi = inOptions.dPhi;
-    params.phiMin = inOptions.phiMin;
-
-    /* Check input files */
-    printf("INFO: Checking input files\n");
-    checkInputFiles(&inOptions, &descriptors, &params);
-
     /* Retreive information about all connected GPU devices */
-    /* Find the best device to use */
-    gpuList = getDeviceInformation(&nDevices);
-    selectedDevice = getBestDevice(gpuList, nDevices);
-    printf("INFO: Selected device %d\n", selectedDevice);
-    cudaSetDevice(selectedDevice);
-    checkCudaError();
-    /* Copy the device info for the best device */
-    selectedDeviceInfo = copySelectedDeviceInfo(gpuList, selectedDevice);
-    free(gpuList);
-
-    /* Gather information from input fits header and setup output images */
-    t.startRead = clock();
-    switch(inOptions.fileFormat) {
-       case FITS:
-
-          fitsStatus = getFitsHeader(&inOptions, &header_parameters, &descriptors);
-
-          checkFitsError(fitsStatus);
-
-          makeOutputFitsImages(&inOptions, &descriptors, &header_parameters, &params);
-          break;
-       case HDF5:
-
-          getHDF5Header(&inOptions, &header_parameters, &params, &descriptors);
-
-          makeOutputHDF5Images(&inOptions, &descriptors, &params, &header);
-          break;
-       default:
-          // Control should never reach this point.
-          printf("ERROR: Encountered an unknown error.\n");
-          printf("ERROR: Contact Sarrvesh if you see this.");
-          exit(FAILURE);
-          break;
-    }
-    t.stopRead = clock();
-    t.msRead += ((unsigned int)(t.stopRead - t.startRead))/CLOCKS_PER_SEC;
-
-    /* Print some useful information */
-    t.startWrite = clock();
-    printOptions(inOptions, params);
-    t.stopWrite = clock();
-    t.msWrite += ((unsigned int)(t.stopWrite - t.startWrite))/CLOCKS_PER_SEC;
-
-    /* Read frequency list */
-    t.startRead = clock();
-    if(getFreqList(&descriptors, &params, &data_arrays)) { return(FAILURE); }
-    t.stopRead = clock();
-    t.msRead += ((unsigned int)(t.stopRead - t.startRead))/CLOCKS_PER_SEC;
-
-    /* Find median lambda20 */
-    t.startProc = clock();
-    getMedianLambda20(&data_arrays);
-
-    /* Generate RMSF */
-    printf("INFO: Computing RMSF\n");
-    if(generateRMSF(&inOptions, &data_arrays,&params)) {
-        printf("Error: Mem alloc failed while generating RMSF\n");
-        return(FAILURE);
-    }
-    t.stopProc = clock();
-    t.msProc += ((unsigned int)(t.stopProc - t.startProc))/CLOCKS_PER_SEC;
-
-    /* Write RMSF to disk */
-    t.startWrite = clock();
-    if(writeRMSF(inOptions, data_arrays)) {
-        printf("Error: Unable to write RMSF to disk\n\n");
-        return(FAILURE);
-    }
-    /* Plot RMSF */
-    #ifdef GNUPLOT_ENABLE
-    if(inOptions.plotRMSF == TRUE) {
-        printf("INFO: Plotting RMSF with gnuplot\n");
-        if(plotRMSF(inOptions)) {
-            printf("Error: Unable to plot RMSF\n\n");
-            return(FAILURE);
-        }
-    }
-    #endif
-    t.stopWrite = clock();
-    t.msWrite += ((unsigned int)(t.stopWrite - t.startWrite))/CLOCKS_PER_SEC;
-
-    /* Start RM Synthesis */
-    printf("INFO: Starting RM Synthesis\n");
-
-    doRMSynthesis(&inOptions, &params, selectedDeviceInfo, &t);
-
-    /* Free up all allocated memory */
-    free(data_arrays.rmsf);
-    free(data_arrays.rmsfReal);
-    free(data_arrays.rmsfImag);
-    free(data_arrays.phiAxis);
-    free(data_arrays.freqList);
-    free(data_arrays.lambda2);
-    free(inOptions.qCubeName);
-    free(inOptions.uCubeName);
-    free(inOptions.freqFileName);
-    free(inOptions.outPrefix);
-
-    /* Close all open files */
-    switch(inOptions.fileFormat) {
-       case FITS:
-          fits_close_file(descriptors.qFile, &fitsStatus);
-          fits_close_file(descriptors.uFile, &fitsStatus);
-          fits_close_file(descriptors.qDirty, &fitsStatus);
-          fits_close_file(descriptors.uDirty, &fitsStatus);
-          fits_close_file(descriptors.pDirty, &fitsStatus);
-          checkFitsError(fitsStatus);
-          break;
-       case HDF5:
-          H5Fclose(descriptors.qFileh5);
-          H5Fclose(descriptors.uFileh5);
-          break;
-       default:
-          // Control should never reach this point
-          printf("ERROR: Encountered an unknown error.\n");
-          printf("ERROR: Contact Sarrvesh if you see this.");
-          exit(FAILURE);
+    /* Find the best device to use. Ranks sharing a node take
+       turns over its devices instead. */
+    if(inOptions.backend == BACKEND_CUDA) {
+        gpuList = getDeviceInformation(&nDevices);
+        if(getRanks()->size > 1)
+            selectedDevice = getRanks()->localRank % nDevices;
+        else
+            selectedDevice = getBestDevice(gpuList, nDevices);
+        printf("INFO: Selected device %d\n", selectedDevice);
+        selectDevice(selectedDevice);
+        free(gpuList);
     }
 
-    /* Estimate the execution time */
-    t.endTime = clock();
-    t.cpuTime = (unsigned int)(t.endTime - t.startTime)/CLOCKS_PER_SEC;
-    hours   = (unsigned int)t.cpuTime/SEC_PER_HOUR;
-    mins    = (unsigned int)(t.cpuTime%SEC_PER_HOUR)/SEC_PER_MIN;
-    secs    = (unsigned int)(t.cpuTime%SEC_PER_HOUR)%SEC_PER_MIN;
-    /* Write timing information to stdout */
-    printf("INFO: Timing Information\n");
-    printf("   Input read time: %0.3f s\n", t.msRead);
-    printf("   Compute time: %0.3f s\n", t.msProc);
-    printf("   Output write time: %0.3f s\n", t.msWrite);
-    printf("   D2H Transfer time: %0.3f s\n", t.msX);
-    printf("INFO: Total execution time: %d:%d:%d\n", hours, mins, secs);
+    /* Run the job, or every field of a batch parset. rmsynthd
+       runs the same code for every request */
+    status = runBatch(&inOptions, selectedDevice, NULL, &t);
+    if(inOptions.backend == BACKEND_CUDA) { resetDevices(); }
+    freeOptions(&inOptions);
+    finalizeRanks();
     printf("\n");
-    cudaDeviceReset();
-    return(SUCCESS);
+    return(status);
 }
@@ -28,12 +28,47 @@ sarrvesh.ss@gmail.com
 extern "C"
 #endif
 
+/* One Q/U cube pair of a batch parset */
+struct batchField {
+    char *qCubeName;
+    char *uCubeName;
+    char *outPrefix;
+    char *iCubeName, *iModelName;  /* Optional Stokes I */
+};
+
+/* One of several phi axes of a parset. Its cubes, RMSF and
+   products are named outPrefix followed by outSuffix */
+struct phiGrid {
+    double phiMin, dPhi;
+    int nPhi;
+    char *outSuffix;
+};
+
+/* A range of channels synthesized on its own. Its outputs are
+   named outPrefix followed by outSuffix */
+struct subband {
+    int firstChan, nChan;
+    char *outSuffix;
+};
+
 /* Structure to store the input options */
 struct optionsList {
     char *qCubeName;
     char *uCubeName;
     char *freqFileName;
+    char *freqDataset;
+    char *weightFileName;
     char *outPrefix;
+    int freqFormat;
+
+    /* Optional Stokes I to divide Q and U by: a cube, or a model
+       with I at iModelFreq (Hz) and the spectral index */
+    int stokesI;
+    char *iCubeName, *iModelName;
+    double iModelFreq;
+
+    int lambda20Mode;
+    double lambda20;
 
     int plotRMSF;
     double phiMin, dPhi;
@@ -41,16 +76,79 @@ struct optionsList {
 
     int nGPU;
     int fileFormat;
+
+    /* INPUT_CUBE, or INPUT_TABLE with the spectra in the dataset
+       or column qColumn of qCubeName, and uColumn of uCubeName */
+    int inputType;
+    char *qColumn, *uColumn;
+
+    int backend, variant;
+    int nThreads;
+
+    int outputOrder;
+    int tileMemory;
+
+    /* Threads reading chunks of the FITS input cubes concurrently */
+    int readThreads;
+
+    /* Memory budgets in MB, 0 for automatic. dryRun only prints
+       the memory plan */
+    int hostMemory, deviceMemory;
+    int dryRun;
+
+    /* Peak refinement: up to refinePeaks peaks of P(phi) per
+       sightline that reach refineThreshold are sampled again
+       refineDPhi apart over +/- refineWidth, i.e. refineSamples
+       points. refinePeaks = 0 switches it off */
+    int refinePeaks, refineSamples;
+    double refineThreshold, refineDPhi, refineWidth;
+
+    /* Noise and S/N maps computed from every synthesized frame.
+       noiseExclude is the phi half-width around the peak left
+       out of the noise, 0 for one RMSF FWHM */
+    int noiseMaps;
+    double noiseExclude;
+
+    /* Component catalog: local maxima of P(phi) that reach both
+       catalogThreshold and catalogSNR times the sightline's noise.
+       outputMode selects whether the cubes are written as well */
+    int outputMode;
+    double catalogThreshold, catalogSNR;
+
+    /* Model fitted to Q and U of every sightline, seeded from the
+       strongest peak, or FIT_NONE */
+    int fitModel, fitIterations;
+
+    /* Phi axes synthesized from the same read of the cubes.
+       phiMin, dPhi and nPhi above are those of the first grid;
+       nGrids is 0 for a single axis */
+    int nGrids;
+    struct phiGrid *grids;
+
+    /* Sub-bands synthesized from the same read of the cubes:
+       nBands listed ranges, or windows of bandWidth channels
+       every bandStep channels. Each is combined with every phi
+       grid. firstChan and nChanBand are the channels of one
+       output set; nChanBand is 0 for all channels */
+    int nBands;
+    struct subband *bands;
+    int bandWidth, bandStep;
+    int firstChan, nChanBand;
+
+    /* Fields of a batch parset. Each field replaces the cube names
+       and the output prefix above; nFields is 0 for a single job */
+    int nFields;
+    struct batchField *fields;
 };
 
 struct fits_header_parameters {
     // These variables are needed for the fits
     int maskAxisLen1, maskAxisLen2;
-    float crval1, crval2, crval3;
-    float crpix1, crpix2, crpix3;
-    float cdelt1, cdelt2, cdelt3;
+    double crval1, crval2, crval3;
+    double crpix1, crpix2, crpix3;
+    double cdelt1, cdelt2, cdelt3;
     char ctype1[CTYPE_LEN], ctype2[CTYPE_LEN], ctype3[CTYPE_LEN];
-}
+};
 
 struct parameters {
     double phiMin, dPhi;
@@ -59,64 +157,63 @@ struct parameters {
     int qAxisNum, uAxisNum;
     int qAxisLen1, qAxisLen2, qAxisLen3;
     int uAxisLen1, uAxisLen2, uAxisLen3;
-    float lambda20;
     float K;
-}
+
+    /* Sightlines and DEC rows per tile of a tile-compressed FITS
+       cube, or 0 */
+    int tileLOS, tileFrames;
+};
 
 struct IOFileDescriptors {
-    fitsfile *qFile, *uFile;
+    fitsfile *qFile, *uFile, *iFile;
     fitsfile *qDirty, *uDirty, *pDirty;
 
     FILE *freq;
 
-    hid_t qFileh5, uFileh5;
+    int qColNum, uColNum;       /* Columns of a FITS table input */
+
+    /* Parallel reads of uncompressed FITS cubes: nReaders file
+       descriptors per cube and the byte offset of its data unit */
+    int nReaders;
+    int *qReadFds, *uReadFds;
+    long long qDataStart, uDataStart;
+    /* Tile-compressed cubes are decoded by cfitsio on the reader
+       threads instead, through handles opened on their descriptors.
+       Each reader's share is a multiple of readUnit pixels */
+    fitsfile **qTileFiles, **uTileFiles;
+    long readUnit;
+    /* Reader threads 1..nReaders-1, kept for the whole run; the
+       thread reading a chunk is reader 0 */
+    struct fitsReaderPool *readerPool;
+    /* Tiles that span several DEC rows are decoded a band of rows
+       at a time and held in band; see readFitsBand() */
+    float *band;
+    int bandFirst, bandRows, tileFrames, frameStart, frameStop;
+    long bandLOS, bandChan, bandShare;
+
+    hid_t qFileh5, uFileh5, iFileh5;
     hid_t qDirtyH5, uDirtyH5, pDirtyH5;
 
-    hid_t qDataspace, uDataspace;
+    hid_t qDataspace, uDataspace, iDataspace;
     hid_t qOutDataspace, uOutDataspace, pOutDataspace;
-    hid_t qDataset, uDataset;
+    hid_t qDataset, uDataset, iDataset;
     hid_t qOutDataset, uOutDataset, pOutDataset;
-    hid_t qMemspace, uMemspace;
+    hid_t qMemspace, uMemspace, iMemspace;
     hid_t qOutMemspace, uOutMemspace, pOutMemspace;
 
 };
 
-/* Structure to store all information related to RM Synthesis */
-struct parList {
-    fitsfile *qFile, *uFile;
-    fitsfile *qDirty, *uDirty, *pDirty;
-
-    hid_t qFileh5, uFileh5;
-    hid_t qDirtyH5, uDirtyH5, pDirtyH5;
-
-    FILE *freq;
-
-    int qAxisNum, uAxisNum;
-    int qAxisLen1, qAxisLen2, qAxisLen3;
-    int uAxisLen1, uAxisLen2, uAxisLen3;
-    int maskAxisLen1, maskAxisLen2;
-    float crval1, crval2, crval3;
-    float crpix1, crpix2, crpix3;
-    float cdelt1, cdelt2, cdelt3;
-    char ctype1[CTYPE_LEN], ctype2[CTYPE_LEN], ctype3[CTYPE_LEN];
-
-    float *freqList;
-    float *lambda2;
-    float lambda20;
-
-    float *phiAxis;
-    float *rmsf, *rmsfReal, *rmsfImag;
-    float K;
-};
-
 struct DataArrays {
-    float *freqList;
+    double *freqList;
     int nFreq;
-    float *lambda2;
+    double *lambda2;
+    double *weights;
+    double sumWeights;
+    double lambda20;
     float *phiAxis;
     int nPhi;
     float *rmsf, *rmsfReal, *rmsfImag;
-}
+};
 
 /* Structure to store useful GPU device information */
 struct deviceInfoList {
@@ -128,17 +225,3 @@ struct deviceInfoList {
     int warpSize;
     int nSM;
 };
-
-/* Structure to store timing information */
-struct timeInfoList {
-   clock_t startRead, stopRead;  /* Read time */
-   float msRead;
-   clock_t startWrite, stopWrite;/* Write time */
-   float msWrite;
-   clock_t startProc, stopProc;  /* Processing time */
-   float msProc;
-   clock_t startX, stopX;        /* Transfer time */
-   float msX;
-   clock_t startTime, endTime;   /* Total time */
-   unsigned int cpuTime;
-};
@@ -0,0 +1,126 @@
+/******************************************************************************
+synthcube.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+
+#include "constants.h"
+#include "synthcube.h"
+
+/*************************************************************
+*
+* Small deterministic random number generator (xorshift32) so
+*  that a given seed always produces the same cube
+*
+*************************************************************/
+static double uniformRandom(unsigned int *state) {
+    unsigned int x = *state;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    *state = x;
+    return((x + 0.5)/4294967296.);
+}
+
+static double gaussianRandom(unsigned int *state) {
+    double u1 = uniformRandom(state), u2 = uniformRandom(state);
+    return(sqrt(-2.*log(u1))*cos(2.*M_PI*u2));
+}
+
+/*************************************************************
+*
+* Generate a noisy Q/U cube with Faraday-thin sources,
+*  P = p0 exp(2i(chi0 + phi0 lambda^2)), and Faraday-thick
+*  Burn slabs, P = p0 exp(2i(chi0 + phiC lambda^2)) sinc(D lambda^2)
+*
+*************************************************************/
+int makeSynthCube(struct synthCubeParams *params, struct synthCube *cube) {
+    unsigned int state = params->seed ? params->seed : 1;
+    long nElements, los, idx;
+    int i, s, nSources;
+    double p0, chi0, phi0, width, arg, amp, x;
+
+    cube->params = *params;
+    nElements = (long)params->nRA*params->nDec*params->nChan;
+    cube->freqList = calloc(params->nChan, sizeof(*cube->freqList));
+    cube->lambda2  = calloc(params->nChan, sizeof(*cube->lambda2));
+    cube->qCube    = calloc(nElements, sizeof(*cube->qCube));
+    cube->uCube    = calloc(nElements, sizeof(*cube->uCube));
+    if(cube->freqList == NULL || cube->lambda2 == NULL ||
+       cube->qCube == NULL || cube->uCube == NULL) {
+        printf("Error: Mem alloc failed while generating the synthetic cube\n");
+        freeSynthCube(cube);
+        return(FAILURE);
+    }
+
+    for(i=0; i<params->nChan; i++) {
+        cube->freqList[i] = params->freqMin + i*(params->nChan > 1 ?
+                  (params->freqMax - params->freqMin)/(params->nChan-1) : 0.);
+        cube->lambda2[i] = (LIGHTSPEED/cube->freqList[i])*(LIGHTSPEED/cube->freqList[i]);
+    }
+
+    /* Noise everywhere */
+    if(params->noise > 0.) {
+        for(idx=0; idx<nElements; idx++) {
+            cube->qCube[idx] = params->noise*gaussianRandom(&state);
+            cube->uCube[idx] = params->noise*gaussianRandom(&state);
+        }
+    }
+
+    /* Sources on random sightlines */
+    nSources = params->nThin + params->nThick;
+    for(s=0; s<nSources; s++) {
+        los   = (long)(uniformRandom(&state)*params->nRA*params->nDec);
+        p0    = 0.5 + uniformRandom(&state);
+        chi0  = M_PI*uniformRandom(&state);
+        phi0  = params->phiRange*(2.*uniformRandom(&state) - 1.);
+        width = s < params->nThin ? 0. : params->maxThickness*uniformRandom(&state);
+        for(i=0; i<params->nChan; i++) {
+            x = width*cube->lambda2[i];
+            amp = x == 0. ? p0 : p0*sin(x)/x;
+            arg = 2.*(chi0 + phi0*cube->lambda2[i]);
+            idx = los*params->nChan + i;
+            cube->qCube[idx] += amp*cos(arg);
+            cube->uCube[idx] += amp*sin(arg);
+        }
+    }
+    return(SUCCESS);
+}
+
+void freeSynthCube(struct synthCube *cube) {
+    free(cube->freqList); free(cube->lambda2);
+    free(cube->qCube); free(cube->uCube);
+    cube->freqList = cube->lambda2 = NULL;
+    cube->qCube = cube->uCube = NULL;
+}
+
+/*************************************************************
+*
+* Turn a LAYOUT_FREQ_FIRST frame into LAYOUT_LOS_FIRST
+*
+*************************************************************/
+void transposeFrame(const float *in, float *out, long nLOS, int nChan) {
+    long los;
+    int i;
+    for(los=0; los<nLOS; los++)
+        for(i=0; i<nChan; i++)
+            out[los + i*nLOS] = in[los*nChan + i];
+}
@@ -0,0 +1,53 @@
+/******************************************************************************
+synthcube.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef SYNTHCUBE_H
+#define SYNTHCUBE_H
+
+/* Shape and content of a synthetic Q/U cube */
+struct synthCubeParams {
+    int nRA, nDec, nChan;
+    double freqMin, freqMax;     /* Hz, channels are uniform */
+    int nThin, nThick;           /* Number of injected sources */
+    double phiRange;             /* Sources lie within +/- phiRange */
+    double maxThickness;         /* Largest Burn slab width in rad/m/m */
+    double noise;                /* Gaussian noise per channel */
+    unsigned int seed;
+};
+
+/* Synthetic cube. Frames are DEC rows; within a frame the layout is
+   LAYOUT_FREQ_FIRST, i.e. [dec][ra][chan] like a rotated FITS cube. */
+struct synthCube {
+    struct synthCubeParams params;
+    double *freqList, *lambda2;
+    float *qCube, *uCube;
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+
+int makeSynthCube(struct synthCubeParams *params, struct synthCube *cube);
+void freeSynthCube(struct synthCube *cube);
+void transposeFrame(const float *in, float *out, long nLOS, int nChan);
+
+#endif
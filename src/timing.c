@@ -0,0 +1,190 @@
+/******************************************************************************
+timing.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<time.h>
+#include<string.h>
+
+#include "constants.h"
+#include "version.h"
+#include "timing.h"
+
+static const char *stageNames[N_TIMER_STAGES] = {
+    "setup", "read", "h2d", "compute", "d2h", "write"
+};
+
+/*************************************************************
+*
+* Monotonic wall clock in seconds
+*
+*************************************************************/
+double getWallTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return(now.tv_sec + now.tv_nsec*1e-9);
+}
+
+/*************************************************************
+*
+* Reset all accumulators and start the total clock
+*
+*************************************************************/
+void initTimer(struct timeInfoList *t) {
+    memset(t, 0, sizeof(*t));
+    t->rowMin = -1.;
+    t->startTime = getWallTime();
+}
+
+/*************************************************************
+*
+* Start and stop the wall clock of one stage
+*
+*************************************************************/
+void startTimer(struct timeInfoList *t, int stage) {
+    t->stageStart[stage] = getWallTime();
+}
+
+void stopTimer(struct timeInfoList *t, int stage) {
+    t->stageTime[stage] += getWallTime() - t->stageStart[stage];
+}
+
+/*************************************************************
+*
+* Accumulate externally measured time (e.g. device events),
+*  bytes moved and floating point operations
+*
+*************************************************************/
+void addStageTime(struct timeInfoList *t, int stage, double seconds) {
+    t->stageTime[stage] += seconds;
+}
+
+void addStageBytes(struct timeInfoList *t, int stage, double bytes) {
+    t->stageBytes[stage] += bytes;
+}
+
+void addFlops(struct timeInfoList *t, double flops) {
+    t->flops += flops;
+}
+
+/*************************************************************
+*
+* Time one row (read to write) and add it to the histogram.
+*  Bin 0 holds rows faster than 1 ms, bin k rows that took
+*  [2^(k-1), 2^k) ms.
+*
+*************************************************************/
+void startRowTimer(struct timeInfoList *t) {
+    t->rowStart = getWallTime();
+}
+
+void stopRowTimer(struct timeInfoList *t) {
+    double elapsed = getWallTime() - t->rowStart;
+    double ms = elapsed*KILO;
+    int bin = 0;
+
+    while(ms >= 1. && bin < N_HIST_BINS-1) { ms /= 2.; bin++; }
+    t->rowHist[bin]++;
+    t->nRows++;
+    if(t->rowMin < 0. || elapsed < t->rowMin) t->rowMin = elapsed;
+    if(elapsed > t->rowMax) t->rowMax = elapsed;
+}
+
+void stopTotalTimer(struct timeInfoList *t) {
+    t->totalTime = getWallTime() - t->startTime;
+}
+
+/*************************************************************
+*
+* Write timing information to stdout
+*
+*************************************************************/
+void printTimingInfo(struct timeInfoList *t) {
+    unsigned int hours, mins, secs;
+    int i;
+
+    hours = (unsigned int)t->totalTime/SEC_PER_HOUR;
+    mins  = ((unsigned int)t->totalTime%SEC_PER_HOUR)/SEC_PER_MIN;
+    secs  = ((unsigned int)t->totalTime%SEC_PER_HOUR)%SEC_PER_MIN;
+
+    printf("INFO: Timing Information\n");
+    for(i=0; i<N_TIMER_STAGES; i++) {
+        printf("   %-8s %10.3f s", stageNames[i], t->stageTime[i]);
+        if(t->stageBytes[i] > 0. && t->stageTime[i] > 0.)
+            printf("  %8.3f GB/s", t->stageBytes[i]/t->stageTime[i]/GIGA);
+        printf("\n");
+    }
+    if(t->stageTime[STAGE_COMPUTE] > 0.)
+        printf("   Compute rate: %0.3f GFLOP/s\n",
+               t->flops/t->stageTime[STAGE_COMPUTE]/GIGA);
+    if(t->nRows > 0)
+        printf("   Rows: %ld (min %0.3f ms, mean %0.3f ms, max %0.3f ms)\n",
+               t->nRows, t->rowMin*KILO,
+               (t->stageTime[STAGE_READ] + t->stageTime[STAGE_H2D] +
+                t->stageTime[STAGE_COMPUTE] + t->stageTime[STAGE_D2H] +
+                t->stageTime[STAGE_WRITE])*KILO/t->nRows, t->rowMax*KILO);
+    printf("INFO: Total execution time: %d:%d:%d\n", hours, mins, secs);
+}
+
+/*************************************************************
+*
+* Write timing information as JSON
+*
+*************************************************************/
+int writeTimingJSON(struct timeInfoList *t, char *filename,
+                    int nRA, int nDec, int nChan, int nPhi) {
+    FILE *json;
+    int i, last;
+
+    printf("INFO: Writing timing information to %s\n", filename);
+    json = fopen(filename, FILE_READWRITE);
+    if(json == NULL)
+        return(FAILURE);
+
+    fprintf(json, "{\n");
+    fprintf(json, "  \"version\": \"%s\",\n", VERSION_STR);
+    fprintf(json, "  \"nRA\": %d, \"nDec\": %d, \"nChan\": %d, \"nPhi\": %d,\n",
+            nRA, nDec, nChan, nPhi);
+    fprintf(json, "  \"totalSeconds\": %.6f,\n", t->totalTime);
+    fprintf(json, "  \"stages\": {\n");
+    for(i=0; i<N_TIMER_STAGES; i++) {
+        fprintf(json, "    \"%s\": {\"seconds\": %.6f, \"bytes\": %.0f, \"GBps\": %.6f}%s\n",
+                stageNames[i], t->stageTime[i], t->stageBytes[i],
+                t->stageTime[i] > 0. ? t->stageBytes[i]/t->stageTime[i]/GIGA : 0.,
+                i < N_TIMER_STAGES-1 ? "," : "");
+    }
+    fprintf(json, "  },\n");
+    fprintf(json, "  \"flops\": %.0f,\n", t->flops);
+    fprintf(json, "  \"GFLOPs\": %.6f,\n", t->stageTime[STAGE_COMPUTE] > 0. ?
+            t->flops/t->stageTime[STAGE_COMPUTE]/GIGA : 0.);
+    fprintf(json, "  \"rows\": {\"count\": %ld, \"minSeconds\": %.6f, \"maxSeconds\": %.6f,\n",
+            t->nRows, t->rowMin > 0. ? t->rowMin : 0., t->rowMax);
+    /* Drop empty bins at the end of the histogram */
+    for(last=N_HIST_BINS-1; last>0 && t->rowHist[last]==0; last--);
+    fprintf(json, "           \"histogramMs\": [");
+    for(i=0; i<=last; i++)
+        fprintf(json, "%d%s", t->rowHist[i], i < last ? ", " : "");
+    fprintf(json, "]}\n");
+    fprintf(json, "}\n");
+
+    fclose(json);
+    return(SUCCESS);
+}
@@ -0,0 +1,63 @@
+/******************************************************************************
+timing.h
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "constants.h"
+
+/* Structure to store timing information. All times are wall
+   clock seconds from a monotonic clock. */
+struct timeInfoList {
+   double stageStart[N_TIMER_STAGES];
+   double stageTime[N_TIMER_STAGES];   /* Accumulated time per stage */
+   double stageBytes[N_TIMER_STAGES];  /* Bytes moved per stage */
+   double flops;                       /* Operations in the kernels */
+   double rowStart, rowMin, rowMax;    /* Per-row read to write time */
+   long nRows;
+   int rowHist[N_HIST_BINS];
+   double startTime, totalTime;        /* Total time */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+double getWallTime(void);
+void initTimer(struct timeInfoList *t);
+void startTimer(struct timeInfoList *t, int stage);
+void stopTimer(struct timeInfoList *t, int stage);
+void addStageTime(struct timeInfoList *t, int stage, double seconds);
+void addStageBytes(struct timeInfoList *t, int stage, double bytes);
+void addFlops(struct timeInfoList *t, double flops);
+void startRowTimer(struct timeInfoList *t);
+void stopRowTimer(struct timeInfoList *t);
+void stopTotalTimer(struct timeInfoList *t);
+void printTimingInfo(struct timeInfoList *t);
+int writeTimingJSON(struct timeInfoList *t, char *filename,
+                    int nRA, int nDec, int nChan, int nPhi);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1032 @@
+/******************************************************************************
+verify.c
+Copyright (C) 2016  {fullname}
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+Correspondence concerning RMSynth_GPU should be addressed to:
+sarrvesh.ss@gmail.com
+
+******************************************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<dirent.h>
+
+#include "hdf5_hl.h"
+
+#include "structures.h"
+#include "constants.h"
+#include "timing.h"
+#include "engine.h"
+#include "rmsynth.h"
+#include "inputparser.h"
+#include "job.h"
+#include "reference.h"
+#include "synthcube.h"
+#include "verify.h"
+
+#define MODE_ROW   0
+#define MODE_BATCH 1
+#define N_MODES    2
+
+/* Largest error allowed relative to the peak of the reference P(\phi),
+   per kernel variant. The recurrence accumulates rounding over
+   RECURRENCE_RESEED steps and gets a looser bound. */
+static const double variantTolerance[N_KERNELS] = { 2e-5, 2e-4 };
+
+/* Small cubes that exercise the corners of the kernels */
+struct verifyCase {
+    const char *name;
+    int nRA, nDec, nChan, nPhi;
+    double dPhi;
+    double freqMin, freqMax;
+    int weighted;       /* Random weights with flagged channels */
+    double tolFactor;   /* Scales variantTolerance for this case */
+    int perCall;        /* Sightlines per call instead of a DEC row */
+};
+
+static const struct verifyCase verifyCases[] = {
+    { "uniform",    16, 8,  64,  64,  4.0, 1.0e9,  2.0e9,  FALSE, 1.,  0 },
+    { "weighted",   16, 8,  64,  64,  4.0, 1.0e9,  2.0e9,  TRUE,  1.,  0 },
+    { "odd-shape",   7, 5,  37,  53,  3.0, 1.1e9,  1.7e9,  TRUE,  1.,  0 },
+    { "single-los",  1, 3, 100,  33,  5.0, 0.7e9,  1.8e9,  FALSE, 1.,  0 },
+    /* Low frequencies and a wide phi range push the phase far beyond
+       2\pi, where single precision arguments lose accuracy */
+    { "wide-phi",    8, 4, 128, 200, 10.0, 1.2e8,  1.8e8,  FALSE, 10., 0 },
+    /* One frame of many sightlines, synthesized in chunks that
+       leave a short one at the end and transposed chunk by chunk
+       for the channel first layout */
+    { "chunked",   333, 1,  48,  40,  4.0, 1.0e9,  2.0e9,  TRUE,  1., 64 }
+};
+#define N_VERIFY_CASES (int)(sizeof(verifyCases)/sizeof(verifyCases[0]))
+
+static const char *modeNames[N_MODES] = { "row", "batch" };
+/* Sightlines per call of a case in a mode */
+#define CALL_LOS(vc, mode, nLOS) ((mode) == MODE_BATCH ? (nLOS) : \
+                                  (vc)->perCall > 0 ? (vc)->perCall : (vc)->nRA)
+static const char *layoutNames[] = { "fits", "hdf5" };
+
+/*************************************************************
+*
+* Position of (los, phi) in an engine output written in calls of
+*  batch sightlines in the given layout. LOS are numbered [dec][ra].
+*
+*************************************************************/
+static long outputIndex(long los, int p, int layout, long batch,
+                        long nLOS, int nPhi) {
+    long first = los - los%batch;
+    long n = first + batch <= nLOS ? batch : nLOS - first;
+
+    if(layout == LAYOUT_FREQ_FIRST) return(los*nPhi + p);
+    return(first*nPhi + (long)p*n + los - first);
+}
+
+/*************************************************************
+*
+* Feed the cube through an engine, either one DEC row (or the
+*  perCall sightlines of the case) per call or the whole cube in
+*  a single call
+*
+*************************************************************/
+static int synthesizeCube(const struct verifyCase *vc, const float *phiAxis,
+                          const struct synthCube *cube, const double *weights,
+                          double lambda20, const float *qIn, const float *uIn,
+                          int backend, int variant, int layout, int mode,
+                          int nThreads, float *qOut, float *uOut, float *pOut) {
+    struct synthEngine engine;
+    long nLOS = (long)vc->nRA*vc->nDec;
+    long batch = CALL_LOS(vc, mode, nLOS);
+    long j, n;
+    int status = SUCCESS;
+
+    if(initEngine(&engine, backend, variant, layout, vc->nChan, vc->nPhi,
+                  batch, FALSE, phiAxis, cube->lambda2, lambda20, weights,
+                  nThreads, 0)) {
+        return(FAILURE);
+    }
+    for(j=0; j<nLOS && status == SUCCESS; j+=batch) {
+        n = j + batch <= nLOS ? batch : nLOS - j;
+        status = runEngineSplit(&engine, qIn + j*vc->nChan, uIn + j*vc->nChan,
+                                n, qOut + j*vc->nPhi, uOut + j*vc->nPhi,
+                                pOut + j*vc->nPhi);
+    }
+    freeEngine(&engine);
+    return(status);
+}
+
+/*************************************************************
+*
+* Run one verification case through every available backend,
+*  kernel variant, layout and mode. Returns the number of
+*  failed checks.
+*
+*************************************************************/
+static int runVerifyCase(const struct verifyCase *vc, int backendSel,
+                         int variantSel, int nThreads) {
+    struct synthCubeParams cp;
+    struct synthCube cube;
+    long nLOS = (long)vc->nRA*vc->nDec, los, idx, j, batch;
+    long inLen = nLOS*vc->nChan, outLen = nLOS*vc->nPhi;
+    double *weights = NULL, *phiAxisD, *qRef, *uRef, *pRef;
+    double *rmsfReal, *rmsfImag, *rmsf;
+    double lambda20 = 0., sumWeights = 0., maxP, err, maxErr, tol;
+    float *phiAxis, *qIn[2], *uIn[2], *qOut, *uOut, *pOut;
+    struct synthEngine engine;
+    int i, p, backend, variant, layout, mode, status, nFailed = 0;
+    unsigned int state = 12345;
+
+    memset(&cp, 0, sizeof(cp));
+    cp.nRA = vc->nRA; cp.nDec = vc->nDec; cp.nChan = vc->nChan;
+    cp.freqMin = vc->freqMin; cp.freqMax = vc->freqMax;
+    cp.nThin = 3; cp.nThick = 1;
+    cp.phiRange = 0.25*vc->nPhi*vc->dPhi;
+    cp.maxThickness = 3.*vc->dPhi;
+    cp.noise = 0.01; cp.seed = 7;
+    if(makeSynthCube(&cp, &cube)) { return(1); }
+
+    phiAxis  = calloc(vc->nPhi, sizeof(*phiAxis));
+    phiAxisD = calloc(vc->nPhi, sizeof(*phiAxisD));
+    weights  = calloc(vc->nChan, sizeof(*weights));
+    qRef = calloc(outLen, sizeof(*qRef)); uRef = calloc(outLen, sizeof(*uRef));
+    pRef = calloc(outLen, sizeof(*pRef));
+    rmsfReal = calloc(vc->nPhi, sizeof(*rmsfReal));
+    rmsfImag = calloc(vc->nPhi, sizeof(*rmsfImag));
+    rmsf     = calloc(vc->nPhi, sizeof(*rmsf));
+    qIn[1] = calloc(inLen, sizeof(float)); uIn[1] = calloc(inLen, sizeof(float));
+    qOut = calloc(outLen, sizeof(*qOut)); uOut = calloc(outLen, sizeof(*uOut));
+    pOut = calloc(outLen, sizeof(*pOut));
+    if(phiAxis == NULL || phiAxisD == NULL || weights == NULL ||
+       qRef == NULL || uRef == NULL || pRef == NULL || rmsfReal == NULL ||
+       rmsfImag == NULL || rmsf == NULL || qIn[1] == NULL ||
+       uIn[1] == NULL || qOut == NULL || uOut == NULL || pOut == NULL) {
+        printf("Error: Mem alloc failed while running %s\n", vc->name);
+        return(1);
+    }
+
+    /* Axes, weights and the weighted mean lambda^2 */
+    for(p=0; p<vc->nPhi; p++) {
+        phiAxisD[p] = (p - vc->nPhi/2)*vc->dPhi;
+        phiAxis[p]  = phiAxisD[p];
+    }
+    for(i=0; i<vc->nChan; i++) {
+        state = state*1103515245u + 12345u;
+        weights[i] = vc->weighted ? 0.5 + (state>>8)/16777216. : 1.;
+        if(vc->weighted && i%7 == 3) weights[i] = 0.;
+        sumWeights += weights[i];
+        lambda20   += weights[i]*cube.lambda2[i];
+    }
+    lambda20 /= sumWeights;
+
+    /* Input as rotated FITS (freq-first) and as HDF5 (LOS-first) */
+    qIn[LAYOUT_FREQ_FIRST] = cube.qCube;
+    uIn[LAYOUT_FREQ_FIRST] = cube.uCube;
+
+    /* Reference in [los][phi] order */
+    referenceComputeQUP(cube.qCube, cube.uCube, nLOS, vc->nChan,
+                        LAYOUT_FREQ_FIRST, vc->nPhi, phiAxisD, cube.lambda2,
+                        lambda20, weights, qRef, uRef, pRef);
+    referenceRMSF(vc->nChan, cube.lambda2, lambda20, weights, vc->nPhi,
+                  phiAxisD, rmsfReal, rmsfImag, rmsf);
+    maxP = 0.;
+    for(idx=0; idx<outLen; idx++)
+        if(pRef[idx] > maxP) maxP = pRef[idx];
+
+    for(backend=0; backend<N_BACKENDS; backend++) {
+        if(backendSel >= 0 && backend != backendSel) continue;
+        for(variant=0; variant<N_KERNELS; variant++) {
+            if(variantSel >= 0 && variant != variantSel) continue;
+            if(!engineHasVariant(backend, variant)) continue;
+            tol = variantTolerance[variant]*vc->tolFactor;
+
+            /* RMSF: response to q=1, u=0 in every channel */
+            for(i=0; i<vc->nChan; i++) { qIn[1][i] = 1.f; uIn[1][i] = 0.f; }
+            if(initEngine(&engine, backend, variant, LAYOUT_FREQ_FIRST,
+                          vc->nChan, vc->nPhi, 1, FALSE, phiAxis, cube.lambda2,
+                          lambda20, weights, nThreads, 0)) {
+                nFailed++;
+                continue;
+            }
+            status = runEngineSplit(&engine, qIn[1], uIn[1], 1, qOut, uOut, pOut);
+            freeEngine(&engine);
+            if(status) {
+                nFailed++;
+                continue;
+            }
+            maxErr = 0.;
+            for(p=0; p<vc->nPhi; p++) {
+                err = fabs(qOut[p] - rmsfReal[p]);
+                if(fabs(uOut[p] - rmsfImag[p]) > err) err = fabs(uOut[p] - rmsfImag[p]);
+                if(fabs(pOut[p] - rmsf[p]) > err) err = fabs(pOut[p] - rmsf[p]);
+                if(err > maxErr) maxErr = err;
+            }
+            printf("%-10s %-5s %-11s %-5s %-5s %10.2e %10.2e %s\n", vc->name,
+                   backendName(backend), variantName(variant), "-", "rmsf",
+                   maxErr, tol, maxErr <= tol ? "PASS" : "FAIL");
+            if(maxErr > tol) nFailed++;
+
+            /* Q, U and P over the cube */
+            for(layout=0; layout<2; layout++) {
+                for(mode=0; mode<N_MODES; mode++) {
+                    batch = CALL_LOS(vc, mode, nLOS);
+                    if(layout == LAYOUT_LOS_FIRST) {
+                        /* Row mode transposes each DEC row (or chunk),
+                           batch mode the cube as one frame */
+                        for(j=0; j<nLOS; j+=batch) {
+                            transposeFrame(cube.qCube + j*vc->nChan, qIn[1] + j*vc->nChan,
+                                           j + batch <= nLOS ? batch : nLOS - j, vc->nChan);
+                            transposeFrame(cube.uCube + j*vc->nChan, uIn[1] + j*vc->nChan,
+                                           j + batch <= nLOS ? batch : nLOS - j, vc->nChan);
+                        }
+                    }
+                    if(synthesizeCube(vc, phiAxis, &cube, weights, lambda20,
+                                      qIn[layout], uIn[layout], backend,
+                                      variant, layout, mode, nThreads,
+                                      qOut, uOut, pOut)) {
+                        nFailed++;
+                        continue;
+                    }
+                    maxErr = 0.;
+                    for(los=0; los<nLOS; los++) {
+                        for(p=0; p<vc->nPhi; p++) {
+                            idx = outputIndex(los, p, layout, batch, nLOS,
+                                              vc->nPhi);
+                            j = los*vc->nPhi + p;
+                            err = fabs(qOut[idx] - qRef[j]);
+                            if(fabs(uOut[idx] - uRef[j]) > err) err = fabs(uOut[idx] - uRef[j]);
+                            if(fabs(pOut[idx] - pRef[j]) > err) err = fabs(pOut[idx] - pRef[j]);
+                            if(err > maxErr) maxErr = err;
+                        }
+                    }
+                    maxErr /= maxP;
+                    printf("%-10s %-5s %-11s %-5s %-5s %10.2e %10.2e %s\n",
+                           vc->name, backendName(backend), variantName(variant),
+                           layoutNames[layout], modeNames[mode], maxErr, tol,
+                           maxErr <= tol ? "PASS" : "FAIL");
+                    if(maxErr > tol) nFailed++;
+                }
+            }
+        }
+    }
+
+    free(phiAxis); free(phiAxisD); free(weights);
+    free(qRef); free(uRef); free(pRef);
+    free(rmsfReal); free(rmsfImag); free(rmsf);
+    free(qIn[1]); free(uIn[1]); free(qOut); free(uOut); free(pOut);
+    freeSynthCube(&cube);
+    return(nFailed);
+}
+
+/* Sightlines of the analysis checks: one Faraday-thin source each
+   over 1-2 GHz, where the RMSF is about 51 rad/m/m wide */
+#define ANALYSIS_NLOS  12
+#define ANALYSIS_NCHAN 256
+#define ANALYSIS_NPHI  201
+#define ANALYSIS_DPHI  5.0
+
+/* A librmsynth context on the analysis sightlines, and the data */
+struct analysisSetup {
+    struct rmsContext *ctx;
+    struct synthCube cube;
+    double lambda20;
+    double phi[ANALYSIS_NLOS], p[ANALYSIS_NLOS], psi[ANALYSIS_NLOS];
+    float *quIn, *quPhi, *pPhi;
+};
+
+static void printCheck(const char *name, int backend, int variant,
+                       double err, double tol) {
+    printf("%-10s %-5s %-11s %-5s %-5s %10.2e %10.2e %s\n", name,
+           backendName(backend), variantName(variant), "-", "-", err, tol,
+           err <= tol ? "PASS" : "FAIL");
+}
+
+/*************************************************************
+*
+* Set up a context for the backend and variant, and synthesize
+*  sightlines of one source each, P = p exp(2i(psi + phi
+*  (lambda^2 - lambda^2_0))), with Gaussian noise per channel.
+*  The sources lie off the phi grid and within +/- 150 rad/m/m.
+*
+*************************************************************/
+static int setupAnalysis(int backend, int variant, int nThreads,
+                         double noise, unsigned int seed, int stokesI,
+                         struct analysisSetup *a) {
+    struct synthCubeParams cp;
+    struct rmsConfig config;
+    long los, idx;
+    int i;
+    double arg;
+
+    memset(a, 0, sizeof(*a));
+    memset(&cp, 0, sizeof(cp));
+    cp.nRA = ANALYSIS_NLOS; cp.nDec = 1; cp.nChan = ANALYSIS_NCHAN;
+    cp.freqMin = 1.0e9; cp.freqMax = 2.0e9;
+    cp.noise = noise; cp.seed = seed;
+    if(makeSynthCube(&cp, &a->cube)) { return(FAILURE); }
+
+    rmsDefaultConfig(&config);
+    config.nChan = ANALYSIS_NCHAN;
+    config.lambda2 = a->cube.lambda2;
+    config.lambda20Mode = LAMBDA20_WEIGHTED;
+    config.nPhi = ANALYSIS_NPHI;
+    config.dPhi = ANALYSIS_DPHI;
+    config.phiMin = -(ANALYSIS_NPHI/2)*ANALYSIS_DPHI;
+    config.backend = backend;
+    config.variant = variant;
+    config.maxLOS = ANALYSIS_NLOS;
+    config.nThreads = nThreads;
+    config.stokesI = stokesI;
+    a->quIn  = calloc(2*ANALYSIS_NLOS*ANALYSIS_NCHAN, sizeof(float));
+    a->quPhi = calloc(2*ANALYSIS_NLOS*ANALYSIS_NPHI, sizeof(float));
+    a->pPhi  = calloc(ANALYSIS_NLOS*ANALYSIS_NPHI, sizeof(float));
+    if(a->quIn == NULL || a->quPhi == NULL || a->pPhi == NULL ||
+       rmsCreate(&config, &a->ctx) != RMS_SUCCESS) {
+        return(FAILURE);
+    }
+    a->lambda20 = rmsGetLambda20(a->ctx);
+
+    for(los=0; los<ANALYSIS_NLOS; los++) {
+        a->phi[los] = -150. + 27.3*los + 0.37;
+        a->p[los]   = 0.5 + 0.1*los;
+        a->psi[los] = -1.4 + 0.25*los;
+        for(i=0; i<ANALYSIS_NCHAN; i++) {
+            idx = los*ANALYSIS_NCHAN + i;
+            arg = 2.*(a->psi[los] + a->phi[los]*(a->cube.lambda2[i] - a->lambda20));
+            a->quIn[2*idx]   = a->cube.qCube[idx] + a->p[los]*cos(arg);
+            a->quIn[2*idx+1] = a->cube.uCube[idx] + a->p[los]*sin(arg);
+        }
+    }
+    if(rmsSynthesizeInterleaved(a->ctx, a->quIn, ANALYSIS_NLOS, a->quPhi,
+                                a->pPhi) != RMS_SUCCESS) {
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+static void freeAnalysis(struct analysisSetup *a) {
+    rmsDestroy(a->ctx);
+    freeSynthCube(&a->cube);
+    free(a->quIn); free(a->quPhi); free(a->pPhi);
+}
+
+/*************************************************************
+*
+* Peak refinement: the refined phi of every source against the
+*  injected phi, in units of the fine step. An even window
+*  length, which cannot be centred, has to be rejected.
+*
+*************************************************************/
+static int checkRefine(int backend, int variant, int nThreads) {
+    struct analysisSetup a;
+    struct rmsRefineConfig refine;
+    struct rmsPeaks peaks;
+    float phi[ANALYSIS_NLOS], p[ANALYSIS_NLOS];
+    double err, maxErr = 0., tol = 0.02;
+    long los;
+
+    memset(&peaks, 0, sizeof(peaks));
+    peaks.phi = phi; peaks.p = p;
+    refine.maxPeaks = 1;
+    refine.threshold = 0.1;
+    refine.nFine = 21;
+    refine.dPhiFine = ANALYSIS_DPHI/10.;
+    if(setupAnalysis(backend, variant, nThreads, 0., 1, FALSE, &a) ||
+       rmsRefine(a.ctx, a.quIn, ANALYSIS_NLOS, a.pPhi, &refine, &peaks)) {
+        freeAnalysis(&a);
+        printCheck("refine", backend, variant, INFINITY, tol);
+        return(1);
+    }
+    for(los=0; los<ANALYSIS_NLOS; los++) {
+        err = fabs(phi[los] - a.phi[los])/refine.dPhiFine;
+        if(!(err <= maxErr)) maxErr = err;
+    }
+    refine.nFine = 20;
+    if(rmsRefine(a.ctx, a.quIn, ANALYSIS_NLOS, a.pPhi, &refine, &peaks) !=
+       RMS_ERR_ARGUMENT)
+        maxErr = INFINITY;
+    freeAnalysis(&a);
+    printCheck("refine", backend, variant, maxErr, tol);
+    return(maxErr <= tol ? 0 : 1);
+}
+
+/*************************************************************
+*
+* Fractional polarization: Q and U scaled by a Stokes I spectrum
+*  that differs between sightlines, synthesized with that I set,
+*  against the synthesis of the unscaled spectra
+*
+*************************************************************/
+static int checkStokesI(int backend, int variant, int nThreads) {
+    struct analysisSetup a;
+    float *quScaled = NULL, *iFrame = NULL, *quPhi = NULL, *pPhi = NULL;
+    long los, idx, nIn = (long)ANALYSIS_NLOS*ANALYSIS_NCHAN;
+    long nOut = (long)ANALYSIS_NLOS*ANALYSIS_NPHI;
+    double err, maxErr = INFINITY, maxP = 0., tol = variantTolerance[variant];
+    int i;
+
+    if(setupAnalysis(backend, variant, nThreads, 0., 1, TRUE, &a) == SUCCESS) {
+        quScaled = calloc(2*nIn, sizeof(*quScaled));
+        iFrame   = calloc(nIn, sizeof(*iFrame));
+        quPhi    = calloc(2*nOut, sizeof(*quPhi));
+        pPhi     = calloc(nOut, sizeof(*pPhi));
+    }
+    if(quScaled != NULL && iFrame != NULL && quPhi != NULL && pPhi != NULL) {
+        for(los=0; los<ANALYSIS_NLOS; los++) {
+            for(i=0; i<ANALYSIS_NCHAN; i++) {
+                idx = los*ANALYSIS_NCHAN + i;
+                iFrame[idx] = (1. + 0.5*los)*pow(a.cube.freqList[i]/1.4e9, -0.7);
+                quScaled[2*idx]   = a.quIn[2*idx]*iFrame[idx];
+                quScaled[2*idx+1] = a.quIn[2*idx+1]*iFrame[idx];
+            }
+        }
+        rmsSetStokesI(a.ctx, iFrame);
+        if(rmsSynthesizeInterleaved(a.ctx, quScaled, ANALYSIS_NLOS, quPhi,
+                                    pPhi) == RMS_SUCCESS) {
+            maxErr = 0.;
+            for(idx=0; idx<nOut; idx++) {
+                if(a.pPhi[idx] > maxP) maxP = a.pPhi[idx];
+                err = fabs(pPhi[idx] - a.pPhi[idx]);
+                if(fabs(quPhi[2*idx] - a.quPhi[2*idx]) > err)
+                    err = fabs(quPhi[2*idx] - a.quPhi[2*idx]);
+                if(fabs(quPhi[2*idx+1] - a.quPhi[2*idx+1]) > err)
+                    err = fabs(quPhi[2*idx+1] - a.quPhi[2*idx+1]);
+                if(err > maxErr) maxErr = err;
+            }
+            maxErr /= maxP;
+        }
+    }
+    free(quScaled); free(iFrame); free(quPhi); free(pPhi);
+    freeAnalysis(&a);
+    printCheck("stokes-i", backend, variant, maxErr, tol);
+    return(maxErr <= tol ? 0 : 1);
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return(x < y ? -1 : x > y);
+}
+
+/* Median of n values, reordering them */
+static double medianOf(double *values, int n) {
+    qsort(values, n, sizeof(*values), compareDoubles);
+    return(n % 2 ? values[n/2] : 0.5*(values[n/2-1] + values[n/2]));
+}
+
+/*************************************************************
+*
+* Noise estimates against the noise injected into the channels,
+*  carried over to phi as \sigma \sqrt{\sum w^2}/\sum w, with a
+*  bright source on every sightline whose RMSF sidelobes are far
+*  above the noise. The estimates of a single sightline scatter
+*  by some 10-20%, so the median ratio over the sightlines is
+*  compared. snr is checked against p over the injected noise.
+*
+*************************************************************/
+static int checkNoise(int backend, int variant, int nThreads) {
+    struct analysisSetup a;
+    struct rmsNoise noise;
+    float sigma[ANALYSIS_NLOS], sigmaBand[ANALYSIS_NLOS], snr[ANALYSIS_NLOS];
+    double ratio[3][ANALYSIS_NLOS], err, maxErr = INFINITY, tol = 0.15;
+    double noiseChan = 0.05, noisePhi = noiseChan/sqrt(ANALYSIS_NCHAN);
+    long los;
+    int k;
+
+    noise.sigma = sigma; noise.rms = NULL;
+    noise.sigmaBand = sigmaBand; noise.snr = snr;
+    if(setupAnalysis(backend, variant, nThreads, noiseChan, 3, FALSE, &a) == SUCCESS &&
+       rmsEstimateNoise(a.ctx, a.quIn, ANALYSIS_NLOS, a.quPhi, a.pPhi, 0.,
+                        &noise) == RMS_SUCCESS) {
+        for(los=0; los<ANALYSIS_NLOS; los++) {
+            ratio[0][los] = sigma[los]/noisePhi;
+            ratio[1][los] = sigmaBand[los]/noisePhi;
+            ratio[2][los] = snr[los]*noisePhi/a.p[los];
+        }
+        maxErr = 0.;
+        for(k=0; k<3; k++) {
+            err = fabs(medianOf(ratio[k], ANALYSIS_NLOS) - 1.);
+            if(!(err <= maxErr)) maxErr = err;
+        }
+    }
+    freeAnalysis(&a);
+    printCheck("noise", backend, variant, maxErr, tol);
+    return(maxErr <= tol ? 0 : 1);
+}
+
+/*************************************************************
+*
+* Component search at 8 sigma: every other sightline gets a
+*  second, fainter source well clear of the first. A sightline
+*  fails if it does not give exactly its sources, each within a
+*  phi plane of where it was injected, rather than also listing
+*  RMSF sidelobes. The error is the number of failed sightlines.
+*
+*************************************************************/
+static int checkComponents(int backend, int variant, int nThreads) {
+    struct analysisSetup a;
+    struct rmsNoise noise;
+    const struct rmsComponent *list;
+    float sigma[ANALYSIS_NLOS];
+    double phi[2], arg, err = INFINITY, tol = 0.;
+    long los, idx, n, c;
+    int i, k, nFound[ANALYSIS_NLOS];
+
+    memset(&noise, 0, sizeof(noise));
+    noise.sigma = sigma;
+    if(setupAnalysis(backend, variant, nThreads, 0.05, 5, FALSE, &a) == SUCCESS) {
+        for(los=1; los<ANALYSIS_NLOS; los+=2) {
+            for(i=0; i<ANALYSIS_NCHAN; i++) {
+                idx = los*ANALYSIS_NCHAN + i;
+                arg = 2.*(0.3 + (a.phi[los] + 120.)*(a.cube.lambda2[i] - a.lambda20));
+                a.quIn[2*idx]   += 0.5*a.p[los]*cos(arg);
+                a.quIn[2*idx+1] += 0.5*a.p[los]*sin(arg);
+            }
+        }
+        if(rmsSynthesizeInterleaved(a.ctx, a.quIn, ANALYSIS_NLOS, a.quPhi,
+                                    a.pPhi) == RMS_SUCCESS &&
+           rmsEstimateNoise(a.ctx, a.quIn, ANALYSIS_NLOS, a.quPhi, a.pPhi,
+                            0., &noise) == RMS_SUCCESS &&
+           rmsFindComponents(a.ctx, ANALYSIS_NLOS, a.quPhi, a.pPhi, sigma,
+                             0., 8., &list, &n) == RMS_SUCCESS) {
+            memset(nFound, 0, sizeof(nFound));
+            for(c=0; c<n; c++) {
+                los = list[c].los;
+                phi[0] = a.phi[los];
+                phi[1] = los%2 ? a.phi[los] + 120. : phi[0];
+                k = nFound[los] < 2 ? nFound[los] : 1;
+                if(fabs(list[c].phi - phi[k]) <= ANALYSIS_DPHI) nFound[los]++;
+                else nFound[los] = -ANALYSIS_NLOS;
+            }
+            for(err=0., los=0; los<ANALYSIS_NLOS; los++)
+                if(nFound[los] != 1 + los%2) err++;
+        }
+    }
+    freeAnalysis(&a);
+    printCheck("components", backend, variant, err, tol);
+    return(err <= tol ? 0 : 1);
+}
+
+/*************************************************************
+*
+* Thin-source fit on the backend of the context: p0, psi0 and phi
+*  of every sightline against the injected ones, in units of the
+*  fitted uncertainties, and the reduced chi^2 against the
+*  channel noise, whose median over the sightlines should be 1.
+*
+*************************************************************/
+static int checkFit(int backend, int variant, int nThreads) {
+    struct analysisSetup a;
+    struct rmsFitConfig fit;
+    struct rmsFitResult result;
+    float params[3*ANALYSIS_NLOS], errors[3*ANALYSIS_NLOS];
+    float chi2[ANALYSIS_NLOS];
+    double values[ANALYSIS_NLOS], inj[3], z, maxZ = INFINITY, err = INFINITY;
+    double tolZ = 5., tol = 0.15;
+    long los;
+    int j;
+
+    fit.model = FIT_THIN;
+    fit.maxIter = DEFAULT_FIT_ITERATIONS;
+    result.params = params; result.errors = errors; result.chi2 = chi2;
+    if(setupAnalysis(backend, variant, nThreads, 0.05, 7, FALSE, &a) == SUCCESS &&
+       rmsFitQU(a.ctx, a.quIn, ANALYSIS_NLOS, a.quPhi, a.pPhi, NULL, &fit,
+                &result) == RMS_SUCCESS) {
+        maxZ = 0.;
+        for(los=0; los<ANALYSIS_NLOS; los++) {
+            inj[0] = a.p[los]; inj[1] = a.psi[los]; inj[2] = a.phi[los];
+            for(j=0; j<3; j++) {
+                z = params[j*ANALYSIS_NLOS+los] - inj[j];
+                if(j == 1) z = remainder(z, M_PI);
+                z = fabs(z)/errors[j*ANALYSIS_NLOS+los];
+                if(!(z <= maxZ)) maxZ = z;
+            }
+            values[los] = chi2[los];
+        }
+        err = fabs(medianOf(values, ANALYSIS_NLOS) - 1.);
+        if(isnan(err)) err = INFINITY;
+    }
+    freeAnalysis(&a);
+    printCheck("fit", backend, variant, maxZ, tolZ);
+    printCheck("fit-chi2", backend, variant, err, tol);
+    return((maxZ <= tolZ ? 0 : 1) + (err <= tol ? 0 : 1));
+}
+
+/* Cubes of the file checks: IO_NDEC rows of IO_NRA sightlines,
+   which a host budget of IO_HOST_MB cuts into several chunks with
+   a short one at the end */
+#define IO_NRA          600
+#define IO_NDEC         3
+#define IO_NCHAN        128
+#define IO_NPHI         128
+#define IO_DPHI         4.0
+#define IO_HOST_MB      1
+#define IO_READ_THREADS 3
+#define IO_PARSET_LEN   4096
+#define IO_NAME_LEN     32
+
+/* Input files of the file checks in a scratch directory, the
+   reference synthesis of them in [los][phi] order, and the
+   output cubes read back from a job */
+struct fileSetup {
+    char dir[FILENAME_LEN/2];
+    struct synthCube cube;
+    double lambda20, maxP;
+    double *ref[NUM_OUTPUTS];
+    float *out[NUM_OUTPUTS];
+};
+
+static void printFileCheck(const char *io, const char *mode, int backend,
+                           int variant, double err, double tol) {
+    printf("%-10s %-5s %-11s %-5s %-5s %10.2e %10.2e %s\n", "files",
+           backendName(backend), variantName(variant), io, mode, err, tol,
+           err <= tol ? "PASS" : "FAIL");
+}
+
+/*************************************************************
+*
+* Write a cube as a rotated FITS image, frequency along NAXIS1,
+*  with the WCS keywords that getFitsHeader() reads
+*
+*************************************************************/
+static int writeFitsCube(const char *name, const float *data, int nRA,
+                         int nDec, int nChan) {
+    static char *ctypes[N_DIMS] = { "FREQ", "RA---SIN", "DEC--SIN" };
+    fitsfile *file;
+    long naxes[N_DIMS], fPixel[N_DIMS] = {1, 1, 1};
+    char key[FLEN_KEYWORD];
+    double one = 1.;
+    int i, fitsStatus = 0;
+
+    naxes[0] = nChan; naxes[1] = nRA; naxes[2] = nDec;
+    fits_create_file(&file, name, &fitsStatus);
+    fits_create_img(file, FLOAT_IMG, N_DIMS, naxes, &fitsStatus);
+    for(i=0; i<N_DIMS; i++) {
+        sprintf(key, "CRVAL%d", i+1);
+        fits_write_key(file, TDOUBLE, key, &one, "", &fitsStatus);
+        sprintf(key, "CRPIX%d", i+1);
+        fits_write_key(file, TDOUBLE, key, &one, "", &fitsStatus);
+        sprintf(key, "CDELT%d", i+1);
+        fits_write_key(file, TDOUBLE, key, &one, "", &fitsStatus);
+        sprintf(key, "CTYPE%d", i+1);
+        fits_write_key(file, TSTRING, key, ctypes[i], "", &fitsStatus);
+    }
+    fits_write_pix(file, TFLOAT, fPixel, (long)nRA*nDec*nChan, (void *)data,
+                   &fitsStatus);
+    fits_close_file(file, &fitsStatus);
+    if(fitsStatus) {
+        fits_report_error(stdout, fitsStatus);
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+/* Write spectra as a table, a 2-D dataset [nRows][nChan] */
+static int writeHDF5Table(const char *name, const char *column,
+                          const float *data, long nRows, int nChan) {
+    hsize_t dims[2];
+    hid_t file;
+    herr_t error;
+
+    dims[0] = nRows; dims[1] = nChan;
+    file = H5Fcreate(name, H5F_ACC_EXCL, H5P_DEFAULT, H5P_DEFAULT);
+    if(file < 0) { return(FAILURE); }
+    error = H5LTmake_dataset_float(file, column, 2, dims, data);
+    H5Fclose(file);
+    return(error < 0 ? FAILURE : SUCCESS);
+}
+
+/*************************************************************
+*
+* Make the scratch directory with the Q and U cubes and their
+*  frequencies, the same spectra as Q and U tables with one row
+*  per sightline, and synthesize them with the reference
+*
+*************************************************************/
+static int setupFiles(struct fileSetup *f) {
+    struct synthCubeParams cp;
+    double phiAxis[IO_NPHI], weights[IO_NCHAN];
+    char name[FILENAME_LEN];
+    long idx, nOut = (long)IO_NRA*IO_NDEC*IO_NPHI;
+    FILE *freq;
+    int i;
+
+    memset(f, 0, sizeof(*f));
+    snprintf(f->dir, sizeof(f->dir), "%s/rmbench.XXXXXX",
+             getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp");
+    if(mkdtemp(f->dir) == NULL) {
+        printf("Error: Unable to create a scratch directory in %s\n", f->dir);
+        f->dir[0] = '\0';
+        return(FAILURE);
+    }
+    memset(&cp, 0, sizeof(cp));
+    cp.nRA = IO_NRA; cp.nDec = IO_NDEC; cp.nChan = IO_NCHAN;
+    cp.freqMin = 1.0e9; cp.freqMax = 2.0e9;
+    cp.nThin = 3; cp.nThick = 1;
+    cp.phiRange = 0.25*IO_NPHI*IO_DPHI;
+    cp.maxThickness = 3.*IO_DPHI;
+    cp.noise = 0.01; cp.seed = 11;
+    if(makeSynthCube(&cp, &f->cube)) { return(FAILURE); }
+    for(i=0; i<NUM_OUTPUTS; i++) {
+        f->ref[i] = calloc(nOut, sizeof(*f->ref[i]));
+        f->out[i] = calloc(nOut, sizeof(*f->out[i]));
+        if(f->ref[i] == NULL || f->out[i] == NULL) { return(FAILURE); }
+    }
+
+    /* Uniform weights, as without a weight file */
+    f->lambda20 = 0.;
+    for(i=0; i<IO_NCHAN; i++) {
+        weights[i] = 1.;
+        f->lambda20 += f->cube.lambda2[i]/IO_NCHAN;
+    }
+    for(i=0; i<IO_NPHI; i++) { phiAxis[i] = (i - IO_NPHI/2)*IO_DPHI; }
+    referenceComputeQUP(f->cube.qCube, f->cube.uCube, (long)IO_NRA*IO_NDEC,
+                        IO_NCHAN, LAYOUT_FREQ_FIRST, IO_NPHI, phiAxis,
+                        f->cube.lambda2, f->lambda20, weights,
+                        f->ref[0], f->ref[1], f->ref[2]);
+    f->maxP = 0.;
+    for(idx=0; idx<nOut; idx++)
+        if(f->ref[2][idx] > f->maxP) f->maxP = f->ref[2][idx];
+
+    snprintf(name, sizeof(name), "%s/freq.txt", f->dir);
+    freq = fopen(name, "w");
+    if(freq == NULL) { return(FAILURE); }
+    for(i=0; i<IO_NCHAN; i++) { fprintf(freq, "%.17g\n", f->cube.freqList[i]); }
+    fclose(freq);
+    snprintf(name, sizeof(name), "%s/q.fits", f->dir);
+    if(writeFitsCube(name, f->cube.qCube, IO_NRA, IO_NDEC, IO_NCHAN)) { return(FAILURE); }
+    snprintf(name, sizeof(name), "%s/u.fits", f->dir);
+    if(writeFitsCube(name, f->cube.uCube, IO_NRA, IO_NDEC, IO_NCHAN)) { return(FAILURE); }
+    snprintf(name, sizeof(name), "%s/q.h5", f->dir);
+    if(writeHDF5Table(name, "Q", f->cube.qCube, (long)IO_NRA*IO_NDEC, IO_NCHAN)) { return(FAILURE); }
+    snprintf(name, sizeof(name), "%s/u.h5", f->dir);
+    if(writeHDF5Table(name, "U", f->cube.uCube, (long)IO_NRA*IO_NDEC, IO_NCHAN)) { return(FAILURE); }
+    return(SUCCESS);
+}
+
+/* Remove the scratch directory, unless a check failed */
+static void freeFiles(struct fileSetup *f, int keep) {
+    struct dirent *entry;
+    DIR *dir;
+    int i;
+
+    for(i=0; i<NUM_OUTPUTS; i++) { free(f->ref[i]); free(f->out[i]); }
+    freeSynthCube(&f->cube);
+    if(f->dir[0] == '\0') { return; }
+    if(keep) {
+        printf("INFO: Inputs, outputs and logs of the file checks are in %s\n", f->dir);
+        return;
+    }
+    dir = opendir(f->dir);
+    while(dir != NULL && (entry = readdir(dir)) != NULL) {
+        if(entry->d_name[0] != '.') { unlinkat(dirfd(dir), entry->d_name, 0); }
+    }
+    if(dir != NULL) { closedir(dir); }
+    rmdir(f->dir);
+}
+
+/*************************************************************
+*
+* Run a job on the scratch files through runJob(), as rmsynthesis
+*  does, with the input lines given and the output cubes named
+*  after the run. What the job prints goes to <run>.log.
+*
+*************************************************************/
+static int runFileJob(struct fileSetup *f, const char *run, const char *input,
+                      int backend, int variant, int nThreads, int readThreads) {
+    char parset[IO_PARSET_LEN], log[FILENAME_LEN];
+    struct optionsList options;
+    struct timeInfoList t;
+    int saved, fd, status;
+
+    snprintf(parset, sizeof(parset),
+             "backend = \"%s\";\nkernel = \"%s\";\nnThreads = %d;\n%s"
+             "freqFileName = \"%s/freq.txt\";\nfreqFormat = \"TEXT\";\n"
+             "lambda20 = %#.17g;\nplotRMSF = False;\n"
+             "phiMin = %#.17g;\ndPhi = %#.17g;\nnPhi = %d;\n"
+             "readThreads = %d;\nhostMemory = %d;\noutPrefix = \"%s/%s_\";\n",
+             backendName(backend), variantName(variant), nThreads, input,
+             f->dir, f->lambda20, -(IO_NPHI/2)*IO_DPHI, IO_DPHI, IO_NPHI,
+             readThreads, IO_HOST_MB, f->dir, run);
+    snprintf(log, sizeof(log), "%s/%s.log", f->dir, run);
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(saved < 0 || fd < 0) {
+        if(saved >= 0) { close(saved); }
+        if(fd >= 0) { close(fd); }
+        return(FAILURE);
+    }
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    initTimer(&t);
+    status = parseInputString(parset, &options);
+    if(status == SUCCESS) { status = runJob(&options, 0, NULL, &t); }
+    freeOptions(&options);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    return(status);
+}
+
+/*************************************************************
+*
+* Read the Q, U and P cubes of a FITS run back in [los][phi]
+*  order, which is the order of the default FITS output
+*
+*************************************************************/
+static int readFitsOutput(struct fileSetup *f, const char *run) {
+    static const char *names[NUM_OUTPUTS] = { Q_DIRTY, U_DIRTY, P_DIRTY };
+    char name[FILENAME_LEN];
+    fitsfile *file;
+    int i, fitsStatus = 0;
+
+    for(i=0; i<NUM_OUTPUTS && fitsStatus == 0; i++) {
+        snprintf(name, sizeof(name), "%s/%s_%s.fits", f->dir, run, names[i]);
+        fits_open_file(&file, name, READONLY, &fitsStatus);
+        fits_read_img(file, TFLOAT, 1, (long)IO_NRA*IO_NDEC*IO_NPHI, NULL,
+                      f->out[i], NULL, &fitsStatus);
+        fits_close_file(file, &fitsStatus);
+    }
+    if(fitsStatus) {
+        fits_report_error(stdout, fitsStatus);
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+/*************************************************************
+*
+* Read the Q, U and P cubes of a table run back. The HDF5 output
+*  of a table is [phi][1][los] and is transposed to [los][phi].
+*
+*************************************************************/
+static int readHDF5Output(struct fileSetup *f, const char *run, float *scratch) {
+    static const char *names[NUM_OUTPUTS] = { Q_DIRTY, U_DIRTY, P_DIRTY };
+    char name[FILENAME_LEN];
+    long los, nLOS = (long)IO_NRA*IO_NDEC;
+    herr_t error = 0;
+    hid_t file;
+    int i, phi;
+
+    for(i=0; i<NUM_OUTPUTS && error >= 0; i++) {
+        snprintf(name, sizeof(name), "%s/%s_%s.h5", f->dir, run, names[i]);
+        file = H5Fopen(name, H5F_ACC_RDONLY, H5P_DEFAULT);
+        if(file < 0) { return(FAILURE); }
+        error = H5LTread_dataset_float(file, PRIMARYDATA, scratch);
+        H5Fclose(file);
+        for(phi=0; phi<IO_NPHI; phi++)
+            for(los=0; los<nLOS; los++)
+                f->out[i][los*IO_NPHI + phi] = scratch[phi*nLOS + los];
+    }
+    if(error < 0) {
+        printf("Error: Unable to read the output of %s\n", run);
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+/* Largest error of the output cubes against the reference,
+   relative to the peak of the reference P */
+static double compareFileOutput(struct fileSetup *f) {
+    long idx, nOut = (long)IO_NRA*IO_NDEC*IO_NPHI;
+    double err, maxErr = 0.;
+    int i;
+
+    for(i=0; i<NUM_OUTPUTS; i++) {
+        for(idx=0; idx<nOut; idx++) {
+            err = fabs(f->out[i][idx] - f->ref[i][idx]);
+            if(!(err <= maxErr)) maxErr = err;
+        }
+    }
+    return(maxErr/f->maxP);
+}
+
+/*************************************************************
+*
+* End to end: the FITS cubes are synthesized by runJob() with one
+*  reader and with a pool of reader threads, in several chunks
+*  per row, and the cubes it writes are compared with the
+*  reference. The two runs must also agree exactly. The table
+*  is read through readTableChunk() in chunks of sightlines with
+*  a short one at the end.
+*
+*************************************************************/
+static int checkFiles(int backend, int variant, int nThreads) {
+    static const int readThreads[2] = { 1, IO_READ_THREADS };
+    struct fileSetup f;
+    char input[IO_PARSET_LEN/2], run[IO_NAME_LEN], mode[IO_NAME_LEN];
+    float *serial[NUM_OUTPUTS] = { NULL, NULL, NULL };
+    long idx, nOut = (long)IO_NRA*IO_NDEC*IO_NPHI;
+    double err, diff, tol = variantTolerance[variant];
+    int i, r, nFailed = 0;
+
+    if(setupFiles(&f)) {
+        printf("Error: Unable to write the inputs of the file checks\n");
+        printFileCheck("fits", "-", backend, variant, INFINITY, tol);
+        freeFiles(&f, TRUE);
+        return(1);
+    }
+    snprintf(input, sizeof(input),
+             "fileFormat = \"FITS\";\nqCubeName = \"%s/q.fits\";\n"
+             "uCubeName = \"%s/u.fits\";\n", f.dir, f.dir);
+    for(r=0; r<2; r++) {
+        snprintf(run, sizeof(run), "fits_%d", readThreads[r]);
+        snprintf(mode, sizeof(mode), "rd=%d", readThreads[r]);
+        err = INFINITY;
+        if(runFileJob(&f, run, input, backend, variant, nThreads,
+                      readThreads[r]) == SUCCESS &&
+           readFitsOutput(&f, run) == SUCCESS)
+            err = compareFileOutput(&f);
+        printFileCheck("fits", mode, backend, variant, err, tol);
+        if(!(err <= tol)) { nFailed++; }
+        /* Keep the cubes of the single reader */
+        for(i=0; r == 0 && i<NUM_OUTPUTS; i++) {
+            serial[i] = f.out[i];
+            f.out[i] = calloc(nOut, sizeof(*f.out[i]));
+            if(f.out[i] == NULL) { r = 2; nFailed++; }
+        }
+    }
+    diff = 0.;
+    for(i=0; i<NUM_OUTPUTS; i++) {
+        for(idx=0; serial[i] != NULL && f.out[i] != NULL && idx<nOut; idx++) {
+            err = fabs(f.out[i][idx] - serial[i][idx]);
+            if(!(err <= diff)) diff = err;
+        }
+    }
+    printFileCheck("fits", "pool", backend, variant, diff, 0.);
+    if(!(diff <= 0.)) { nFailed++; }
+
+    snprintf(input, sizeof(input),
+             "fileFormat = \"HDF5\";\ninputType = \"TABLE\";\n"
+             "qCubeName = \"%s/q.h5\";\nuCubeName = \"%s/u.h5\";\n", f.dir, f.dir);
+    err = INFINITY;
+    if(serial[0] != NULL &&
+       runFileJob(&f, "table", input, backend, variant, nThreads, 1) == SUCCESS &&
+       readHDF5Output(&f, "table", serial[0]) == SUCCESS)
+        err = compareFileOutput(&f);
+    printFileCheck("table", "hdf5", backend, variant, err, tol);
+    if(!(err <= tol)) { nFailed++; }
+    for(i=0; i<NUM_OUTPUTS; i++) { free(serial[i]); }
+    freeFiles(&f, nFailed > 0);
+    return(nFailed);
+}
+
+/*************************************************************
+*
+* Run the analysis checks through every available backend and
+*  kernel variant. Returns the number of failed checks.
+*
+*************************************************************/
+static int runAnalysisChecks(int backendSel, int variantSel, int nThreads) {
+    int backend, variant, nFailed = 0;
+
+    for(backend=0; backend<N_BACKENDS; backend++) {
+        if(backendSel >= 0 && backend != backendSel) continue;
+        for(variant=0; variant<N_KERNELS; variant++) {
+            if(variantSel >= 0 && variant != variantSel) continue;
+            if(!engineHasVariant(backend, variant)) continue;
+            nFailed += checkRefine(backend, variant, nThreads);
+            nFailed += checkStokesI(backend, variant, nThreads);
+            nFailed += checkNoise(backend, variant, nThreads);
+            nFailed += checkComponents(backend, variant, nThreads);
+            nFailed += checkFit(backend, variant, nThreads);
+            nFailed += checkFiles(backend, variant, nThreads);
+        }
+    }
+    return(nFailed);
+}
+
+/*************************************************************
+*
+* Compare every backend, kernel variant, data layout and
+*  row/batch mode against the double precision reference on
+*  small generated cubes, then check the analysis on top of
+*  the synthesis. Returns the number of failed checks.
+*
+*************************************************************/
+int runVerifySuite(int backendSel, int variantSel, int nThreads) {
+    int c, nFailed = 0;
+
+    printf("INFO: Errors are relative to the peak of the reference P\n");
+    printf("%-10s %-5s %-11s %-5s %-5s %10s %10s\n", "case", "back",
+           "kernel", "io", "mode", "maxErr", "tol");
+    for(c=0; c<N_VERIFY_CASES; c++)
+        nFailed += runVerifyCase(&verifyCases[c], backendSel, variantSel,
+                                 nThreads);
+    nFailed += runAnalysisChecks(backendSel, variantSel, nThreads);
+    return(nFailed);
+}